@@ -414,6 +414,8 @@
 #define __NR_memfd_create		(__NR_SYSCALL_BASE+385)
 #define __NR_bpf			(__NR_SYSCALL_BASE+386)
 #define __NR_execveat			(__NR_SYSCALL_BASE+387)
+#define __NR_io_setup2			(__NR_SYSCALL_BASE+388)
+#define __NR_path_batch			(__NR_SYSCALL_BASE+389)
 
 /*
  * The following SWIs are ARM private.
@@ -62,6 +62,7 @@ enum vmcs_sm_cmd_e {
 	VMCS_SM_CMD_HOST_WALK_PID_MAP,
 
 	VMCS_SM_CMD_CLEAN_INVALID,
+	VMCS_SM_CMD_CLEAN_INVALID2,
 
 	VMCS_SM_CMD_LAST	/* Do no delete */
 };
@@ -175,6 +176,22 @@ struct vmcs_sm_ioctl_clean_invalid {
 	} s[8];
 };
 
+/* One block of struct vmcs_sm_ioctl_clean_invalid2, cmd is as for
+** struct vmcs_sm_ioctl_clean_invalid.
+*/
+struct vmcs_sm_ioctl_clean_invalid_block {
+	unsigned int cmd;
+	unsigned int handle;
+	unsigned int addr;
+	unsigned int size;
+};
+
+struct vmcs_sm_ioctl_clean_invalid2 {
+	/* user -> kernel */
+	unsigned int op_count;
+	struct vmcs_sm_ioctl_clean_invalid_block s[0];
+};
+
 /* IOCTL numbers */
 #define VMCS_SM_IOCTL_MEM_ALLOC\
 	_IOR(VMCS_SM_MAGIC_TYPE, VMCS_SM_CMD_ALLOC,\
@@ -206,6 +223,9 @@ struct vmcs_sm_ioctl_clean_invalid {
 #define VMCS_SM_IOCTL_MEM_CLEAN_INVALID\
 	_IOR(VMCS_SM_MAGIC_TYPE, VMCS_SM_CMD_CLEAN_INVALID,\
 	 struct vmcs_sm_ioctl_clean_invalid)
+#define VMCS_SM_IOCTL_MEM_CLEAN_INVALID2\
+	_IOR(VMCS_SM_MAGIC_TYPE, VMCS_SM_CMD_CLEAN_INVALID2,\
+	 struct vmcs_sm_ioctl_clean_invalid2)
 
 #define VMCS_SM_IOCTL_SIZE_USR_HDL\
 	_IOR(VMCS_SM_MAGIC_TYPE, VMCS_SM_CMD_SIZE_USR_HANDLE,\
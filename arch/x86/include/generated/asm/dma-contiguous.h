@@ -0,0 +1 @@
+#include <asm-generic/dma-contiguous.h>
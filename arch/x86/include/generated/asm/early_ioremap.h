@@ -0,0 +1 @@
+#include <asm-generic/early_ioremap.h>
@@ -31,8 +31,10 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
+#include <linux/shrinker.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 #include <linux/slab.h>
@@ -46,10 +48,41 @@
 #include <uapi/linux/android/binder.h>
 #include "binder_trace.h"
 
-static DEFINE_MUTEX(binder_main_lock);
+/*
+ * Locking:
+ *
+ * binder_main_lock is taken for read around every ioctl and poll, which
+ * keeps procs, threads and binder_context_mgr_node alive, and for write
+ * by anything that walks or tears down more than one proc (deferred
+ * release and flush, BINDER_THREAD_EXIT, BINDER_SET_CONTEXT_MGR and the
+ * debugfs dumps).
+ *
+ * Under the read side, proc->lock protects the proc's own threads, nodes,
+ * refs, buffers and work lists, and the transaction stacks of its
+ * threads.  A node belongs to the proc that owns it; once that proc is
+ * gone the node sits on binder_dead_nodes and binder_dead_nodes_lock
+ * stands in for the owner's lock.  Code that updates a ref and the node
+ * it points at must hold both sides.
+ *
+ * At most two proc locks are held at once, lower address first, and
+ * binder_dead_nodes_lock nests inside them.  Transactions whose objects
+ * would need a third proc's lock are retried with binder_main_lock held
+ * for write.
+ */
+static DECLARE_RWSEM(binder_main_lock);
+static struct task_struct *binder_main_lock_owner;
+static DEFINE_MUTEX(binder_dead_nodes_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 static DEFINE_MUTEX(binder_mmap_lock);
 
+/*
+ * Pages of freed buffers stay mapped on binder_lru until either a new
+ * buffer reuses them or the shrinker takes them back.
+ */
+static DEFINE_SPINLOCK(binder_lru_lock);
+static LIST_HEAD(binder_lru);
+static unsigned long binder_lru_count;
+
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
@@ -58,7 +91,7 @@ static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static kuid_t binder_context_mgr_uid = INVALID_UID;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -158,22 +191,22 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_REPLY_SG) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -189,8 +222,7 @@ struct binder_transaction_log_entry {
 	int offsets_size;
 };
 struct binder_transaction_log {
-	int next;
-	int full;
+	atomic_t cur;	/* number of entries ever added */
 	struct binder_transaction_log_entry entry[32];
 };
 static struct binder_transaction_log binder_transaction_log;
@@ -200,14 +232,10 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+	unsigned int cur = atomic_inc_return(&log->cur) - 1;
 
-	e = &log->entry[log->next];
+	e = &log->entry[cur % ARRAY_SIZE(log->entry)];
 	memset(e, 0, sizeof(*e));
-	log->next++;
-	if (log->next == ARRAY_SIZE(log->entry)) {
-		log->next = 0;
-		log->full = 1;
-	}
 	return e;
 }
 
@@ -283,9 +311,16 @@ struct binder_buffer {
 	struct binder_node *target_node;
 	size_t data_size;
 	size_t offsets_size;
+	size_t extra_buffers_size;
 	uint8_t data[0];
 };
 
+struct binder_lru_page {
+	struct list_head lru;	/* on binder_lru while mapped but unused */
+	struct page *page_ptr;
+	struct binder_proc *proc;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -293,6 +328,7 @@ enum binder_deferred_state {
 };
 
 struct binder_proc {
+	struct mutex lock;
 	struct hlist_node proc_node;
 	struct rb_root threads;
 	struct rb_root nodes;
@@ -313,9 +349,12 @@ struct binder_proc {
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	unsigned long page_faults;	/* pages allocated and mapped */
+	unsigned long page_lru_hits;	/* pages reused from binder_lru */
+	unsigned long pages_reclaimed;	/* pages taken by the shrinker */
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
@@ -350,6 +389,8 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	/* command handed back with BINDER_RETRY_EXCLUSIVE, already counted */
+	void __user *redo_cmd;
 };
 
 struct binder_transaction {
@@ -426,14 +467,92 @@ static long task_close_fd(struct binder_proc *proc, unsigned int fd)
 static inline void binder_lock(const char *tag)
 {
 	trace_binder_lock(tag);
-	mutex_lock(&binder_main_lock);
+	down_read(&binder_main_lock);
+	trace_binder_locked(tag);
+}
+
+static inline void binder_lock_exclusive(const char *tag)
+{
+	trace_binder_lock(tag);
+	down_write(&binder_main_lock);
+	binder_main_lock_owner = current;
 	trace_binder_locked(tag);
 }
 
+static inline bool binder_is_exclusive(void)
+{
+	return binder_main_lock_owner == current;
+}
+
 static inline void binder_unlock(const char *tag)
 {
 	trace_binder_unlock(tag);
-	mutex_unlock(&binder_main_lock);
+	if (binder_is_exclusive()) {
+		binder_main_lock_owner = NULL;
+		up_write(&binder_main_lock);
+	} else {
+		up_read(&binder_main_lock);
+	}
+}
+
+static inline void binder_proc_lock(struct binder_proc *proc)
+{
+	mutex_lock(&proc->lock);
+}
+
+static inline void binder_proc_unlock(struct binder_proc *proc)
+{
+	mutex_unlock(&proc->lock);
+}
+
+/*
+ * Take @other's lock on top of @proc's, which the caller holds. Returns
+ * true if @proc had to be dropped to keep the address order, in which case
+ * anything looked up under it must be looked up again.
+ */
+static bool binder_proc_lock_also(struct binder_proc *proc,
+				  struct binder_proc *other)
+{
+	if (other == proc)
+		return false;
+	if (other > proc) {
+		mutex_lock_nested(&other->lock, SINGLE_DEPTH_NESTING);
+		return false;
+	}
+	mutex_unlock(&proc->lock);
+	mutex_lock(&other->lock);
+	mutex_lock_nested(&proc->lock, SINGLE_DEPTH_NESTING);
+	return true;
+}
+
+static void binder_proc_unlock_also(struct binder_proc *proc,
+				    struct binder_proc *other)
+{
+	if (other && other != proc)
+		mutex_unlock(&other->lock);
+}
+
+/*
+ * Lock the owner of a node, or binder_dead_nodes_lock if @owner is NULL,
+ * on top of @proc. Same return convention as binder_proc_lock_also().
+ */
+static bool binder_lock_node_owner(struct binder_proc *proc,
+				   struct binder_proc *owner)
+{
+	if (owner == NULL) {
+		mutex_lock(&binder_dead_nodes_lock);
+		return false;
+	}
+	return binder_proc_lock_also(proc, owner);
+}
+
+static void binder_unlock_node_owner(struct binder_proc *proc,
+				     struct binder_proc *owner)
+{
+	if (owner == NULL)
+		mutex_unlock(&binder_dead_nodes_lock);
+	else
+		binder_proc_unlock_also(proc, owner);
 }
 
 static void binder_set_nice(long nice)
@@ -545,14 +664,39 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add(struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	if (list_empty(&page->lru)) {
+		list_add_tail(&page->lru, &binder_lru);
+		binder_lru_count++;
+	}
+	spin_unlock(&binder_lru_lock);
+}
+
+static bool binder_lru_del(struct binder_lru_page *page)
+{
+	bool on_lru;
+
+	spin_lock(&binder_lru_lock);
+	on_lru = !list_empty(&page->lru);
+	if (on_lru) {
+		list_del_init(&page->lru);
+		binder_lru_count--;
+	}
+	spin_unlock(&binder_lru_lock);
+	return on_lru;
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
 {
 	void *page_addr;
 	unsigned long user_page_addr;
-	struct page **page;
-	struct mm_struct *mm;
+	struct binder_lru_page *page;
+	struct mm_struct *mm = NULL;
+	bool need_map = false;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "%d: %s pages %p-%p\n", proc->pid,
@@ -563,44 +707,61 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 
 	trace_binder_update_page_range(proc, allocate, start, end);
 
-	if (vma)
-		mm = NULL;
-	else
-		mm = get_task_mm(proc->tsk);
+	if (allocate == 0) {
+		/* keep them mapped for the next buffer, see binder_shrink_scan */
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			binder_lru_add(&proc->pages[(page_addr - proc->buffer) /
+						    PAGE_SIZE]);
+		return 0;
+	}
 
-	if (mm) {
-		down_write(&mm->mmap_sem);
-		vma = proc->vma;
-		if (vma && mm != proc->vma_vm_mm) {
-			pr_err("%d: vma mm and task mm mismatch\n",
-				proc->pid);
-			vma = NULL;
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (!page->page_ptr) {
+			need_map = true;
+			break;
 		}
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
-	if (vma == NULL) {
-		pr_err("%d: binder_alloc_buf failed to map pages in userspace, no vma\n",
-			proc->pid);
-		goto err_no_vma;
+	/* only pages that were never mapped or were reclaimed need the mm */
+	if (need_map && !vma) {
+		mm = get_task_mm(proc->tsk);
+		if (mm) {
+			down_write(&mm->mmap_sem);
+			vma = proc->vma;
+			if (vma && mm != proc->vma_vm_mm) {
+				pr_err("%d: vma mm and task mm mismatch\n",
+					proc->pid);
+				vma = NULL;
+			}
+		}
+		if (vma == NULL) {
+			pr_err("%d: binder_alloc_buf failed to map pages in userspace, no vma\n",
+				proc->pid);
+			goto err_no_vma;
+		}
 	}
 
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
 		int ret;
 
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page->page_ptr) {
+			if (binder_lru_del(page))
+				proc->page_lru_hits++;
+			continue;
+		}
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO);
-		if (*page == NULL) {
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_HIGHMEM |
+					    __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			pr_err("%d: binder_alloc_buf failed for page at %p\n",
 				proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		ret = map_kernel_range_noflush((unsigned long)page_addr,
-					PAGE_SIZE, PAGE_KERNEL, page);
+					PAGE_SIZE, PAGE_KERNEL,
+					&page->page_ptr);
 		flush_cache_vmap((unsigned long)page_addr,
 				(unsigned long)page_addr + PAGE_SIZE);
 		if (ret != 1) {
@@ -610,13 +771,13 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			pr_err("%d: binder_alloc_buf failed to map page at %lx in userspace\n",
 			       proc->pid, user_page_addr);
 			goto err_vm_insert_page_failed;
 		}
-		/* vm_insert_page does not seem to increment the refcount */
+		proc->page_faults++;
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -624,21 +785,17 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 err_alloc_page_failed:
-		;
-	}
+	/* whatever was set up already stays mapped, parked on the lru */
+	for (page_addr -= PAGE_SIZE; page_addr >= start;
+	     page_addr -= PAGE_SIZE)
+		binder_lru_add(&proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE]);
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -647,9 +804,88 @@ err_no_vma:
 	return -ENOMEM;
 }
 
+static unsigned long binder_shrink_count(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	return READ_ONCE(binder_lru_count);
+}
+
+/*
+ * Give back cached pages. Everything is trylocked: reclaim can be entered
+ * from inside binder with a proc lock or an mmap_sem already held.
+ */
+static unsigned long binder_shrink_scan(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	unsigned long scanned = 0, freed = 0;
+
+	/* keeps the procs on the lru from being released under us */
+	if (!down_read_trylock(&binder_main_lock))
+		return SHRINK_STOP;
+
+	while (scanned++ < sc->nr_to_scan) {
+		struct binder_lru_page *page;
+		struct binder_proc *proc;
+		struct mm_struct *mm;
+		void *page_addr;
+
+		spin_lock(&binder_lru_lock);
+		if (list_empty(&binder_lru)) {
+			spin_unlock(&binder_lru_lock);
+			break;
+		}
+		page = list_first_entry(&binder_lru, struct binder_lru_page,
+					lru);
+		proc = page->proc;
+		if (!mutex_trylock(&proc->lock)) {
+			list_move_tail(&page->lru, &binder_lru);
+			spin_unlock(&binder_lru_lock);
+			continue;
+		}
+		list_del_init(&page->lru);
+		binder_lru_count--;
+		spin_unlock(&binder_lru_lock);
+
+		page_addr = proc->buffer + (page - proc->pages) * PAGE_SIZE;
+		mm = get_task_mm(proc->tsk);
+		if (mm && !down_read_trylock(&mm->mmap_sem)) {
+			binder_lru_add(page);
+			mutex_unlock(&proc->lock);
+			mmput(mm);
+			continue;
+		}
+		if (mm) {
+			if (proc->vma && mm == proc->vma_vm_mm)
+				zap_page_range(proc->vma, (uintptr_t)page_addr +
+					       proc->user_buffer_offset,
+					       PAGE_SIZE, NULL);
+			up_read(&mm->mmap_sem);
+		}
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
+		proc->pages_reclaimed++;
+		mutex_unlock(&proc->lock);
+		if (mm)
+			mmput(mm);
+		freed++;
+	}
+
+	up_read(&binder_main_lock);
+	return freed;
+}
+
+static struct shrinker binder_shrinker = {
+	.count_objects = binder_shrink_count,
+	.scan_objects = binder_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
-					      size_t offsets_size, int is_async)
+					      size_t offsets_size,
+					      size_t extra_buffers_size,
+					      int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -657,7 +893,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
 	void *end_page_addr;
-	size_t size;
+	size_t size, data_offsets_size;
 
 	if (proc->vma == NULL) {
 		pr_err("%d: binder_alloc_buf, no vma\n",
@@ -665,14 +901,20 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	size = ALIGN(data_size, sizeof(void *)) +
+	data_offsets_size = ALIGN(data_size, sizeof(void *)) +
 		ALIGN(offsets_size, sizeof(void *));
 
-	if (size < data_size || size < offsets_size) {
+	if (data_offsets_size < data_size || data_offsets_size < offsets_size) {
 		binder_user_error("%d: got transaction with invalid size %zd-%zd\n",
 				proc->pid, data_size, offsets_size);
 		return NULL;
 	}
+	size = data_offsets_size + ALIGN(extra_buffers_size, sizeof(void *));
+	if (size < data_offsets_size || size < extra_buffers_size) {
+		binder_user_error("%d: got transaction with invalid extra_buffers_size %zd\n",
+				  proc->pid, extra_buffers_size);
+		return NULL;
+	}
 
 	if (is_async &&
 	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
@@ -742,6 +984,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		      proc->pid, size, buffer);
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
+	buffer->extra_buffers_size = extra_buffers_size;
 	buffer->async_transaction = is_async;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
@@ -816,7 +1059,8 @@ static void binder_free_buf(struct binder_proc *proc,
 	buffer_size = binder_buffer_size(proc, buffer);
 
 	size = ALIGN(buffer->data_size, sizeof(void *)) +
-		ALIGN(buffer->offsets_size, sizeof(void *));
+		ALIGN(buffer->offsets_size, sizeof(void *)) +
+		ALIGN(buffer->extra_buffers_size, sizeof(void *));
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "%d: binder_free_buf %p size %zd buffer_size %zd\n",
@@ -909,7 +1153,7 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
@@ -1021,6 +1265,35 @@ static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 	return NULL;
 }
 
+/*
+ * Look up @desc in @proc and lock the owner of the node it refers to, so
+ * that both the ref and the node can be updated. The owner to pass to
+ * binder_unlock_node_owner() is returned in @ownerp.
+ */
+static struct binder_ref *binder_get_ref_lock_owner(struct binder_proc *proc,
+						    uint32_t desc,
+						    struct binder_proc **ownerp)
+{
+	struct binder_proc *owner;
+	struct binder_ref *ref;
+
+	while (1) {
+		ref = binder_get_ref(proc, desc);
+		if (ref == NULL)
+			return NULL;
+		owner = ref->node->proc;
+		if (!binder_lock_node_owner(proc, owner))
+			break;
+		/* @proc was dropped, the ref may be gone or point elsewhere */
+		ref = binder_get_ref(proc, desc);
+		if (ref && ref->node->proc == owner)
+			break;
+		binder_unlock_node_owner(proc, owner);
+	}
+	*ownerp = owner;
+	return ref;
+}
+
 static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 						  struct binder_node *node)
 {
@@ -1044,7 +1317,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1237,33 +1510,96 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	}
 }
 
+/*
+ * Returns the size of the object at @offset in @buffer, or 0 if the offset
+ * is misaligned, the type is unknown or the object does not fit.
+ */
+static size_t binder_validate_object(struct binder_buffer *buffer, u64 offset)
+{
+	struct flat_binder_object *fp;
+	size_t object_size;
+
+	if (buffer->data_size < sizeof(fp->type) ||
+	    offset > buffer->data_size - sizeof(fp->type) ||
+	    !IS_ALIGNED(offset, sizeof(u32)))
+		return 0;
+
+	fp = (struct flat_binder_object *)(buffer->data + offset);
+	switch (fp->type) {
+	case BINDER_TYPE_BINDER:
+	case BINDER_TYPE_WEAK_BINDER:
+	case BINDER_TYPE_HANDLE:
+	case BINDER_TYPE_WEAK_HANDLE:
+	case BINDER_TYPE_FD:
+		object_size = sizeof(struct flat_binder_object);
+		break;
+	case BINDER_TYPE_PTR:
+		object_size = sizeof(struct binder_buffer_object);
+		break;
+	case BINDER_TYPE_FDA:
+		object_size = sizeof(struct binder_fd_array_object);
+		break;
+	default:
+		return 0;
+	}
+	if (buffer->data_size < object_size ||
+	    offset > buffer->data_size - object_size)
+		return 0;
+	return object_size;
+}
+
+/*
+ * Returns the BINDER_TYPE_PTR object at @index of the offsets array at
+ * @start, which must be one of the @num_valid objects already checked.
+ */
+static struct binder_buffer_object *binder_validate_ptr(struct binder_buffer *b,
+							binder_size_t index,
+							binder_size_t *start,
+							binder_size_t num_valid)
+{
+	struct binder_buffer_object *bp;
+
+	if (index >= num_valid)
+		return NULL;
+
+	bp = (struct binder_buffer_object *)(b->data + start[index]);
+	if (bp->type != BINDER_TYPE_PTR)
+		return NULL;
+	return bp;
+}
+
+/*
+ * Without @lock_owners the caller must already hold the owners of every
+ * node the buffer's handles refer to, as binder_transaction() does when
+ * it unwinds.
+ */
 static void binder_transaction_buffer_release(struct binder_proc *proc,
 					      struct binder_buffer *buffer,
-					      binder_size_t *failed_at)
+					      binder_size_t *failed_at,
+					      bool lock_owners)
 {
-	binder_size_t *offp, *off_end;
+	binder_size_t *offp, *off_start, *off_end;
 	int debug_id = buffer->debug_id;
 
 	binder_debug(BINDER_DEBUG_TRANSACTION,
-		     "%d buffer release %d, size %zd-%zd, failed at %p\n",
+		     "%d buffer release %d, size %zd-%zd-%zd, failed at %p\n",
 		     proc->pid, buffer->debug_id,
-		     buffer->data_size, buffer->offsets_size, failed_at);
+		     buffer->data_size, buffer->offsets_size,
+		     buffer->extra_buffers_size, failed_at);
 
 	if (buffer->target_node)
 		binder_dec_node(buffer->target_node, 1, 0);
 
-	offp = (binder_size_t *)(buffer->data +
-				 ALIGN(buffer->data_size, sizeof(void *)));
+	off_start = (binder_size_t *)(buffer->data +
+				      ALIGN(buffer->data_size, sizeof(void *)));
 	if (failed_at)
 		off_end = failed_at;
 	else
-		off_end = (void *)offp + buffer->offsets_size;
-	for (; offp < off_end; offp++) {
+		off_end = (void *)off_start + buffer->offsets_size;
+	for (offp = off_start; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
 
-		if (*offp > buffer->data_size - sizeof(*fp) ||
-		    buffer->data_size < sizeof(*fp) ||
-		    !IS_ALIGNED(*offp, sizeof(u32))) {
+		if (!binder_validate_object(buffer, *offp)) {
 			pr_err("transaction release %d bad offset %lld, size %zd\n",
 			       debug_id, (u64)*offp, buffer->data_size);
 			continue;
@@ -1286,8 +1622,14 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_proc *owner;
+			struct binder_ref *ref;
 
+			if (lock_owners)
+				ref = binder_get_ref_lock_owner(proc, fp->handle,
+								&owner);
+			else
+				ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
 				pr_err("transaction release %d bad handle %d\n",
 				 debug_id, fp->handle);
@@ -1297,6 +1639,8 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        ref %d desc %d (node %d)\n",
 				     ref->debug_id, ref->desc, ref->node->debug_id);
 			binder_dec_ref(ref, fp->type == BINDER_TYPE_HANDLE);
+			if (lock_owners)
+				binder_unlock_node_owner(proc, owner);
 		} break;
 
 		case BINDER_TYPE_FD:
@@ -1306,6 +1650,47 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				task_close_fd(proc, fp->handle);
 			break;
 
+		case BINDER_TYPE_PTR:
+			/* the copy lives and dies with the buffer */
+			break;
+
+		case BINDER_TYPE_FDA: {
+			struct binder_fd_array_object *fda;
+			struct binder_buffer_object *parent;
+			binder_size_t fd_buf_size, fdi;
+			u32 *fd_array;
+
+			/* like BINDER_TYPE_FD, the target owns them once sent */
+			if (!failed_at)
+				break;
+			fda = (struct binder_fd_array_object *)fp;
+			parent = binder_validate_ptr(buffer, fda->parent,
+						     off_start,
+						     offp - off_start);
+			if (parent == NULL) {
+				pr_err("transaction release %d bad parent offset\n",
+				       debug_id);
+				break;
+			}
+			fd_buf_size = sizeof(u32) * fda->num_fds;
+			if (fda->num_fds >= SIZE_MAX / sizeof(u32) ||
+			    fd_buf_size > parent->length ||
+			    fda->parent_offset > parent->length - fd_buf_size) {
+				pr_err("transaction release %d bad fd array, %lld fds\n",
+				       debug_id, (u64)fda->num_fds);
+				break;
+			}
+			/* the parent was already pointed at the target's copy */
+			fd_array = (u32 *)((uintptr_t)parent->buffer -
+					   proc->user_buffer_offset +
+					   fda->parent_offset);
+			binder_debug(BINDER_DEBUG_TRANSACTION,
+				     "        fd array of %lld\n",
+				     (u64)fda->num_fds);
+			for (fdi = 0; fdi < fda->num_fds; fdi++)
+				task_close_fd(proc, fd_array[fdi]);
+		} break;
+
 		default:
 			pr_err("transaction release %d bad object type %x\n",
 				debug_id, fp->type);
@@ -1314,16 +1699,218 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
-static void binder_transaction(struct binder_proc *proc,
+/* Returned up from binder_thread_write() to redo a command exclusively */
+#define BINDER_RETRY_EXCLUSIVE	1
+
+/*
+ * A handle to a node owned by neither end of a transaction needs a third
+ * proc's lock, which cannot be taken in order once both ends are held.
+ * That is mostly the service manager handing out handles, so such
+ * transactions are simply redone with binder_main_lock held for write.
+ */
+static bool binder_transaction_needs_exclusive(struct binder_proc *proc,
+					       struct binder_proc *target_proc,
+					       struct binder_buffer *buffer,
+					       binder_size_t *offp,
+					       binder_size_t *off_end)
+{
+	for (; offp < off_end; offp++) {
+		struct flat_binder_object *fp;
+		struct binder_ref *ref;
+
+		/* bad offsets are reported by the translation loop */
+		if (!binder_validate_object(buffer, *offp))
+			return false;
+		fp = (struct flat_binder_object *)(buffer->data + *offp);
+		if (fp->type != BINDER_TYPE_HANDLE &&
+		    fp->type != BINDER_TYPE_WEAK_HANDLE)
+			continue;
+		ref = binder_get_ref(proc, fp->handle);
+		if (ref && ref->node->proc != proc &&
+		    ref->node->proc != target_proc)
+			return true;
+	}
+	return false;
+}
+
+/* Returns the fd installed in the target, or a negative errno */
+static int binder_translate_fd(int fd, struct binder_transaction *t,
+			       struct binder_thread *thread,
+			       struct binder_transaction *in_reply_to)
+{
+	struct binder_proc *proc = thread->proc;
+	struct binder_proc *target_proc = t->to_proc;
+	struct file *file;
+	int target_fd;
+
+	if (in_reply_to) {
+		if (!(in_reply_to->flags & TF_ACCEPT_FDS)) {
+			binder_user_error("%d:%d got reply with fd, %d, but target does not allow fds\n",
+				proc->pid, thread->pid, fd);
+			return -EPERM;
+		}
+	} else if (!t->buffer->target_node->accept_fds) {
+		binder_user_error("%d:%d got transaction with fd, %d, but target does not allow fds\n",
+			proc->pid, thread->pid, fd);
+		return -EPERM;
+	}
+
+	file = fget(fd);
+	if (file == NULL) {
+		binder_user_error("%d:%d got transaction with invalid fd, %d\n",
+			proc->pid, thread->pid, fd);
+		return -EBADF;
+	}
+	if (security_binder_transfer_file(proc->tsk, target_proc->tsk,
+					  file) < 0) {
+		fput(file);
+		return -EPERM;
+	}
+	target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
+	if (target_fd < 0) {
+		fput(file);
+		return -ENOMEM;
+	}
+	task_fd_install(target_proc, target_fd, file);
+	trace_binder_transaction_fd(t, fd, target_fd);
+	binder_debug(BINDER_DEBUG_TRANSACTION,
+		     "        fd %d -> %d\n", fd, target_fd);
+	return target_fd;
+}
+
+static int binder_translate_fd_array(struct binder_fd_array_object *fda,
+				     struct binder_buffer_object *parent,
+				     struct binder_transaction *t,
+				     struct binder_thread *thread,
+				     struct binder_transaction *in_reply_to)
+{
+	struct binder_proc *proc = thread->proc;
+	struct binder_proc *target_proc = t->to_proc;
+	binder_size_t fdi, fd_buf_size;
+	int target_fd;
+	u32 *fd_array;
+
+	if (fda->num_fds >= SIZE_MAX / sizeof(u32)) {
+		binder_user_error("%d:%d got transaction with invalid number of fds, %lld\n",
+				  proc->pid, thread->pid, (u64)fda->num_fds);
+		return -EINVAL;
+	}
+	fd_buf_size = sizeof(u32) * fda->num_fds;
+	if (fd_buf_size > parent->length ||
+	    fda->parent_offset > parent->length - fd_buf_size) {
+		binder_user_error("%d:%d got transaction with no room for %lld fds\n",
+				  proc->pid, thread->pid, (u64)fda->num_fds);
+		return -EINVAL;
+	}
+	fd_array = (u32 *)((uintptr_t)parent->buffer -
+			   target_proc->user_buffer_offset +
+			   fda->parent_offset);
+	if (!IS_ALIGNED((uintptr_t)fd_array, sizeof(u32))) {
+		binder_user_error("%d:%d got transaction with misaligned fd array\n",
+				  proc->pid, thread->pid);
+		return -EINVAL;
+	}
+
+	/* translated in place, inside the target's copy of the parent */
+	for (fdi = 0; fdi < fda->num_fds; fdi++) {
+		target_fd = binder_translate_fd(fd_array[fdi], t, thread,
+						in_reply_to);
+		if (target_fd < 0)
+			goto err_translate_fd_failed;
+		fd_array[fdi] = target_fd;
+	}
+	return 0;
+
+err_translate_fd_failed:
+	while (fdi--)
+		task_close_fd(target_proc, fd_array[fdi]);
+	return target_fd;
+}
+
+/*
+ * A fixup may only go into the buffer sent last or one of its ancestors,
+ * and never below a fixup already made there: anything else could
+ * overwrite a pointer or fd array that was translated before.
+ */
+static bool binder_validate_fixup(struct binder_buffer *b,
+				  binder_size_t *off_start,
+				  struct binder_buffer_object *parent,
+				  binder_size_t fixup_offset,
+				  struct binder_buffer_object *last_obj,
+				  binder_size_t last_min_offset)
+{
+	if (last_obj == NULL)
+		return false;
+
+	while (last_obj != parent) {
+		/* already validated when last_obj was translated */
+		if (!(last_obj->flags & BINDER_BUFFER_FLAG_HAS_PARENT))
+			return false;
+		last_min_offset = last_obj->parent_offset + sizeof(uintptr_t);
+		last_obj = (struct binder_buffer_object *)
+			(b->data + off_start[last_obj->parent]);
+	}
+	return fixup_offset >= last_min_offset;
+}
+
+static int binder_fixup_parent(struct binder_transaction *t,
 			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+			       struct binder_buffer_object *bp,
+			       binder_size_t *off_start,
+			       binder_size_t num_valid,
+			       struct binder_buffer_object *last_fixup_obj,
+			       binder_size_t last_fixup_min_off)
+{
+	struct binder_proc *proc = thread->proc;
+	struct binder_proc *target_proc = t->to_proc;
+	struct binder_buffer_object *parent;
+	u8 *parent_buffer;
+
+	if (!(bp->flags & BINDER_BUFFER_FLAG_HAS_PARENT))
+		return 0;
+
+	parent = binder_validate_ptr(t->buffer, bp->parent, off_start,
+				     num_valid);
+	if (parent == NULL) {
+		binder_user_error("%d:%d got transaction with invalid parent offset or type\n",
+				  proc->pid, thread->pid);
+		return -EINVAL;
+	}
+	if (!binder_validate_fixup(t->buffer, off_start, parent,
+				   bp->parent_offset, last_fixup_obj,
+				   last_fixup_min_off)) {
+		binder_user_error("%d:%d got transaction with out-of-order buffer fixup\n",
+				  proc->pid, thread->pid);
+		return -EINVAL;
+	}
+	if (parent->length < sizeof(binder_uintptr_t) ||
+	    bp->parent_offset > parent->length - sizeof(binder_uintptr_t)) {
+		binder_user_error("%d:%d got transaction with invalid parent offset\n",
+				  proc->pid, thread->pid);
+		return -EINVAL;
+	}
+	parent_buffer = (u8 *)((uintptr_t)parent->buffer -
+			       target_proc->user_buffer_offset);
+	*(binder_uintptr_t *)(parent_buffer + bp->parent_offset) = bp->buffer;
+	return 0;
+}
+
+static int binder_transaction(struct binder_proc *proc,
+			      struct binder_thread *thread,
+			      struct binder_transaction_data *tr, int reply,
+			      binder_size_t extra_buffers_size)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
-	binder_size_t *offp, *off_end;
+	binder_size_t *offp, *off_start, *off_end;
+	binder_size_t off_min;
+	u8 *sg_bufp, *sg_buf_end;
+	struct binder_buffer_object *last_fixup_obj;
+	binder_size_t last_fixup_min_off;
 	struct binder_proc *target_proc;
-	struct binder_thread *target_thread = NULL;
-	struct binder_node *target_node = NULL;
+	struct binder_proc *locked_proc = NULL;
+	struct binder_thread *target_thread;
+	struct binder_node *target_node;
 	struct list_head *target_list;
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
@@ -1338,6 +1925,9 @@ static void binder_transaction(struct binder_proc *proc,
 	e->data_size = tr->data_size;
 	e->offsets_size = tr->offsets_size;
 
+retry:
+	target_thread = NULL;
+	target_node = NULL;
 	if (reply) {
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
@@ -1358,23 +1948,17 @@ static void binder_transaction(struct binder_proc *proc,
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
-		thread->transaction_stack = in_reply_to->to_parent;
 		target_thread = in_reply_to->from;
 		if (target_thread == NULL) {
+			/* failing the reply walks other threads' stacks */
+			if (!binder_is_exclusive()) {
+				binder_proc_unlock_also(proc, locked_proc);
+				return BINDER_RETRY_EXCLUSIVE;
+			}
+			thread->transaction_stack = in_reply_to->to_parent;
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
-		if (target_thread->transaction_stack != in_reply_to) {
-			binder_user_error("%d:%d got reply transaction with bad target transaction stack %d, expected %d\n",
-				proc->pid, thread->pid,
-				target_thread->transaction_stack ?
-				target_thread->transaction_stack->debug_id : 0,
-				in_reply_to->debug_id);
-			return_error = BR_FAILED_REPLY;
-			in_reply_to = NULL;
-			target_thread = NULL;
-			goto err_dead_binder;
-		}
 		target_proc = target_thread->proc;
 	} else {
 		if (tr->target.handle) {
@@ -1426,6 +2010,26 @@ static void binder_transaction(struct binder_proc *proc,
 			}
 		}
 	}
+	if (target_proc != locked_proc) {
+		binder_proc_unlock_also(proc, locked_proc);
+		locked_proc = target_proc;
+		if (binder_proc_lock_also(proc, target_proc))
+			goto retry;
+	}
+	if (reply) {
+		thread->transaction_stack = in_reply_to->to_parent;
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("%d:%d got reply transaction with bad target transaction stack %d, expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			target_thread = NULL;
+			goto err_dead_binder;
+		}
+	}
 	if (target_thread) {
 		e->to_thread = target_thread->pid;
 		target_list = &target_thread->todo;
@@ -1451,25 +2055,27 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
 		binder_debug(BINDER_DEBUG_TRANSACTION,
-			     "%d:%d BC_REPLY %d -> %d:%d, data %016llx-%016llx size %lld-%lld\n",
+			     "%d:%d BC_REPLY %d -> %d:%d, data %016llx-%016llx size %lld-%lld-%lld\n",
 			     proc->pid, thread->pid, t->debug_id,
 			     target_proc->pid, target_thread->pid,
 			     (u64)tr->data.ptr.buffer,
 			     (u64)tr->data.ptr.offsets,
-			     (u64)tr->data_size, (u64)tr->offsets_size);
+			     (u64)tr->data_size, (u64)tr->offsets_size,
+			     (u64)extra_buffers_size);
 	else
 		binder_debug(BINDER_DEBUG_TRANSACTION,
-			     "%d:%d BC_TRANSACTION %d -> %d - node %d, data %016llx-%016llx size %lld-%lld\n",
+			     "%d:%d BC_TRANSACTION %d -> %d - node %d, data %016llx-%016llx size %lld-%lld-%lld\n",
 			     proc->pid, thread->pid, t->debug_id,
 			     target_proc->pid, target_node->debug_id,
 			     (u64)tr->data.ptr.buffer,
 			     (u64)tr->data.ptr.offsets,
-			     (u64)tr->data_size, (u64)tr->offsets_size);
+			     (u64)tr->data_size, (u64)tr->offsets_size,
+			     (u64)extra_buffers_size);
 
 	if (!reply && !(tr->flags & TF_ONE_WAY))
 		t->from = thread;
@@ -1485,7 +2091,8 @@ static void binder_transaction(struct binder_proc *proc,
 	trace_binder_transaction(reply, t, target_node);
 
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, extra_buffers_size,
+		!reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
@@ -1498,8 +2105,9 @@ static void binder_transaction(struct binder_proc *proc,
 	if (target_node)
 		binder_inc_node(target_node, 1, 0, NULL);
 
-	offp = (binder_size_t *)(t->buffer->data +
-				 ALIGN(tr->data_size, sizeof(void *)));
+	off_start = (binder_size_t *)(t->buffer->data +
+				      ALIGN(tr->data_size, sizeof(void *)));
+	offp = off_start;
 
 	if (copy_from_user(t->buffer->data, (const void __user *)(uintptr_t)
 			   tr->data.ptr.buffer, tr->data_size)) {
@@ -1521,19 +2129,50 @@ static void binder_transaction(struct binder_proc *proc,
 		return_error = BR_FAILED_REPLY;
 		goto err_bad_offset;
 	}
-	off_end = (void *)offp + tr->offsets_size;
+	if (!IS_ALIGNED(extra_buffers_size, sizeof(u64))) {
+		binder_user_error("%d:%d got transaction with unaligned buffers size, %lld\n",
+				  proc->pid, thread->pid,
+				  (u64)extra_buffers_size);
+		return_error = BR_FAILED_REPLY;
+		goto err_bad_offset;
+	}
+	off_end = (void *)off_start + tr->offsets_size;
+	sg_bufp = (u8 *)(PTR_ALIGN(off_end, sizeof(void *)));
+	sg_buf_end = sg_bufp + t->buffer->extra_buffers_size;
+	off_min = 0;
+	last_fixup_obj = NULL;
+	last_fixup_min_off = 0;
+	if (!binder_is_exclusive() &&
+	    binder_transaction_needs_exclusive(proc, target_proc, t->buffer,
+					       offp, off_end)) {
+		binder_transaction_buffer_release(target_proc, t->buffer, offp,
+						  false);
+		t->buffer->transaction = NULL;
+		binder_free_buf(target_proc, t->buffer);
+		kfree(tcomplete);
+		binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
+		kfree(t);
+		binder_stats_deleted(BINDER_STAT_TRANSACTION);
+		if (reply)
+			thread->transaction_stack = in_reply_to;
+		binder_proc_unlock_also(proc, locked_proc);
+		return BINDER_RETRY_EXCLUSIVE;
+	}
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
-
-		if (*offp > t->buffer->data_size - sizeof(*fp) ||
-		    t->buffer->data_size < sizeof(*fp) ||
-		    !IS_ALIGNED(*offp, sizeof(u32))) {
-			binder_user_error("%d:%d got transaction with invalid offset, %lld\n",
-					  proc->pid, thread->pid, (u64)*offp);
+		size_t object_size;
+
+		object_size = binder_validate_object(t->buffer, *offp);
+		if (object_size == 0 || *offp < off_min) {
+			binder_user_error("%d:%d got transaction with invalid offset (%lld, min %lld max %lld) or object\n",
+					  proc->pid, thread->pid, (u64)*offp,
+					  (u64)off_min,
+					  (u64)t->buffer->data_size);
 			return_error = BR_FAILED_REPLY;
 			goto err_bad_offset;
 		}
 		fp = (struct flat_binder_object *)(t->buffer->data + *offp);
+		off_min = *offp + object_size;
 		switch (fp->type) {
 		case BINDER_TYPE_BINDER:
 		case BINDER_TYPE_WEAK_BINDER: {
@@ -1631,48 +2270,82 @@ static void binder_transaction(struct binder_proc *proc,
 
 		case BINDER_TYPE_FD: {
 			int target_fd;
-			struct file *file;
 
-			if (reply) {
-				if (!(in_reply_to->flags & TF_ACCEPT_FDS)) {
-					binder_user_error("%d:%d got reply with fd, %d, but target does not allow fds\n",
-						proc->pid, thread->pid, fp->handle);
-					return_error = BR_FAILED_REPLY;
-					goto err_fd_not_allowed;
-				}
-			} else if (!target_node->accept_fds) {
-				binder_user_error("%d:%d got transaction with fd, %d, but target does not allow fds\n",
-					proc->pid, thread->pid, fp->handle);
+			target_fd = binder_translate_fd(fp->handle, t, thread,
+							in_reply_to);
+			if (target_fd < 0) {
 				return_error = BR_FAILED_REPLY;
-				goto err_fd_not_allowed;
+				goto err_translate_failed;
 			}
+			fp->handle = target_fd;
+		} break;
 
-			file = fget(fp->handle);
-			if (file == NULL) {
-				binder_user_error("%d:%d got transaction with invalid fd, %d\n",
-					proc->pid, thread->pid, fp->handle);
+		case BINDER_TYPE_FDA: {
+			struct binder_fd_array_object *fda =
+				(struct binder_fd_array_object *)fp;
+			struct binder_buffer_object *parent;
+
+			parent = binder_validate_ptr(t->buffer, fda->parent,
+						     off_start,
+						     offp - off_start);
+			if (parent == NULL) {
+				binder_user_error("%d:%d got transaction with invalid parent offset or type\n",
+						  proc->pid, thread->pid);
 				return_error = BR_FAILED_REPLY;
-				goto err_fget_failed;
+				goto err_bad_parent;
 			}
-			if (security_binder_transfer_file(proc->tsk,
-							  target_proc->tsk,
-							  file) < 0) {
-				fput(file);
+			if (!binder_validate_fixup(t->buffer, off_start, parent,
+						   fda->parent_offset,
+						   last_fixup_obj,
+						   last_fixup_min_off)) {
+				binder_user_error("%d:%d got transaction with out-of-order buffer fixup\n",
+						  proc->pid, thread->pid);
 				return_error = BR_FAILED_REPLY;
-				goto err_get_unused_fd_failed;
+				goto err_bad_parent;
 			}
-			target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
-			if (target_fd < 0) {
-				fput(file);
+			if (binder_translate_fd_array(fda, parent, t, thread,
+						      in_reply_to) < 0) {
 				return_error = BR_FAILED_REPLY;
-				goto err_get_unused_fd_failed;
+				goto err_translate_failed;
 			}
-			task_fd_install(target_proc, target_fd, file);
-			trace_binder_transaction_fd(t, fp->handle, target_fd);
-			binder_debug(BINDER_DEBUG_TRANSACTION,
-				     "        fd %d -> %d\n", fp->handle, target_fd);
-			/* TODO: fput? */
-			fp->handle = target_fd;
+			last_fixup_obj = parent;
+			last_fixup_min_off = fda->parent_offset +
+					     sizeof(u32) * fda->num_fds;
+		} break;
+
+		case BINDER_TYPE_PTR: {
+			struct binder_buffer_object *bp =
+				(struct binder_buffer_object *)fp;
+			size_t buf_left = sg_buf_end - sg_bufp;
+
+			if (bp->length > buf_left) {
+				binder_user_error("%d:%d got transaction with too large buffer\n",
+						  proc->pid, thread->pid);
+				return_error = BR_FAILED_REPLY;
+				goto err_bad_offset;
+			}
+			/* the only copy: straight into the target's mapping */
+			if (copy_from_user(sg_bufp,
+					   (const void __user *)(uintptr_t)
+					   bp->buffer, bp->length)) {
+				binder_user_error("%d:%d got transaction with invalid buffer ptr\n",
+						  proc->pid, thread->pid);
+				return_error = BR_FAILED_REPLY;
+				goto err_copy_data_failed;
+			}
+			bp->buffer = (uintptr_t)sg_bufp +
+				     target_proc->user_buffer_offset;
+			sg_bufp += ALIGN(bp->length, sizeof(u64));
+
+			if (binder_fixup_parent(t, thread, bp, off_start,
+						offp - off_start,
+						last_fixup_obj,
+						last_fixup_min_off) < 0) {
+				return_error = BR_FAILED_REPLY;
+				goto err_translate_failed;
+			}
+			last_fixup_obj = bp;
+			last_fixup_min_off = 0;
 		} break;
 
 		default:
@@ -1705,11 +2378,11 @@ static void binder_transaction(struct binder_proc *proc,
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
-	return;
+	binder_proc_unlock_also(proc, locked_proc);
+	return 0;
 
-err_get_unused_fd_failed:
-err_fget_failed:
-err_fd_not_allowed:
+err_translate_failed:
+err_bad_parent:
 err_binder_get_ref_for_node_failed:
 err_binder_get_ref_failed:
 err_binder_new_node_failed:
@@ -1717,7 +2390,7 @@ err_bad_object_type:
 err_bad_offset:
 err_copy_data_failed:
 	trace_binder_transaction_failed_buffer_release(t->buffer);
-	binder_transaction_buffer_release(target_proc, t->buffer, offp);
+	binder_transaction_buffer_release(target_proc, t->buffer, offp, false);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
@@ -1750,6 +2423,8 @@ err_no_context_mgr_node:
 		binder_send_failed_reply(in_reply_to, return_error);
 	} else
 		thread->return_error = return_error;
+	binder_proc_unlock_also(proc, locked_proc);
+	return 0;
 }
 
 static int binder_thread_write(struct binder_proc *proc,
@@ -1763,14 +2438,20 @@ static int binder_thread_write(struct binder_proc *proc,
 	void __user *end = buffer + size;
 
 	while (ptr < end && thread->return_error == BR_OK) {
+		void __user *cmd_ptr = ptr;
+		bool redo = cmd_ptr == thread->redo_cmd;
+
+		thread->redo_cmd = NULL;
 		if (get_user(cmd, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
-		trace_binder_command(cmd);
-		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+		if (!redo) {
+			trace_binder_command(cmd);
+			if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
+				atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+				atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+				atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
+			}
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1778,6 +2459,7 @@ static int binder_thread_write(struct binder_proc *proc,
 		case BC_RELEASE:
 		case BC_DECREFS: {
 			uint32_t target;
+			struct binder_proc *owner;
 			struct binder_ref *ref;
 			const char *debug_string;
 
@@ -1786,15 +2468,20 @@ static int binder_thread_write(struct binder_proc *proc,
 			ptr += sizeof(uint32_t);
 			if (target == 0 && binder_context_mgr_node &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
+				owner = binder_context_mgr_node->proc;
+				binder_lock_node_owner(proc, owner);
 				ref = binder_get_ref_for_node(proc,
 					       binder_context_mgr_node);
-				if (ref->desc != target) {
+				if (ref == NULL)
+					binder_unlock_node_owner(proc, owner);
+				else if (ref->desc != target) {
 					binder_user_error("%d:%d tried to acquire reference to desc 0, got %d instead\n",
 						proc->pid, thread->pid,
 						ref->desc);
 				}
 			} else
-				ref = binder_get_ref(proc, target);
+				ref = binder_get_ref_lock_owner(proc, target,
+								&owner);
 			if (ref == NULL) {
 				binder_user_error("%d:%d refcount change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1823,6 +2510,7 @@ static int binder_thread_write(struct binder_proc *proc,
 				     "%d:%d %s ref %d desc %d s %d w %d for node %d\n",
 				     proc->pid, thread->pid, debug_string, ref->debug_id,
 				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			binder_unlock_node_owner(proc, owner);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1913,6 +2601,8 @@ static int binder_thread_write(struct binder_proc *proc,
 				     buffer->debug_id,
 				     buffer->transaction ? "active" : "finished");
 
+			/* keep it ours while proc->lock is dropped below */
+			buffer->allow_user_free = 0;
 			if (buffer->transaction) {
 				buffer->transaction->buffer = NULL;
 				buffer->transaction = NULL;
@@ -1925,7 +2615,7 @@ static int binder_thread_write(struct binder_proc *proc,
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
 			trace_binder_transaction_buffer_release(buffer);
-			binder_transaction_buffer_release(proc, buffer, NULL);
+			binder_transaction_buffer_release(proc, buffer, NULL, true);
 			binder_free_buf(proc, buffer);
 			break;
 		}
@@ -1937,7 +2627,27 @@ static int binder_thread_write(struct binder_proc *proc,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			if (binder_transaction(proc, thread, &tr,
+					       cmd == BC_REPLY, 0)) {
+				thread->redo_cmd = cmd_ptr;
+				return BINDER_RETRY_EXCLUSIVE;
+			}
+			break;
+		}
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			if (binder_transaction(proc, thread,
+					       &tr.transaction_data,
+					       cmd == BC_REPLY_SG,
+					       tr.buffers_size)) {
+				thread->redo_cmd = cmd_ptr;
+				return BINDER_RETRY_EXCLUSIVE;
+			}
 			break;
 		}
 
@@ -2120,9 +2830,9 @@ static void binder_stat_br(struct binder_proc *proc,
 {
 	trace_binder_return(cmd);
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2184,6 +2894,7 @@ retry:
 	if (wait_for_proc_work)
 		proc->ready_threads++;
 
+	binder_proc_unlock(proc);
 	binder_unlock(__func__);
 
 	trace_binder_wait_for_work(wait_for_proc_work,
@@ -2212,6 +2923,7 @@ retry:
 	}
 
 	binder_lock(__func__);
+	binder_proc_lock(proc);
 
 	if (wait_for_proc_work)
 		proc->ready_threads--;
@@ -2599,12 +3311,14 @@ static unsigned int binder_poll(struct file *filp,
 	int wait_for_proc_work;
 
 	binder_lock(__func__);
+	binder_proc_lock(proc);
 
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
 
+	binder_proc_unlock(proc);
 	binder_unlock(__func__);
 
 	if (wait_for_proc_work) {
@@ -2659,6 +3373,12 @@ static int binder_ioctl_write_read(struct file *filp,
 				ret = -EFAULT;
 			goto out;
 		}
+		if (ret == BINDER_RETRY_EXCLUSIVE) {
+			/* binder_ioctl() picks up from write_consumed */
+			if (copy_to_user(ubuf, &bwr, sizeof(bwr)))
+				ret = -EFAULT;
+			goto out;
+		}
 	}
 	if (bwr.read_size > 0) {
 		ret = binder_thread_read(proc, thread, bwr.read_buffer,
@@ -2733,6 +3453,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	bool exclusive;
 
 	/*pr_info("binder_ioctl: %d:%d %x %lx\n",
 			proc->pid, current->pid, cmd, arg);*/
@@ -2743,7 +3464,14 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		goto err_unlocked;
 
-	binder_lock(__func__);
+	/* both of these reach into other procs' threads and nodes */
+	exclusive = cmd == BINDER_SET_CONTEXT_MGR || cmd == BINDER_THREAD_EXIT;
+retry:
+	if (exclusive)
+		binder_lock_exclusive(__func__);
+	else
+		binder_lock(__func__);
+	binder_proc_lock(proc);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2753,6 +3481,12 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	switch (cmd) {
 	case BINDER_WRITE_READ:
 		ret = binder_ioctl_write_read(filp, cmd, arg, thread);
+		if (ret == BINDER_RETRY_EXCLUSIVE) {
+			binder_proc_unlock(proc);
+			binder_unlock(__func__);
+			exclusive = true;
+			goto retry;
+		}
 		if (ret)
 			goto err;
 		break;
@@ -2795,6 +3529,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
+	binder_proc_unlock(proc);
 	binder_unlock(__func__);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
@@ -2842,7 +3577,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int ret, i;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2899,6 +3634,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2951,11 +3690,12 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	mutex_init(&proc->lock);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
 
-	binder_lock(__func__);
+	binder_lock_exclusive(__func__);
 
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
@@ -3140,15 +3880,17 @@ static void binder_deferred_release(struct binder_proc *proc)
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
 			void *page_addr;
 
-			if (!proc->pages[i])
+			if (!proc->pages[i].page_ptr)
 				continue;
 
 			page_addr = proc->buffer + i * PAGE_SIZE;
-			binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-				     "%s: %d: page %d at %p not freed\n",
-				     __func__, proc->pid, i, page_addr);
+			/* cached pages are expected, anything else leaked */
+			if (!binder_lru_del(&proc->pages[i]))
+				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+					     "%s: %d: page %d at %p not freed\n",
+					     __func__, proc->pid, i, page_addr);
 			unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-			__free_page(proc->pages[i]);
+			__free_page(proc->pages[i].page_ptr);
 			page_count++;
 		}
 		kfree(proc->pages);
@@ -3173,7 +3915,7 @@ static void binder_deferred_func(struct work_struct *work)
 	int defer;
 
 	do {
-		binder_lock(__func__);
+		binder_lock_exclusive(__func__);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3432,7 +4174,9 @@ static const char * const binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG",
 };
 
 static const char * const binder_objstat_strings[] = {
@@ -3453,17 +4197,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3471,11 +4219,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3484,7 +4234,8 @@ static void print_binder_proc_stats(struct seq_file *m,
 {
 	struct binder_work *w;
 	struct rb_node *n;
-	int count, strong, weak;
+	int count, strong, weak, mapped, cached, i;
+	size_t free_size, largest;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3517,6 +4268,36 @@ static void print_binder_proc_stats(struct seq_file *m,
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
 
+	count = 0;
+	free_size = 0;
+	largest = 0;
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		size_t size = binder_buffer_size(proc, buffer);
+
+		count++;
+		free_size += size;
+		if (size > largest)
+			largest = size;
+	}
+	seq_printf(m, "  free buffers: %d, %zd bytes, largest %zd\n",
+		   count, free_size, largest);
+
+	mapped = 0;
+	cached = 0;
+	for (i = 0; proc->pages && i < proc->buffer_size / PAGE_SIZE; i++) {
+		if (!proc->pages[i].page_ptr)
+			continue;
+		mapped++;
+		if (!list_empty(&proc->pages[i].lru))
+			cached++;
+	}
+	seq_printf(m, "  pages: %d mapped, %d cached\n"
+			"  page faults %lu lru hits %lu reclaimed %lu\n",
+			mapped, cached, proc->page_faults,
+			proc->page_lru_hits, proc->pages_reclaimed);
+
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
@@ -3540,7 +4321,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		binder_lock(__func__);
+		binder_lock_exclusive(__func__);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3562,11 +4343,12 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		binder_lock(__func__);
+		binder_lock_exclusive(__func__);
 
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	seq_printf(m, "lru pages: %lu\n", READ_ONCE(binder_lru_count));
 
 	hlist_for_each_entry(proc, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
@@ -3581,7 +4363,7 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		binder_lock(__func__);
+		binder_lock_exclusive(__func__);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, &binder_procs, proc_node)
@@ -3597,7 +4379,7 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		binder_lock(__func__);
+		binder_lock_exclusive(__func__);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
@@ -3619,14 +4401,13 @@ static void print_binder_transaction_log_entry(struct seq_file *m,
 static int binder_transaction_log_show(struct seq_file *m, void *unused)
 {
 	struct binder_transaction_log *log = m->private;
-	int i;
+	unsigned int cur = atomic_read(&log->cur);
+	unsigned int count = min_t(unsigned int, cur, ARRAY_SIZE(log->entry));
+	unsigned int i;
 
-	if (log->full) {
-		for (i = log->next; i < ARRAY_SIZE(log->entry); i++)
-			print_binder_transaction_log_entry(m, &log->entry[i]);
-	}
-	for (i = 0; i < log->next; i++)
-		print_binder_transaction_log_entry(m, &log->entry[i]);
+	for (i = cur - count; i != cur; i++)
+		print_binder_transaction_log_entry(m,
+				&log->entry[i % ARRAY_SIZE(log->entry)]);
 	return 0;
 }
 
@@ -3665,6 +4446,8 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	if (!ret)
+		register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
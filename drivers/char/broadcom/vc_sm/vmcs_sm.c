@@ -21,6 +21,7 @@
 #include <linux/dma-mapping.h>
 #include <linux/errno.h>
 #include <linux/fs.h>
+#include <linux/hashtable.h>
 #include <linux/hugetlb.h>
 #include <linux/ioctl.h>
 #include <linux/kernel.h>
@@ -55,6 +56,15 @@
 #define VC_SM_DEBUG               "debug"
 #define VC_SM_WRITE_BUF_SIZE      128
 
+/* Size (log2) of the lookup indices.  Resources are hashed per opened device
+** on their guid, maps globally on pid+address and pid+user handle.
+*/
+#define VC_SM_RESOURCE_HASH_BITS  6
+#define VC_SM_MAP_HASH_BITS       8
+
+/* Cache maintenance blocks copied from user space at a time. */
+#define VC_SM_CLEAN_BATCH         16
+
 /* Statistics tracked per resource and globally.
 */
 enum SM_STATS_T {
@@ -104,6 +114,8 @@ struct SM_PDE_T {
 */
 struct sm_mmap {
 	struct list_head map_list;	/* Linked list of maps. */
+	struct hlist_node addr_node;	/* Index on pid+address. */
+	struct hlist_node hdl_node;	/* Index on pid+user handle. */
 
 	struct SM_RESOURCE_T *resource;	/* Pointer to the resource. */
 
@@ -124,6 +136,7 @@ struct sm_mmap {
 struct SM_RESOURCE_T {
 	struct list_head resource_list;	/* List of resources. */
 	struct list_head global_resource_list;	/* Global list of resources. */
+	struct hlist_node guid_node;	/* Index on guid in private data. */
 
 	pid_t pid;		/* PID owning that resource. */
 	uint32_t res_guid;	/* Unique identifier. */
@@ -148,6 +161,7 @@ struct SM_RESOURCE_T {
 */
 struct SM_PRIV_DATA_T {
 	struct list_head resource_list; /* List of resources. */
+	DECLARE_HASHTABLE(resource_hash, VC_SM_RESOURCE_HASH_BITS);
 
 	pid_t pid;                      /* PID of creator. */
 
@@ -173,6 +187,8 @@ struct SM_STATE_T {
 
 	struct mutex map_lock;          /* Global map lock. */
 	struct list_head map_list;      /* List of maps. */
+	DECLARE_HASHTABLE(map_addr_hash, VC_SM_MAP_HASH_BITS);
+	DECLARE_HASHTABLE(map_hdl_hash, VC_SM_MAP_HASH_BITS);
 	struct list_head resource_list;	/* List of resources. */
 
 	enum SM_STATS_T deceased[END_ALL];    /* Natural termination stats. */
@@ -208,6 +224,14 @@ static const char *const sm_cache_map_vector[] = {
 
 /* ---- Private Functions ------------------------------------------------ */
 
+/* Key of a map in the global indices, the pid spreads identical addresses
+** (or handles) mapped by different processes.
+*/
+static inline u32 vmcs_sm_map_key(unsigned int pid, unsigned long val)
+{
+	return (u32)val ^ hash_32(pid, 32);
+}
+
 static inline unsigned vcaddr_to_pfn(unsigned long vc_addr)
 {
 	unsigned long pfn = vc_addr & 0x3FFFFFFF;
@@ -258,18 +282,17 @@ static unsigned int vmcs_sm_vc_handle_from_pid_and_address(unsigned int pid,
 
 	/* Lookup the resource.
 	 */
-	if (!list_empty(&sm_state->map_list)) {
-		list_for_each_entry(map, &sm_state->map_list, map_list) {
-			if (map->res_pid != pid || map->res_addr != addr)
-				continue;
+	hash_for_each_possible(sm_state->map_addr_hash, map, addr_node,
+			       vmcs_sm_map_key(pid, addr)) {
+		if (map->res_pid != pid || map->res_addr != addr)
+			continue;
 
-			pr_debug("[%s]: global map %p (pid %u, addr %lx) -> vc-hdl %x (usr-hdl %x)\n",
-				__func__, map, map->res_pid, map->res_addr,
-				map->res_vc_hdl, map->res_usr_hdl);
+		pr_debug("[%s]: global map %p (pid %u, addr %lx) -> vc-hdl %x (usr-hdl %x)\n",
+			__func__, map, map->res_pid, map->res_addr,
+			map->res_vc_hdl, map->res_usr_hdl);
 
-			handle = map->res_vc_hdl;
-			break;
-		}
+		handle = map->res_vc_hdl;
+		break;
 	}
 
 	mutex_unlock(&(sm_state->map_lock));
@@ -307,18 +330,17 @@ static unsigned int vmcs_sm_usr_handle_from_pid_and_address(unsigned int pid,
 
 	/* Lookup the resource.
 	 */
-	if (!list_empty(&sm_state->map_list)) {
-		list_for_each_entry(map, &sm_state->map_list, map_list) {
-			if (map->res_pid != pid || map->res_addr != addr)
-				continue;
+	hash_for_each_possible(sm_state->map_addr_hash, map, addr_node,
+			       vmcs_sm_map_key(pid, addr)) {
+		if (map->res_pid != pid || map->res_addr != addr)
+			continue;
 
-			pr_debug("[%s]: global map %p (pid %u, addr %lx) -> usr-hdl %x (vc-hdl %x)\n",
-				__func__, map, map->res_pid, map->res_addr,
-				map->res_usr_hdl, map->res_vc_hdl);
+		pr_debug("[%s]: global map %p (pid %u, addr %lx) -> usr-hdl %x (vc-hdl %x)\n",
+			__func__, map, map->res_pid, map->res_addr,
+			map->res_usr_hdl, map->res_vc_hdl);
 
-			handle = map->res_usr_hdl;
-			break;
-		}
+		handle = map->res_usr_hdl;
+		break;
 	}
 
 	mutex_unlock(&(sm_state->map_lock));
@@ -406,18 +428,17 @@ static unsigned int vmcs_sm_usr_address_from_pid_and_usr_handle(unsigned int
 
 	/* Lookup the resource.
 	 */
-	if (!list_empty(&sm_state->map_list)) {
-		list_for_each_entry(map, &sm_state->map_list, map_list) {
-			if (map->res_pid != pid || map->res_usr_hdl != hdl)
-				continue;
+	hash_for_each_possible(sm_state->map_hdl_hash, map, hdl_node,
+			       vmcs_sm_map_key(pid, hdl)) {
+		if (map->res_pid != pid || map->res_usr_hdl != hdl)
+			continue;
 
-			pr_debug("[%s]: global map %p (pid %u, vc-hdl %x, usr-hdl %x) -> addr %lx\n",
-				__func__, map, map->res_pid, map->res_vc_hdl,
-				map->res_usr_hdl, map->res_addr);
+		pr_debug("[%s]: global map %p (pid %u, vc-hdl %x, usr-hdl %x) -> addr %lx\n",
+			__func__, map, map->res_pid, map->res_vc_hdl,
+			map->res_usr_hdl, map->res_addr);
 
-			addr = map->res_addr;
-			break;
-		}
+		addr = map->res_addr;
+		break;
 	}
 
 	mutex_unlock(&(sm_state->map_lock));
@@ -448,6 +469,10 @@ static void vmcs_sm_add_map(struct SM_STATE_T *state,
 	/* Add to the global list of mappings
 	 */
 	list_add(&map->map_list, &state->map_list);
+	hash_add(state->map_addr_hash, &map->addr_node,
+		 vmcs_sm_map_key(map->res_pid, map->res_addr));
+	hash_add(state->map_hdl_hash, &map->hdl_node,
+		 vmcs_sm_map_key(map->res_pid, map->res_usr_hdl));
 
 	/* Add to the list of mappings for this resource
 	 */
@@ -472,6 +497,8 @@ static void vmcs_sm_remove_map(struct SM_STATE_T *state,
 	/* Remove from the global list of mappings
 	 */
 	list_del(&map->map_list);
+	hash_del(&map->addr_node);
+	hash_del(&map->hdl_node);
 
 	/* Remove from the list of mapping for this resource
 	 */
@@ -721,6 +748,8 @@ static void vmcs_sm_add_resource(struct SM_PRIV_DATA_T *privdata,
 {
 	mutex_lock(&(sm_state->map_lock));
 	list_add(&resource->resource_list, &privdata->resource_list);
+	hash_add(privdata->resource_hash, &resource->guid_node,
+		 resource->res_guid);
 	list_add(&resource->global_resource_list, &sm_state->resource_list);
 	mutex_unlock(&(sm_state->map_lock));
 
@@ -740,7 +769,8 @@ static struct SM_RESOURCE_T *vmcs_sm_acquire_resource(struct SM_PRIV_DATA_T
 
 	mutex_lock(&(sm_state->map_lock));
 
-	list_for_each_entry(resource, &private->resource_list, resource_list) {
+	hash_for_each_possible(private->resource_hash, resource, guid_node,
+			       res_guid) {
 		if (resource->res_guid != res_guid)
 			continue;
 
@@ -835,6 +865,7 @@ static void vmcs_sm_release_resource(struct SM_RESOURCE_T *resource, int force)
 	/* Time to free the resource. Start by removing it from the list */
 	list_del(&resource->resource_list);
 	list_del(&resource->global_resource_list);
+	hash_del(&resource->guid_node);
 
 	/* Walk the global resource list, find out if the resource is used
 	 * somewhere else. In which case we don't want to delete it.
@@ -980,6 +1011,7 @@ static struct SM_PRIV_DATA_T *vc_sm_create_priv_data(pid_t id)
 	snprintf(alloc_name, sizeof(alloc_name), "%d", id);
 
 	INIT_LIST_HEAD(&file_data->resource_list);
+	hash_init(file_data->resource_hash);
 	file_data->pid = id;
 	file_data->dir_pid = debugfs_create_dir(alloc_name,
 			sm_state->dir_alloc);
@@ -1194,7 +1226,18 @@ static struct vm_operations_struct vcsm_vm_ops = {
 	.fault = vcsm_vma_fault,
 };
 
-/* Walks a VMA and clean each valid page from the cache */
+/* Clean + invalidate a run of contiguous present pages in one go. */
+static inline void vcsm_cache_clean_run(unsigned long *run, unsigned long end)
+{
+	if (*run) {
+		dmac_flush_range((const void *)*run, (const void *)end);
+		*run = 0;
+	}
+}
+
+/* Walks a VMA and clean each valid page from the cache.  Contiguous present
+** pages are handled as a single range rather than page by page.
+*/
 static void vcsm_vma_cache_clean_page_range(unsigned long addr,
 					    unsigned long end)
 {
@@ -1203,6 +1246,7 @@ static void vcsm_vma_cache_clean_page_range(unsigned long addr,
 	pmd_t *pmd;
 	pte_t *pte;
 	unsigned long pgd_next, pud_next, pmd_next;
+	unsigned long run = 0;
 
 	if (addr >= end)
 		return;
@@ -1212,34 +1256,41 @@ static void vcsm_vma_cache_clean_page_range(unsigned long addr,
 	do {
 		pgd_next = pgd_addr_end(addr, end);
 
-		if (pgd_none(*pgd) || pgd_bad(*pgd))
+		if (pgd_none(*pgd) || pgd_bad(*pgd)) {
+			vcsm_cache_clean_run(&run, addr);
 			continue;
+		}
 
 		/* Walk PUD */
 		pud = pud_offset(pgd, addr);
 		do {
 			pud_next = pud_addr_end(addr, pgd_next);
-			if (pud_none(*pud) || pud_bad(*pud))
+			if (pud_none(*pud) || pud_bad(*pud)) {
+				vcsm_cache_clean_run(&run, addr);
 				continue;
+			}
 
 			/* Walk PMD */
 			pmd = pmd_offset(pud, addr);
 			do {
 				pmd_next = pmd_addr_end(addr, pud_next);
-				if (pmd_none(*pmd) || pmd_bad(*pmd))
+				if (pmd_none(*pmd) || pmd_bad(*pmd)) {
+					vcsm_cache_clean_run(&run, addr);
 					continue;
+				}
 
 				/* Walk PTE */
 				pte = pte_offset_map(pmd, addr);
 				do {
 					if (pte_none(*pte)
-					    || !pte_present(*pte))
+					    || !pte_present(*pte)) {
+						vcsm_cache_clean_run(&run,
+								     addr);
 						continue;
+					}
 
-					/* Clean + invalidate */
-					dmac_flush_range((const void *) addr,
-							 (const void *)
-							 (addr + PAGE_SIZE));
+					if (!run)
+						run = addr;
 
 				} while (pte++, addr +=
 					 PAGE_SIZE, addr != pmd_next);
@@ -1249,6 +1300,8 @@ static void vcsm_vma_cache_clean_page_range(unsigned long addr,
 
 		} while (pud++, addr = pud_next, addr != pgd_next);
 	} while (pgd++, addr = pgd_next, addr != end);
+
+	vcsm_cache_clean_run(&run, end);
 }
 
 /* Map an allocated data into something that the user space.
@@ -2014,6 +2067,83 @@ error:
 	return ret;
 }
 
+/* Flush/Invalidate the cache for an array of blocks in one call.  Blocks are
+** read from user space in batches; consecutive blocks on the same buffer
+** share the resource lookup and the mmap semaphore.
+*/
+static int vc_sm_ioctl_clean_invalid2(struct SM_PRIV_DATA_T *private,
+				      unsigned long arg)
+{
+	struct vmcs_sm_ioctl_clean_invalid2 __user *ioparam =
+	    (struct vmcs_sm_ioctl_clean_invalid2 __user *)arg;
+	struct vmcs_sm_ioctl_clean_invalid_block block[VC_SM_CLEAN_BATCH];
+	struct SM_RESOURCE_T *resource = NULL;
+	unsigned int op_count, done, count, i;
+	int ret = 0;
+
+	if (get_user(op_count, &ioparam->op_count))
+		return -EFAULT;
+
+	for (done = 0; done < op_count && ret == 0; done += count) {
+		count = min_t(unsigned int, op_count - done,
+			      VC_SM_CLEAN_BATCH);
+
+		if (copy_from_user(block, &ioparam->s[done],
+				   count * sizeof(block[0])) != 0) {
+			pr_err("[%s]: failed to copy-from-user blocks %u-%u\n",
+				__func__, done, done + count - 1);
+			ret = -EFAULT;
+			break;
+		}
+
+		down_read(&current->mm->mmap_sem);
+		for (i = 0; i < count; i++) {
+			unsigned long base, end;
+
+			/* 0 and unknown commands are a NOOP. */
+			if (block[i].cmd < 1 || block[i].cmd > 3)
+				continue;
+
+			if (resource == NULL ||
+			    resource->res_guid != block[i].handle) {
+				/* Dropping the last reference unmaps, which
+				 * takes the semaphore for writing.
+				 */
+				if (resource != NULL) {
+					up_read(&current->mm->mmap_sem);
+					vmcs_sm_release_resource(resource, 0);
+					down_read(&current->mm->mmap_sem);
+				}
+
+				resource = vmcs_sm_acquire_resource(private,
+							block[i].handle);
+				if (resource == NULL) {
+					ret = -EINVAL;
+					break;
+				}
+			}
+
+			if (!resource->res_cached)
+				continue;
+
+			base = block[i].addr & ~(PAGE_SIZE - 1);
+			end = (block[i].addr + block[i].size + PAGE_SIZE - 1) &
+			      ~(PAGE_SIZE - 1);
+			resource->res_stats[block[i].cmd == 1 ?
+					    INVALID : FLUSH]++;
+
+			/* L1/L2 cache flush */
+			vcsm_vma_cache_clean_page_range(base, end);
+		}
+		up_read(&current->mm->mmap_sem);
+	}
+
+	if (resource != NULL)
+		vmcs_sm_release_resource(resource, 0);
+
+	return ret;
+}
+
 /* Handle control from host. */
 static long vc_sm_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
@@ -2780,6 +2910,16 @@ static long vc_sm_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		break;
 
+	/* Flush/Invalidate the cache for an array of mappings. */
+	case VMCS_SM_CMD_CLEAN_INVALID2:
+		{
+			ret = vc_sm_ioctl_clean_invalid2(file_data, arg);
+
+			/* Done. */
+			goto out;
+		}
+		break;
+
 	default:
 		{
 			ret = -EINVAL;
@@ -2979,6 +3119,8 @@ static void vc_sm_connected_init(void)
 
 	INIT_LIST_HEAD(&sm_state->map_list);
 	INIT_LIST_HEAD(&sm_state->resource_list);
+	hash_init(sm_state->map_addr_hash);
+	hash_init(sm_state->map_hdl_hash);
 
 	sm_state->data_knl = vc_sm_create_priv_data(0);
 	if (sm_state->data_knl == NULL) {
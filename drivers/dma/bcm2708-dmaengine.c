@@ -32,6 +32,7 @@
 
 #include <linux/dmaengine.h>
 #include <linux/dma-mapping.h>
+#include <linux/dmapool.h>
 #include <linux/err.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
@@ -48,6 +49,8 @@
 #include "virt-dma.h"
 
 static unsigned dma_debug;
+/* queued descriptors started as one chain, with one interrupt at the end */
+static unsigned int chain_descs = 8;
 
 /*
  * Legacy DMA API
@@ -353,6 +356,11 @@ struct bcm2835_dma_cb {
 	uint32_t pad[2];
 };
 
+struct bcm2835_cb_entry {
+	struct bcm2835_dma_cb *cb;
+	dma_addr_t paddr;
+};
+
 struct bcm2835_chan {
 	struct virt_dma_chan vc;
 	struct list_head node;
@@ -362,6 +370,8 @@ struct bcm2835_chan {
 
 	int ch;
 	struct bcm2835_desc *desc;
+	struct list_head chain;		/* descriptors the engine is running */
+	struct dma_pool *cb_pool;
 
 	void __iomem *chan_base;
 	int irq_number;
@@ -370,15 +380,15 @@ struct bcm2835_chan {
 };
 
 struct bcm2835_desc {
+	struct bcm2835_chan *c;
 	struct virt_dma_desc vd;
 	enum dma_transfer_direction dir;
-
-	unsigned int control_block_size;
-	struct bcm2835_dma_cb *control_block_base;
-	dma_addr_t control_block_base_phys;
+	bool cyclic;
 
 	unsigned int frames;
 	size_t size;
+
+	struct bcm2835_cb_entry cb_list[];
 };
 
 #define BCM2835_DMA_CS		0x00
@@ -458,16 +468,54 @@ static void dma_dumpregs(struct bcm2835_chan *c)
 	pr_debug("--------------------------------------\n");
 }
 
-static void bcm2835_dma_desc_free(struct virt_dma_desc *vd)
+static void bcm2835_dma_free_cb_chain(struct bcm2835_desc *desc)
 {
-	struct bcm2835_desc *desc = container_of(vd, struct bcm2835_desc, vd);
-	dma_free_coherent(desc->vd.tx.chan->device->dev,
-			desc->control_block_size,
-			desc->control_block_base,
-			desc->control_block_base_phys);
+	unsigned int i;
+
+	for (i = 0; i < desc->frames; i++)
+		dma_pool_free(desc->c->cb_pool, desc->cb_list[i].cb,
+			      desc->cb_list[i].paddr);
 	kfree(desc);
 }
 
+static void bcm2835_dma_desc_free(struct virt_dma_desc *vd)
+{
+	bcm2835_dma_free_cb_chain(container_of(vd, struct bcm2835_desc, vd));
+}
+
+/* Allocates a descriptor with @frames zeroed control blocks from the pool */
+static struct bcm2835_desc *bcm2835_dma_desc_alloc(struct bcm2835_chan *c,
+		enum dma_transfer_direction dir, unsigned int frames)
+{
+	struct bcm2835_desc *d;
+	unsigned int i;
+
+	d = kzalloc(sizeof(*d) + frames * sizeof(struct bcm2835_cb_entry),
+		    GFP_NOWAIT);
+	if (!d)
+		return NULL;
+
+	d->c = c;
+	d->dir = dir;
+
+	for (i = 0; i < frames; i++) {
+		struct bcm2835_cb_entry *cb_entry = &d->cb_list[i];
+
+		cb_entry->cb = dma_pool_alloc(c->cb_pool, GFP_NOWAIT,
+					      &cb_entry->paddr);
+		if (!cb_entry->cb)
+			goto error_cb;
+		memset(cb_entry->cb, 0, sizeof(*cb_entry->cb));
+		d->frames++;
+	}
+
+	return d;
+
+error_cb:
+	bcm2835_dma_free_cb_chain(d);
+	return NULL;
+}
+
 static int bcm2835_dma_abort(void __iomem *chan_base)
 {
 	unsigned long cs;
@@ -507,18 +555,45 @@ static int bcm2835_dma_abort(void __iomem *chan_base)
 static void bcm2835_dma_start_desc(struct bcm2835_chan *c)
 {
 	struct virt_dma_desc *vd = vchan_next_desc(&c->vc);
-	struct bcm2835_desc *d;
+	struct bcm2835_desc *d, *last;
+	unsigned int n = 1;
 
 	if (!vd) {
 		c->desc = NULL;
 		return;
 	}
 
-	list_del(&vd->node);
+	list_move_tail(&vd->node, &c->chain);
 
 	c->desc = d = to_bcm2835_dma_desc(&vd->tx);
+	c->cyclic = d->cyclic;
+
+	/*
+	 * Link the other issued transfers behind this one so the engine
+	 * runs through all of them, and only interrupt at the very end.
+	 * The engine is idle, so the blocks can still be rewritten.
+	 */
+	last = d;
+	while (!c->cyclic && n < chain_descs) {
+		struct bcm2835_dma_cb *tail;
+		struct bcm2835_desc *next;
+
+		vd = vchan_next_desc(&c->vc);
+		if (!vd)
+			break;
+		next = to_bcm2835_dma_desc(&vd->tx);
+		if (next->cyclic)
+			break;
+
+		tail = last->cb_list[last->frames - 1].cb;
+		tail->next = next->cb_list[0].paddr;
+		tail->info &= ~BCM2835_DMA_INT_EN;
+		list_move_tail(&vd->node, &c->chain);
+		last = next;
+		n++;
+	}
 
-	writel(d->control_block_base_phys, c->chan_base + BCM2835_DMA_ADDR);
+	writel(d->cb_list[0].paddr, c->chan_base + BCM2835_DMA_ADDR);
 	writel(BCM2835_DMA_ACTIVE, c->chan_base + BCM2835_DMA_CS);
 
 }
@@ -545,7 +620,13 @@ static irqreturn_t bcm2835_dma_callback(int irq, void *data)
 				c->chan_base + BCM2835_DMA_CS);
 
 		} else {
-			vchan_cookie_complete(&c->desc->vd);
+			struct virt_dma_desc *vd, *tmp;
+
+			/* the whole chain is done */
+			list_for_each_entry_safe(vd, tmp, &c->chain, node) {
+				list_del(&vd->node);
+				vchan_cookie_complete(vd);
+			}
 			bcm2835_dma_start_desc(c);
 		}
 	}
@@ -558,13 +639,23 @@ static irqreturn_t bcm2835_dma_callback(int irq, void *data)
 static int bcm2835_dma_alloc_chan_resources(struct dma_chan *chan)
 {
 	struct bcm2835_chan *c = to_bcm2835_dma_chan(chan);
+	struct device *dev = c->vc.chan.device->dev;
 	int ret;
 
-	dev_dbg(c->vc.chan.device->dev,
-			"Allocating DMA channel %d\n", c->ch);
+	dev_dbg(dev, "Allocating DMA channel %d\n", c->ch);
+
+	/* control blocks must be 256-bit aligned */
+	c->cb_pool = dma_pool_create(dev_name(dev), dev,
+				     sizeof(struct bcm2835_dma_cb), 32, 0);
+	if (!c->cb_pool) {
+		dev_err(dev, "unable to allocate descriptor pool\n");
+		return -ENOMEM;
+	}
 
 	ret = request_irq(c->irq_number,
 			bcm2835_dma_callback, 0, "DMA IRQ", c);
+	if (ret)
+		dma_pool_destroy(c->cb_pool);
 
 	return ret;
 }
@@ -575,6 +666,7 @@ static void bcm2835_dma_free_chan_resources(struct dma_chan *chan)
 
 	vchan_free_chan_resources(&c->vc);
 	free_irq(c->irq_number, c);
+	dma_pool_destroy(c->cb_pool);
 
 	dev_dbg(c->vc.chan.device->dev, "Freeing DMA channel %u\n", c->ch);
 }
@@ -590,15 +682,14 @@ static size_t bcm2835_dma_desc_size_pos(struct bcm2835_desc *d, dma_addr_t addr)
 	size_t size;
 
 	for (size = i = 0; i < d->frames; i++) {
-		struct bcm2835_dma_cb *control_block =
-			&d->control_block_base[i];
+		struct bcm2835_dma_cb *control_block = d->cb_list[i].cb;
 		size_t this_size = control_block->length;
 		dma_addr_t dma;
 
-		if (d->dir == DMA_DEV_TO_MEM)
-			dma = control_block->dst;
-		else
+		if (d->dir == DMA_MEM_TO_DEV)
 			dma = control_block->src;
+		else
+			dma = control_block->dst;
 
 		if (size)
 			size += this_size;
@@ -609,15 +700,57 @@ static size_t bcm2835_dma_desc_size_pos(struct bcm2835_desc *d, dma_addr_t addr)
 	return size;
 }
 
+static bool bcm2835_dma_desc_has_cb(struct bcm2835_desc *d, dma_addr_t cb)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->frames; i++)
+		if (d->cb_list[i].paddr == cb)
+			return true;
+	return false;
+}
+
+/*
+ * Residue of @want in the running chain: everything before the block the
+ * engine is on is done, everything after it untouched.
+ */
+static size_t bcm2835_dma_chain_residue(struct bcm2835_chan *c,
+					struct bcm2835_desc *want)
+{
+	dma_addr_t cb = readl(c->chan_base + BCM2835_DMA_ADDR);
+	struct virt_dma_desc *vd;
+	bool passed = false;
+
+	list_for_each_entry(vd, &c->chain, node) {
+		struct bcm2835_desc *d = to_bcm2835_dma_desc(&vd->tx);
+
+		if (!passed && bcm2835_dma_desc_has_cb(d, cb)) {
+			dma_addr_t pos;
+
+			if (d != want) {
+				passed = true;
+				continue;
+			}
+			if (d->dir == DMA_MEM_TO_DEV)
+				pos = readl(c->chan_base + BCM2835_DMA_SOURCE_AD);
+			else
+				pos = readl(c->chan_base + BCM2835_DMA_DEST_AD);
+			return bcm2835_dma_desc_size_pos(d, pos);
+		}
+		if (d == want)
+			return passed ? d->size : 0;
+	}
+
+	return 0;
+}
+
 static enum dma_status bcm2835_dma_tx_status(struct dma_chan *chan,
 	dma_cookie_t cookie, struct dma_tx_state *txstate)
 {
 	struct bcm2835_chan *c = to_bcm2835_dma_chan(chan);
-	struct bcm2835_desc *d;
 	struct virt_dma_desc *vd;
 	enum dma_status ret;
 	unsigned long flags;
-	dma_addr_t pos;
 
 	ret = dma_cookie_status(chan, cookie, txstate);
 	if (ret == DMA_COMPLETE || !txstate)
@@ -628,17 +761,16 @@ static enum dma_status bcm2835_dma_tx_status(struct dma_chan *chan,
 	if (vd) {
 		txstate->residue =
 			bcm2835_dma_desc_size(to_bcm2835_dma_desc(&vd->tx));
-	} else if (c->desc && c->desc->vd.tx.cookie == cookie) {
-		d = c->desc;
-
-		if (d->dir == DMA_MEM_TO_DEV)
-			pos = readl(c->chan_base + BCM2835_DMA_SOURCE_AD);
-		else if (d->dir == DMA_DEV_TO_MEM)
-			pos = readl(c->chan_base + BCM2835_DMA_DEST_AD);
-		else
-			pos = 0;
+	} else if (c->desc) {
+		struct bcm2835_desc *want = NULL;
 
-		txstate->residue = bcm2835_dma_desc_size_pos(d, pos);
+		list_for_each_entry(vd, &c->chain, node) {
+			if (vd->tx.cookie == cookie) {
+				want = to_bcm2835_dma_desc(&vd->tx);
+				break;
+			}
+		}
+		txstate->residue = want ? bcm2835_dma_chain_residue(c, want) : 0;
 	} else {
 		txstate->residue = 0;
 	}
@@ -660,6 +792,51 @@ static void bcm2835_dma_issue_pending(struct dma_chan *chan)
 	spin_unlock_irqrestore(&c->vc.lock, flags);
 }
 
+static struct dma_async_tx_descriptor *bcm2835_dma_prep_dma_memcpy(
+	struct dma_chan *chan, dma_addr_t dst, dma_addr_t src,
+	size_t len, unsigned long flags)
+{
+	struct bcm2835_chan *c = to_bcm2835_dma_chan(chan);
+	struct bcm2835_desc *d;
+	unsigned int info, frame, max_size;
+	size_t done;
+
+	if (!len)
+		return NULL;
+
+	info = BCM2835_DMA_S_INC | BCM2835_DMA_D_INC | BCM2835_DMA_WAIT_RESP;
+	if (c->ch >= 8) { /* we have a LITE channel */
+		max_size = MAX_LITE_TRANSFER;
+	} else {
+		max_size = MAX_NORMAL_TRANSFER;
+		/* 128-bit reads and writes, which LITE channels lack */
+		info |= BCM2835_DMA_S_WIDTH | BCM2835_DMA_D_WIDTH;
+	}
+
+	d = bcm2835_dma_desc_alloc(c, DMA_MEM_TO_MEM,
+				   DIV_ROUND_UP(len, max_size));
+	if (!d)
+		return NULL;
+
+	for (frame = 0, done = 0; frame < d->frames; frame++) {
+		struct bcm2835_dma_cb *control_block = d->cb_list[frame].cb;
+
+		control_block->info = info;
+		control_block->src = src + done;
+		control_block->dst = dst + done;
+		control_block->length = min_t(size_t, len - done, max_size);
+		done += control_block->length;
+
+		if (frame == d->frames - 1)
+			control_block->info |= BCM2835_DMA_INT_EN;
+		else
+			control_block->next = d->cb_list[frame + 1].paddr;
+	}
+	d->size = len;
+
+	return vchan_tx_prep(&c->vc, &d->vd, flags);
+}
+
 static struct dma_async_tx_descriptor *bcm2835_dma_prep_dma_cyclic(
 	struct dma_chan *chan, dma_addr_t buf_addr, size_t buf_len,
 	size_t period_len, enum dma_transfer_direction direction,
@@ -697,39 +874,25 @@ static struct dma_async_tx_descriptor *bcm2835_dma_prep_dma_cyclic(
 		return NULL;
 	}
 
-	/* Now allocate and setup the descriptor. */
-	d = kzalloc(sizeof(*d), GFP_NOWAIT);
-	if (!d)
-		return NULL;
-
-	d->dir = direction;
-
 	if (c->ch >= 8) /* we have a LITE channel */
 		max_size = MAX_LITE_TRANSFER;
 	else
 		max_size = MAX_NORMAL_TRANSFER;
 	period_len = min(period_len, max_size);
 
-	d->frames = (buf_len-1) / period_len + 1;
-
-	/* Allocate memory for control blocks */
-	d->control_block_size = d->frames * sizeof(struct bcm2835_dma_cb);
-	d->control_block_base = dma_zalloc_coherent(chan->device->dev,
-			d->control_block_size, &d->control_block_base_phys,
-			GFP_NOWAIT);
-
-	if (!d->control_block_base) {
-		kfree(d);
+	/* Now allocate and setup the descriptor. */
+	d = bcm2835_dma_desc_alloc(c, direction, (buf_len-1) / period_len + 1);
+	if (!d)
 		return NULL;
-	}
+
+	d->cyclic = true;
 
 	/*
 	 * Iterate over all frames, create a control block
 	 * for each frame and link them together.
 	 */
 	for (frame = 0; frame < d->frames; frame++) {
-		struct bcm2835_dma_cb *control_block =
-			&d->control_block_base[frame];
+		struct bcm2835_dma_cb *control_block = d->cb_list[frame].cb;
 
 		/* Setup adresses */
 		if (d->dir == DMA_DEV_TO_MEM) {
@@ -767,13 +930,9 @@ static struct dma_async_tx_descriptor *bcm2835_dma_prep_dma_cyclic(
 		 * This function is called on cyclic DMA transfers.
 		 * Therefore, wrap around at number of frames.
 		 */
-		control_block->next = d->control_block_base_phys +
-			sizeof(struct bcm2835_dma_cb)
-			* ((frame + 1) % d->frames);
+		control_block->next = d->cb_list[(frame + 1) % d->frames].paddr;
 	}
 
-	c->cyclic = true;
-
 	return vchan_tx_prep(&c->vc, &d->vd, flags);
 }
 
@@ -789,7 +948,7 @@ static struct dma_async_tx_descriptor *bcm2835_dma_prep_slave_sg(
 	dma_addr_t dev_addr;
 	struct scatterlist *sgent;
 	unsigned int es, sync_type;
-	unsigned int i, j, splitct, max_size;
+	unsigned int i, j, frame, frames, max_size;
 
 	if (!is_slave_direction(direction)) {
 		dev_err(chan->device->dev, "%s: bad direction?\n", __func__);
@@ -815,55 +974,38 @@ static struct dma_async_tx_descriptor *bcm2835_dma_prep_slave_sg(
 		return NULL;
 	}
 
-	/* Now allocate and setup the descriptor. */
-	d = kzalloc(sizeof(*d), GFP_NOWAIT);
-	if (!d)
-		return NULL;
-
-	d->dir = direction;
-
 	if (c->ch >= 8) /* we have a LITE channel */
 		max_size = MAX_LITE_TRANSFER;
 	else
 		max_size = MAX_NORMAL_TRANSFER;
 
-	/* We store the length of the SG list in d->frames
-	   taking care to account for splitting up transfers
+	/* One control block per SG entry, splitting up transfers
 	   too large for a LITE channel */
+	frames = 0;
+	for_each_sg(sgl, sgent, sg_len, i)
+		frames += DIV_ROUND_UP(sg_dma_len(sgent), max_size);
+	if (!frames)
+		return NULL;
 
-	d->frames = 0;
-	for_each_sg(sgl, sgent, sg_len, i) {
-		uint32_t len = sg_dma_len(sgent);
-		d->frames += 1 + len / max_size;
-	}
-
-	/* Allocate memory for control blocks */
-	d->control_block_size = d->frames * sizeof(struct bcm2835_dma_cb);
-	d->control_block_base = dma_zalloc_coherent(chan->device->dev,
-			d->control_block_size, &d->control_block_base_phys,
-			GFP_NOWAIT);
-
-	if (!d->control_block_base) {
-		kfree(d);
+	/* Now allocate and setup the descriptor. */
+	d = bcm2835_dma_desc_alloc(c, direction, frames);
+	if (!d)
 		return NULL;
-	}
 
 	/*
 	 * Iterate over all SG entries, create a control block
 	 * for each frame and link them together.
 	 */
-
-	/* we count the number of times an SG entry had to be splitct
-	   as a result of using a LITE channel */
-	splitct = 0;
+	frame = 0;
 
 	for_each_sg(sgl, sgent, sg_len, i) {
 		dma_addr_t addr = sg_dma_address(sgent);
 		uint32_t len = sg_dma_len(sgent);
 
-		for (j = 0; j < len; j += max_size) {
+		for (j = 0; j < len; j += max_size, frame++) {
 			struct bcm2835_dma_cb *control_block =
-				&d->control_block_base[i+splitct];
+				d->cb_list[frame].cb;
+			u32 waits = SDHCI_BCM_DMA_WAITS;
 
 			/* Setup adresses */
 			if (d->dir == DMA_DEV_TO_MEM) {
@@ -879,16 +1021,11 @@ static struct dma_async_tx_descriptor *bcm2835_dma_prep_slave_sg(
 			}
 
 			/* Common part */
-			u32 waits = SDHCI_BCM_DMA_WAITS;
 			if ((dma_debug >> 0) & 0x1f)
 				waits = (dma_debug >> 0) & 0x1f;
 			control_block->info |= BCM2835_DMA_WAITS(waits);
 			control_block->info |= BCM2835_DMA_WAIT_RESP;
 
-			/* Enable  */
-			if (i == sg_len-1 && len-j <= max_size)
-				control_block->info |= BCM2835_DMA_INT_EN;
-
 			/* Setup synchronization */
 			if (sync_type != 0)
 				control_block->info |= sync_type;
@@ -902,25 +1039,17 @@ static struct dma_async_tx_descriptor *bcm2835_dma_prep_slave_sg(
 			control_block->length = min(len-j, max_size);
 			d->size += control_block->length;
 
-			/*
-			 * Next block is the next frame.
-			 */
-			if (i < sg_len-1 || len-j > max_size) {
+			if (frame < d->frames - 1) {
 				/* next block is the next frame. */
-				control_block->next = d->control_block_base_phys +
-				sizeof(struct bcm2835_dma_cb) * (i + splitct + 1);
+				control_block->next = d->cb_list[frame + 1].paddr;
 			} else {
-				/* next block is empty. */
+				/* last block: interrupt, next block is empty. */
+				control_block->info |= BCM2835_DMA_INT_EN;
 				control_block->next = 0;
 			}
-
-			if (len-j > max_size)
-				splitct++;
 		}
 	}
 
-	c->cyclic = false;
-
 	return vchan_tx_prep(&c->vc, &d->vd, flags);
 }
 
@@ -965,6 +1094,7 @@ static int bcm2835_dma_terminate_all(struct dma_chan *chan)
 	 */
 	if (c->desc) {
 		c->desc = NULL;
+		c->vc.cyclic = NULL;
 		bcm2835_dma_abort(c->chan_base);
 
 		/* Wait for stopping */
@@ -980,6 +1110,7 @@ static int bcm2835_dma_terminate_all(struct dma_chan *chan)
 			dev_err(d->ddev.dev, "DMA transfer could not be terminated\n");
 	}
 
+	list_splice_tail_init(&c->chain, &head);
 	vchan_get_all_descriptors(&c->vc, &head);
 	spin_unlock_irqrestore(&c->vc.lock, flags);
 	vchan_dma_desc_free_list(&c->vc, &head);
@@ -999,6 +1130,7 @@ static int bcm2835_dma_chan_init(struct bcm2835_dmadev *d, int chan_id, int irq)
 	c->vc.desc_free = bcm2835_dma_desc_free;
 	vchan_init(&c->vc, &d->ddev);
 	INIT_LIST_HEAD(&c->node);
+	INIT_LIST_HEAD(&c->chain);
 
 	c->chan_base = BCM2835_DMA_CHANIO(d->base, chan_id);
 	c->ch = chan_id;
@@ -1020,6 +1152,7 @@ static int bcm2708_dma_chan_init(struct bcm2835_dmadev *d,
 	c->vc.desc_free = bcm2835_dma_desc_free;
 	vchan_init(&c->vc, &d->ddev);
 	INIT_LIST_HEAD(&c->node);
+	INIT_LIST_HEAD(&c->chain);
 
 	c->chan_base = chan_base;
 	c->ch = chan_id;
@@ -1101,17 +1234,20 @@ static int bcm2835_dma_probe(struct platform_device *pdev)
 	dma_cap_set(DMA_SLAVE, od->ddev.cap_mask);
 	dma_cap_set(DMA_PRIVATE, od->ddev.cap_mask);
 	dma_cap_set(DMA_CYCLIC, od->ddev.cap_mask);
+	dma_cap_set(DMA_MEMCPY, od->ddev.cap_mask);
 	od->ddev.device_alloc_chan_resources = bcm2835_dma_alloc_chan_resources;
 	od->ddev.device_free_chan_resources = bcm2835_dma_free_chan_resources;
 	od->ddev.device_tx_status = bcm2835_dma_tx_status;
 	od->ddev.device_issue_pending = bcm2835_dma_issue_pending;
 	od->ddev.device_prep_dma_cyclic = bcm2835_dma_prep_dma_cyclic;
 	od->ddev.device_prep_slave_sg = bcm2835_dma_prep_slave_sg;
+	od->ddev.device_prep_dma_memcpy = bcm2835_dma_prep_dma_memcpy;
 	od->ddev.device_terminate_all = bcm2835_dma_terminate_all;
 	od->ddev.device_config = bcm2835_dma_slave_config;
 	od->ddev.src_addr_widths = BIT(DMA_SLAVE_BUSWIDTH_4_BYTES);
 	od->ddev.dst_addr_widths = BIT(DMA_SLAVE_BUSWIDTH_4_BYTES);
-	od->ddev.directions = BIT(DMA_DEV_TO_MEM) | BIT(DMA_MEM_TO_DEV);
+	od->ddev.directions = BIT(DMA_DEV_TO_MEM) | BIT(DMA_MEM_TO_DEV) |
+			      BIT(DMA_MEM_TO_MEM);
 	od->ddev.residue_granularity = DMA_RESIDUE_GRANULARITY_BURST;
 	od->ddev.dev = &pdev->dev;
 	INIT_LIST_HEAD(&od->ddev.channels);
@@ -1170,17 +1306,20 @@ static int bcm2835_dma_probe(struct platform_device *pdev)
 	dma_cap_set(DMA_SLAVE, od->ddev.cap_mask);
 	dma_cap_set(DMA_PRIVATE, od->ddev.cap_mask);
 	dma_cap_set(DMA_CYCLIC, od->ddev.cap_mask);
+	dma_cap_set(DMA_MEMCPY, od->ddev.cap_mask);
 	od->ddev.device_alloc_chan_resources = bcm2835_dma_alloc_chan_resources;
 	od->ddev.device_free_chan_resources = bcm2835_dma_free_chan_resources;
 	od->ddev.device_tx_status = bcm2835_dma_tx_status;
 	od->ddev.device_issue_pending = bcm2835_dma_issue_pending;
 	od->ddev.device_prep_dma_cyclic = bcm2835_dma_prep_dma_cyclic;
 	od->ddev.device_prep_slave_sg = bcm2835_dma_prep_slave_sg;
+	od->ddev.device_prep_dma_memcpy = bcm2835_dma_prep_dma_memcpy;
 	od->ddev.device_terminate_all = bcm2835_dma_terminate_all;
 	od->ddev.device_config = bcm2835_dma_slave_config;
 	od->ddev.src_addr_widths = BIT(DMA_SLAVE_BUSWIDTH_4_BYTES);
 	od->ddev.dst_addr_widths = BIT(DMA_SLAVE_BUSWIDTH_4_BYTES);
-	od->ddev.directions = BIT(DMA_DEV_TO_MEM) | BIT(DMA_MEM_TO_DEV);
+	od->ddev.directions = BIT(DMA_DEV_TO_MEM) | BIT(DMA_MEM_TO_DEV) |
+			      BIT(DMA_MEM_TO_MEM);
 	od->ddev.residue_granularity = DMA_RESIDUE_GRANULARITY_BURST;
 	od->ddev.dev = &pdev->dev;
 	INIT_LIST_HEAD(&od->ddev.channels);
@@ -1285,6 +1424,8 @@ subsys_initcall(bcm2835_init);
 module_exit(bcm2835_exit);
 
 module_param(dma_debug, uint, 0644);
+module_param(chain_descs, uint, 0644);
+MODULE_PARM_DESC(chain_descs, "Queued transfers to run per interrupt (1 disables chaining)");
 #ifdef CONFIG_DMA_BCM2708_LEGACY
 /* Keep backward compatibility: dma.dmachans= */
 #undef MODULE_PARAM_PREFIX
@@ -15,14 +15,40 @@
  * physical memory for our BOs.
  */
 
+#include <linux/moduleparam.h>
+#include <linux/shrinker.h>
+
 #include "vc4_drv.h"
 #include "uapi/drm/vc4_drm.h"
 
+/* Per-size-class cache statistics are kept for power-of-two ranges of
+ * page counts: 1 page, 2-3 pages, 4-7 pages, ..., with the last class
+ * collecting everything larger.
+ */
+#define VC4_BO_STAT_CLASSES 12
+
+/* A cached BO up to this fraction larger than the request may be
+ * handed out when there isn't an exact fit, rather than carving a
+ * fresh allocation out of CMA.
+ */
+#define VC4_BO_CACHE_SLACK_SHIFT 3
+
+static unsigned int bo_cache_max_kb = 32 * 1024;
+module_param(bo_cache_max_kb, uint, 0644);
+MODULE_PARM_DESC(bo_cache_max_kb,
+		 "Maximum size of unused BOs kept in the BO cache (KB)");
+
 static struct {
 	u32 num_allocated;
 	u32 size_allocated;
 	u32 num_cached;
 	u32 size_cached;
+
+	struct {
+		u32 hits;
+		u32 misses;
+		u32 evictions;
+	} class[VC4_BO_STAT_CLASSES];
 } bo_stats;
 
 static void
@@ -48,10 +74,17 @@ bo_page_index(size_t size)
 	return (size / PAGE_SIZE) - 1;
 }
 
+static uint32_t
+bo_stat_class(size_t size)
+{
+	return min_t(uint32_t, ilog2(size / PAGE_SIZE),
+		     VC4_BO_STAT_CLASSES - 1);
+}
+
 static void
 vc4_bo_destroy(struct vc4_bo *bo)
 {
-	kfree(bo->validated_shader);
+	vc4_free_validated_shader(bo->validated_shader);
 	bo->validated_shader = NULL;
 
 	bo_stats.num_allocated--;
@@ -108,17 +141,63 @@ vc4_get_cache_list_for_size(struct drm_device *dev, size_t size)
 	return &vc4->bo_cache.size_list[page_index];
 }
 
+/* Frees the oldest BO in the cache, returning the number of pages
+ * released.
+ */
+static unsigned long
+vc4_bo_cache_evict_oldest(struct drm_device *dev)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	struct vc4_bo *bo = list_last_entry(&vc4->bo_cache.time_list,
+					    struct vc4_bo, unref_head);
+	unsigned long pages = bo->base.base.size >> PAGE_SHIFT;
+
+	bo_stats.class[bo_stat_class(bo->base.base.size)].evictions++;
+	vc4_bo_remove_from_cache(bo);
+	vc4_bo_destroy(bo);
+
+	return pages;
+}
+
 void
 vc4_bo_cache_purge(struct drm_device *dev)
 {
 	struct vc4_dev *vc4 = to_vc4_dev(dev);
 
-	while (!list_empty(&vc4->bo_cache.time_list)) {
-		struct vc4_bo *bo = list_last_entry(&vc4->bo_cache.time_list,
-						    struct vc4_bo, unref_head);
+	while (!list_empty(&vc4->bo_cache.time_list))
+		vc4_bo_cache_evict_oldest(dev);
+}
+
+/* Looks for a cached BO that can satisfy an allocation of size bytes,
+ * preferring an exact fit.
+ */
+static struct vc4_bo *
+vc4_bo_get_from_cache(struct drm_device *dev, uint32_t size)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	uint32_t page_index = bo_page_index(size);
+	uint32_t max_index = bo_page_index(size +
+					   (size >> VC4_BO_CACHE_SLACK_SHIFT));
+	uint32_t i;
+
+	if (vc4->bo_cache.size_list_size <= page_index)
+		return NULL;
+
+	max_index = min(max_index, vc4->bo_cache.size_list_size - 1);
+	for (i = page_index; i <= max_index; i++) {
+		struct vc4_bo *bo;
+
+		if (list_empty(&vc4->bo_cache.size_list[i]))
+			continue;
+
+		bo = list_first_entry(&vc4->bo_cache.size_list[i],
+				      struct vc4_bo, size_head);
 		vc4_bo_remove_from_cache(bo);
-		vc4_bo_destroy(bo);
+		kref_init(&bo->base.base.refcount);
+		return bo;
 	}
+
+	return NULL;
 }
 
 struct vc4_bo *
@@ -126,24 +205,20 @@ vc4_bo_create(struct drm_device *dev, size_t unaligned_size)
 {
 	struct vc4_dev *vc4 = to_vc4_dev(dev);
 	uint32_t size = roundup(unaligned_size, PAGE_SIZE);
-	uint32_t page_index = bo_page_index(size);
 	struct drm_gem_cma_object *cma_obj;
+	struct vc4_bo *bo;
 	int pass;
 
 	if (size == 0)
 		return NULL;
 
 	/* First, try to get a vc4_bo from the kernel BO cache. */
-	if (vc4->bo_cache.size_list_size > page_index) {
-		if (!list_empty(&vc4->bo_cache.size_list[page_index])) {
-			struct vc4_bo *bo =
-				list_first_entry(&vc4->bo_cache.size_list[page_index],
-						 struct vc4_bo, size_head);
-			vc4_bo_remove_from_cache(bo);
-			kref_init(&bo->base.base.refcount);
-			return bo;
-		}
+	bo = vc4_bo_get_from_cache(dev, size);
+	if (bo) {
+		bo_stats.class[bo_stat_class(size)].hits++;
+		return bo;
 	}
+	bo_stats.class[bo_stat_class(size)].misses++;
 
 	/* Otherwise, make a new BO. */
 	for (pass = 0; ; pass++) {
@@ -226,8 +301,7 @@ vc4_bo_cache_free_old(struct drm_device *dev)
 			return;
 		}
 
-		vc4_bo_remove_from_cache(bo);
-		vc4_bo_destroy(bo);
+		vc4_bo_cache_evict_oldest(dev);
 	}
 }
 
@@ -263,7 +337,7 @@ vc4_free_object(struct drm_gem_object *gem_bo)
 		return;
 	}
 
-	kfree(bo->validated_shader);
+	vc4_free_validated_shader(bo->validated_shader);
 	bo->validated_shader = NULL;
 
 	/* If the BO was exported, and it's made it to this point,
@@ -279,6 +353,9 @@ vc4_free_object(struct drm_gem_object *gem_bo)
 	bo_stats.num_cached++;
 	bo_stats.size_cached += gem_bo->size;
 
+	while (bo_stats.size_cached / 1024 > bo_cache_max_kb)
+		vc4_bo_cache_evict_oldest(dev);
+
 	vc4_bo_cache_free_old(dev);
 }
 
@@ -303,6 +380,38 @@ vc4_bo_cache_time_timer(unsigned long data)
 	schedule_work(&vc4->bo_cache.time_work);
 }
 
+static unsigned long
+vc4_bo_cache_shrinker_count(struct shrinker *shrinker,
+			    struct shrink_control *sc)
+{
+	/* Read without struct_mutex; this is only a hint. */
+	return ACCESS_ONCE(bo_stats.size_cached) >> PAGE_SHIFT;
+}
+
+static unsigned long
+vc4_bo_cache_shrinker_scan(struct shrinker *shrinker,
+			   struct shrink_control *sc)
+{
+	struct vc4_dev *vc4 =
+		container_of(shrinker, struct vc4_dev, bo_cache.shrinker);
+	struct drm_device *dev = vc4->dev;
+	unsigned long freed = 0;
+
+	/* The allocation that got us here may be made with
+	 * struct_mutex held, so don't wait for it.
+	 */
+	if (!mutex_trylock(&dev->struct_mutex))
+		return SHRINK_STOP;
+
+	while (freed < sc->nr_to_scan &&
+	       !list_empty(&vc4->bo_cache.time_list))
+		freed += vc4_bo_cache_evict_oldest(dev);
+
+	mutex_unlock(&dev->struct_mutex);
+
+	return freed;
+}
+
 void
 vc4_bo_cache_init(struct drm_device *dev)
 {
@@ -314,6 +423,12 @@ vc4_bo_cache_init(struct drm_device *dev)
 	setup_timer(&vc4->bo_cache.time_timer,
 		    vc4_bo_cache_time_timer,
 		    (unsigned long) dev);
+
+	vc4->bo_cache.shrinker.count_objects = vc4_bo_cache_shrinker_count;
+	vc4->bo_cache.shrinker.scan_objects = vc4_bo_cache_shrinker_scan;
+	vc4->bo_cache.shrinker.seeks = DEFAULT_SEEKS;
+	if (register_shrinker(&vc4->bo_cache.shrinker))
+		DRM_ERROR("Failed to register BO cache shrinker\n");
 }
 
 void
@@ -321,6 +436,9 @@ vc4_bo_cache_destroy(struct drm_device *dev)
 {
 	struct vc4_dev *vc4 = to_vc4_dev(dev);
 
+	if (vc4->bo_cache.shrinker.nr_deferred)
+		unregister_shrinker(&vc4->bo_cache.shrinker);
+
 	del_timer(&vc4->bo_cache.time_timer);
 	cancel_work_sync(&vc4->bo_cache.time_work);
 
@@ -456,6 +574,30 @@ vc4_mmap_bo_ioctl(struct drm_device *dev, void *data,
 	return 0;
 }
 
+/*
+ * Counts a new userspace mapping of the BO, unless it holds a validated
+ * shader.  This is done under struct_mutex, which submit holds while
+ * validating, so a BO can't be mapped between the validator checking
+ * mmap_count and caching its result.  The caller drops the count again
+ * if setting up the mapping fails.
+ */
+static int vc4_bo_get_mapping(struct vc4_bo *bo)
+{
+	struct drm_device *dev = bo->base.base.dev;
+	int ret = 0;
+
+	mutex_lock(&dev->struct_mutex);
+	if (bo->validated_shader) {
+		DRM_ERROR("mmaping of shader BOs not allowed.\n");
+		ret = -EINVAL;
+	} else {
+		atomic_inc(&bo->mmap_count);
+	}
+	mutex_unlock(&dev->struct_mutex);
+
+	return ret;
+}
+
 int vc4_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	struct drm_gem_object *gem_obj;
@@ -469,9 +611,10 @@ int vc4_mmap(struct file *filp, struct vm_area_struct *vma)
 	gem_obj = vma->vm_private_data;
 	bo = to_vc4_bo(gem_obj);
 
-	if (bo->validated_shader) {
-		DRM_ERROR("mmaping of shader BOs not allowed.\n");
-		return -EINVAL;
+	ret = vc4_bo_get_mapping(bo);
+	if (ret) {
+		drm_gem_vm_close(vma);
+		return ret;
 	}
 
 	/*
@@ -485,8 +628,10 @@ int vc4_mmap(struct file *filp, struct vm_area_struct *vma)
 	ret = dma_mmap_writecombine(bo->base.base.dev->dev, vma,
 				    bo->base.vaddr, bo->base.paddr,
 				    vma->vm_end - vma->vm_start);
-	if (ret)
+	if (ret) {
+		atomic_dec(&bo->mmap_count);
 		drm_gem_vm_close(vma);
+	}
 
 	return ret;
 }
@@ -494,15 +639,40 @@ int vc4_mmap(struct file *filp, struct vm_area_struct *vma)
 int vc4_prime_mmap(struct drm_gem_object *obj, struct vm_area_struct *vma)
 {
 	struct vc4_bo *bo = to_vc4_bo(obj);
+	int ret;
 
-	if (bo->validated_shader) {
-		DRM_ERROR("mmaping of shader BOs not allowed.\n");
-		return -EINVAL;
-	}
+	ret = vc4_bo_get_mapping(bo);
+	if (ret)
+		return ret;
+
+	ret = drm_gem_cma_prime_mmap(obj, vma);
+	if (ret)
+		atomic_dec(&bo->mmap_count);
+
+	return ret;
+}
+
+static void vc4_vm_open(struct vm_area_struct *vma)
+{
+	struct vc4_bo *bo = to_vc4_bo(vma->vm_private_data);
 
-	return drm_gem_cma_prime_mmap(obj, vma);
+	atomic_inc(&bo->mmap_count);
+	drm_gem_vm_open(vma);
 }
 
+static void vc4_vm_close(struct vm_area_struct *vma)
+{
+	struct vc4_bo *bo = to_vc4_bo(vma->vm_private_data);
+
+	atomic_dec(&bo->mmap_count);
+	drm_gem_vm_close(vma);
+}
+
+const struct vm_operations_struct vc4_vm_ops = {
+	.open = vc4_vm_open,
+	.close = vc4_vm_close,
+};
+
 void *vc4_prime_vmap(struct drm_gem_object *obj)
 {
 	struct vc4_bo *bo = to_vc4_bo(obj);
@@ -520,6 +690,7 @@ int vc4_bo_stats_debugfs(struct seq_file *m, void *unused)
 {
 	struct drm_info_node *node = (struct drm_info_node *) m->private;
 	struct drm_device *dev = node->minor->dev;
+	int i;
 
 	mutex_lock(&dev->struct_mutex);
 
@@ -535,6 +706,16 @@ int vc4_bo_stats_debugfs(struct seq_file *m, void *unused)
 		   bo_stats.num_cached);
 	seq_printf(m, "size bos cached: %dkb\n",
 		   bo_stats.size_cached / 1024);
+	seq_printf(m, "max size bos cached: %ukb\n", bo_cache_max_kb);
+
+	seq_puts(m, "\npages   hits   misses evictions\n");
+	for (i = 0; i < VC4_BO_STAT_CLASSES; i++) {
+		seq_printf(m, "%5u%c %6u %8u %9u\n",
+			   1 << i, i == VC4_BO_STAT_CLASSES - 1 ? '+' : ' ',
+			   bo_stats.class[i].hits,
+			   bo_stats.class[i].misses,
+			   bo_stats.class[i].evictions);
+	}
 
 	mutex_unlock(&dev->struct_mutex);
 
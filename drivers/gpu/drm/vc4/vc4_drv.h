@@ -17,7 +17,7 @@ struct vc4_dev {
 	struct vc4_crtc *crtc[3];
 	struct vc4_v3d *v3d;
 
-	/* Sequence number for the last job queued in job_list.
+	/* Sequence number for the last job queued in bin_job_list.
 	 * Starts at 0 (no jobs emitted).
 	 */
 	uint64_t emit_seqno;
@@ -27,11 +27,18 @@ struct vc4_dev {
 	 */
 	uint64_t finished_seqno;
 
-	/* List of all struct vc4_exec_info for jobs to be executed.
-	 * The first job in the list is the one currently programmed
-	 * into ct0ca/ct1ca for execution.
+	/* List of all struct vc4_exec_info for jobs to be executed in
+	 * the binner.  The first job in the list is the one currently
+	 * programmed into ct0ca for execution.
 	 */
-	struct list_head job_list;
+	struct list_head bin_job_list;
+
+	/* List of all struct vc4_exec_info for jobs that have
+	 * completed binning and are ready for rendering.  The first
+	 * job in the list is the one currently programmed into ct1ca
+	 * for execution.  Binning of the next job overlaps with it.
+	 */
+	struct list_head render_job_list;
 	/* List of the finished vc4_exec_infos waiting to be freed by
 	 * job_done_work.
 	 */
@@ -40,6 +47,11 @@ struct vc4_dev {
 	wait_queue_head_t job_wait_queue;
 	struct work_struct job_done_work;
 
+	/* Timeline for the sync_file fences handed out by
+	 * DRM_IOCTL_VC4_SUBMIT_CL, signaled as jobs finish rendering.
+	 */
+	struct vc4_sync_timeline *timeline;
+
 	/* List of struct vc4_seqno_cb for callbacks to be made from a
 	 * workqueue when the given seqno is passed.
 	 */
@@ -72,6 +84,11 @@ struct vc4_dev {
 		struct list_head time_list;
 		struct work_struct time_work;
 		struct timer_list time_timer;
+
+		/* Releases cached BOs back to CMA under memory
+		 * pressure.
+		 */
+		struct shrinker shrinker;
 	} bo_cache;
 
 	struct {
@@ -83,6 +100,16 @@ struct vc4_dev {
 	struct semaphore async_modeset;
 
 	struct drm_fbdev_cma *fbdev;
+
+	/* Statistics on the CPU cost of command list validation,
+	 * protected by struct_mutex.
+	 */
+	struct {
+		uint64_t submits;
+		uint64_t validate_ns;
+		uint64_t shader_cache_hits;
+		uint64_t shader_cache_misses;
+	} validate_stats;
 };
 
 static inline struct vc4_dev *
@@ -108,10 +135,19 @@ struct vc4_bo {
 	struct list_head size_head;
 
 	/* Struct for shader validation state, if created by
-	 * DRM_IOCTL_VC4_CREATE_SHADER_BO.
+	 * DRM_IOCTL_VC4_CREATE_SHADER_BO or cached from a previous
+	 * submit that used the BO as a shader.  Set and checked under
+	 * struct_mutex.  While it is set the BO can't be mapped or used
+	 * as anything but a shader.
 	 */
 	struct vc4_validated_shader_info *validated_shader;
 
+	/* Number of userspace mappings of the BO.  While the BO is
+	 * mapped its contents may change after validation, so the
+	 * validation results aren't cached in validated_shader.
+	 */
+	atomic_t mmap_count;
+
 	/* Set if the buffer has been either imported or exported via
 	 * dmabufs.  Used for shader mapping security checks.
 	 */
@@ -204,7 +240,9 @@ struct vc4_exec_info {
 	struct vc4_bo_exec_state *bo;
 	uint32_t bo_count;
 
-	/* Pointers for our position in vc4->job_list */
+	/* Pointers for our position in vc4->bin_job_list,
+	 * render_job_list or job_done_list.
+	 */
 	struct list_head head;
 
 	/* List of other BOs used in the job that need to be released
@@ -276,11 +314,29 @@ struct vc4_exec_info {
 };
 
 static inline struct vc4_exec_info *
-vc4_first_job(struct vc4_dev *vc4)
+vc4_first_bin_job(struct vc4_dev *vc4)
+{
+	if (list_empty(&vc4->bin_job_list))
+		return NULL;
+	return list_first_entry(&vc4->bin_job_list, struct vc4_exec_info, head);
+}
+
+static inline struct vc4_exec_info *
+vc4_first_render_job(struct vc4_dev *vc4)
 {
-	if (list_empty(&vc4->job_list))
+	if (list_empty(&vc4->render_job_list))
 		return NULL;
-	return list_first_entry(&vc4->job_list, struct vc4_exec_info, head);
+	return list_first_entry(&vc4->render_job_list,
+				struct vc4_exec_info, head);
+}
+
+static inline struct vc4_exec_info *
+vc4_last_render_job(struct vc4_dev *vc4)
+{
+	if (list_empty(&vc4->render_job_list))
+		return NULL;
+	return list_last_entry(&vc4->render_job_list,
+			       struct vc4_exec_info, head);
 }
 
 /**
@@ -386,6 +442,7 @@ int vc4_bo_stats_debugfs(struct seq_file *m, void *unused);
 int vc4_mmap(struct file *filp, struct vm_area_struct *vma);
 int vc4_prime_mmap(struct drm_gem_object *obj, struct vm_area_struct *vma);
 void *vc4_prime_vmap(struct drm_gem_object *obj);
+extern const struct vm_operations_struct vc4_vm_ops;
 
 /* vc4_debugfs.c */
 int vc4_debugfs_init(struct drm_minor *minor);
@@ -394,6 +451,22 @@ void vc4_debugfs_cleanup(struct drm_minor *minor);
 /* vc4_drv.c */
 void __iomem *vc4_ioremap_regs(struct platform_device *dev, int index);
 
+/* vc4_fence.c */
+#ifdef CONFIG_SYNC
+int vc4_fence_init(struct drm_device *dev);
+void vc4_fence_fini(struct drm_device *dev);
+int vc4_fence_create_fd(struct drm_device *dev, uint64_t seqno);
+void vc4_fence_signal(struct vc4_dev *vc4);
+#else
+static inline int vc4_fence_init(struct drm_device *dev) { return 0; }
+static inline void vc4_fence_fini(struct drm_device *dev) {}
+static inline int vc4_fence_create_fd(struct drm_device *dev, uint64_t seqno)
+{
+	return -ENODEV;
+}
+static inline void vc4_fence_signal(struct vc4_dev *vc4) {}
+#endif
+
 /* vc4_gem.c */
 void vc4_gem_init(struct drm_device *dev);
 void vc4_gem_destroy(struct drm_device *dev);
@@ -403,13 +476,16 @@ int vc4_wait_seqno_ioctl(struct drm_device *dev, void *data,
 			 struct drm_file *file_priv);
 int vc4_wait_bo_ioctl(struct drm_device *dev, void *data,
 		      struct drm_file *file_priv);
-void vc4_submit_next_job(struct drm_device *dev);
+void vc4_submit_next_bin_job(struct drm_device *dev);
+void vc4_submit_next_render_job(struct drm_device *dev);
+void vc4_move_job_to_render(struct drm_device *dev, struct vc4_exec_info *exec);
 int vc4_wait_for_seqno(struct drm_device *dev, uint64_t seqno,
 		       uint64_t timeout_ns, bool interruptible);
 void vc4_job_handle_completed(struct vc4_dev *vc4);
 int vc4_queue_seqno_cb(struct drm_device *dev,
 		       struct vc4_seqno_cb *cb, uint64_t seqno,
 		       void (*func)(struct vc4_seqno_cb *cb));
+int vc4_validate_stats_debugfs(struct seq_file *m, void *unused);
 
 /* vc4_hdmi.c */
 void vc4_hdmi_register(void);
@@ -462,6 +538,9 @@ vc4_validate_shader_recs(struct drm_device *dev, struct vc4_exec_info *exec);
 struct vc4_validated_shader_info *
 vc4_validate_shader(struct drm_gem_cma_object *shader_obj);
 
+void
+vc4_free_validated_shader(struct vc4_validated_shader_info *validated_shader);
+
 bool vc4_use_bo(struct vc4_exec_info *exec,
 		uint32_t hindex,
 		enum vc4_bo_mode mode,
@@ -0,0 +1,201 @@
+/*
+ * Copyright © 2015 Broadcom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/**
+ * DOC: sync_file fences for V3D jobs
+ *
+ * Each job submitted with VC4_SUBMIT_CL_FENCE_FD_OUT gets a fence fd
+ * on a per-device sync timeline.  The timeline's value is the
+ * finished seqno, so a point for a job's seqno is signaled once the
+ * render done interrupt for that job has been handled.  This lets
+ * userspace and other drivers wait on or poll a job without the
+ * DRM_IOCTL_VC4_WAIT_SEQNO round trip.
+ */
+
+#include <linux/fcntl.h>
+#include <linux/file.h>
+
+#include "../../../staging/android/sync.h"
+#include "vc4_drv.h"
+
+struct vc4_sync_timeline {
+	struct sync_timeline obj;
+	struct vc4_dev *vc4;
+};
+
+struct vc4_sync_pt {
+	struct sync_pt pt;
+	u32 seqno;
+};
+
+static int vc4_seqno_cmp(u32 a, u32 b)
+{
+	if (a == b)
+		return 0;
+
+	return ((s32)a - (s32)b) < 0 ? -1 : 1;
+}
+
+static struct vc4_sync_pt *
+vc4_sync_pt_create(struct vc4_sync_timeline *timeline, u32 seqno)
+{
+	struct vc4_sync_pt *pt;
+
+	pt = (struct vc4_sync_pt *)
+		sync_pt_create(&timeline->obj, sizeof(struct vc4_sync_pt));
+	if (!pt)
+		return NULL;
+
+	pt->seqno = seqno;
+
+	return pt;
+}
+
+static struct sync_pt *vc4_sync_pt_dup(struct sync_pt *sync_pt)
+{
+	struct vc4_sync_pt *pt = (struct vc4_sync_pt *)sync_pt;
+	struct vc4_sync_timeline *timeline =
+		(struct vc4_sync_timeline *)sync_pt_parent(sync_pt);
+
+	return (struct sync_pt *)vc4_sync_pt_create(timeline, pt->seqno);
+}
+
+static int vc4_sync_pt_has_signaled(struct sync_pt *sync_pt)
+{
+	struct vc4_sync_pt *pt = (struct vc4_sync_pt *)sync_pt;
+	struct vc4_sync_timeline *timeline =
+		(struct vc4_sync_timeline *)sync_pt_parent(sync_pt);
+
+	return vc4_seqno_cmp((u32)timeline->vc4->finished_seqno,
+			     pt->seqno) >= 0;
+}
+
+static int vc4_sync_pt_compare(struct sync_pt *a, struct sync_pt *b)
+{
+	struct vc4_sync_pt *pt_a = (struct vc4_sync_pt *)a;
+	struct vc4_sync_pt *pt_b = (struct vc4_sync_pt *)b;
+
+	return vc4_seqno_cmp(pt_a->seqno, pt_b->seqno);
+}
+
+static int vc4_sync_fill_driver_data(struct sync_pt *sync_pt,
+				     void *data, int size)
+{
+	struct vc4_sync_pt *pt = (struct vc4_sync_pt *)sync_pt;
+
+	if (size < sizeof(pt->seqno))
+		return -ENOMEM;
+
+	memcpy(data, &pt->seqno, sizeof(pt->seqno));
+
+	return sizeof(pt->seqno);
+}
+
+static void vc4_sync_timeline_value_str(struct sync_timeline *sync_timeline,
+					char *str, int size)
+{
+	struct vc4_sync_timeline *timeline =
+		(struct vc4_sync_timeline *)sync_timeline;
+
+	snprintf(str, size, "%u", (u32)timeline->vc4->finished_seqno);
+}
+
+static void vc4_sync_pt_value_str(struct sync_pt *sync_pt,
+				  char *str, int size)
+{
+	struct vc4_sync_pt *pt = (struct vc4_sync_pt *)sync_pt;
+
+	snprintf(str, size, "%u", pt->seqno);
+}
+
+static struct sync_timeline_ops vc4_sync_timeline_ops = {
+	.driver_name = "vc4",
+	.dup = vc4_sync_pt_dup,
+	.has_signaled = vc4_sync_pt_has_signaled,
+	.compare = vc4_sync_pt_compare,
+	.fill_driver_data = vc4_sync_fill_driver_data,
+	.timeline_value_str = vc4_sync_timeline_value_str,
+	.pt_value_str = vc4_sync_pt_value_str,
+};
+
+int
+vc4_fence_init(struct drm_device *dev)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	struct vc4_sync_timeline *timeline;
+
+	timeline = (struct vc4_sync_timeline *)
+		sync_timeline_create(&vc4_sync_timeline_ops,
+				     sizeof(struct vc4_sync_timeline),
+				     "vc4-v3d");
+	if (!timeline)
+		return -ENOMEM;
+
+	timeline->vc4 = vc4;
+	vc4->timeline = timeline;
+
+	return 0;
+}
+
+void
+vc4_fence_fini(struct drm_device *dev)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+
+	if (!vc4->timeline)
+		return;
+
+	sync_timeline_destroy(&vc4->timeline->obj);
+	vc4->timeline = NULL;
+}
+
+/* Returns a new fd for a fence that signals when the job with the
+ * given seqno has finished rendering, or a negative error code.
+ */
+int
+vc4_fence_create_fd(struct drm_device *dev, uint64_t seqno)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	struct vc4_sync_pt *pt;
+	struct sync_fence *fence;
+	int fd;
+
+	if (!vc4->timeline)
+		return -ENODEV;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	pt = vc4_sync_pt_create(vc4->timeline, (u32)seqno);
+	if (!pt) {
+		put_unused_fd(fd);
+		return -ENOMEM;
+	}
+
+	fence = sync_fence_create("vc4-job", &pt->pt);
+	if (!fence) {
+		sync_pt_free(&pt->pt);
+		put_unused_fd(fd);
+		return -ENOMEM;
+	}
+
+	sync_fence_install(fence, fd);
+
+	return fd;
+}
+
+/* Called from the render done interrupt (with job_lock held) after
+ * finished_seqno has been advanced.
+ */
+void
+vc4_fence_signal(struct vc4_dev *vc4)
+{
+	if (vc4->timeline)
+		sync_timeline_signal(&vc4->timeline->obj);
+}
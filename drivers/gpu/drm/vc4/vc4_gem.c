@@ -75,7 +75,8 @@ vc4_hangcheck_elapsed(unsigned long data)
 	uint32_t ct0ca, ct1ca;
 
 	/* If idle, we can stop watching for hangs. */
-	if (list_empty(&vc4->job_list))
+	if (list_empty(&vc4->bin_job_list) &&
+	    list_empty(&vc4->render_job_list))
 		return;
 
 	ct0ca = V3D_READ(V3D_CTNCA(0));
@@ -191,30 +192,73 @@ vc4_flush_caches(struct drm_device *dev)
 }
 
 /* Sets the registers for the next job to be actually be executed in
- * the hardware.
+ * the binner.
  *
  * The job_lock should be held during this.
  */
 void
-vc4_submit_next_job(struct drm_device *dev)
+vc4_submit_next_bin_job(struct drm_device *dev)
 {
 	struct vc4_dev *vc4 = to_vc4_dev(dev);
-	struct vc4_exec_info *exec = vc4_first_job(vc4);
+	struct vc4_exec_info *exec;
 
+again:
+	exec = vc4_first_bin_job(vc4);
 	if (!exec)
 		return;
 
 	vc4_flush_caches(dev);
 
-	/* Disable the binner's pre-loaded overflow memory address */
-	V3D_WRITE(V3D_BPOA, 0);
-	V3D_WRITE(V3D_BPOS, 0);
+	/* Either put the job in the binner if it uses the binner, or
+	 * immediately move it to the to-be-rendered queue.
+	 */
+	if (exec->ct0ca != exec->ct0ea) {
+		/* Disable the binner's pre-loaded overflow memory
+		 * address
+		 */
+		V3D_WRITE(V3D_BPOA, 0);
+		V3D_WRITE(V3D_BPOS, 0);
 
-	if (exec->ct0ca != exec->ct0ea)
 		submit_cl(dev, 0, exec->ct0ca, exec->ct0ea);
+	} else {
+		vc4_move_job_to_render(dev, exec);
+		goto again;
+	}
+}
+
+/* Sets the registers for the next job to be actually be executed in
+ * the renderer.
+ *
+ * The job_lock should be held during this.
+ */
+void
+vc4_submit_next_render_job(struct drm_device *dev)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	struct vc4_exec_info *exec = vc4_first_render_job(vc4);
+
+	if (!exec)
+		return;
+
 	submit_cl(dev, 1, exec->ct1ca, exec->ct1ea);
 }
 
+/* Moves a job that has finished binning to the render queue, and
+ * starts rendering it if the renderer is idle.
+ *
+ * The job_lock should be held during this.
+ */
+void
+vc4_move_job_to_render(struct drm_device *dev, struct vc4_exec_info *exec)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	bool was_empty = list_empty(&vc4->render_job_list);
+
+	list_move_tail(&exec->head, &vc4->render_job_list);
+	if (was_empty)
+		vc4_submit_next_render_job(dev);
+}
+
 static void
 vc4_update_bo_seqnos(struct vc4_exec_info *exec, uint64_t seqno)
 {
@@ -232,13 +276,12 @@ vc4_update_bo_seqnos(struct vc4_exec_info *exec, uint64_t seqno)
 }
 
 /* Queues a struct vc4_exec_info for execution.  If no job is
- * currently executing, then submits it.
+ * currently binning, then submits it.
  *
- * Unlike most GPUs, our hardware only handles one command list at a
- * time.  To queue multiple jobs at once, we'd need to edit the
- * previous command list to have a jump to the new one at the end, and
- * then bump the end address.  That's a change for a later date,
- * though.
+ * The binner and renderer each only handle one command list at a
+ * time, but they run independently: once a job's binning is done (the
+ * binner flush interrupt), it moves to the render queue and the next
+ * job starts binning while it renders.
  */
 static void
 vc4_queue_submit(struct drm_device *dev, struct vc4_exec_info *exec)
@@ -251,14 +294,13 @@ vc4_queue_submit(struct drm_device *dev, struct vc4_exec_info *exec)
 	vc4_update_bo_seqnos(exec, seqno);
 
 	spin_lock_irqsave(&vc4->job_lock, irqflags);
-	list_add_tail(&exec->head, &vc4->job_list);
+	list_add_tail(&exec->head, &vc4->bin_job_list);
 
-	/* If no job was executing, kick ours off.  Otherwise, it'll
-	 * get started when the previous job's frame done interrupt
-	 * occurs.
+	/* If no job was binning, kick ours off.  Otherwise, it'll get
+	 * started when the previous job's flush done interrupt occurs.
 	 */
-	if (vc4_first_job(vc4) == exec) {
-		vc4_submit_next_job(dev);
+	if (vc4_first_bin_job(vc4) == exec) {
+		vc4_submit_next_bin_job(dev);
 		vc4_queue_hangcheck(dev);
 	}
 
@@ -335,7 +377,9 @@ fail:
 static int
 vc4_get_bcl(struct drm_device *dev, struct vc4_exec_info *exec)
 {
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
 	struct drm_vc4_submit_cl *args = exec->args;
+	ktime_t validate_start;
 	void *temp = NULL;
 	void *bin;
 	int ret = 0;
@@ -422,6 +466,8 @@ vc4_get_bcl(struct drm_device *dev, struct vc4_exec_info *exec)
 	exec->uniforms_p = exec->exec_bo->paddr + uniforms_offset;
 	exec->uniforms_size = args->uniforms_size;
 
+	validate_start = ktime_get();
+
 	ret = vc4_validate_bin_cl(dev,
 				  exec->exec_bo->vaddr + bin_offset,
 				  bin,
@@ -431,6 +477,10 @@ vc4_get_bcl(struct drm_device *dev, struct vc4_exec_info *exec)
 
 	ret = vc4_validate_shader_recs(dev, exec);
 
+	vc4->validate_stats.submits++;
+	vc4->validate_stats.validate_ns +=
+		ktime_to_ns(ktime_sub(ktime_get(), validate_start));
+
 fail:
 	kfree(temp);
 	return ret;
@@ -592,7 +642,8 @@ vc4_submit_cl_ioctl(struct drm_device *dev, void *data,
 	struct vc4_exec_info *exec;
 	int ret;
 
-	if ((args->flags & ~VC4_SUBMIT_CL_USE_CLEAR_COLOR) != 0) {
+	if ((args->flags & ~(VC4_SUBMIT_CL_USE_CLEAR_COLOR |
+			     VC4_SUBMIT_CL_FENCE_FD_OUT)) != 0) {
 		DRM_ERROR("Unknown flags: 0x%02x\n", args->flags);
 		return -EINVAL;
 	}
@@ -636,6 +687,18 @@ vc4_submit_cl_ioctl(struct drm_device *dev, void *data,
 
 	mutex_unlock(&dev->struct_mutex);
 
+	/* The job is already queued at this point.  The args are
+	 * copied back even on error, so if we can't make a fence the
+	 * caller can still wait on the returned seqno.
+	 */
+	args->fence_fd = -1;
+	if (args->flags & VC4_SUBMIT_CL_FENCE_FD_OUT) {
+		ret = vc4_fence_create_fd(dev, args->seqno);
+		if (ret < 0)
+			return ret;
+		args->fence_fd = ret;
+	}
+
 	return 0;
 
 fail:
@@ -651,7 +714,8 @@ vc4_gem_init(struct drm_device *dev)
 {
 	struct vc4_dev *vc4 = to_vc4_dev(dev);
 
-	INIT_LIST_HEAD(&vc4->job_list);
+	INIT_LIST_HEAD(&vc4->bin_job_list);
+	INIT_LIST_HEAD(&vc4->render_job_list);
 	INIT_LIST_HEAD(&vc4->job_done_list);
 	INIT_LIST_HEAD(&vc4->seqno_cb_list);
 	spin_lock_init(&vc4->job_lock);
@@ -664,6 +728,9 @@ vc4_gem_init(struct drm_device *dev)
 	INIT_WORK(&vc4->job_done_work, vc4_job_done_work);
 
 	vc4_bo_cache_init(dev);
+
+	if (vc4_fence_init(dev))
+		DRM_ERROR("Couldn't create fence timeline\n");
 }
 
 void
@@ -684,5 +751,34 @@ vc4_gem_destroy(struct drm_device *dev)
 		vc4->overflow_mem = NULL;
 	}
 
+	vc4_fence_fini(dev);
+
 	vc4_bo_cache_destroy(dev);
 }
+
+#ifdef CONFIG_DEBUG_FS
+int vc4_validate_stats_debugfs(struct seq_file *m, void *unused)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	uint64_t submits, validate_ns;
+
+	mutex_lock(&dev->struct_mutex);
+
+	submits = vc4->validate_stats.submits;
+	validate_ns = vc4->validate_stats.validate_ns;
+
+	seq_printf(m, "submits validated: %llu\n", submits);
+	seq_printf(m, "validation ns/submit: %llu\n",
+		   submits ? div64_u64(validate_ns, submits) : 0);
+	seq_printf(m, "shader cache hits: %llu\n",
+		   vc4->validate_stats.shader_cache_hits);
+	seq_printf(m, "shader cache misses: %llu\n",
+		   vc4->validate_stats.shader_cache_misses);
+
+	mutex_unlock(&dev->struct_mutex);
+
+	return 0;
+}
+#endif
@@ -44,6 +44,7 @@
 #include "vc4_regs.h"
 
 #define V3D_DRIVER_IRQS (V3D_INT_OUTOMEM | \
+			 V3D_INT_FLDONE | \
 			 V3D_INT_FRDONE)
 
 DECLARE_WAIT_QUEUE_HEAD(render_wait);
@@ -66,9 +67,11 @@ vc4_overflow_mem_work(struct work_struct *work)
 
 	/* If there's a job executing currently, then our previous
 	 * overflow allocation is getting used in that job and we need
-	 * to queue it to be released when the job is done.  But if no
-	 * job is executing at all, then we can free the old overflow
-	 * object direcctly.
+	 * to queue it to be released when the job is done.  The
+	 * current bin job is the newest one that can reference it; if
+	 * nothing is binning, the last job queued for rendering is.
+	 * But if no job is executing at all, then we can free the old
+	 * overflow object direcctly.
 	 *
 	 * No lock necessary for this pointer since we're the only
 	 * ones that update the pointer, and our workqueue won't
@@ -79,9 +82,11 @@ vc4_overflow_mem_work(struct work_struct *work)
 		unsigned long irqflags;
 
 		spin_lock_irqsave(&vc4->job_lock, irqflags);
-		current_exec = vc4_first_job(vc4);
+		current_exec = vc4_first_bin_job(vc4);
+		if (!current_exec)
+			current_exec = vc4_last_render_job(vc4);
 		if (current_exec) {
-			vc4->overflow_mem->seqno = vc4->finished_seqno + 1;
+			vc4->overflow_mem->seqno = current_exec->seqno;
 			list_add_tail(&vc4->overflow_mem->unref_head,
 				      &current_exec->unref_list);
 			vc4->overflow_mem = NULL;
@@ -101,22 +106,44 @@ vc4_overflow_mem_work(struct work_struct *work)
 }
 
 static void
-vc4_irq_finish_job(struct drm_device *dev)
+vc4_irq_finish_bin_job(struct drm_device *dev)
 {
 	struct vc4_dev *vc4 = to_vc4_dev(dev);
-	struct vc4_exec_info *exec = vc4_first_job(vc4);
+	struct vc4_exec_info *exec = vc4_first_bin_job(vc4);
 
 	if (!exec)
 		return;
 
+	vc4_move_job_to_render(dev, exec);
+	vc4_submit_next_bin_job(dev);
+}
+
+static void
+vc4_irq_retire_job(struct drm_device *dev, struct vc4_exec_info *exec)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+
 	vc4->finished_seqno++;
 	list_move_tail(&exec->head, &vc4->job_done_list);
-	vc4_submit_next_job(dev);
 
+	vc4_fence_signal(vc4);
 	wake_up_all(&vc4->job_wait_queue);
 	schedule_work(&vc4->job_done_work);
 }
 
+static void
+vc4_irq_finish_render_job(struct drm_device *dev)
+{
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
+	struct vc4_exec_info *exec = vc4_first_render_job(vc4);
+
+	if (!exec)
+		return;
+
+	vc4_irq_retire_job(dev, exec);
+	vc4_submit_next_render_job(dev);
+}
+
 irqreturn_t
 vc4_irq(int irq, void *arg)
 {
@@ -128,9 +155,10 @@ vc4_irq(int irq, void *arg)
 	barrier();
 	intctl = V3D_READ(V3D_INTCTL);
 
-	/* Acknowledge the interrupts we're handling here. The render
-	 * frame done interrupt will be cleared, while OUTOMEM will
-	 * stay high until the underlying cause is cleared.
+	/* Acknowledge the interrupts we're handling here. The binner
+	 * flush and render frame done interrupts will be cleared,
+	 * while OUTOMEM will stay high until the underlying cause is
+	 * cleared.
 	 */
 	V3D_WRITE(V3D_INTCTL, intctl);
 
@@ -141,9 +169,16 @@ vc4_irq(int irq, void *arg)
 		status = IRQ_HANDLED;
 	}
 
+	if (intctl & V3D_INT_FLDONE) {
+		spin_lock(&vc4->job_lock);
+		vc4_irq_finish_bin_job(dev);
+		spin_unlock(&vc4->job_lock);
+		status = IRQ_HANDLED;
+	}
+
 	if (intctl & V3D_INT_FRDONE) {
 		spin_lock(&vc4->job_lock);
-		vc4_irq_finish_job(dev);
+		vc4_irq_finish_render_job(dev);
 		spin_unlock(&vc4->job_lock);
 		status = IRQ_HANDLED;
 	}
@@ -170,7 +205,9 @@ vc4_irq_postinstall(struct drm_device *dev)
 {
 	struct vc4_dev *vc4 = to_vc4_dev(dev);
 
-	/* Enable both the render done and out of memory interrupts. */
+	/* Enable the bin flush, render done and out of memory
+	 * interrupts.
+	 */
 	V3D_WRITE(V3D_INTENA, V3D_DRIVER_IRQS);
 
 	return 0;
@@ -207,7 +244,19 @@ void vc4_irq_reset(struct drm_device *dev)
 	 */
 	V3D_WRITE(V3D_INTENA, V3D_DRIVER_IRQS);
 
+	/* Retire the oldest job, which is the one that stopped making
+	 * progress: the render job if there is one, otherwise the bin
+	 * job.  Then restart whatever is left from scratch.
+	 */
 	spin_lock_irqsave(&vc4->job_lock, irqflags);
-	vc4_irq_finish_job(dev);
+	if (vc4_first_render_job(vc4)) {
+		vc4_irq_finish_render_job(dev);
+	} else {
+		struct vc4_exec_info *exec = vc4_first_bin_job(vc4);
+
+		if (exec)
+			vc4_irq_retire_job(dev, exec);
+	}
+	vc4_submit_next_bin_job(dev);
 	spin_unlock_irqrestore(&vc4->job_lock, irqflags);
 }
@@ -119,6 +119,16 @@ vc4_use_bo(struct vc4_exec_info *exec,
 		}
 	}
 
+	/* The GPU must not write to or sample from a BO whose validated
+	 * shader is cached, or the cached result no longer describes it.
+	 */
+	if (mode != VC4_MODE_SHADER &&
+	    to_vc4_bo(&exec->bo[hindex].bo->base)->validated_shader) {
+		DRM_ERROR("Trying to use shader BO as something other than "
+			  "a shader\n");
+		return false;
+	}
+
 	*obj = exec->bo[hindex].bo;
 	return true;
 }
@@ -780,7 +790,9 @@ validate_shader_rec(struct drm_device *dev,
 	struct drm_gem_cma_object *bo[ARRAY_SIZE(gl_relocs) + 8];
 	uint32_t nr_attributes = 0, nr_fixed_relocs, nr_relocs, packet_size;
 	int i;
+	struct vc4_dev *vc4 = to_vc4_dev(dev);
 	struct vc4_validated_shader_info *validated_shader;
+	struct vc4_validated_shader_info *uncached_shader = NULL;
 
 	if (state->packet == VC4_PACKET_NV_SHADER_STATE) {
 		relocs = nv_relocs;
@@ -850,16 +862,27 @@ validate_shader_rec(struct drm_device *dev,
 		*(uint32_t *)(pkt_v + o) = bo[i]->paddr + src_offset;
 
 		switch (relocs[i].type) {
-		case RELOC_CODE:
+		case RELOC_CODE: {
+			struct vc4_bo *shader_bo = to_vc4_bo(&bo[i]->base);
+
 			if (src_offset != 0) {
 				DRM_ERROR("Shaders must be at offset 0 of "
 					  "the BO.\n");
 				goto fail;
 			}
 
-			validated_shader = vc4_validate_shader(bo[i]);
-			if (!validated_shader)
-				goto fail;
+			validated_shader = shader_bo->validated_shader;
+			if (validated_shader) {
+				vc4->validate_stats.shader_cache_hits++;
+			} else {
+				vc4->validate_stats.shader_cache_misses++;
+				validated_shader = vc4_validate_shader(bo[i]);
+				if (!validated_shader)
+					goto fail;
+				if (validated_shader !=
+				    shader_bo->validated_shader)
+					uncached_shader = validated_shader;
+			}
 
 			if (validated_shader->uniforms_src_size >
 			    exec->uniforms_size) {
@@ -891,7 +914,10 @@ validate_shader_rec(struct drm_device *dev,
 			exec->uniforms_v += validated_shader->uniforms_size;
 			exec->uniforms_p += validated_shader->uniforms_size;
 
+			vc4_free_validated_shader(uncached_shader);
+			uncached_shader = NULL;
 			break;
+		}
 
 		case RELOC_VBO:
 			break;
@@ -932,6 +958,7 @@ validate_shader_rec(struct drm_device *dev,
 	return 0;
 
 fail:
+	vc4_free_validated_shader(uncached_shader);
 	return -EINVAL;
 }
 
@@ -528,10 +528,27 @@ vc4_validate_shader(struct drm_gem_cma_object *shader_obj)
 		(validated_shader->uniforms_size +
 		 4 * validated_shader->num_texture_samples);
 
-	shader_bo->validated_shader = validated_shader;
+	/* If userspace still has the BO mapped, or shares it through a
+	 * dmabuf, it could rewrite the shader after we've validated it,
+	 * so only cache the result for private, unmapped BOs and leave
+	 * the caller to free it otherwise.
+	 */
+	if (atomic_read(&shader_bo->mmap_count) == 0 &&
+	    !shader_bo->dma_buf_import_export)
+		shader_bo->validated_shader = validated_shader;
 	return validated_shader;
 
 fail:
-	kfree(validated_shader);
+	vc4_free_validated_shader(validated_shader);
 	return NULL;
 }
+
+void
+vc4_free_validated_shader(struct vc4_validated_shader_info *validated_shader)
+{
+	if (!validated_shader)
+		return;
+
+	kfree(validated_shader->texture_samples);
+	kfree(validated_shader);
+}
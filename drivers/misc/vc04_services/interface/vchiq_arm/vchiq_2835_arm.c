@@ -39,6 +39,9 @@
 #include <linux/dma-mapping.h>
 #include <linux/version.h>
 #include <linux/io.h>
+#include <linux/mmu_notifier.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
 #include <linux/platform_data/mailbox-bcm2708.h>
 #include <linux/platform_device.h>
 #include <linux/uaccess.h>
@@ -55,6 +58,9 @@
 
 #define MAX_FRAGMENTS (VCHIQ_NUM_CURRENT_BULKS * 2)
 
+/* Pinned pagelists kept per process for reuse by later bulk transfers */
+#define MAX_CACHED_PAGELISTS 8
+
 #define BELL0	0x00
 #define BELL2	0x08
 
@@ -63,6 +69,28 @@ typedef struct vchiq_2835_state_struct {
    VCHIQ_ARM_STATE_T arm_state;
 } VCHIQ_2835_ARM_STATE_T;
 
+/* A process's cached pagelists. The pages stay pinned while cached, so the
+** MMU notifier drops any entry whose mapping changes under it. */
+struct pagelist_cache {
+	struct mmu_notifier mn;
+	struct mm_struct *mm;
+	struct list_head list;
+	struct list_head entries;	/* most recently used first */
+	int num_entries;
+	int dead;
+	unsigned int invalidate_seq;
+	struct work_struct release_work;
+};
+
+struct pagelist_cache_entry {
+	struct list_head list;	/* empty once evicted or invalidated */
+	char __user *buf;
+	size_t count;
+	unsigned short type;
+	int in_use;
+	PAGELIST_T *pagelist;
+};
+
 static void __iomem *g_regs;
 static FRAGMENTS_T *g_fragments_base;
 static FRAGMENTS_T *g_free_fragments;
@@ -73,6 +101,16 @@ extern int vchiq_arm_log_level;
 
 static DEFINE_SEMAPHORE(g_free_fragments_mutex);
 
+static LIST_HEAD(g_pagelist_caches);
+static DEFINE_SPINLOCK(g_pagelist_cache_lock);
+static DEFINE_MUTEX(g_pagelist_cache_mutex);
+
+static atomic64_t g_pagelist_cache_hits;
+static atomic64_t g_pagelist_cache_misses;
+static atomic64_t g_pagelist_cache_invalidations;
+static atomic64_t g_bulk_zero_copy_bytes;
+static atomic64_t g_bulk_fragment_bytes;
+
 static irqreturn_t
 vchiq_doorbell_irq(int irq, void *dev_id);
 
@@ -83,6 +121,9 @@ create_pagelist(char __user *buf, size_t count, unsigned short type,
 static void
 free_pagelist(PAGELIST_T *pagelist, int actual);
 
+static void
+pagelist_cache_exit(void);
+
 int vchiq_platform_init(struct platform_device *pdev, VCHIQ_STATE_T *state)
 {
 	struct device *dev = &pdev->dev;
@@ -271,6 +312,23 @@ vchiq_dump_platform_state(void *dump_context)
 	vchiq_dump(dump_context, buf, len + 1);
 }
 
+void
+vchiq_platform_exit(VCHIQ_STATE_T *state)
+{
+	pagelist_cache_exit();
+}
+
+void
+vchiq_platform_get_bulk_stats(VCHIQ_PLATFORM_BULK_STATS_T *stats)
+{
+	stats->pagelist_cache_hits = atomic64_read(&g_pagelist_cache_hits);
+	stats->pagelist_cache_misses = atomic64_read(&g_pagelist_cache_misses);
+	stats->pagelist_cache_invalidations =
+		atomic64_read(&g_pagelist_cache_invalidations);
+	stats->zero_copy_bytes = atomic64_read(&g_bulk_zero_copy_bytes);
+	stats->fragment_bytes = atomic64_read(&g_bulk_fragment_bytes);
+}
+
 VCHIQ_STATUS_T
 vchiq_platform_suspend(VCHIQ_STATE_T *state)
 {
@@ -336,6 +394,329 @@ vchiq_doorbell_irq(int irq, void *dev_id)
 	return ret;
 }
 
+/*
+ * Pagelist cache
+ *
+ * Video and camera clients tend to cycle through the same few buffers, so
+ * rather than pinning the pages and rebuilding the pagelist for every bulk
+ * transfer, recently used pagelists are kept with their pages pinned and
+ * matched on (address, size, direction). Any change to the mapping of a
+ * cached range - munmap, mremap, COW, migration, exit - is reported through
+ * the MMU notifier, and the affected entries are dropped (or, if a transfer
+ * is in flight, released when it completes).
+ */
+
+static void
+release_pagelist_pages(PAGELIST_T *pagelist)
+{
+	unsigned long *need_release;
+	struct page **pages;
+	unsigned int num_pages, i;
+
+	num_pages =
+		(pagelist->length + pagelist->offset + PAGE_SIZE - 1) /
+		PAGE_SIZE;
+
+	need_release = (unsigned long *)(pagelist->addrs + num_pages);
+	pages = (struct page **)(pagelist->addrs + num_pages + 2);
+
+	if (*need_release) {
+		for (i = 0; i < num_pages; i++)
+			page_cache_release(pages[i]);
+	}
+
+	kfree(pagelist);
+}
+
+static void
+pagelist_cache_free_entries(struct list_head *dead)
+{
+	struct pagelist_cache_entry *entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, dead, list) {
+		release_pagelist_pages(entry->pagelist);
+		kfree(entry);
+	}
+}
+
+/* Called with g_pagelist_cache_lock held */
+static void
+pagelist_cache_remove(struct pagelist_cache *cache,
+	struct pagelist_cache_entry *entry, struct list_head *dead)
+{
+	cache->num_entries--;
+	if (entry->in_use)
+		list_del_init(&entry->list);
+	else
+		list_move(&entry->list, dead);
+}
+
+static void
+pagelist_cache_invalidate(struct pagelist_cache *cache,
+	unsigned long start, unsigned long end)
+{
+	struct pagelist_cache_entry *entry, *tmp;
+	LIST_HEAD(dead);
+
+	spin_lock(&g_pagelist_cache_lock);
+	cache->invalidate_seq++;
+	list_for_each_entry_safe(entry, tmp, &cache->entries, list) {
+		unsigned long first = (unsigned long)entry->buf & PAGE_MASK;
+		unsigned long last = PAGE_ALIGN((unsigned long)entry->buf +
+			entry->count);
+
+		if (first < end && start < last) {
+			pagelist_cache_remove(cache, entry, &dead);
+			atomic64_inc(&g_pagelist_cache_invalidations);
+		}
+	}
+	spin_unlock(&g_pagelist_cache_lock);
+
+	pagelist_cache_free_entries(&dead);
+}
+
+static void
+pagelist_cache_invalidate_page(struct mmu_notifier *mn,
+	struct mm_struct *mm, unsigned long address)
+{
+	struct pagelist_cache *cache =
+		container_of(mn, struct pagelist_cache, mn);
+
+	pagelist_cache_invalidate(cache, address, address + PAGE_SIZE);
+}
+
+static void
+pagelist_cache_invalidate_range_start(struct mmu_notifier *mn,
+	struct mm_struct *mm, unsigned long start, unsigned long end)
+{
+	struct pagelist_cache *cache =
+		container_of(mn, struct pagelist_cache, mn);
+
+	pagelist_cache_invalidate(cache, start, end);
+}
+
+static void
+pagelist_cache_release_work(struct work_struct *work)
+{
+	struct pagelist_cache *cache =
+		container_of(work, struct pagelist_cache, release_work);
+
+	/* Can't be done from the release callback itself */
+	mmu_notifier_unregister(&cache->mn, cache->mm);
+	kfree(cache);
+}
+
+static void
+pagelist_cache_release(struct mmu_notifier *mn, struct mm_struct *mm)
+{
+	struct pagelist_cache *cache =
+		container_of(mn, struct pagelist_cache, mn);
+	int dead;
+
+	pagelist_cache_invalidate(cache, 0, ULONG_MAX);
+
+	spin_lock(&g_pagelist_cache_lock);
+	dead = cache->dead;
+	if (!dead) {
+		cache->dead = 1;
+		list_del(&cache->list);
+	}
+	spin_unlock(&g_pagelist_cache_lock);
+
+	if (!dead)
+		schedule_work(&cache->release_work);
+}
+
+static const struct mmu_notifier_ops pagelist_cache_mmu_notifier_ops = {
+	.release = pagelist_cache_release,
+	.invalidate_page = pagelist_cache_invalidate_page,
+	.invalidate_range_start = pagelist_cache_invalidate_range_start,
+};
+
+static struct pagelist_cache *
+pagelist_cache_find(struct mm_struct *mm)
+{
+	struct pagelist_cache *cache;
+
+	list_for_each_entry(cache, &g_pagelist_caches, list) {
+		if (cache->mm == mm)
+			return cache;
+	}
+
+	return NULL;
+}
+
+/* Called in the context of the process that owns mm */
+static struct pagelist_cache *
+pagelist_cache_get(struct mm_struct *mm)
+{
+	struct pagelist_cache *cache;
+
+	spin_lock(&g_pagelist_cache_lock);
+	cache = pagelist_cache_find(mm);
+	spin_unlock(&g_pagelist_cache_lock);
+	if (cache)
+		return cache;
+
+	mutex_lock(&g_pagelist_cache_mutex);
+
+	spin_lock(&g_pagelist_cache_lock);
+	cache = pagelist_cache_find(mm);
+	spin_unlock(&g_pagelist_cache_lock);
+	if (cache)
+		goto unlock;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		goto unlock;
+
+	cache->mn.ops = &pagelist_cache_mmu_notifier_ops;
+	cache->mm = mm;
+	INIT_LIST_HEAD(&cache->entries);
+	INIT_WORK(&cache->release_work, pagelist_cache_release_work);
+
+	if (mmu_notifier_register(&cache->mn, mm) != 0) {
+		kfree(cache);
+		cache = NULL;
+		goto unlock;
+	}
+
+	spin_lock(&g_pagelist_cache_lock);
+	list_add(&cache->list, &g_pagelist_caches);
+	spin_unlock(&g_pagelist_cache_lock);
+
+unlock:
+	mutex_unlock(&g_pagelist_cache_mutex);
+	return cache;
+}
+
+/* On a miss, *pseq receives the sequence number to pass to
+** pagelist_cache_insert() once the new pagelist has been built. */
+static PAGELIST_T *
+pagelist_cache_lookup(struct pagelist_cache *cache, char __user *buf,
+	size_t count, unsigned short type, unsigned int *pseq)
+{
+	struct pagelist_cache_entry *entry;
+	PAGELIST_T *pagelist = NULL;
+
+	spin_lock(&g_pagelist_cache_lock);
+	list_for_each_entry(entry, &cache->entries, list) {
+		if ((entry->buf == buf) && (entry->count == count) &&
+			(entry->type == type) && !entry->in_use) {
+			entry->in_use = 1;
+			list_move(&entry->list, &cache->entries);
+			pagelist = entry->pagelist;
+			break;
+		}
+	}
+	*pseq = cache->invalidate_seq;
+	spin_unlock(&g_pagelist_cache_lock);
+
+	if (pagelist)
+		atomic64_inc(&g_pagelist_cache_hits);
+	else
+		atomic64_inc(&g_pagelist_cache_misses);
+
+	return pagelist;
+}
+
+static struct pagelist_cache_entry *
+pagelist_cache_insert(struct pagelist_cache *cache, char __user *buf,
+	size_t count, unsigned short type, PAGELIST_T *pagelist,
+	unsigned int seq)
+{
+	struct pagelist_cache_entry *entry, *victim;
+	LIST_HEAD(dead);
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return NULL;
+
+	entry->buf = buf;
+	entry->count = count;
+	entry->type = type;
+	entry->in_use = 1;
+	entry->pagelist = pagelist;
+
+	spin_lock(&g_pagelist_cache_lock);
+
+	/* The pages may have been remapped while they were being pinned */
+	if (cache->dead || (cache->invalidate_seq != seq))
+		goto fail;
+
+	if (cache->num_entries >= MAX_CACHED_PAGELISTS) {
+		victim = NULL;
+		list_for_each_entry_reverse(victim, &cache->entries, list) {
+			if (!victim->in_use)
+				break;
+		}
+		if (&victim->list == &cache->entries)
+			goto fail;
+		pagelist_cache_remove(cache, victim, &dead);
+	}
+
+	list_add(&entry->list, &cache->entries);
+	cache->num_entries++;
+	spin_unlock(&g_pagelist_cache_lock);
+
+	pagelist_cache_free_entries(&dead);
+
+	return entry;
+
+fail:
+	spin_unlock(&g_pagelist_cache_lock);
+	kfree(entry);
+	return NULL;
+}
+
+/* Returns non-zero if the pagelist is still cached, and must not be freed */
+static int
+pagelist_cache_put(struct pagelist_cache_entry *entry)
+{
+	int cached;
+
+	spin_lock(&g_pagelist_cache_lock);
+	entry->in_use = 0;
+	cached = !list_empty(&entry->list);
+	spin_unlock(&g_pagelist_cache_lock);
+
+	if (!cached)
+		kfree(entry);
+
+	return cached;
+}
+
+/* Drop every cached pagelist, so that no notifiers are left pointing into
+** the module once it has been unloaded. */
+static void
+pagelist_cache_exit(void)
+{
+	struct pagelist_cache *cache;
+
+	mutex_lock(&g_pagelist_cache_mutex);
+	for (;;) {
+		spin_lock(&g_pagelist_cache_lock);
+		cache = list_first_entry_or_null(&g_pagelist_caches,
+			struct pagelist_cache, list);
+		if (cache) {
+			cache->dead = 1;
+			list_del(&cache->list);
+		}
+		spin_unlock(&g_pagelist_cache_lock);
+
+		if (!cache)
+			break;
+
+		pagelist_cache_invalidate(cache, 0, ULONG_MAX);
+		mmu_notifier_unregister(&cache->mn, cache->mm);
+		kfree(cache);
+	}
+	mutex_unlock(&g_pagelist_cache_mutex);
+
+	/* Wait for any caches already being released by exiting processes */
+	flush_scheduled_work();
+}
+
 /* There is a potential problem with partial cache lines (pages?)
 ** at the ends of the block when reading. If the CPU accessed anything in
 ** the same line (page?) then it may have pulled old data into the cache,
@@ -361,18 +742,37 @@ create_pagelist(char __user *buf, size_t count, unsigned short type,
 	char *addr, *base_addr, *next_addr;
 	int run, addridx, actual_pages;
         unsigned long *need_release;
+	struct pagelist_cache_entry **cache_entry;
+	struct pagelist_cache *cache = NULL;
+	unsigned int seq = 0;
+	/* kernel callers (e.g. audio) may have no mm to pin pages in */
+	bool lowmem = virt_addr_valid(buf);
 
 	offset = (unsigned int)buf & (PAGE_SIZE - 1);
 	num_pages = (count + offset + PAGE_SIZE - 1) / PAGE_SIZE;
 
 	*ppagelist = NULL;
 
+	if (!is_vmalloc_addr(buf) && !lowmem) {
+		cache = pagelist_cache_get(task->mm);
+		if (cache) {
+			pagelist = pagelist_cache_lookup(cache, buf, count,
+				type, &seq);
+			if (pagelist) {
+				addrs = pagelist->addrs;
+				pagelist->type = type;
+				goto setup_fragments;
+			}
+		}
+	}
+
 	/* Allocate enough storage to hold the page pointers and the page
 	** list
 	*/
 	pagelist = kmalloc(sizeof(PAGELIST_T) +
                            (num_pages * sizeof(unsigned long)) +
                            sizeof(unsigned long) +
+                           sizeof(struct pagelist_cache_entry *) +
                            (num_pages * sizeof(pages[0])),
                            GFP_KERNEL);
 
@@ -383,13 +783,20 @@ create_pagelist(char __user *buf, size_t count, unsigned short type,
 
 	addrs = pagelist->addrs;
         need_release = (unsigned long *)(addrs + num_pages);
-	pages = (struct page **)(addrs + num_pages + 1);
+	cache_entry = (struct pagelist_cache_entry **)(addrs + num_pages + 1);
+	pages = (struct page **)(addrs + num_pages + 2);
+	*cache_entry = NULL;
 
 	if (is_vmalloc_addr(buf)) {
 		for (actual_pages = 0; actual_pages < num_pages; actual_pages++) {
 			pages[actual_pages] = vmalloc_to_page(buf + (actual_pages * PAGE_SIZE));
 		}
                 *need_release = 0; /* do not try and release vmalloc pages */
+	} else if (lowmem) {
+		for (actual_pages = 0; actual_pages < num_pages; actual_pages++)
+			pages[actual_pages] = virt_to_page(buf +
+						(actual_pages * PAGE_SIZE));
+		*need_release = 0; /* nor kernel pages */
 	} else {
 		down_read(&task->mm->mmap_sem);
 		actual_pages = get_user_pages(task, task->mm,
@@ -449,6 +856,11 @@ create_pagelist(char __user *buf, size_t count, unsigned short type,
 	addrs[addridx] = (unsigned long)base_addr + run;
 	addridx++;
 
+	if (cache)
+		*cache_entry = pagelist_cache_insert(cache, buf, count, type,
+			pagelist, seq);
+
+setup_fragments:
 	/* Partial cache lines (fragments) require special measures */
 	if ((type == PAGELIST_READ) &&
 		((pagelist->offset & (CACHE_LINE_SIZE - 1)) ||
@@ -457,7 +869,7 @@ create_pagelist(char __user *buf, size_t count, unsigned short type,
 		FRAGMENTS_T *fragments;
 
 		if (down_interruptible(&g_free_fragments_sema) != 0) {
-			kfree(pagelist);
+			free_pagelist(pagelist, -1);
 			return -EINTR;
 		}
 
@@ -487,8 +899,10 @@ static void
 free_pagelist(PAGELIST_T *pagelist, int actual)
 {
         unsigned long *need_release;
+	struct pagelist_cache_entry **cache_entry;
 	struct page **pages;
 	unsigned int num_pages, i;
+	int copied = 0;
 
 	vchiq_log_trace(vchiq_arm_log_level,
 		"free_pagelist - %x, %d", (unsigned int)pagelist, actual);
@@ -498,7 +912,9 @@ free_pagelist(PAGELIST_T *pagelist, int actual)
 		PAGE_SIZE;
 
         need_release = (unsigned long *)(pagelist->addrs + num_pages);
-	pages = (struct page **)(pagelist->addrs + num_pages + 1);
+	cache_entry = (struct pagelist_cache_entry **)
+		(pagelist->addrs + num_pages + 1);
+	pages = (struct page **)(pagelist->addrs + num_pages + 2);
 
 	/* Deal with any partial cache lines (fragments) */
 	if (pagelist->type >= PAGELIST_READ_WITH_FRAGMENTS) {
@@ -518,6 +934,7 @@ free_pagelist(PAGELIST_T *pagelist, int actual)
 				pagelist->offset,
 				fragments->headbuf,
 				head_bytes);
+			copied += head_bytes;
 		}
 		if ((actual >= 0) && (head_bytes < actual) &&
 			(tail_bytes != 0)) {
@@ -525,6 +942,7 @@ free_pagelist(PAGELIST_T *pagelist, int actual)
 				((pagelist->offset + actual) &
 				(PAGE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1)),
 				fragments->tailbuf, tail_bytes);
+			copied += tail_bytes;
 		}
 
 		down(&g_free_fragments_mutex);
@@ -534,14 +952,18 @@ free_pagelist(PAGELIST_T *pagelist, int actual)
 		up(&g_free_fragments_sema);
 	}
 
-        if (*need_release) {
-		for (i = 0; i < num_pages; i++) {
-			if (pagelist->type != PAGELIST_WRITE)
-				set_page_dirty(pages[i]);
+	if (actual > 0) {
+		atomic64_add(copied, &g_bulk_fragment_bytes);
+		atomic64_add(actual - copied, &g_bulk_zero_copy_bytes);
+	}
 
-			page_cache_release(pages[i]);
-		}
+        if (*need_release && (pagelist->type != PAGELIST_WRITE)) {
+		for (i = 0; i < num_pages; i++)
+			set_page_dirty(pages[i]);
         }
 
-	kfree(pagelist);
+	if (*cache_entry && pagelist_cache_put(*cache_entry))
+		return;
+
+	release_pagelist_pages(pagelist);
 }
@@ -185,7 +185,8 @@ static const char *const ioctl_names[] = {
 	"SET_SERVICE_OPTION",
 	"DUMP_PHYS_MEM",
 	"LIB_VERSION",
-	"CLOSE_DELIVERED"
+	"CLOSE_DELIVERED",
+	"DEQUEUE_MESSAGES"
 };
 
 vchiq_static_assert((sizeof(ioctl_names)/sizeof(ioctl_names[0])) ==
@@ -281,7 +282,10 @@ service_callback(VCHIQ_REASON_T reason, VCHIQ_HEADER_T *header,
 
 	DEBUG_TRACE(SERVICE_CALLBACK_LINE);
 
+	/* The caller holds a reference on the service */
+	rcu_read_lock();
 	service = handle_to_service(handle);
+	rcu_read_unlock();
 	BUG_ON(!service);
 	user_service = (USER_SERVICE_T *)service->base.userdata;
 	instance = user_service->instance;
@@ -987,6 +991,133 @@ vchiq_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		DEBUG_TRACE(DEQUEUE_MESSAGE_LINE);
 	} break;
 
+	case VCHIQ_IOC_DEQUEUE_MESSAGES: {
+		VCHIQ_DEQUEUE_MESSAGES_T args;
+		USER_SERVICE_T *user_service;
+		VCHIQ_HEADER_T *headers[MSG_QUEUE_SIZE];
+		unsigned int sizes[MSG_QUEUE_SIZE];
+		unsigned int offset = 0;
+		int count = 0;
+
+		DEBUG_TRACE(DEQUEUE_MESSAGE_LINE);
+		if (copy_from_user
+			 (&args, (const void __user *)arg,
+			  sizeof(args)) != 0) {
+			ret = -EFAULT;
+			break;
+		}
+		if ((args.count == 0) || (args.sizes == NULL)) {
+			ret = -EINVAL;
+			break;
+		}
+		if (args.count > MSG_QUEUE_SIZE)
+			args.count = MSG_QUEUE_SIZE;
+
+		service = find_service_for_instance(instance, args.handle);
+		if (!service) {
+			ret = -EINVAL;
+			break;
+		}
+		user_service = (USER_SERVICE_T *)service->base.userdata;
+		if (user_service->is_vchi == 0) {
+			ret = -EINVAL;
+			break;
+		}
+
+		spin_lock(&msg_queue_spinlock);
+		if (user_service->msg_remove == user_service->msg_insert) {
+			if (!args.blocking) {
+				spin_unlock(&msg_queue_spinlock);
+				DEBUG_TRACE(DEQUEUE_MESSAGE_LINE);
+				ret = -EWOULDBLOCK;
+				break;
+			}
+			user_service->dequeue_pending = 1;
+			do {
+				spin_unlock(&msg_queue_spinlock);
+				DEBUG_TRACE(DEQUEUE_MESSAGE_LINE);
+				if (down_interruptible(
+					&user_service->insert_event) != 0) {
+					vchiq_log_info(vchiq_arm_log_level,
+						"DEQUEUE_MESSAGES interrupted");
+					ret = -EINTR;
+					break;
+				}
+				spin_lock(&msg_queue_spinlock);
+			} while (user_service->msg_remove ==
+				user_service->msg_insert);
+
+			if (ret)
+				break;
+		}
+
+		BUG_ON((int)(user_service->msg_insert -
+			user_service->msg_remove) < 0);
+
+		/* Take as many messages as will fit, leaving the rest (and
+		** any close marker behind them) for the next call */
+		while ((count < args.count) &&
+			(user_service->msg_remove != user_service->msg_insert)) {
+			VCHIQ_HEADER_T *header =
+				user_service->msg_queue[user_service->msg_remove &
+					(MSG_QUEUE_SIZE - 1)];
+
+			if (header == NULL) {
+				if (count == 0) {
+					user_service->msg_remove++;
+					ret = -ENOTCONN;
+				}
+				break;
+			}
+			if ((offset > args.bufsize) ||
+				(header->size > args.bufsize - offset)) {
+				if (count == 0) {
+					vchiq_log_error(vchiq_arm_log_level,
+						"header %x: bufsize %x < size %x",
+						(unsigned int)header,
+						args.bufsize, header->size);
+					ret = -EMSGSIZE;
+				}
+				break;
+			}
+
+			headers[count] = header;
+			sizes[count] = header->size;
+			offset += ALIGN(header->size,
+				VCHIQ_DEQUEUE_MESSAGES_ALIGN);
+			count++;
+			user_service->msg_remove++;
+		}
+		spin_unlock(&msg_queue_spinlock);
+
+		if (ret == -ENOTCONN)
+			up(&user_service->remove_event);
+		if (ret)
+			break;
+
+		offset = 0;
+		for (i = 0; i < count; i++) {
+			up(&user_service->remove_event);
+			if ((ret == 0) && (args.buf != NULL) &&
+				(copy_to_user((void __user *)args.buf + offset,
+					headers[i]->data, sizes[i]) != 0))
+				ret = -EFAULT;
+			offset += ALIGN(sizes[i],
+				VCHIQ_DEQUEUE_MESSAGES_ALIGN);
+		}
+
+		if ((ret == 0) &&
+			(copy_to_user((void __user *)args.sizes, sizes,
+				count * sizeof(sizes[0])) != 0))
+			ret = -EFAULT;
+
+		vchiq_release_messages(service->handle, headers, count);
+
+		if (ret == 0)
+			ret = count;
+		DEBUG_TRACE(DEQUEUE_MESSAGE_LINE);
+	} break;
+
 	case VCHIQ_IOC_GET_CLIENT_ID: {
 		VCHIQ_SERVICE_HANDLE_T handle = (VCHIQ_SERVICE_HANDLE_T)arg;
 
@@ -1364,8 +1495,9 @@ vchiq_dump_platform_instances(void *dump_context)
 	/* There is no list of instances, so instead scan all services,
 		marking those that have been dumped. */
 
+	rcu_read_lock();
 	for (i = 0; i < state->unused_service; i++) {
-		VCHIQ_SERVICE_T *service = state->services[i];
+		VCHIQ_SERVICE_T *service = rcu_dereference(state->services[i]);
 		VCHIQ_INSTANCE_T instance;
 
 		if (service && (service->base.callback == service_callback)) {
@@ -1374,12 +1506,16 @@ vchiq_dump_platform_instances(void *dump_context)
 				instance->mark = 0;
 		}
 	}
+	rcu_read_unlock();
 
 	for (i = 0; i < state->unused_service; i++) {
-		VCHIQ_SERVICE_T *service = state->services[i];
+		VCHIQ_SERVICE_T *service = find_service_by_port(state, i);
 		VCHIQ_INSTANCE_T instance;
 
-		if (service && (service->base.callback == service_callback)) {
+		if (!service)
+			continue;
+
+		if (service->base.callback == service_callback) {
 			instance = service->instance;
 			if (instance && !instance->mark) {
 				len = snprintf(buf, sizeof(buf),
@@ -1397,6 +1533,8 @@ vchiq_dump_platform_instances(void *dump_context)
 				instance->mark = 1;
 			}
 		}
+
+		unlock_service(service);
 	}
 }
 
@@ -2040,8 +2178,10 @@ output_timeout_error(VCHIQ_STATE_T *state)
 		snprintf(service_err, 50, " Videocore usecount is 0");
 		goto output_msg;
 	}
+	rcu_read_lock();
 	for (i = 0; i < active_services; i++) {
-		VCHIQ_SERVICE_T *service_ptr = state->services[i];
+		VCHIQ_SERVICE_T *service_ptr =
+			rcu_dereference(state->services[i]);
 		if (service_ptr && service_ptr->service_use_count &&
 			(service_ptr->srvstate != VCHIQ_SRVSTATE_FREE)) {
 			snprintf(service_err, 50, " %c%c%c%c(%d) service has "
@@ -2054,6 +2194,7 @@ output_timeout_error(VCHIQ_STATE_T *state)
 			break;
 		}
 	}
+	rcu_read_unlock();
 
 output_msg:
 	vchiq_log_error(vchiq_susp_log_level,
@@ -2675,8 +2816,10 @@ vchiq_dump_service_use_state(VCHIQ_STATE_T *state)
 	if (active_services > local_max_services)
 		only_nonzero = 1;
 
+	rcu_read_lock();
 	for (i = 0; (i < active_services) && (j < local_max_services); i++) {
-		VCHIQ_SERVICE_T *service_ptr = state->services[i];
+		VCHIQ_SERVICE_T *service_ptr =
+			rcu_dereference(state->services[i]);
 		if (!service_ptr)
 			continue;
 
@@ -2690,6 +2833,7 @@ vchiq_dump_service_use_state(VCHIQ_STATE_T *state)
 							service_use_count;
 		}
 	}
+	rcu_read_unlock();
 
 	read_unlock_bh(&arm_state->susp_res_lock);
 
@@ -2857,6 +3001,7 @@ failed_debugfs_init:
 
 static int vchiq_remove(struct platform_device *pdev)
 {
+	vchiq_platform_exit(&g_state);
 	device_destroy(vchiq_class, vchiq_devid);
 	class_destroy(vchiq_class);
 	cdev_del(&vchiq_cdev);
@@ -2880,7 +3025,40 @@ static struct platform_driver vchiq_driver = {
 	.probe = vchiq_probe,
 	.remove = vchiq_remove,
 };
+
+#ifdef CONFIG_BCM2708_VCHIQ_LOOPBACK
+/* There is no VideoCore to describe in the device tree, so instantiate the
+ * device here and let vchiq_loopback.c emulate the other side. */
+static struct platform_device *vchiq_loopback_pdev;
+
+static int __init vchiq_driver_init(void)
+{
+	int err;
+
+	err = platform_driver_register(&vchiq_driver);
+	if (err)
+		return err;
+
+	vchiq_loopback_pdev = platform_device_register_simple(
+		vchiq_driver.driver.name, -1, NULL, 0);
+	if (IS_ERR(vchiq_loopback_pdev)) {
+		platform_driver_unregister(&vchiq_driver);
+		return PTR_ERR(vchiq_loopback_pdev);
+	}
+
+	return 0;
+}
+module_init(vchiq_driver_init);
+
+static void __exit vchiq_driver_exit(void)
+{
+	platform_device_unregister(vchiq_loopback_pdev);
+	platform_driver_unregister(&vchiq_driver);
+}
+module_exit(vchiq_driver_exit);
+#else
 module_platform_driver(vchiq_driver);
+#endif
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Broadcom Corporation");
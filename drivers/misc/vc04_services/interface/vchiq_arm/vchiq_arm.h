@@ -126,11 +126,23 @@ typedef struct vchiq_arm_state_struct {
 
 } VCHIQ_ARM_STATE_T;
 
+typedef struct vchiq_platform_bulk_stats_struct {
+	uint64_t pagelist_cache_hits;
+	uint64_t pagelist_cache_misses;
+	uint64_t pagelist_cache_invalidations;
+	/* bytes transferred directly to/from the user pages */
+	uint64_t zero_copy_bytes;
+	/* bytes copied through the partial cache line fragments */
+	uint64_t fragment_bytes;
+} VCHIQ_PLATFORM_BULK_STATS_T;
+
 extern int vchiq_arm_log_level;
 extern int vchiq_susp_log_level;
 
 int vchiq_platform_init(struct platform_device *pdev, VCHIQ_STATE_T *state);
 
+void vchiq_platform_exit(VCHIQ_STATE_T *state);
+
 extern VCHIQ_STATE_T *
 vchiq_get_state(void);
 
@@ -181,6 +193,9 @@ vchiq_dump_service_use_state(VCHIQ_STATE_T *state);
 extern VCHIQ_ARM_STATE_T*
 vchiq_platform_get_arm_state(VCHIQ_STATE_T *state);
 
+extern void
+vchiq_platform_get_bulk_stats(VCHIQ_PLATFORM_BULK_STATS_T *stats);
+
 extern int
 vchiq_videocore_wanted(VCHIQ_STATE_T *state);
 
@@ -88,7 +88,6 @@ int vchiq_sync_log_level = VCHIQ_LOG_DEFAULT;
 
 static atomic_t pause_bulks_count = ATOMIC_INIT(0);
 
-static DEFINE_SPINLOCK(service_spinlock);
 DEFINE_SPINLOCK(bulk_waiter_spinlock);
 DEFINE_SPINLOCK(quota_spinlock);
 
@@ -171,15 +170,13 @@ find_service_by_handle(VCHIQ_SERVICE_HANDLE_T handle)
 {
 	VCHIQ_SERVICE_T *service;
 
-	spin_lock(&service_spinlock);
+	rcu_read_lock();
 	service = handle_to_service(handle);
-	if (service && (service->srvstate != VCHIQ_SRVSTATE_FREE) &&
-		(service->handle == handle)) {
-		BUG_ON(service->ref_count == 0);
-		service->ref_count++;
-	} else
+	if (service && ((service->srvstate == VCHIQ_SRVSTATE_FREE) ||
+		(service->handle != handle) ||
+		!kref_get_unless_zero(&service->ref_count)))
 		service = NULL;
-	spin_unlock(&service_spinlock);
+	rcu_read_unlock();
 
 	if (!service)
 		vchiq_log_info(vchiq_core_log_level,
@@ -193,14 +190,12 @@ find_service_by_port(VCHIQ_STATE_T *state, int localport)
 {
 	VCHIQ_SERVICE_T *service = NULL;
 	if ((unsigned int)localport <= VCHIQ_PORT_MAX) {
-		spin_lock(&service_spinlock);
-		service = state->services[localport];
-		if (service && (service->srvstate != VCHIQ_SRVSTATE_FREE)) {
-			BUG_ON(service->ref_count == 0);
-			service->ref_count++;
-		} else
+		rcu_read_lock();
+		service = rcu_dereference(state->services[localport]);
+		if (service && ((service->srvstate == VCHIQ_SRVSTATE_FREE) ||
+			!kref_get_unless_zero(&service->ref_count)))
 			service = NULL;
-		spin_unlock(&service_spinlock);
+		rcu_read_unlock();
 	}
 
 	if (!service)
@@ -215,16 +210,14 @@ find_service_for_instance(VCHIQ_INSTANCE_T instance,
 	VCHIQ_SERVICE_HANDLE_T handle) {
 	VCHIQ_SERVICE_T *service;
 
-	spin_lock(&service_spinlock);
+	rcu_read_lock();
 	service = handle_to_service(handle);
-	if (service && (service->srvstate != VCHIQ_SRVSTATE_FREE) &&
-		(service->handle == handle) &&
-		(service->instance == instance)) {
-		BUG_ON(service->ref_count == 0);
-		service->ref_count++;
-	} else
+	if (service && ((service->srvstate == VCHIQ_SRVSTATE_FREE) ||
+		(service->handle != handle) ||
+		(service->instance != instance) ||
+		!kref_get_unless_zero(&service->ref_count)))
 		service = NULL;
-	spin_unlock(&service_spinlock);
+	rcu_read_unlock();
 
 	if (!service)
 		vchiq_log_info(vchiq_core_log_level,
@@ -238,18 +231,16 @@ find_closed_service_for_instance(VCHIQ_INSTANCE_T instance,
 	VCHIQ_SERVICE_HANDLE_T handle) {
 	VCHIQ_SERVICE_T *service;
 
-	spin_lock(&service_spinlock);
+	rcu_read_lock();
 	service = handle_to_service(handle);
 	if (service &&
-		((service->srvstate == VCHIQ_SRVSTATE_FREE) ||
-		 (service->srvstate == VCHIQ_SRVSTATE_CLOSED)) &&
-		(service->handle == handle) &&
-		(service->instance == instance)) {
-		BUG_ON(service->ref_count == 0);
-		service->ref_count++;
-	} else
+		(((service->srvstate != VCHIQ_SRVSTATE_FREE) &&
+		  (service->srvstate != VCHIQ_SRVSTATE_CLOSED)) ||
+		(service->handle != handle) ||
+		(service->instance != instance) ||
+		!kref_get_unless_zero(&service->ref_count)))
 		service = NULL;
-	spin_unlock(&service_spinlock);
+	rcu_read_unlock();
 
 	if (!service)
 		vchiq_log_info(vchiq_core_log_level,
@@ -265,18 +256,17 @@ next_service_by_instance(VCHIQ_STATE_T *state, VCHIQ_INSTANCE_T instance,
 	VCHIQ_SERVICE_T *service = NULL;
 	int idx = *pidx;
 
-	spin_lock(&service_spinlock);
+	rcu_read_lock();
 	while (idx < state->unused_service) {
-		VCHIQ_SERVICE_T *srv = state->services[idx++];
+		VCHIQ_SERVICE_T *srv = rcu_dereference(state->services[idx++]);
 		if (srv && (srv->srvstate != VCHIQ_SRVSTATE_FREE) &&
-			(srv->instance == instance)) {
+			(srv->instance == instance) &&
+			kref_get_unless_zero(&srv->ref_count)) {
 			service = srv;
-			BUG_ON(service->ref_count == 0);
-			service->ref_count++;
 			break;
 		}
 	}
-	spin_unlock(&service_spinlock);
+	rcu_read_unlock();
 
 	*pidx = idx;
 
@@ -286,33 +276,32 @@ next_service_by_instance(VCHIQ_STATE_T *state, VCHIQ_INSTANCE_T instance,
 void
 lock_service(VCHIQ_SERVICE_T *service)
 {
-	spin_lock(&service_spinlock);
-	BUG_ON(!service || (service->ref_count == 0));
-	if (service)
-		service->ref_count++;
-	spin_unlock(&service_spinlock);
+	BUG_ON(!service);
+	kref_get(&service->ref_count);
 }
 
-void
-unlock_service(VCHIQ_SERVICE_T *service)
+static void
+service_release(struct kref *kref)
 {
+	VCHIQ_SERVICE_T *service =
+		container_of(kref, VCHIQ_SERVICE_T, ref_count);
 	VCHIQ_STATE_T *state = service->state;
-	spin_lock(&service_spinlock);
-	BUG_ON(!service || (service->ref_count == 0));
-	if (service && service->ref_count) {
-		service->ref_count--;
-		if (!service->ref_count) {
-			BUG_ON(service->srvstate != VCHIQ_SRVSTATE_FREE);
-			state->services[service->localport] = NULL;
-		} else
-			service = NULL;
-	}
-	spin_unlock(&service_spinlock);
 
-	if (service && service->userdata_term)
+	BUG_ON(service->srvstate != VCHIQ_SRVSTATE_FREE);
+	RCU_INIT_POINTER(state->services[service->localport], NULL);
+
+	if (service->userdata_term)
 		service->userdata_term(service->base.userdata);
 
-	kfree(service);
+	/* Lookups may still be looking at the service */
+	kfree_rcu(service, rcu);
+}
+
+void
+unlock_service(VCHIQ_SERVICE_T *service)
+{
+	BUG_ON(!service);
+	kref_put(&service->ref_count, service_release);
 }
 
 int
@@ -331,17 +320,29 @@ vchiq_get_client_id(VCHIQ_SERVICE_HANDLE_T handle)
 void *
 vchiq_get_service_userdata(VCHIQ_SERVICE_HANDLE_T handle)
 {
-	VCHIQ_SERVICE_T *service = handle_to_service(handle);
+	VCHIQ_SERVICE_T *service;
+	void *userdata;
+
+	rcu_read_lock();
+	service = handle_to_service(handle);
+	userdata = service ? service->base.userdata : NULL;
+	rcu_read_unlock();
 
-	return service ? service->base.userdata : NULL;
+	return userdata;
 }
 
 int
 vchiq_get_service_fourcc(VCHIQ_SERVICE_HANDLE_T handle)
 {
-	VCHIQ_SERVICE_T *service = handle_to_service(handle);
+	VCHIQ_SERVICE_T *service;
+	int fourcc;
 
-	return service ? service->base.fourcc : 0;
+	rcu_read_lock();
+	service = handle_to_service(handle);
+	fourcc = service ? service->base.fourcc : 0;
+	rcu_read_unlock();
+
+	return fourcc;
 }
 
 static void
@@ -486,17 +487,20 @@ get_listening_service(VCHIQ_STATE_T *state, int fourcc)
 
 	WARN_ON(fourcc == VCHIQ_FOURCC_INVALID);
 
+	rcu_read_lock();
 	for (i = 0; i < state->unused_service; i++) {
-		VCHIQ_SERVICE_T *service = state->services[i];
+		VCHIQ_SERVICE_T *service = rcu_dereference(state->services[i]);
 		if (service &&
 			(service->public_fourcc == fourcc) &&
 			((service->srvstate == VCHIQ_SRVSTATE_LISTENING) ||
 			((service->srvstate == VCHIQ_SRVSTATE_OPEN) &&
-			(service->remoteport == VCHIQ_PORT_FREE)))) {
-			lock_service(service);
+			(service->remoteport == VCHIQ_PORT_FREE))) &&
+			kref_get_unless_zero(&service->ref_count)) {
+			rcu_read_unlock();
 			return service;
 		}
 	}
+	rcu_read_unlock();
 
 	return NULL;
 }
@@ -506,14 +510,17 @@ static VCHIQ_SERVICE_T *
 get_connected_service(VCHIQ_STATE_T *state, unsigned int port)
 {
 	int i;
+	rcu_read_lock();
 	for (i = 0; i < state->unused_service; i++) {
-		VCHIQ_SERVICE_T *service = state->services[i];
+		VCHIQ_SERVICE_T *service = rcu_dereference(state->services[i]);
 		if (service && (service->srvstate == VCHIQ_SRVSTATE_OPEN)
-			&& (service->remoteport == port)) {
-			lock_service(service);
+			&& (service->remoteport == port) &&
+			kref_get_unless_zero(&service->ref_count)) {
+			rcu_read_unlock();
 			return service;
 		}
 	}
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -1103,21 +1110,18 @@ claim_slot(VCHIQ_SLOT_INFO_T *slot)
 	slot->use_count++;
 }
 
+/* Called with the recycle_mutex held */
 static void
-release_slot(VCHIQ_STATE_T *state, VCHIQ_SLOT_INFO_T *slot_info,
+release_slot_locked(VCHIQ_STATE_T *state, VCHIQ_SLOT_INFO_T *slot_info,
 	VCHIQ_HEADER_T *header, VCHIQ_SERVICE_T *service)
 {
 	int release_count;
 
-	mutex_lock(&state->recycle_mutex);
-
 	if (header) {
 		int msgid = header->msgid;
 		if (((msgid & VCHIQ_MSGID_CLAIMED) == 0) ||
-			(service && service->closing)) {
-			mutex_unlock(&state->recycle_mutex);
+			(service && service->closing))
 			return;
-		}
 
 		/* Rewrite the message header to prevent a double
 		** release */
@@ -1150,7 +1154,14 @@ release_slot(VCHIQ_STATE_T *state, VCHIQ_SLOT_INFO_T *slot_info,
 		** contains one. */
 		remote_event_signal(&state->remote->recycle);
 	}
+}
 
+static void
+release_slot(VCHIQ_STATE_T *state, VCHIQ_SLOT_INFO_T *slot_info,
+	VCHIQ_HEADER_T *header, VCHIQ_SERVICE_T *service)
+{
+	mutex_lock(&state->recycle_mutex);
+	release_slot_locked(state, slot_info, header, service);
 	mutex_unlock(&state->recycle_mutex);
 }
 
@@ -1473,10 +1484,17 @@ resume_bulks(VCHIQ_STATE_T *state)
 		__func__, state->deferred_bulks);
 
 	for (i = 0; i < state->unused_service; i++) {
-		VCHIQ_SERVICE_T *service = state->services[i];
+		VCHIQ_SERVICE_T *service;
 		int resolved_rx = 0;
 		int resolved_tx = 0;
-		if (!service || (service->srvstate != VCHIQ_SRVSTATE_OPEN))
+
+		rcu_read_lock();
+		service = rcu_dereference(state->services[i]);
+		if (service && ((service->srvstate != VCHIQ_SRVSTATE_OPEN) ||
+			!kref_get_unless_zero(&service->ref_count)))
+			service = NULL;
+		rcu_read_unlock();
+		if (!service)
 			continue;
 
 		mutex_lock(&service->bulk_mutex);
@@ -1487,6 +1505,7 @@ resume_bulks(VCHIQ_STATE_T *state)
 			notify_bulks(service, &service->bulk_rx, 1);
 		if (resolved_tx)
 			notify_bulks(service, &service->bulk_tx, 1);
+		unlock_service(service);
 	}
 	state->deferred_bulks = 0;
 }
@@ -2552,7 +2571,7 @@ vchiq_add_service_internal(VCHIQ_STATE_T *state,
 		service->base.callback = params->callback;
 		service->base.userdata = params->userdata;
 		service->handle        = VCHIQ_SERVICE_HANDLE_INVALID;
-		service->ref_count     = 1;
+		kref_init(&service->ref_count);
 		service->srvstate      = VCHIQ_SRVSTATE_FREE;
 		service->userdata_term = userdata_term;
 		service->localport     = VCHIQ_PORT_FREE;
@@ -2583,17 +2602,14 @@ vchiq_add_service_internal(VCHIQ_STATE_T *state,
 	}
 
 	if (service) {
-		VCHIQ_SERVICE_T **pservice = NULL;
+		VCHIQ_SERVICE_T __rcu **pservice = NULL;
 		int i;
 
-		/* Although it is perfectly possible to use service_spinlock
-		** to protect the creation of services, it is overkill as it
-		** disables interrupts while the array is searched.
-		** The only danger is of another thread trying to create a
-		** service - service deletion is safe.
-		** Therefore it is preferable to use state->mutex which,
-		** although slower to claim, doesn't block interrupts while
-		** it is held.
+		/* Lookups are lock-free (RCU), so state->mutex need only
+		** stop another thread from creating a service at the same
+		** time - service deletion is safe. A slot may still be
+		** cleared, and its service freed, under us, so the existing
+		** services are only looked at under RCU.
 		*/
 
 		mutex_lock(&state->mutex);
@@ -2604,15 +2620,16 @@ vchiq_add_service_internal(VCHIQ_STATE_T *state,
 
 		if (srvstate == VCHIQ_SRVSTATE_OPENING) {
 			for (i = 0; i < state->unused_service; i++) {
-				VCHIQ_SERVICE_T *srv = state->services[i];
-				if (!srv) {
+				if (!rcu_access_pointer(state->services[i])) {
 					pservice = &state->services[i];
 					break;
 				}
 			}
 		} else {
+			rcu_read_lock();
 			for (i = (state->unused_service - 1); i >= 0; i--) {
-				VCHIQ_SERVICE_T *srv = state->services[i];
+				VCHIQ_SERVICE_T *srv =
+					rcu_dereference(state->services[i]);
 				if (!srv)
 					pservice = &state->services[i];
 				else if ((srv->public_fourcc == params->fourcc)
@@ -2625,6 +2642,7 @@ vchiq_add_service_internal(VCHIQ_STATE_T *state,
 					break;
 				}
 			}
+			rcu_read_unlock();
 		}
 
 		if (pservice) {
@@ -2636,7 +2654,7 @@ vchiq_add_service_internal(VCHIQ_STATE_T *state,
 				(state->id * VCHIQ_MAX_SERVICES) |
 				service->localport;
 			handle_seq += VCHIQ_MAX_STATES * VCHIQ_MAX_SERVICES;
-			*pservice = service;
+			rcu_assign_pointer(*pservice, service);
 			if (pservice == &state->services[state->unused_service])
 				state->unused_service++;
 		}
@@ -2670,7 +2688,7 @@ vchiq_add_service_internal(VCHIQ_STATE_T *state,
 			service->localport);
 	}
 
-	/* Don't unlock the service - leave it with a ref_count of 1. */
+	/* Don't unlock the service - leave it with a reference held. */
 
 	return service;
 }
@@ -2704,7 +2722,7 @@ vchiq_open_service_internal(VCHIQ_SERVICE_T *service, int client_id)
 					"%d: osi - srvstate = %s (ref %d)",
 					service->state->id,
 					srvstate_names[service->srvstate],
-					service->ref_count);
+					atomic_read(&service->ref_count.refcount));
 			status = VCHIQ_ERROR;
 			VCHIQ_SERVICE_STATS_INC(service, error_count);
 			vchiq_release_service_internal(service);
@@ -3503,6 +3521,43 @@ vchiq_release_message(VCHIQ_SERVICE_HANDLE_T handle, VCHIQ_HEADER_T *header)
 	unlock_service(service);
 }
 
+/* Release a batch of messages for one service, taking the service and
+** recycle locks once rather than once per message. */
+void
+vchiq_release_messages(VCHIQ_SERVICE_HANDLE_T handle,
+	VCHIQ_HEADER_T **headers, unsigned int count)
+{
+	VCHIQ_SERVICE_T *service = find_service_by_handle(handle);
+	VCHIQ_SHARED_STATE_T *remote;
+	VCHIQ_STATE_T *state;
+	unsigned int i;
+
+	if (!service)
+		return;
+
+	state = service->state;
+	remote = state->remote;
+
+	mutex_lock(&state->recycle_mutex);
+	for (i = 0; i < count; i++) {
+		VCHIQ_HEADER_T *header = headers[i];
+		int slot_index = SLOT_INDEX_FROM_DATA(state, (void *)header);
+
+		if ((slot_index >= remote->slot_first) &&
+			(slot_index <= remote->slot_last)) {
+			if (header->msgid & VCHIQ_MSGID_CLAIMED)
+				release_slot_locked(state,
+					SLOT_INFO_FROM_INDEX(state,
+						slot_index),
+					header, service);
+		} else if (slot_index == remote->slot_sync)
+			release_message_sync(state, header);
+	}
+	mutex_unlock(&state->recycle_mutex);
+
+	unlock_service(service);
+}
+
 static void
 release_message_sync(VCHIQ_STATE_T *state, VCHIQ_HEADER_T *header)
 {
@@ -3749,7 +3804,8 @@ vchiq_dump_service_state(void *dump_context, VCHIQ_SERVICE_T *service)
 
 	len = snprintf(buf, sizeof(buf), "Service %d: %s (ref %u)",
 		service->localport, srvstate_names[service->srvstate],
-		service->ref_count - 1); /*Don't include the lock just taken*/
+		/* Don't include the lock just taken */
+		atomic_read(&service->ref_count.refcount) - 1);
 
 	if (service->srvstate != VCHIQ_SRVSTATE_FREE) {
 		char remoteport[30];
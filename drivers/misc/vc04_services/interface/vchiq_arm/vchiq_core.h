@@ -37,6 +37,13 @@
 #include <linux/mutex.h>
 #include <linux/semaphore.h>
 #include <linux/kthread.h>
+#include <linux/kref.h>
+#include <linux/rcupdate.h>
+
+/* dsb() is ARM specific; the loopback platform may be built elsewhere */
+#ifndef dsb
+#define dsb() mb()
+#endif
 
 #include "vchiq_cfg.h"
 
@@ -284,7 +291,8 @@ typedef struct vchiq_slot_info_struct {
 typedef struct vchiq_service_struct {
 	VCHIQ_SERVICE_BASE_T base;
 	VCHIQ_SERVICE_HANDLE_T handle;
-	unsigned int ref_count;
+	struct kref ref_count;
+	struct rcu_head rcu;
 	int srvstate;
 	VCHIQ_USERDATA_TERM_T userdata_term;
 	unsigned int localport;
@@ -502,7 +510,9 @@ struct vchiq_state_struct {
 		int error_count;
 	} stats;
 
-	VCHIQ_SERVICE_T * services[VCHIQ_MAX_SERVICES];
+	/* Filled in under the state mutex, cleared by the service's last
+	** unlock_service() (which may not hold it), read under RCU */
+	VCHIQ_SERVICE_T __rcu *services[VCHIQ_MAX_SERVICES];
 	VCHIQ_SERVICE_QUOTA_T service_quotas[VCHIQ_MAX_SERVICES];
 	VCHIQ_SLOT_INFO_T slot_info[VCHIQ_MAX_SLOTS];
 
@@ -585,6 +595,8 @@ vchiq_loud_error_footer(void);
 extern void
 request_poll(VCHIQ_STATE_T *state, VCHIQ_SERVICE_T *service, int poll_type);
 
+/* Must be called under rcu_read_lock(). The result is only safe to use
+** after rcu_read_unlock() if a reference is already held on the service. */
 static inline VCHIQ_SERVICE_T *
 handle_to_service(VCHIQ_SERVICE_HANDLE_T handle)
 {
@@ -593,7 +605,8 @@ handle_to_service(VCHIQ_SERVICE_HANDLE_T handle)
 	if (!state)
 		return NULL;
 
-	return state->services[handle & (VCHIQ_MAX_SERVICES - 1)];
+	return rcu_dereference(
+		state->services[handle & (VCHIQ_MAX_SERVICES - 1)]);
 }
 
 extern VCHIQ_SERVICE_T *
@@ -315,6 +315,37 @@ void vchiq_debugfs_remove_instance(VCHIQ_INSTANCE_T instance)
 	debugfs_remove_recursive(node->dentry);
 }
 
+static int debugfs_bulk_stats_show(struct seq_file *f, void *offset)
+{
+	VCHIQ_PLATFORM_BULK_STATS_T stats;
+
+	vchiq_platform_get_bulk_stats(&stats);
+
+	seq_printf(f, "pagelist_cache_hits: %llu\n",
+		stats.pagelist_cache_hits);
+	seq_printf(f, "pagelist_cache_misses: %llu\n",
+		stats.pagelist_cache_misses);
+	seq_printf(f, "pagelist_cache_invalidations: %llu\n",
+		stats.pagelist_cache_invalidations);
+	seq_printf(f, "zero_copy_bytes: %llu\n", stats.zero_copy_bytes);
+	seq_printf(f, "fragment_bytes: %llu\n", stats.fragment_bytes);
+
+	return 0;
+}
+
+static int debugfs_bulk_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, debugfs_bulk_stats_show, NULL);
+}
+
+static const struct file_operations debugfs_bulk_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= debugfs_bulk_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 
 int vchiq_debugfs_init(void)
 {
@@ -332,6 +363,10 @@ int vchiq_debugfs_init(void)
 	if (vchiq_debugfs_create_log_entries(vchiq_debugfs_top()) != 0)
 		goto fail;
 
+	if (!debugfs_create_file("bulk_stats", 0444, vchiq_debugfs_top(),
+				 NULL, &debugfs_bulk_stats_fops))
+		goto fail;
+
 	return 0;
 
 fail:
@@ -83,6 +83,20 @@ typedef struct {
 	void *buf;
 } VCHIQ_DEQUEUE_MESSAGE_T;
 
+/* Payloads are packed into buf, each starting on a
+ * VCHIQ_DEQUEUE_MESSAGES_ALIGN boundary, and their sizes are written to
+ * sizes. The ioctl returns the number of messages dequeued. */
+#define VCHIQ_DEQUEUE_MESSAGES_ALIGN 8
+
+typedef struct {
+	unsigned int handle;
+	int blocking;
+	unsigned int count;
+	unsigned int bufsize;
+	void *buf;
+	unsigned int *sizes;
+} VCHIQ_DEQUEUE_MESSAGES_T;
+
 typedef struct {
 	unsigned int config_size;
 	VCHIQ_CONFIG_T *pconfig;
@@ -126,6 +140,8 @@ typedef struct {
 	_IOW(VCHIQ_IOC_MAGIC,  15, VCHIQ_DUMP_MEM_T)
 #define VCHIQ_IOC_LIB_VERSION          _IO(VCHIQ_IOC_MAGIC,   16)
 #define VCHIQ_IOC_CLOSE_DELIVERED      _IO(VCHIQ_IOC_MAGIC,   17)
-#define VCHIQ_IOC_MAX                  17
+#define VCHIQ_IOC_DEQUEUE_MESSAGES \
+	_IOWR(VCHIQ_IOC_MAGIC, 18, VCHIQ_DEQUEUE_MESSAGES_T)
+#define VCHIQ_IOC_MAX                  18
 
 #endif
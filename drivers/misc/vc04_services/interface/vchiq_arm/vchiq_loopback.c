@@ -0,0 +1,656 @@
+/**
+ * Copyright (c) 2010-2012 Broadcom. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions, and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The names of the above-listed copyright holders may not be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * ALTERNATIVELY, this software may be distributed under the terms of the
+ * GNU General Public License ("GPL") version 2, as published by the Free
+ * Software Foundation.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Software loopback platform for VCHIQ.
+ *
+ * This is a drop-in replacement for vchiq_2835_arm.c which needs no
+ * VideoCore. A second VCHIQ state, initialised as the master, sits on the
+ * other half of the same slot memory and plays the part of the VideoCore:
+ * doorbells become direct pokes of the peer's events, and bulk transfers are
+ * performed with memcpy by the master's slot handler. The emulated VideoCore
+ * offers a pool of 'LPBK' services (see vchiq_loopback.h) which echo, sink
+ * or bulk-transfer on request, so that the slot handling and bulk paths of
+ * vchiq_core.c can be exercised and measured on any board.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "vchiq_arm.h"
+#include "vchiq_connected.h"
+#include "vchiq_killable.h"
+#include "vchiq_loopback.h"
+
+#define MAX_LOOPBACK_SERVICES 32
+
+typedef struct vchiq_loopback_state_struct {
+	int inited;
+	VCHIQ_ARM_STATE_T arm_state;
+} VCHIQ_LOOPBACK_ARM_STATE_T;
+
+/* The emulated VideoCore only needs an instance to own its services */
+struct vchiq_instance_struct {
+	VCHIQ_STATE_T *state;
+};
+
+/* An ARM-side bulk buffer, made addressable from the master's threads */
+struct loopback_bulk {
+	char *addr;
+	void *vaddr;
+	unsigned int num_pages;
+	int dir;
+	struct page *pages[0];
+};
+
+struct loopback_request {
+	struct list_head list;
+	struct vchiq_loopback_msg msg;
+};
+
+struct loopback_server {
+	VCHIQ_SERVICE_HANDLE_T handle;
+	spinlock_t lock;
+	struct list_head requests;
+	struct work_struct work;
+	void *buf;
+	unsigned int buf_size;
+};
+
+static int loopback_slots = 2 * 32;
+module_param(loopback_slots, int, 0444);
+MODULE_PARM_DESC(loopback_slots, "Number of data slots shared by the two sides");
+
+static int loopback_services = 8;
+module_param(loopback_services, int, 0444);
+MODULE_PARM_DESC(loopback_services, "Number of emulated VideoCore services");
+
+static VCHIQ_STATE_T g_master_state;
+static VCHIQ_STATE_T *g_slave_state;
+static struct vchiq_instance_struct g_master_instance;
+static struct workqueue_struct *g_server_wq;
+static struct loopback_server g_servers[MAX_LOOPBACK_SERVICES];
+
+extern int vchiq_arm_log_level;
+
+static VCHIQ_STATUS_T
+loopback_service_callback(VCHIQ_REASON_T reason, VCHIQ_HEADER_T *header,
+	VCHIQ_SERVICE_HANDLE_T handle, void *bulk_userdata);
+
+static void
+loopback_server_work(struct work_struct *work);
+
+static int
+loopback_connect_func(void *v);
+
+static void
+loopback_free_slots(void *slot_mem)
+{
+	vfree(slot_mem);
+}
+
+static int
+loopback_add_servers(void)
+{
+	VCHIQ_SERVICE_PARAMS_T params;
+	int i;
+
+	params.fourcc = VCHIQ_LOOPBACK_FOURCC;
+	params.callback = loopback_service_callback;
+	params.version = VCHIQ_LOOPBACK_VER;
+	params.version_min = VCHIQ_LOOPBACK_MIN_VER;
+
+	for (i = 0; i < loopback_services; i++) {
+		struct loopback_server *server = &g_servers[i];
+		VCHIQ_SERVICE_T *service;
+
+		spin_lock_init(&server->lock);
+		INIT_LIST_HEAD(&server->requests);
+		INIT_WORK(&server->work, loopback_server_work);
+
+		params.userdata = server;
+		service = vchiq_add_service_internal(&g_master_state, &params,
+			VCHIQ_SRVSTATE_LISTENING, &g_master_instance, NULL);
+		if (!service)
+			return -ENOMEM;
+		server->handle = service->handle;
+	}
+
+	return 0;
+}
+
+int vchiq_platform_init(struct platform_device *pdev, VCHIQ_STATE_T *state)
+{
+	struct device *dev = &pdev->dev;
+	VCHIQ_SLOT_ZERO_T *vchiq_slot_zero;
+	struct task_struct *connect_thread;
+	void *slot_mem;
+	int slot_mem_size;
+	int err;
+
+	if (loopback_services > MAX_LOOPBACK_SERVICES)
+		loopback_services = MAX_LOOPBACK_SERVICES;
+
+	slot_mem_size = PAGE_ALIGN((VCHIQ_SLOT_ZERO_SLOTS + loopback_slots) *
+		VCHIQ_SLOT_SIZE);
+	slot_mem = vzalloc(slot_mem_size);
+	if (!slot_mem) {
+		dev_err(dev, "could not allocate slot memory\n");
+		return -ENOMEM;
+	}
+
+	err = devm_add_action(dev, loopback_free_slots, slot_mem);
+	if (err) {
+		vfree(slot_mem);
+		return err;
+	}
+
+	vchiq_slot_zero = vchiq_init_slots(slot_mem, slot_mem_size);
+	if (!vchiq_slot_zero)
+		return -EINVAL;
+
+	/* Bring up the emulated VideoCore first, as the firmware would be */
+	g_master_instance.state = &g_master_state;
+	if (vchiq_init_state(&g_master_state, vchiq_slot_zero, 1) !=
+		VCHIQ_SUCCESS)
+		return -EINVAL;
+
+	g_server_wq = alloc_ordered_workqueue("vchiq-loopback", 0);
+	if (!g_server_wq)
+		return -ENOMEM;
+
+	err = loopback_add_servers();
+	if (err) {
+		dev_err(dev, "could not add loopback services\n");
+		return err;
+	}
+
+	g_slave_state = state;
+	if (vchiq_init_state(state, vchiq_slot_zero, 0) != VCHIQ_SUCCESS)
+		return -EINVAL;
+
+	connect_thread = kthread_run(loopback_connect_func, NULL, "VCHIQlb");
+	if (IS_ERR(connect_thread))
+		return PTR_ERR(connect_thread);
+
+	vchiq_log_info(vchiq_arm_log_level,
+		"vchiq_init - loopback done (slots %p, %d slots, %d services)",
+		vchiq_slot_zero, loopback_slots,
+		loopback_services);
+
+	vchiq_call_connected_callbacks();
+
+	return 0;
+}
+
+VCHIQ_STATUS_T
+vchiq_platform_init_state(VCHIQ_STATE_T *state)
+{
+	VCHIQ_LOOPBACK_ARM_STATE_T *platform_state;
+	VCHIQ_STATUS_T status;
+
+	platform_state = kzalloc(sizeof(*platform_state), GFP_KERNEL);
+	if (!platform_state)
+		return VCHIQ_ERROR;
+
+	state->platform_state = (VCHIQ_PLATFORM_STATE_T)platform_state;
+	platform_state->inited = 1;
+	status = vchiq_arm_init_state(state, &platform_state->arm_state);
+	if (status != VCHIQ_SUCCESS)
+		platform_state->inited = 0;
+
+	/* The emulated VideoCore must not start a keepalive thread of its
+	** own - it would compete with the ARM side for the KEEP service. */
+	if (state->is_master)
+		platform_state->arm_state.first_connect = 1;
+
+	return status;
+}
+
+VCHIQ_ARM_STATE_T*
+vchiq_platform_get_arm_state(VCHIQ_STATE_T *state)
+{
+	VCHIQ_LOOPBACK_ARM_STATE_T *platform_state =
+		(VCHIQ_LOOPBACK_ARM_STATE_T *)state->platform_state;
+
+	if (!platform_state->inited)
+		BUG();
+
+	return &platform_state->arm_state;
+}
+
+void
+remote_event_signal(REMOTE_EVENT_T *event)
+{
+	VCHIQ_STATE_T *peer;
+
+	wmb();
+
+	event->fired = 1;
+
+	mb();
+
+	if (!event->armed)
+		return;
+
+	/* Ring the "doorbell" by polling the side which owns the event */
+	if ((char *)event >= (char *)g_master_state.local &&
+		(char *)event < (char *)(g_master_state.local + 1))
+		peer = &g_master_state;
+	else
+		peer = g_slave_state;
+
+	if (peer)
+		remote_event_pollall(peer);
+}
+
+int
+vchiq_copy_from_user(void *dst, const void *src, int size)
+{
+	if ((unsigned long)src < TASK_SIZE) {
+		return copy_from_user(dst, src, size);
+	} else {
+		memcpy(dst, src, size);
+		return 0;
+	}
+}
+
+static struct loopback_bulk *
+create_loopback_bulk(char __user *buf, int size, int dir)
+{
+	struct loopback_bulk *lb;
+	unsigned int num_pages, offset;
+	int actual_pages;
+
+	if ((unsigned long)buf >= TASK_SIZE) {
+		/* Kernel buffers are already addressable by the master */
+		lb = kzalloc(sizeof(*lb), GFP_KERNEL);
+		if (!lb)
+			return NULL;
+		lb->addr = (char __force *)buf;
+		lb->dir = dir;
+		return lb;
+	}
+
+	offset = (unsigned long)buf & (PAGE_SIZE - 1);
+	num_pages = (size + offset + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	lb = kzalloc(sizeof(*lb) + num_pages * sizeof(struct page *),
+		GFP_KERNEL);
+	if (!lb)
+		return NULL;
+
+	down_read(&current->mm->mmap_sem);
+	actual_pages = get_user_pages(current, current->mm,
+		(unsigned long)buf & ~(PAGE_SIZE - 1), num_pages,
+		(dir == VCHIQ_BULK_RECEIVE) /*Write */, 0 /*Force */,
+		lb->pages, NULL /*vmas */);
+	up_read(&current->mm->mmap_sem);
+
+	if (actual_pages != num_pages) {
+		vchiq_log_info(vchiq_arm_log_level,
+			"create_loopback_bulk - only %d/%d pages locked",
+			actual_pages, num_pages);
+		while (actual_pages > 0)
+			page_cache_release(lb->pages[--actual_pages]);
+		kfree(lb);
+		return NULL;
+	}
+
+	lb->vaddr = vmap(lb->pages, num_pages, VM_MAP, PAGE_KERNEL);
+	if (!lb->vaddr) {
+		while (num_pages > 0)
+			page_cache_release(lb->pages[--num_pages]);
+		kfree(lb);
+		return NULL;
+	}
+
+	lb->num_pages = num_pages;
+	lb->addr = (char *)lb->vaddr + offset;
+	lb->dir = dir;
+
+	/* Make the user's writes visible through the kernel alias */
+	if (dir == VCHIQ_BULK_TRANSMIT)
+		flush_kernel_vmap_range(lb->vaddr, num_pages * PAGE_SIZE);
+
+	return lb;
+}
+
+static void
+free_loopback_bulk(struct loopback_bulk *lb)
+{
+	unsigned int i;
+
+	if (lb->vaddr) {
+		if (lb->dir == VCHIQ_BULK_RECEIVE)
+			flush_kernel_vmap_range(lb->vaddr,
+				lb->num_pages * PAGE_SIZE);
+		vunmap(lb->vaddr);
+
+		for (i = 0; i < lb->num_pages; i++) {
+			if (lb->dir == VCHIQ_BULK_RECEIVE)
+				set_page_dirty_lock(lb->pages[i]);
+			page_cache_release(lb->pages[i]);
+		}
+	}
+
+	kfree(lb);
+}
+
+VCHIQ_STATUS_T
+vchiq_prepare_bulk_data(VCHIQ_BULK_T *bulk, VCHI_MEM_HANDLE_T memhandle,
+	void *offset, int size, int dir)
+{
+	struct loopback_bulk *lb;
+
+	bulk->handle = memhandle;
+
+	/* The emulated VideoCore transfers to and from its own buffers */
+	if (memhandle == VCHIQ_LOOPBACK_MEMHANDLE) {
+		bulk->data = offset;
+		return VCHIQ_SUCCESS;
+	}
+
+	WARN_ON(memhandle != VCHI_MEM_HANDLE_INVALID);
+
+	lb = create_loopback_bulk((char __user *)offset, size, dir);
+	if (!lb)
+		return VCHIQ_ERROR;
+
+	/* The descriptor travels to the master in place of a pagelist */
+	bulk->data = lb;
+	bulk->remote_data = lb;
+
+	return VCHIQ_SUCCESS;
+}
+
+void
+vchiq_complete_bulk(VCHIQ_BULK_T *bulk)
+{
+	if (!bulk || bulk->handle == VCHIQ_LOOPBACK_MEMHANDLE)
+		return;
+
+	if (bulk->data)
+		free_loopback_bulk((struct loopback_bulk *)bulk->data);
+}
+
+void
+vchiq_transfer_bulk(VCHIQ_BULK_T *bulk)
+{
+	struct loopback_bulk *lb = bulk->remote_data;
+	int size;
+
+	/* Called on the master side, with the bulk transfer mutex held */
+	if (!lb || !bulk->data) {
+		bulk->actual = VCHIQ_BULK_ACTUAL_ABORTED;
+		return;
+	}
+
+	size = min(bulk->size, bulk->remote_size);
+	if (bulk->dir == VCHIQ_BULK_TRANSMIT)
+		memcpy(lb->addr, bulk->data, size);
+	else
+		memcpy(bulk->data, lb->addr, size);
+
+	bulk->actual = size;
+}
+
+void
+vchiq_dump_platform_state(void *dump_context)
+{
+	char buf[80];
+	int len;
+	len = snprintf(buf, sizeof(buf),
+		"  Platform: loopback (emulated VC master, %d services)",
+		loopback_services);
+	vchiq_dump(dump_context, buf, len + 1);
+}
+
+void
+vchiq_platform_exit(VCHIQ_STATE_T *state)
+{
+}
+
+void
+vchiq_platform_get_bulk_stats(VCHIQ_PLATFORM_BULK_STATS_T *stats)
+{
+	/* Bulk data is copied directly between the two states */
+	memset(stats, 0, sizeof(*stats));
+}
+
+VCHIQ_STATUS_T
+vchiq_platform_suspend(VCHIQ_STATE_T *state)
+{
+	return VCHIQ_ERROR;
+}
+
+VCHIQ_STATUS_T
+vchiq_platform_resume(VCHIQ_STATE_T *state)
+{
+	return VCHIQ_SUCCESS;
+}
+
+void
+vchiq_platform_paused(VCHIQ_STATE_T *state)
+{
+}
+
+void
+vchiq_platform_resumed(VCHIQ_STATE_T *state)
+{
+}
+
+int
+vchiq_platform_videocore_wanted(VCHIQ_STATE_T *state)
+{
+	return 1; /* autosuspend not supported - videocore always wanted */
+}
+
+int
+vchiq_platform_use_suspend_timer(void)
+{
+	return 0;
+}
+
+void
+vchiq_dump_platform_use_state(VCHIQ_STATE_T *state)
+{
+	vchiq_log_info(vchiq_arm_log_level, "Suspend timer not in use");
+}
+
+void
+vchiq_platform_handle_timeout(VCHIQ_STATE_T *state)
+{
+	(void)state;
+}
+
+/*
+ * Local functions - the emulated VideoCore
+ */
+
+static int
+loopback_connect_func(void *v)
+{
+	/* Blocks until the ARM side connects */
+	if (vchiq_connect_internal(&g_master_state, &g_master_instance) !=
+		VCHIQ_SUCCESS)
+		vchiq_log_error(vchiq_arm_log_level,
+			"loopback: emulated VideoCore failed to connect");
+
+	return 0;
+}
+
+/* Called by the master's slot handler thread */
+static VCHIQ_STATUS_T
+loopback_service_callback(VCHIQ_REASON_T reason, VCHIQ_HEADER_T *header,
+	VCHIQ_SERVICE_HANDLE_T handle, void *bulk_userdata)
+{
+	struct loopback_server *server =
+		(struct loopback_server *)VCHIQ_GET_SERVICE_USERDATA(handle);
+	struct loopback_request *req, *tmp;
+	struct vchiq_loopback_msg *msg;
+
+	switch (reason) {
+	case VCHIQ_SERVICE_OPENED:
+		/* The emulated VideoCore never suspends */
+		vchiq_use_service(handle);
+		break;
+
+	case VCHIQ_SERVICE_CLOSED:
+		spin_lock(&server->lock);
+		list_for_each_entry_safe(req, tmp, &server->requests, list) {
+			list_del(&req->list);
+			kfree(req);
+		}
+		spin_unlock(&server->lock);
+		break;
+
+	case VCHIQ_MESSAGE_AVAILABLE:
+		msg = (struct vchiq_loopback_msg *)header->data;
+		if (header->size < sizeof(*msg)) {
+			vchiq_log_error(vchiq_arm_log_level,
+				"loopback: short message (%d bytes)",
+				header->size);
+			vchiq_release_message(handle, header);
+			break;
+		}
+
+		switch (msg->cmd) {
+		case VCHIQ_LOOPBACK_ECHO: {
+			VCHIQ_ELEMENT_T element = { header->data,
+						    header->size };
+			if (vchiq_queue_message(handle, &element, 1) !=
+				VCHIQ_SUCCESS)
+				vchiq_log_error(vchiq_arm_log_level,
+					"loopback: echo failed");
+		} break;
+
+		case VCHIQ_LOOPBACK_BULK_TO_VC:
+		case VCHIQ_LOOPBACK_BULK_FROM_VC:
+			/* Bulks are resolved by this thread, so they must be
+			** queued from elsewhere */
+			req = kmalloc(sizeof(*req), GFP_KERNEL);
+			if (!req)
+				break;
+			req->msg = *msg;
+			spin_lock(&server->lock);
+			list_add_tail(&req->list, &server->requests);
+			spin_unlock(&server->lock);
+			queue_work(g_server_wq, &server->work);
+			break;
+
+		case VCHIQ_LOOPBACK_SINK:
+		default:
+			break;
+		}
+		vchiq_release_message(handle, header);
+		break;
+
+	default:
+		break;
+	}
+
+	return VCHIQ_SUCCESS;
+}
+
+static void
+loopback_server_work(struct work_struct *work)
+{
+	struct loopback_server *server =
+		container_of(work, struct loopback_server, work);
+	struct loopback_request *req;
+
+	while (1) {
+		struct bulk_waiter waiter;
+		VCHIQ_BULK_DIR_T dir;
+		VCHIQ_STATUS_T status;
+
+		spin_lock(&server->lock);
+		req = list_first_entry_or_null(&server->requests,
+			struct loopback_request, list);
+		if (req)
+			list_del(&req->list);
+		spin_unlock(&server->lock);
+
+		if (!req)
+			break;
+
+		if (req->msg.size > VCHIQ_LOOPBACK_MAX_BULK) {
+			vchiq_log_error(vchiq_arm_log_level,
+				"loopback: %u byte bulk exceeds the %d limit",
+				req->msg.size, VCHIQ_LOOPBACK_MAX_BULK);
+			kfree(req);
+			continue;
+		}
+
+		if (req->msg.size > server->buf_size) {
+			vfree(server->buf);
+			server->buf = vmalloc(req->msg.size);
+			server->buf_size = server->buf ? req->msg.size : 0;
+		}
+
+		if (!server->buf) {
+			vchiq_log_error(vchiq_arm_log_level,
+				"loopback: no memory for %u byte bulk",
+				req->msg.size);
+			kfree(req);
+			continue;
+		}
+
+		dir = (req->msg.cmd == VCHIQ_LOOPBACK_BULK_TO_VC) ?
+			VCHIQ_BULK_RECEIVE : VCHIQ_BULK_TRANSMIT;
+		status = vchiq_bulk_transfer(server->handle,
+			VCHIQ_LOOPBACK_MEMHANDLE, server->buf, req->msg.size,
+			&waiter, VCHIQ_BULK_MODE_BLOCKING, dir);
+		if (status != VCHIQ_SUCCESS)
+			vchiq_log_warning(vchiq_arm_log_level,
+				"loopback: %cx bulk of %u bytes failed (%d)",
+				(dir == VCHIQ_BULK_TRANSMIT) ? 't' : 'r',
+				req->msg.size, status);
+
+		kfree(req);
+	}
+}
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2010-2012 Broadcom. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions, and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The names of the above-listed copyright holders may not be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * ALTERNATIVELY, this software may be distributed under the terms of the
+ * GNU General Public License ("GPL") version 2, as published by the Free
+ * Software Foundation.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VCHIQ_LOOPBACK_H
+#define VCHIQ_LOOPBACK_H
+
+#include <linux/types.h>
+#include "vchiq_if.h"
+
+/* Services offered by the emulated VideoCore of the loopback transport. All
+** of them share the same fourcc; each open claims the next free instance. */
+#define VCHIQ_LOOPBACK_FOURCC		VCHIQ_MAKE_FOURCC('L', 'P', 'B', 'K')
+#define VCHIQ_LOOPBACK_VER		1
+#define VCHIQ_LOOPBACK_MIN_VER		1
+
+/* Memory handle used by the emulated VideoCore for its own (kernel) bulk
+** buffers, so the platform layer can tell them apart from ARM-side bulks. */
+#define VCHIQ_LOOPBACK_MEMHANDLE	((VCHI_MEM_HANDLE_T)0x4c50424b)
+
+/* Largest bulk the emulated VideoCore will send or receive */
+#define VCHIQ_LOOPBACK_MAX_BULK		(16 * 1024 * 1024)
+
+enum vchiq_loopback_cmd {
+	VCHIQ_LOOPBACK_ECHO,		/* reply with a copy of the message */
+	VCHIQ_LOOPBACK_SINK,		/* consume the message silently */
+	VCHIQ_LOOPBACK_BULK_TO_VC,	/* receive a bulk of 'size' bytes */
+	VCHIQ_LOOPBACK_BULK_FROM_VC	/* transmit a bulk of 'size' bytes */
+};
+
+/* Header at the start of every message sent to a loopback service. Any
+** payload beyond the header is ignored (or echoed back). */
+struct vchiq_loopback_msg {
+	uint32_t cmd;
+	uint32_t size;
+	uint32_t seq;
+	uint32_t reserved;
+};
+
+#endif /* VCHIQ_LOOPBACK_H */
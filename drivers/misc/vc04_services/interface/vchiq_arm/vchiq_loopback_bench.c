@@ -0,0 +1,417 @@
+/**
+ * Copyright (c) 2010-2012 Broadcom. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions, and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The names of the above-listed copyright holders may not be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * ALTERNATIVELY, this software may be distributed under the terms of the
+ * GNU General Public License ("GPL") version 2, as published by the Free
+ * Software Foundation.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput and latency benchmark for the VCHIQ loopback platform.
+ *
+ * Opens 'services' connections to the emulated VideoCore of
+ * vchiq_loopback.c and, for each message size in 'msg_sizes', measures
+ * echo round trips (with a latency histogram) and one-way message rate;
+ * then measures bulk throughput in both directions. Results are reported
+ * in the kernel log when the module is loaded, e.g.
+ *
+ *   modprobe vchiq_loopback_bench services=4 msg_sizes=16,1024,4000
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "interface/vchi/vchi.h"
+#include "vchiq_loopback.h"
+
+#define BENCH_MAX_SERVICES	32
+#define BENCH_MAX_MSG_SIZE	(VCHIQ_MAX_MSG_SIZE)
+#define BENCH_HIST_BUCKETS	16	/* powers of two, in microseconds */
+
+struct bench_client {
+	VCHI_SERVICE_HANDLE_T handle;
+	struct completion done;
+	char *tx_buf;
+	char *rx_buf;
+	void *bulk_buf;
+	int msg_size;
+	int error;
+	u64 lat_min;
+	u64 lat_max;
+	u64 lat_sum;
+	u32 hist[BENCH_HIST_BUCKETS];
+};
+
+static int services = 1;
+module_param(services, int, 0444);
+MODULE_PARM_DESC(services, "Number of concurrent loopback services");
+
+static int messages = 10000;
+module_param(messages, int, 0444);
+MODULE_PARM_DESC(messages, "Messages per service for each message size");
+
+static int msg_sizes[8] = { 16, 128, 1024, 4000 };
+static int num_msg_sizes = 4;
+module_param_array(msg_sizes, int, &num_msg_sizes, 0444);
+MODULE_PARM_DESC(msg_sizes, "Message sizes to test, in bytes");
+
+static int bulk_size = 1024 * 1024;
+module_param(bulk_size, int, 0444);
+MODULE_PARM_DESC(bulk_size, "Size of each bulk transfer, in bytes");
+
+static int bulks = 64;
+module_param(bulks, int, 0444);
+MODULE_PARM_DESC(bulks, "Bulk transfers per service in each direction");
+
+static struct bench_client bench_clients[BENCH_MAX_SERVICES];
+
+static void bench_callback(void *param, VCHI_CALLBACK_REASON_T reason,
+			   void *msg_handle)
+{
+	/* Messages are collected with blocking dequeues */
+}
+
+static int bench_send(struct bench_client *client, int cmd, int size,
+		      int seq, int msg_size)
+{
+	struct vchiq_loopback_msg *msg =
+		(struct vchiq_loopback_msg *)client->tx_buf;
+
+	msg->cmd = cmd;
+	msg->size = size;
+	msg->seq = seq;
+
+	return vchi_msg_queue(client->handle, msg, msg_size,
+			      VCHI_FLAGS_BLOCK_UNTIL_QUEUED, NULL);
+}
+
+static int bench_wait_reply(struct bench_client *client)
+{
+	uint32_t len;
+
+	return vchi_msg_dequeue(client->handle, client->rx_buf,
+				BENCH_MAX_MSG_SIZE, &len,
+				VCHI_FLAGS_BLOCK_UNTIL_OP_COMPLETE);
+}
+
+static void bench_record(struct bench_client *client, u64 ns)
+{
+	int bucket = 0;
+
+	if (ns >= NSEC_PER_USEC)
+		bucket = min(ilog2(div_u64(ns, NSEC_PER_USEC)) + 1,
+			     BENCH_HIST_BUCKETS - 1);
+	client->hist[bucket]++;
+	client->lat_sum += ns;
+	client->lat_min = min(client->lat_min, ns);
+	client->lat_max = max(client->lat_max, ns);
+}
+
+static int bench_echo_thread(void *data)
+{
+	struct bench_client *client = data;
+	int i;
+
+	for (i = 0; i < messages && !client->error; i++) {
+		u64 start = ktime_get_ns();
+
+		client->error = bench_send(client, VCHIQ_LOOPBACK_ECHO, 0, i,
+					   client->msg_size) ||
+				bench_wait_reply(client);
+		if (!client->error)
+			bench_record(client, ktime_get_ns() - start);
+	}
+
+	complete(&client->done);
+	return 0;
+}
+
+static int bench_sink_thread(void *data)
+{
+	struct bench_client *client = data;
+	int i;
+
+	for (i = 0; i < messages && !client->error; i++)
+		client->error = bench_send(client, VCHIQ_LOOPBACK_SINK, 0, i,
+					   client->msg_size);
+
+	/* Messages are handled in order, so one echo flushes the lot */
+	if (!client->error)
+		client->error = bench_send(client, VCHIQ_LOOPBACK_ECHO, 0, i,
+					   sizeof(struct vchiq_loopback_msg)) ||
+				bench_wait_reply(client);
+
+	complete(&client->done);
+	return 0;
+}
+
+static int bench_bulk_to_vc_thread(void *data)
+{
+	struct bench_client *client = data;
+	int i;
+
+	for (i = 0; i < bulks && !client->error; i++)
+		client->error = bench_send(client, VCHIQ_LOOPBACK_BULK_TO_VC,
+					   bulk_size, i,
+					   sizeof(struct vchiq_loopback_msg)) ||
+				vchi_bulk_queue_transmit(client->handle,
+					client->bulk_buf, bulk_size,
+					VCHI_FLAGS_BLOCK_UNTIL_OP_COMPLETE,
+					NULL);
+
+	complete(&client->done);
+	return 0;
+}
+
+static int bench_bulk_from_vc_thread(void *data)
+{
+	struct bench_client *client = data;
+	int i;
+
+	for (i = 0; i < bulks && !client->error; i++)
+		client->error = bench_send(client, VCHIQ_LOOPBACK_BULK_FROM_VC,
+					   bulk_size, i,
+					   sizeof(struct vchiq_loopback_msg)) ||
+				vchi_bulk_queue_receive(client->handle,
+					client->bulk_buf, bulk_size,
+					VCHI_FLAGS_BLOCK_UNTIL_OP_COMPLETE,
+					NULL);
+
+	complete(&client->done);
+	return 0;
+}
+
+/* Runs fn on every client concurrently, returning the elapsed time in ns */
+static s64 bench_run(int (*fn)(void *), int msg_size)
+{
+	struct task_struct *tasks[BENCH_MAX_SERVICES];
+	u64 start;
+	int i;
+
+	for (i = 0; i < services; i++) {
+		struct bench_client *client = &bench_clients[i];
+
+		init_completion(&client->done);
+		client->msg_size = msg_size;
+		client->error = 0;
+		client->lat_min = U64_MAX;
+		client->lat_max = 0;
+		client->lat_sum = 0;
+		memset(client->hist, 0, sizeof(client->hist));
+
+		tasks[i] = kthread_create(fn, client, "vchiq_bench/%d", i);
+		if (IS_ERR(tasks[i])) {
+			s64 err = PTR_ERR(tasks[i]);
+
+			while (i--)
+				kthread_stop(tasks[i]);
+			return err;
+		}
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < services; i++)
+		wake_up_process(tasks[i]);
+	for (i = 0; i < services; i++)
+		wait_for_completion(&bench_clients[i].done);
+
+	for (i = 0; i < services; i++)
+		if (bench_clients[i].error)
+			return -EIO;
+
+	return ktime_get_ns() - start;
+}
+
+static u64 bench_rate(u64 count, s64 ns)
+{
+	return ns > 0 ? div64_u64(count * NSEC_PER_SEC, ns) : 0;
+}
+
+static int bench_messages(int msg_size)
+{
+	u64 lat_min = U64_MAX, lat_max = 0, lat_sum = 0;
+	u32 hist[BENCH_HIST_BUCKETS] = { 0 };
+	u64 total = (u64)messages * services;
+	s64 echo_ns, sink_ns;
+	int i, j;
+
+	echo_ns = bench_run(bench_echo_thread, msg_size);
+	if (echo_ns < 0)
+		return echo_ns;
+
+	for (i = 0; i < services; i++) {
+		struct bench_client *client = &bench_clients[i];
+
+		lat_min = min(lat_min, client->lat_min);
+		lat_max = max(lat_max, client->lat_max);
+		lat_sum += client->lat_sum;
+		for (j = 0; j < BENCH_HIST_BUCKETS; j++)
+			hist[j] += client->hist[j];
+	}
+
+	sink_ns = bench_run(bench_sink_thread, msg_size);
+	if (sink_ns < 0)
+		return sink_ns;
+
+	pr_info("%d service(s), %4d byte messages: echo %llu/s, sink %llu/s\n",
+		services, msg_size, bench_rate(total, echo_ns),
+		bench_rate(total, sink_ns));
+	pr_info("  round trip ns: min %llu avg %llu max %llu\n",
+		lat_min, div64_u64(lat_sum, total), lat_max);
+	for (j = 0; j < BENCH_HIST_BUCKETS; j++) {
+		if (!hist[j])
+			continue;
+		if (j == BENCH_HIST_BUCKETS - 1)
+			pr_info("  >=%6u us: %u\n", 1 << (j - 1), hist[j]);
+		else
+			pr_info("  < %6u us: %u\n", 1 << j, hist[j]);
+	}
+
+	return 0;
+}
+
+static int bench_bulk(void)
+{
+	u64 total = (u64)bulks * services * bulk_size;
+	s64 to_vc_ns, from_vc_ns;
+
+	to_vc_ns = bench_run(bench_bulk_to_vc_thread, 0);
+	if (to_vc_ns < 0)
+		return to_vc_ns;
+
+	from_vc_ns = bench_run(bench_bulk_from_vc_thread, 0);
+	if (from_vc_ns < 0)
+		return from_vc_ns;
+
+	pr_info("%d service(s), %d byte bulks: to VC %llu MB/s, from VC %llu MB/s\n",
+		services, bulk_size,
+		bench_rate(total, to_vc_ns) >> 20,
+		bench_rate(total, from_vc_ns) >> 20);
+
+	return 0;
+}
+
+static int __init vchiq_loopback_bench_init(void)
+{
+	VCHI_INSTANCE_T instance;
+	int opened = 0;
+	int ret, i;
+
+	if (services < 1 || services > BENCH_MAX_SERVICES ||
+	    messages < 1 || bulks < 0 || bulk_size < 1 ||
+	    bulk_size > VCHIQ_LOOPBACK_MAX_BULK)
+		return -EINVAL;
+
+	for (i = 0; i < num_msg_sizes; i++)
+		if (msg_sizes[i] < sizeof(struct vchiq_loopback_msg) ||
+		    msg_sizes[i] > BENCH_MAX_MSG_SIZE)
+			return -EINVAL;
+
+	ret = vchi_initialise(&instance);
+	if (ret)
+		return -EIO;
+
+	ret = vchi_connect(NULL, 0, instance);
+	if (ret) {
+		ret = -EIO;
+		goto out_disconnect;
+	}
+
+	for (opened = 0; opened < services; opened++) {
+		struct bench_client *client = &bench_clients[opened];
+		SERVICE_CREATION_T params = {
+			VCHI_VERSION_EX(VCHIQ_LOOPBACK_VER,
+					VCHIQ_LOOPBACK_MIN_VER),
+			VCHIQ_LOOPBACK_FOURCC,
+			NULL,		/* connection */
+			0,		/* rx fifo size (unused) */
+			0,		/* tx fifo size (unused) */
+			bench_callback,
+			client,
+			1,		/* unaligned bulk receives */
+			1,		/* unaligned bulk transmits */
+			0		/* want crc check on bulk transfers */
+		};
+
+		client->tx_buf = kzalloc(BENCH_MAX_MSG_SIZE, GFP_KERNEL);
+		client->rx_buf = kmalloc(BENCH_MAX_MSG_SIZE, GFP_KERNEL);
+		client->bulk_buf = vzalloc(bulk_size);
+		if (!client->tx_buf || !client->rx_buf || !client->bulk_buf) {
+			ret = -ENOMEM;
+			goto out_close;
+		}
+
+		if (vchi_service_open(instance, &params, &client->handle)) {
+			pr_err("could not open loopback service %d\n", opened);
+			ret = -ENODEV;
+			goto out_close;
+		}
+	}
+
+	for (i = 0; i < num_msg_sizes; i++) {
+		ret = bench_messages(msg_sizes[i]);
+		if (ret)
+			goto out_close;
+	}
+
+	if (bulks)
+		ret = bench_bulk();
+
+out_close:
+	if (ret)
+		pr_err("benchmark failed (%d)\n", ret);
+	for (i = 0; i < opened; i++)
+		vchi_service_close(bench_clients[i].handle);
+	for (i = 0; i < services; i++) {
+		kfree(bench_clients[i].tx_buf);
+		kfree(bench_clients[i].rx_buf);
+		vfree(bench_clients[i].bulk_buf);
+	}
+out_disconnect:
+	vchi_disconnect(instance);
+
+	return ret;
+}
+module_init(vchiq_loopback_bench_init);
+
+static void __exit vchiq_loopback_bench_exit(void)
+{
+}
+module_exit(vchiq_loopback_bench_exit);
+
+MODULE_DESCRIPTION("VCHIQ loopback transport benchmark");
+MODULE_LICENSE("Dual BSD/GPL");
@@ -48,6 +48,9 @@
 #include <linux/dma-mapping.h>
 #include <linux/of_dma.h>
 #include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #define DRIVER_NAME "sdhost-bcm2835"
 
@@ -112,6 +115,10 @@
 
 #define MHZ 1000000
 
+/* request latency histogram: <250us, <500us, ... doubling, then the rest */
+#define LAT_BUCKETS		8
+#define LAT_BUCKET0_US		250
+
 #ifndef BCM2708_PERI_BASE
  #define BCM2708_PERI_BASE 0x20000000
 #endif
@@ -120,6 +127,16 @@
 #define BCM2835_VCMMU_SHIFT		(0x7E000000 - BCM2708_PERI_BASE)
 
 
+struct bcm2835_sdhost_stats {
+	unsigned long		reqs[2];	/* data requests, read and write */
+	unsigned long long	bytes[2];
+	unsigned long long	total_us[2];
+	u32			max_us[2];
+	unsigned long		hist[2][LAT_BUCKETS];
+	unsigned long		premapped;	/* mapped by pre_req */
+	unsigned long		dma_finished;	/* completed from the DMA callback */
+};
+
 struct bcm2835_host {
 	spinlock_t		lock;
 
@@ -165,6 +182,9 @@ struct bcm2835_host {
 
 	unsigned int			debug:1;		/* Enable debug output */
 
+	unsigned int			in_dma_callback:1;	/* Finish from the DMA callback... */
+	unsigned int			finish_pending:1;	/* ...once it drops the lock */
+
 	u32				thread_isr;
 
 	/*DMA part*/
@@ -176,6 +196,9 @@ struct bcm2835_host {
 	bool				use_dma;
 	/*end of DMA part*/
 
+	ktime_t				req_start;	/* when the current request arrived */
+	struct bcm2835_sdhost_stats	stats;
+
 	int				max_delay;	/* maximum length of time spent waiting */
 	struct timeval			stop_time;	/* when the last stop was issued */
 	u32				delay_after_stop; /* minimum time between stop and subsequent data transfer */
@@ -185,6 +208,18 @@ struct bcm2835_host {
 };
 
 
+/*
+ * The request is done. From the DMA completion callback it is finished
+ * there and then, rather than by a second trip through a tasklet.
+ */
+static void bcm2835_sdhost_schedule_finish(struct bcm2835_host *host)
+{
+	if (host->in_dma_callback)
+		host->finish_pending = 1;
+	else
+		tasklet_schedule(&host->finish_tasklet);
+}
+
 static inline void bcm2835_sdhost_write(struct bcm2835_host *host, u32 val, int reg)
 {
 	writel(val, host->ioaddr + reg);
@@ -424,15 +459,50 @@ static void bcm2835_sdhost_wait_write_complete(struct bcm2835_host *host)
 }
 
 static void bcm2835_sdhost_finish_data(struct bcm2835_host *host);
+static void bcm2835_sdhost_tasklet_finish(unsigned long param);
+
+static bool bcm2835_sdhost_data_uses_dma(struct bcm2835_host *host,
+					 struct mmc_data *data)
+{
+	return host->have_dma && (data->blocks > host->pio_limit);
+}
+
+static struct dma_chan *bcm2835_sdhost_dma_chan(struct bcm2835_host *host,
+						struct mmc_data *data,
+						u32 *dir_data)
+{
+	if (data->flags & MMC_DATA_READ) {
+		*dir_data = DMA_FROM_DEVICE;
+		return host->dma_chan_rx;
+	}
+	*dir_data = DMA_TO_DEVICE;
+	return host->dma_chan_tx;
+}
+
+/* Unmap unless pre_req mapped it, in which case post_req unmaps it */
+static void bcm2835_sdhost_dma_unmap(struct bcm2835_host *host,
+				     struct mmc_data *data)
+{
+	struct dma_chan *dma_chan;
+	u32 dir_data;
+
+	if (data->host_cookie)
+		return;
+
+	dma_chan = bcm2835_sdhost_dma_chan(host, data, &dir_data);
+	dma_unmap_sg(dma_chan->device->dev, data->sg, data->sg_len, dir_data);
+}
 
 static void bcm2835_sdhost_dma_complete(void *param)
 {
 	struct bcm2835_host *host = param;
 	struct dma_chan *dma_chan;
 	unsigned long flags;
+	bool finish;
 	u32 dir_data;
 
 	spin_lock_irqsave(&host->lock, flags);
+	host->in_dma_callback = 1;
 
 	if (host->data) {
 		bool write_complete;
@@ -455,15 +525,25 @@ static void bcm2835_sdhost_dma_complete(void *param)
 				dir_data = DMA_FROM_DEVICE;
 			}
 
-			dma_unmap_sg(dma_chan->device->dev,
-				     host->data->sg, host->data->sg_len,
-				     dir_data);
+			if (!host->data->host_cookie)
+				dma_unmap_sg(dma_chan->device->dev,
+					     host->data->sg, host->data->sg_len,
+					     dir_data);
 
 			bcm2835_sdhost_finish_data(host);
 		}
 	}
 
+	host->in_dma_callback = 0;
+	finish = host->finish_pending;
+	host->finish_pending = 0;
+	if (finish)
+		host->stats.dma_finished++;
+
 	spin_unlock_irqrestore(&host->lock, flags);
+
+	if (finish)
+		bcm2835_sdhost_tasklet_finish((unsigned long)host);
 }
 
 static bool data_transfer_wait(struct bcm2835_host *host, const char *caller)
@@ -595,49 +675,84 @@ static void bcm2835_sdhost_transfer_pio(struct bcm2835_host *host)
 }
 
 
-static void bcm2835_sdhost_transfer_dma(struct bcm2835_host *host)
+/*
+ * Maps @data, unless pre_req already has, and prepares its descriptor.
+ * Done before the command is sent so the transfer can start right away.
+ */
+static struct dma_async_tx_descriptor *
+bcm2835_sdhost_prep_dma(struct bcm2835_host *host, struct mmc_data *data)
 {
-	u32 len, dir_data, dir_slave;
 	struct dma_async_tx_descriptor *desc = NULL;
 	struct dma_chan *dma_chan;
+	u32 dir_data, dir_slave;
+	int len;
 
-	pr_debug("bcm2835_sdhost_transfer_dma()\n");
-
-	WARN_ON(!host->data);
-
-	if (!host->data)
-		return;
-
-	if (host->data->flags & MMC_DATA_READ) {
-		dma_chan = host->dma_chan_rx;
-		dir_data = DMA_FROM_DEVICE;
-		dir_slave = DMA_DEV_TO_MEM;
-	} else {
-		dma_chan = host->dma_chan_tx;
-		dir_data = DMA_TO_DEVICE;
-		dir_slave = DMA_MEM_TO_DEV;
-	}
+	dma_chan = bcm2835_sdhost_dma_chan(host, data, &dir_data);
+	dir_slave = (data->flags & MMC_DATA_READ) ?
+		DMA_DEV_TO_MEM : DMA_MEM_TO_DEV;
 
 	BUG_ON(!dma_chan->device);
 	BUG_ON(!dma_chan->device->dev);
-	BUG_ON(!host->data->sg);
+	BUG_ON(!data->sg);
 
-	len = dma_map_sg(dma_chan->device->dev, host->data->sg,
-			 host->data->sg_len, dir_data);
+	if (data->host_cookie)
+		len = data->host_cookie;
+	else
+		len = dma_map_sg(dma_chan->device->dev, data->sg,
+				 data->sg_len, dir_data);
 	if (len > 0) {
-		desc = dmaengine_prep_slave_sg(dma_chan, host->data->sg,
+		desc = dmaengine_prep_slave_sg(dma_chan, data->sg,
 					       len, dir_slave,
 					       DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
 	} else {
 		dev_err(mmc_dev(host->mmc), "dma_map_sg returned zero length\n");
+		return NULL;
 	}
-	if (desc) {
-		desc->callback = bcm2835_sdhost_dma_complete;
-		desc->callback_param = host;
-		dmaengine_submit(desc);
-		dma_async_issue_pending(dma_chan);
+	if (!desc) {
+		bcm2835_sdhost_dma_unmap(host, data);
+		return NULL;
+	}
+
+	desc->callback = bcm2835_sdhost_dma_complete;
+	desc->callback_param = host;
+	return desc;
+}
+
+static void bcm2835_sdhost_start_dma(struct bcm2835_host *host,
+				     struct mmc_data *data,
+				     struct dma_async_tx_descriptor *desc)
+{
+	struct dma_chan *dma_chan;
+	u32 dir_data;
+
+	dma_chan = bcm2835_sdhost_dma_chan(host, data, &dir_data);
+	dmaengine_submit(desc);
+
+	/* the command never got as far as setting up the transfer */
+	if (host->data != data || !host->use_dma) {
+		dmaengine_terminate_all(dma_chan);
+		bcm2835_sdhost_dma_unmap(host, data);
+		return;
 	}
 
+	dma_async_issue_pending(dma_chan);
+}
+
+static void bcm2835_sdhost_transfer_dma(struct bcm2835_host *host)
+{
+	struct dma_async_tx_descriptor *desc;
+	struct mmc_data *data = host->data;
+
+	pr_debug("bcm2835_sdhost_transfer_dma()\n");
+
+	WARN_ON(!data);
+
+	if (!data)
+		return;
+
+	desc = bcm2835_sdhost_prep_dma(host, data);
+	if (desc)
+		bcm2835_sdhost_start_dma(host, data, desc);
 }
 
 
@@ -676,7 +791,7 @@ static void bcm2835_sdhost_prepare_data(struct bcm2835_host *host, struct mmc_co
 	host->flush_fifo = 0;
 	host->data->bytes_xfered = 0;
 
-	host->use_dma = host->have_dma && (data->blocks > host->pio_limit);
+	host->use_dma = bcm2835_sdhost_data_uses_dma(host, data);
 	if (!host->use_dma) {
 		int flags;
 
@@ -728,7 +843,7 @@ void bcm2835_sdhost_send_command(struct bcm2835_host *host, struct mmc_command *
 				mmc_hostname(host->mmc));
 			bcm2835_sdhost_dumpregs(host);
 			cmd->error = -EIO;
-			tasklet_schedule(&host->finish_tasklet);
+			bcm2835_sdhost_schedule_finish(host);
 			return;
 		}
 		timeout--;
@@ -759,7 +874,7 @@ void bcm2835_sdhost_send_command(struct bcm2835_host *host, struct mmc_command *
 		pr_err("%s: unsupported response type!\n",
 			mmc_hostname(host->mmc));
 		cmd->error = -EINVAL;
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 		return;
 	}
 
@@ -869,7 +984,7 @@ static void bcm2835_sdhost_transfer_complete(struct bcm2835_host *host)
 		if (!host->use_busy)
 			bcm2835_sdhost_finish_command(host);
 	} else {
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 	}
 }
 
@@ -913,7 +1028,7 @@ static void bcm2835_sdhost_finish_command(struct bcm2835_host *host)
 		       mmc_hostname(host->mmc));
 		bcm2835_sdhost_dumpregs(host);
 		host->cmd->error = -EIO;
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 		return;
 	}
 
@@ -929,7 +1044,7 @@ static void bcm2835_sdhost_finish_command(struct bcm2835_host *host)
 			       mmc_hostname(host->mmc));
 			bcm2835_sdhost_dumpregs(host);
 			host->cmd->error = -EIO;
-			tasklet_schedule(&host->finish_tasklet);
+			bcm2835_sdhost_schedule_finish(host);
 			return;
 		}
 	}
@@ -961,7 +1076,7 @@ static void bcm2835_sdhost_finish_command(struct bcm2835_host *host)
 			bcm2835_sdhost_dumpregs(host);
 			host->cmd->error = -EIO;
 		}
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 		return;
 	}
 
@@ -996,12 +1111,12 @@ static void bcm2835_sdhost_finish_command(struct bcm2835_host *host)
 			bcm2835_sdhost_finish_command(host);
 	} else if (host->cmd == host->mrq->stop)
 		/* Finished CMD12 */
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 	else {
 		/* Processed actual command. */
 		host->cmd = NULL;
 		if (!host->data)
-			tasklet_schedule(&host->finish_tasklet);
+			bcm2835_sdhost_schedule_finish(host);
 		else if (host->data_complete)
 			bcm2835_sdhost_transfer_complete(host);
 	}
@@ -1031,7 +1146,7 @@ static void bcm2835_sdhost_timeout(unsigned long data)
 				host->mrq->cmd->error = -ETIMEDOUT;
 
 			pr_debug("timeout_timer tasklet_schedule\n");
-			tasklet_schedule(&host->finish_tasklet);
+			bcm2835_sdhost_schedule_finish(host);
 		}
 	}
 
@@ -1138,7 +1253,7 @@ static u32 bcm2835_sdhost_busy_irq(struct bcm2835_host *host, u32 intmask)
 			host->cmd->error = -ETIMEDOUT;
 
 		bcm2835_sdhost_dumpregs(host);
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 	}
 	else
 		bcm2835_sdhost_finish_command(host);
@@ -1170,7 +1285,7 @@ static u32 bcm2835_sdhost_data_irq(struct bcm2835_host *host, u32 intmask)
 			host->data->error = -ETIMEDOUT;
 
 		bcm2835_sdhost_dumpregs(host);
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 		return handled;
 	}
 
@@ -1197,8 +1312,6 @@ static u32 bcm2835_sdhost_data_irq(struct bcm2835_host *host, u32 intmask)
 
 static u32 bcm2835_sdhost_block_irq(struct bcm2835_host *host, u32 intmask)
 {
-	struct dma_chan *dma_chan;
-	u32 dir_data;
 	const u32 handled = (SDHSTS_REW_TIME_OUT |
 			     SDHSTS_CRC16_ERROR |
 			     SDHSTS_FIFO_ERROR);
@@ -1222,7 +1335,7 @@ static u32 bcm2835_sdhost_block_irq(struct bcm2835_host *host, u32 intmask)
 
 		if (host->debug)
 			bcm2835_sdhost_dumpregs(host);
-		tasklet_schedule(&host->finish_tasklet);
+		bcm2835_sdhost_schedule_finish(host);
 		return handled;
 	}
 
@@ -1242,11 +1355,7 @@ static u32 bcm2835_sdhost_block_irq(struct bcm2835_host *host, u32 intmask)
 				  jiffies + host->pio_timeout);
 		}
 	} else if (host->data->flags & MMC_DATA_WRITE) {
-		dma_chan = host->dma_chan_tx;
-		dir_data = DMA_TO_DEVICE;
-		dma_unmap_sg(dma_chan->device->dev,
-			     host->data->sg, host->data->sg_len,
-			     dir_data);
+		bcm2835_sdhost_dma_unmap(host, host->data);
 
 		bcm2835_sdhost_finish_data(host);
 	}
@@ -1471,10 +1580,12 @@ void bcm2835_sdhost_set_clock(struct bcm2835_host *host, unsigned int clock)
 
 static void bcm2835_sdhost_request(struct mmc_host *mmc, struct mmc_request *mrq)
 {
+	struct dma_async_tx_descriptor *desc = NULL;
 	struct bcm2835_host *host;
 	unsigned long flags;
 
 	host = mmc_priv(mmc);
+	host->req_start = ktime_get();
 
 	if (host->debug) {
 		struct mmc_command *cmd = mrq->cmd;
@@ -1500,6 +1611,10 @@ static void bcm2835_sdhost_request(struct mmc_host *mmc, struct mmc_request *mrq
 		return;
 	}
 
+	if (!mrq->sbc && mrq->data &&
+	    bcm2835_sdhost_data_uses_dma(host, mrq->data))
+		desc = bcm2835_sdhost_prep_dma(host, mrq->data);
+
 	spin_lock_irqsave(&host->lock, flags);
 
 	WARN_ON(host->mrq != NULL);
@@ -1514,15 +1629,57 @@ static void bcm2835_sdhost_request(struct mmc_host *mmc, struct mmc_request *mrq
 	mmiowb();
 	spin_unlock_irqrestore(&host->lock, flags);
 
-	if (!mrq->sbc && mrq->cmd->data && host->use_dma)
+	if (desc)
 		/* DMA transfer starts now, PIO starts after irq */
-		bcm2835_sdhost_transfer_dma(host);
+		bcm2835_sdhost_start_dma(host, mrq->data, desc);
 
 	if (!host->use_busy)
 		bcm2835_sdhost_finish_command(host);
 }
 
 
+static void bcm2835_sdhost_pre_req(struct mmc_host *mmc,
+				   struct mmc_request *mrq, bool is_first_req)
+{
+	struct bcm2835_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	struct dma_chan *dma_chan;
+	u32 dir_data;
+	int len;
+
+	if (!data)
+		return;
+
+	data->host_cookie = 0;
+	if (!bcm2835_sdhost_data_uses_dma(host, data))
+		return;
+
+	/* map while the previous request is still transferring */
+	dma_chan = bcm2835_sdhost_dma_chan(host, data, &dir_data);
+	len = dma_map_sg(dma_chan->device->dev, data->sg, data->sg_len,
+			 dir_data);
+	if (len > 0) {
+		data->host_cookie = len;
+		host->stats.premapped++;
+	}
+}
+
+static void bcm2835_sdhost_post_req(struct mmc_host *mmc,
+				    struct mmc_request *mrq, int err)
+{
+	struct bcm2835_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	struct dma_chan *dma_chan;
+	u32 dir_data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_chan = bcm2835_sdhost_dma_chan(host, data, &dir_data);
+	dma_unmap_sg(dma_chan->device->dev, data->sg, data->sg_len, dir_data);
+	data->host_cookie = 0;
+}
+
 static void bcm2835_sdhost_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 {
 
@@ -1581,6 +1738,8 @@ static int bcm2835_sdhost_multi_io_quirk(struct mmc_card *card,
 
 static struct mmc_host_ops bcm2835_sdhost_ops = {
 	.request = bcm2835_sdhost_request,
+	.pre_req = bcm2835_sdhost_pre_req,
+	.post_req = bcm2835_sdhost_post_req,
 	.set_ios = bcm2835_sdhost_set_ios,
 	.enable_sdio_irq = bcm2835_sdhost_enable_sdio_irq,
 	.hw_reset = bcm2835_sdhost_reset,
@@ -1588,6 +1747,30 @@ static struct mmc_host_ops bcm2835_sdhost_ops = {
 };
 
 
+static void bcm2835_sdhost_account(struct bcm2835_host *host,
+				   struct mmc_request *mrq)
+{
+	struct bcm2835_sdhost_stats *stats = &host->stats;
+	struct mmc_data *data = mrq->data;
+	u32 us, t;
+	int dir, i;
+
+	if (!data || data->error)
+		return;
+
+	dir = (data->flags & MMC_DATA_WRITE) ? 1 : 0;
+	us = ktime_us_delta(ktime_get(), host->req_start);
+
+	stats->reqs[dir]++;
+	stats->bytes[dir] += data->bytes_xfered;
+	stats->total_us[dir] += us;
+	if (us > stats->max_us[dir])
+		stats->max_us[dir] = us;
+	for (i = 0, t = us / LAT_BUCKET0_US; t && i < LAT_BUCKETS - 1; i++)
+		t >>= 1;
+	stats->hist[dir][i]++;
+}
+
 static void bcm2835_sdhost_tasklet_finish(unsigned long param)
 {
 	struct bcm2835_host *host;
@@ -1631,6 +1814,8 @@ static void bcm2835_sdhost_tasklet_finish(unsigned long param)
 		}
 	}
 
+	bcm2835_sdhost_account(host, mrq);
+
 	host->mrq = NULL;
 	host->cmd = NULL;
 	host->data = NULL;
@@ -1643,6 +1828,63 @@ static void bcm2835_sdhost_tasklet_finish(unsigned long param)
 
 
 
+static int bcm2835_sdhost_stats_show(struct seq_file *s, void *unused)
+{
+	static const char * const dir_names[] = { "read", "write" };
+	struct bcm2835_host *host = s->private;
+	struct bcm2835_sdhost_stats stats;
+	unsigned long flags;
+	int dir, i;
+
+	spin_lock_irqsave(&host->lock, flags);
+	stats = host->stats;
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	for (dir = 0; dir < 2; dir++) {
+		u32 limit = LAT_BUCKET0_US;
+
+		seq_printf(s, "%s: %lu requests, %llu bytes, avg %llu us, max %u us\n",
+			   dir_names[dir], stats.reqs[dir], stats.bytes[dir],
+			   stats.reqs[dir] ?
+			   div_u64(stats.total_us[dir], stats.reqs[dir]) : 0,
+			   stats.max_us[dir]);
+		for (i = 0; i < LAT_BUCKETS - 1; i++, limit <<= 1)
+			seq_printf(s, "  < %6u us: %lu\n", limit,
+				   stats.hist[dir][i]);
+		seq_printf(s, "  >= %5u us: %lu\n", limit, stats.hist[dir][i]);
+	}
+	seq_printf(s, "premapped: %lu\n", stats.premapped);
+	seq_printf(s, "finished from dma callback: %lu\n", stats.dma_finished);
+	return 0;
+}
+
+static int bcm2835_sdhost_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bcm2835_sdhost_stats_show, inode->i_private);
+}
+
+/* any write clears the counters */
+static ssize_t bcm2835_sdhost_stats_write(struct file *file,
+					  const char __user *buf,
+					  size_t count, loff_t *ppos)
+{
+	struct bcm2835_host *host = ((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&host->lock, flags);
+	memset(&host->stats, 0, sizeof(host->stats));
+	spin_unlock_irqrestore(&host->lock, flags);
+	return count;
+}
+
+static const struct file_operations bcm2835_sdhost_stats_fops = {
+	.open		= bcm2835_sdhost_stats_open,
+	.read		= seq_read,
+	.write		= bcm2835_sdhost_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 int bcm2835_sdhost_add_host(struct bcm2835_host *host)
 {
 	struct mmc_host *mmc;
@@ -1734,6 +1976,10 @@ int bcm2835_sdhost_add_host(struct bcm2835_host *host)
 	mmiowb();
 	mmc_add_host(mmc);
 
+	/* removed along with the rest of the host's debugfs directory */
+	debugfs_create_file("stats", S_IRUSR | S_IWUSR, mmc->debugfs_root,
+			    host, &bcm2835_sdhost_stats_fops);
+
 	pio_limit_string[0] = '\0';
 	if (host->have_dma && (host->pio_limit > 0))
 		sprintf(pio_limit_string, " (>%d)", host->pio_limit);
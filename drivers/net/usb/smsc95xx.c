@@ -46,6 +46,8 @@
 #define SMSC95XX_INTERNAL_PHY_ID	(1)
 #define SMSC95XX_TX_OVERHEAD		(8)
 #define SMSC95XX_TX_OVERHEAD_CSUM	(12)
+#define SMSC95XX_NAPI_WEIGHT		(64)
+#define SMSC95XX_TX_AGGR_SIZE		(16 * 1024)
 #define SUPPORTED_WAKE			(WAKE_PHY | WAKE_UCAST | WAKE_BCAST | \
 					 WAKE_MCAST | WAKE_ARP | WAKE_MAGIC)
 
@@ -69,12 +71,33 @@ struct smsc95xx_priv {
 	spinlock_t mac_cr_lock;
 	u8 features;
 	u8 suspend_flags;
+	struct napi_struct napi;
+	struct sk_buff_head rxq;
+	struct sk_buff *tx_aggr_skb;
+	u32 tx_aggr_packets;
+	u32 tx_aggr_payload;
 };
 
 static bool turbo_mode = false;
 module_param(turbo_mode, bool, 0644);
 MODULE_PARM_DESC(turbo_mode, "Enable multiple frames per Rx transaction");
 
+static unsigned int rx_burst_cap;
+module_param(rx_burst_cap, uint, 0644);
+MODULE_PARM_DESC(rx_burst_cap, "Rx burst size in bytes with turbo_mode, 0 for the per-speed default");
+
+static unsigned int bulk_in_delay = DEFAULT_BULK_IN_DELAY;
+module_param(bulk_in_delay, uint, 0644);
+MODULE_PARM_DESC(bulk_in_delay, "Time the device waits to fill a Rx burst before sending it short");
+
+static int rx_copybreak = 256;
+module_param(rx_copybreak, int, 0644);
+MODULE_PARM_DESC(rx_copybreak, "Copy received frames up to this size instead of cloning the Rx buffer");
+
+static bool tx_aggr = false;
+module_param(tx_aggr, bool, 0644);
+MODULE_PARM_DESC(tx_aggr, "Pack multiple frames per Tx transaction when the stack has more queued");
+
 static char *macaddr = ":";
 module_param(macaddr, charp, 0);
 MODULE_PARM_DESC(macaddr, "MAC address");
@@ -1003,12 +1026,19 @@ static int smsc95xx_reset(struct usbnet *dev)
 	if (!turbo_mode) {
 		burst_cap = 0;
 		dev->rx_urb_size = MAX_SINGLE_PACKET_SIZE;
-	} else if (dev->udev->speed == USB_SPEED_HIGH) {
-		burst_cap = DEFAULT_HS_BURST_CAP_SIZE / HS_USB_PKT_SIZE;
-		dev->rx_urb_size = DEFAULT_HS_BURST_CAP_SIZE;
 	} else {
-		burst_cap = DEFAULT_FS_BURST_CAP_SIZE / FS_USB_PKT_SIZE;
-		dev->rx_urb_size = DEFAULT_FS_BURST_CAP_SIZE;
+		u32 pkt_size = (dev->udev->speed == USB_SPEED_HIGH) ?
+			HS_USB_PKT_SIZE : FS_USB_PKT_SIZE;
+
+		if (rx_burst_cap >= MAX_SINGLE_PACKET_SIZE)
+			/* BURST_CAP holds an 8 bit packet count */
+			burst_cap = min_t(u32, rx_burst_cap / pkt_size, 255);
+		else if (dev->udev->speed == USB_SPEED_HIGH)
+			burst_cap = DEFAULT_HS_BURST_CAP_SIZE / pkt_size;
+		else
+			burst_cap = DEFAULT_FS_BURST_CAP_SIZE / pkt_size;
+
+		dev->rx_urb_size = burst_cap * pkt_size;
 	}
 
 	netif_dbg(dev, ifup, dev->net, "rx_urb_size=%ld\n",
@@ -1026,7 +1056,7 @@ static int smsc95xx_reset(struct usbnet *dev)
 		  "Read Value from BURST_CAP after writing: 0x%08x\n",
 		  read_buf);
 
-	ret = smsc95xx_write_reg(dev, BULK_IN_DLY, DEFAULT_BULK_IN_DELAY);
+	ret = smsc95xx_write_reg(dev, BULK_IN_DLY, bulk_in_delay);
 	if (ret < 0)
 		return ret;
 
@@ -1142,9 +1172,44 @@ static int smsc95xx_reset(struct usbnet *dev)
 	return 0;
 }
 
+static int smsc95xx_open(struct net_device *net)
+{
+	struct usbnet *dev = netdev_priv(net);
+	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
+	int ret;
+
+	napi_enable(&pdata->napi);
+
+	ret = usbnet_open(net);
+	if (ret < 0)
+		napi_disable(&pdata->napi);
+
+	return ret;
+}
+
+static int smsc95xx_stop(struct net_device *net)
+{
+	struct usbnet *dev = netdev_priv(net);
+	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
+	int ret;
+
+	ret = usbnet_stop(net);
+
+	napi_disable(&pdata->napi);
+	skb_queue_purge(&pdata->rxq);
+
+	if (pdata->tx_aggr_skb) {
+		net->stats.tx_dropped += pdata->tx_aggr_packets;
+		dev_kfree_skb_any(pdata->tx_aggr_skb);
+		pdata->tx_aggr_skb = NULL;
+	}
+
+	return ret;
+}
+
 static const struct net_device_ops smsc95xx_netdev_ops = {
-	.ndo_open		= usbnet_open,
-	.ndo_stop		= usbnet_stop,
+	.ndo_open		= smsc95xx_open,
+	.ndo_stop		= smsc95xx_stop,
 	.ndo_start_xmit		= usbnet_start_xmit,
 	.ndo_tx_timeout		= usbnet_tx_timeout,
 	.ndo_change_mtu		= usbnet_change_mtu,
@@ -1155,6 +1220,8 @@ static const struct net_device_ops smsc95xx_netdev_ops = {
 	.ndo_set_features	= smsc95xx_set_features,
 };
 
+static int smsc95xx_poll(struct napi_struct *napi, int budget);
+
 static int smsc95xx_bind(struct usbnet *dev, struct usb_interface *intf)
 {
 	struct smsc95xx_priv *pdata = NULL;
@@ -1178,6 +1245,10 @@ static int smsc95xx_bind(struct usbnet *dev, struct usb_interface *intf)
 
 	spin_lock_init(&pdata->mac_cr_lock);
 
+	skb_queue_head_init(&pdata->rxq);
+	netif_napi_add(dev->net, &pdata->napi, smsc95xx_poll,
+		       SMSC95XX_NAPI_WEIGHT);
+
 	if (DEFAULT_TX_CSUM_ENABLE)
 		dev->net->features |= NETIF_F_HW_CSUM;
 	if (DEFAULT_RX_CSUM_ENABLE)
@@ -1216,6 +1287,7 @@ static void smsc95xx_unbind(struct usbnet *dev, struct usb_interface *intf)
 {
 	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
 	if (pdata) {
+		netif_napi_del(&pdata->napi);
 		netif_dbg(dev, ifdown, dev->net, "free pdata\n");
 		kfree(pdata);
 		pdata = NULL;
@@ -1791,12 +1863,101 @@ static void smsc95xx_rx_csum_offload(struct sk_buff *skb)
 	skb_trim(skb, skb->len - 2);
 }
 
+/* Collects a received frame for smsc95xx_poll(), which feeds it to GRO */
+static void smsc95xx_rx_queue(struct usbnet *dev, struct sk_buff_head *list,
+			      struct sk_buff *skb)
+{
+	/* usbnet holds frames back while Rx is paused */
+	if (test_bit(EVENT_RX_PAUSED, &dev->flags)) {
+		usbnet_skb_return(dev, skb);
+		return;
+	}
+
+	skb->protocol = eth_type_trans(skb, dev->net);
+	dev->net->stats.rx_packets++;
+	dev->net->stats.rx_bytes += skb->len;
+	memset(skb->cb, 0, sizeof(struct skb_data));
+
+	if (skb_defer_rx_timestamp(skb))
+		return;
+
+	__skb_queue_tail(list, skb);
+}
+
+static int smsc95xx_poll(struct napi_struct *napi, int budget)
+{
+	struct smsc95xx_priv *pdata =
+		container_of(napi, struct smsc95xx_priv, napi);
+	struct sk_buff_head process;
+	struct sk_buff *skb;
+	unsigned long flags;
+	int work = 0;
+
+	__skb_queue_head_init(&process);
+
+	spin_lock_irqsave(&pdata->rxq.lock, flags);
+	while (work < budget && (skb = __skb_dequeue(&pdata->rxq))) {
+		__skb_queue_tail(&process, skb);
+		work++;
+	}
+	spin_unlock_irqrestore(&pdata->rxq.lock, flags);
+
+	while ((skb = __skb_dequeue(&process)))
+		napi_gro_receive(napi, skb);
+
+	if (work < budget) {
+		napi_complete(napi);
+
+		/* catch frames queued after the queue was drained */
+		if (!skb_queue_empty(&pdata->rxq))
+			napi_schedule(napi);
+	}
+
+	return work;
+}
+
+/* Small frames are copied so they don't pin the whole Rx buffer */
+static struct sk_buff *smsc95xx_rx_frame(struct usbnet *dev,
+					 struct sk_buff *skb,
+					 unsigned char *packet, u16 size)
+{
+	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
+	struct sk_buff *ax_skb;
+
+	if (size <= rx_copybreak) {
+		ax_skb = napi_alloc_skb(&pdata->napi, size);
+		if (ax_skb)
+			memcpy(skb_put(ax_skb, size), packet, size);
+		return ax_skb;
+	}
+
+	ax_skb = skb_clone(skb, GFP_ATOMIC);
+	if (ax_skb) {
+		ax_skb->len = size;
+		ax_skb->data = packet;
+		skb_set_tail_pointer(ax_skb, size);
+	}
+
+	return ax_skb;
+}
+
 static int smsc95xx_rx_fixup(struct usbnet *dev, struct sk_buff *skb)
 {
+	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
+	struct sk_buff_head frames;
+	unsigned long flags;
+	int ret = 1;
+
 	/* This check is no longer done by usbnet */
 	if (skb->len < dev->net->hard_header_len)
 		return 0;
 
+	/*
+	 * With FLAG_MULTI_PACKET every frame of the burst, the last one
+	 * included, is passed up from here and usbnet frees the Rx buffer.
+	 */
+	__skb_queue_head_init(&frames);
+
 	while (skb->len > 0) {
 		u32 header, align_count;
 		struct sk_buff *ax_skb;
@@ -1830,36 +1991,26 @@ static int smsc95xx_rx_fixup(struct usbnet *dev, struct sk_buff *skb)
 			}
 		} else {
 			/* ETH_FRAME_LEN + 4(CRC) + 2(COE) + 4(Vlan) */
-			if (unlikely(size > (ETH_FRAME_LEN + 12))) {
+			if (unlikely(size > (ETH_FRAME_LEN + 12) ||
+				     size > skb->len)) {
 				netif_dbg(dev, rx_err, dev->net,
 					  "size err header=0x%08x\n", header);
-				return 0;
-			}
-
-			/* last frame in this batch */
-			if (skb->len == size) {
-				if (dev->net->features & NETIF_F_RXCSUM)
-					smsc95xx_rx_csum_offload(skb);
-				skb_trim(skb, skb->len - 4); /* remove fcs */
-
-				return 1;
+				ret = 0;
+				break;
 			}
 
-			ax_skb = skb_clone(skb, GFP_ATOMIC);
+			ax_skb = smsc95xx_rx_frame(dev, skb, packet, size);
 			if (unlikely(!ax_skb)) {
 				netdev_warn(dev->net, "Error allocating skb\n");
-				return 0;
+				ret = 0;
+				break;
 			}
 
-			ax_skb->len = size;
-			ax_skb->data = packet;
-			skb_set_tail_pointer(ax_skb, size);
-
 			if (dev->net->features & NETIF_F_RXCSUM)
 				smsc95xx_rx_csum_offload(ax_skb);
 			skb_trim(ax_skb, ax_skb->len - 4); /* remove fcs */
 
-			usbnet_skb_return(dev, ax_skb);
+			smsc95xx_rx_queue(dev, &frames, ax_skb);
 		}
 
 		skb_pull(skb, size);
@@ -1869,12 +2020,15 @@ static int smsc95xx_rx_fixup(struct usbnet *dev, struct sk_buff *skb)
 			skb_pull(skb, align_count);
 	}
 
-	if (unlikely(skb->len < 0)) {
-		netdev_warn(dev->net, "invalid rx length<0 %d\n", skb->len);
-		return 0;
+	if (!skb_queue_empty(&frames)) {
+		spin_lock_irqsave(&pdata->rxq.lock, flags);
+		skb_queue_splice_tail_init(&frames, &pdata->rxq);
+		spin_unlock_irqrestore(&pdata->rxq.lock, flags);
+
+		napi_schedule(&pdata->napi);
 	}
 
-	return 1;
+	return ret;
 }
 
 static u32 smsc95xx_calc_csum_preamble(struct sk_buff *skb)
@@ -1884,7 +2038,8 @@ static u32 smsc95xx_calc_csum_preamble(struct sk_buff *skb)
 	return (high_16 << 16) | low_16;
 }
 
-static struct sk_buff *smsc95xx_tx_fixup(struct usbnet *dev,
+/* Prepends the Tx command words (and checksum preamble) to one frame */
+static struct sk_buff *smsc95xx_tx_frame(struct usbnet *dev,
 					 struct sk_buff *skb, gfp_t flags)
 {
 	bool csum = skb->ip_summed == CHECKSUM_PARTIAL;
@@ -1938,6 +2093,73 @@ static struct sk_buff *smsc95xx_tx_fixup(struct usbnet *dev,
 	return skb;
 }
 
+static struct sk_buff *smsc95xx_tx_aggr_flush(struct usbnet *dev)
+{
+	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
+	struct sk_buff *aggr = pdata->tx_aggr_skb;
+
+	pdata->tx_aggr_skb = NULL;
+	usbnet_set_skb_tx_stats(aggr, pdata->tx_aggr_packets,
+				pdata->tx_aggr_payload - aggr->len);
+	return aggr;
+}
+
+/*
+ * With tx_aggr set, frames the stack marks with xmit_more are packed into
+ * one bulk-out transfer, each starting on a 4 byte boundary behind its own
+ * command words. The batch goes out with the first frame that has no
+ * successor queued, or once another full-sized frame might not fit, so no
+ * timer is needed and an idle link sees no added latency.
+ */
+static struct sk_buff *smsc95xx_tx_fixup(struct usbnet *dev,
+					 struct sk_buff *skb, gfp_t flags)
+{
+	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
+	bool more = skb->xmit_more;
+	unsigned int payload = skb->len;
+	struct sk_buff *aggr;
+
+	skb = smsc95xx_tx_frame(dev, skb, flags);
+	if (!skb) {
+		/* usbnet doesn't count this for FLAG_MULTI_PACKET drivers */
+		dev->net->stats.tx_dropped++;
+		if (more || !pdata->tx_aggr_skb)
+			return NULL;
+		return smsc95xx_tx_aggr_flush(dev);
+	}
+
+	aggr = pdata->tx_aggr_skb;
+	if (!aggr) {
+		if (!tx_aggr || !more)
+			goto send_single;
+
+		aggr = alloc_skb(SMSC95XX_TX_AGGR_SIZE, flags);
+		if (!aggr)
+			goto send_single;
+
+		pdata->tx_aggr_skb = aggr;
+		pdata->tx_aggr_packets = 0;
+		pdata->tx_aggr_payload = 0;
+	}
+
+	if (aggr->len % 4)
+		memset(skb_put(aggr, 4 - aggr->len % 4), 0, 4 - aggr->len % 4);
+	memcpy(skb_put(aggr, skb->len), skb->data, skb->len);
+	dev_kfree_skb_any(skb);
+
+	pdata->tx_aggr_packets++;
+	pdata->tx_aggr_payload += payload;
+
+	if (more && skb_tailroom(aggr) >= dev->hard_mtu + 3)
+		return NULL;
+
+	return smsc95xx_tx_aggr_flush(dev);
+
+send_single:
+	usbnet_set_skb_tx_stats(skb, 1, payload - skb->len);
+	return skb;
+}
+
 static int smsc95xx_manage_power(struct usbnet *dev, int on)
 {
 	struct smsc95xx_priv *pdata = (struct smsc95xx_priv *)(dev->data[0]);
@@ -1968,7 +2190,8 @@ static const struct driver_info smsc95xx_info = {
 	.tx_fixup	= smsc95xx_tx_fixup,
 	.status		= smsc95xx_status,
 	.manage_power	= smsc95xx_manage_power,
-	.flags		= FLAG_ETHER | FLAG_SEND_ZLP | FLAG_LINK_INTR,
+	.flags		= FLAG_ETHER | FLAG_SEND_ZLP | FLAG_LINK_INTR |
+			  FLAG_MULTI_PACKET,
 };
 
 static const struct usb_device_id products[] = {
@@ -30,6 +30,9 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/interval_tree_generic.h>
+#include <linux/wait.h>
 #include <linux/shmem_fs.h>
 #include "ashmem.h"
 
@@ -40,19 +43,21 @@
 /**
  * struct ashmem_area - The anonymous shared memory area
  * @name:		The optional name in /proc/pid/maps
- * @unpinned_list:	The list of all ashmem areas
+ * @lock:		Protects everything below and the area's ranges
+ * @unpinned:		Interval tree of the area's unpinned ranges
  * @file:		The shmem-based backing file
  * @size:		The size of the mapping, in bytes
  * @prot_masks:		The allowed protection bits, as vm_flags
  *
  * The lifecycle of this structure is from our parent file's open() until
- * its release(). It is also protected by 'ashmem_mutex'
+ * its release(). It is protected by its own 'lock'.
  *
  * Warning: Mappings do NOT pin this structure; It dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];
-	struct list_head unpinned_list;
+	struct mutex lock;
+	struct rb_root unpinned;
 	struct file *file;
 	size_t size;
 	unsigned long prot_mask;
@@ -61,40 +66,50 @@ struct ashmem_area {
 /**
  * struct ashmem_range - A range of unpinned/evictable pages
  * @lru:	         The entry in the LRU list
- * @unpinned:	         The entry in its area's unpinned list
+ * @rb:		         The node in its area's unpinned interval tree
  * @asma:	         The associated anonymous shared memory area.
  * @pgstart:	         The starting page (inclusive)
  * @pgend:	         The ending page (inclusive)
+ * @subtree_last:        The highest pgend below @rb, for the interval tree
  * @purged:	         The purge status (ASHMEM_NOT or ASHMEM_WAS_PURGED)
  *
  * The lifecycle of this structure is from unpin to pin.
- * It is protected by 'ashmem_mutex'
+ * It is protected by its area's 'lock', and @lru by 'ashmem_lru_lock'.
  */
 struct ashmem_range {
 	struct list_head lru;
-	struct list_head unpinned;
+	struct rb_node rb;
 	struct ashmem_area *asma;
 	size_t pgstart;
 	size_t pgend;
+	size_t subtree_last;
 	unsigned int purged;
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
 /**
  * long lru_count - The count of pages on our LRU list.
  *
- * This is protected by ashmem_mutex.
+ * This is protected by ashmem_lru_lock.
  */
 static unsigned long lru_count;
 
 /**
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->lock -> ashmem_lru_lock
+ *                asma->lock -> i_mutex -> i_alloc_sem
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/*
+ * The shrinker drops an area's lock from under ashmem_release(); release
+ * waits for it to be done before freeing the area.
+ */
+static atomic_t ashmem_shrink_inflight = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(ashmem_shrink_wait);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -111,15 +126,11 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 #define page_range_subsumed_by_range(range, start, end) \
 	(((range)->pgstart <= (start)) && ((range)->pgend >= (end)))
 
-#define page_in_range(range, page) \
-	(((range)->pgstart <= (page)) && ((range)->pgend >= (page)))
-
-#define page_range_in_range(range, start, end) \
-	(page_in_range(range, start) || page_in_range(range, end) || \
-		page_range_subsumes_range(range, start, end))
+#define range_start(range)	((range)->pgstart)
+#define range_last(range)	((range)->pgend)
 
-#define range_before_page(range, page) \
-	((range)->pgend < (page))
+INTERVAL_TREE_DEFINE(struct ashmem_range, rb, size_t, subtree_last,
+		     range_start, range_last, static, range_tree)
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
@@ -132,37 +143,46 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
  */
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 /**
- * lru_del() - Removes a range of memory from the LRU list
+ * __lru_del() - Removes a range of memory from the LRU list
  * @range:     The memory range being removed
  *
  * The range is first deleted from the LRU list.
  * After this, the size of the range is removed from @lru_count
+ *
+ * Caller must hold ashmem_lru_lock.
  */
-static inline void lru_del(struct ashmem_range *range)
+static inline void __lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+static inline void lru_del(struct ashmem_range *range)
+{
+	spin_lock(&ashmem_lru_lock);
+	__lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
 /**
  * range_alloc() - Allocates and initializes a new ashmem_range structure
  * @asma:	   The associated ashmem_area
- * @prev_range:	   The previous ashmem_range in the sorted asma->unpinned list
  * @purged:	   Initial purge status (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * @start:	   The starting page (inclusive)
  * @end:	   The ending page (inclusive)
  *
- * This function is protected by ashmem_mutex.
+ * Caller must hold asma->lock.
  *
  * Return: 0 if successful, or -ENOMEM if there is an error
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
 	struct ashmem_range *range;
@@ -176,7 +196,7 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	range_tree_insert(range, &asma->unpinned);
 
 	if (range_on_lru(range))
 		lru_add(range);
@@ -190,7 +210,7 @@ static int range_alloc(struct ashmem_area *asma,
  */
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
+	range_tree_remove(range, &range->asma->unpinned);
 	if (range_on_lru(range))
 		lru_del(range);
 	kmem_cache_free(ashmem_range_cachep, range);
@@ -203,21 +223,24 @@ static void range_del(struct ashmem_range *range)
  * @end:	    The ending byte of the new range
  *
  * This does not modify the data inside the existing range in any way - It
- * simply shrinks the boundaries of the range.
- *
- * Theoretically, with a little tweaking, this could eventually be changed
- * to range_resize, and expand the lru_count if the new range is larger.
+ * simply shrinks the boundaries of the range. The range is taken out of
+ * the interval tree while its endpoints change.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
 {
 	size_t pre = range_size(range);
 
+	range_tree_remove(range, &range->asma->unpinned);
 	range->pgstart = start;
 	range->pgend = end;
+	range_tree_insert(range, &range->asma->unpinned);
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 /**
@@ -243,7 +266,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->lock);
+	asma->unpinned = RB_ROOT;
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -262,12 +286,15 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
+	mutex_lock(&asma->lock);
+	while ((range = range_tree_iter_first(&asma->unpinned, 0, SIZE_MAX)))
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
+
+	/* a shrinker that had our lock may still be unlocking it */
+	wait_event(ashmem_shrink_wait, !atomic_read(&ashmem_shrink_inflight));
 
 	if (asma->file)
 		fput(asma->file);
@@ -291,7 +318,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0)
@@ -302,7 +329,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 		goto out_unlock;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	/*
 	 * asma and asma->file are used outside the lock here.  We assume
@@ -318,7 +345,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	return ret;
 
 out_unlock:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -327,7 +354,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -347,7 +374,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -363,7 +390,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -413,7 +440,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_file = asma->file;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -434,29 +461,53 @@ out:
 static unsigned long
 ashmem_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
+	struct ashmem_area *asma;
 	unsigned long freed = 0;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (!(sc->gfp_mask & __GFP_FS))
 		return SHRINK_STOP;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE;
+	atomic_inc(&ashmem_shrink_inflight);
+	spin_lock(&ashmem_lru_lock);
+	while (sc->nr_to_scan && !list_empty(&ashmem_lru_list)) {
+		loff_t start, end;
+
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		asma = range->asma;
+		sc->nr_to_scan--;
 
-		vfs_fallocate(range->asma->file,
+		/*
+		 * Areas being pinned or unpinned are skipped rather than
+		 * waited for; we may even have been entered from one.
+		 */
+		if (!mutex_trylock(&asma->lock)) {
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			spin_unlock(&ashmem_lru_lock);
+			cond_resched();
+			spin_lock(&ashmem_lru_lock);
+			continue;
+		}
+		__lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE;
+		vfs_fallocate(asma->file,
 			      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
 			      start, end - start);
 		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
 		freed += range_size(range);
-		if (--sc->nr_to_scan <= 0)
-			break;
+		mutex_unlock(&asma->lock);
+
+		spin_lock(&ashmem_lru_lock);
 	}
-	mutex_unlock(&ashmem_mutex);
+	spin_unlock(&ashmem_lru_lock);
+
+	if (atomic_dec_and_test(&ashmem_shrink_inflight))
+		wake_up_all(&ashmem_shrink_wait);
 	return freed;
 }
 
@@ -485,7 +536,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -500,7 +551,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -511,10 +562,10 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	char local_name[ASHMEM_NAME_LEN];
 
 	/*
-	 * Holding the ashmem_mutex while doing a copy_from_user might cause
+	 * Holding asma->lock while doing a copy_from_user might cause
 	 * an data abort which would try to access mmap_sem. If another
 	 * thread has invoked ashmem_mmap then it will be holding the
-	 * semaphore and will be waiting for ashmem_mutex, there by leading to
+	 * semaphore and will be waiting for asma->lock, there by leading to
 	 * deadlock. We'll release the mutex  and take the name to a local
 	 * variable that does not need protection and later copy the local
 	 * variable to the structure member with lock held.
@@ -524,14 +575,14 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 		return len;
 	if (len == ASHMEM_NAME_LEN)
 		local_name[ASHMEM_NAME_LEN - 1] = '\0';
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file))
 		ret = -EINVAL;
 	else
 		strcpy(asma->name + ASHMEM_NAME_PREFIX_LEN, local_name);
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -547,7 +598,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 	 */
 	char local_name[ASHMEM_NAME_LEN];
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		/*
 		 * Copying only `len', instead of ASHMEM_NAME_LEN, bytes
@@ -559,7 +610,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 		len = sizeof(ASHMEM_NAME_DEF);
 		memcpy(local_name, ASHMEM_NAME_DEF, len);
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	/*
 	 * Now we are just copying from the stack variable to userland
@@ -574,17 +625,16 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	range = range_tree_iter_first(&asma->unpinned, pgstart, pgend);
+	while (range) {
+		next = range_tree_iter_next(range, pgstart, pgend);
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -600,38 +650,33 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 * 4. The requested range punches a hole in an existing range,
 		 *    so we have to update one side of the range and then
 		 *    create a new range for the other side.
+		 *
+		 * Whatever is left of a range no longer overlaps the request,
+		 * so moving it in the tree does not disturb the walk.
 		 */
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret |= range->purged;
-
-			/* Case #1: Easy. Just nuke the whole thing. */
-			if (page_range_subsumes_range(range, pgstart, pgend)) {
-				range_del(range);
-				continue;
-			}
-
-			/* Case #2: We overlap from the start, so adjust it */
-			if (range->pgstart >= pgstart) {
-				range_shrink(range, pgend + 1, range->pgend);
-				continue;
-			}
-
-			/* Case #3: We overlap from the rear, so adjust it */
-			if (range->pgend <= pgend) {
-				range_shrink(range, range->pgstart, pgstart-1);
-				continue;
-			}
+		ret |= range->purged;
 
+		/* Case #1: Easy. Just nuke the whole thing. */
+		if (page_range_subsumes_range(range, pgstart, pgend)) {
+			range_del(range);
+		/* Case #2: We overlap from the start, so adjust it */
+		} else if (range->pgstart >= pgstart) {
+			range_shrink(range, pgend + 1, range->pgend);
+		/* Case #3: We overlap from the rear, so adjust it */
+		} else if (range->pgend <= pgend) {
+			range_shrink(range, range->pgstart, pgstart - 1);
+		} else {
 			/*
 			 * Case #4: We eat a chunk out of the middle. A bit
 			 * more complicated, we allocate a new range for the
 			 * second half and adjust the first chunk's endpoint.
 			 */
-			range_alloc(asma, range, range->purged,
+			range_alloc(asma, range->purged,
 				    pgend + 1, range->pgend);
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
+		range = next;
 	}
 
 	return ret;
@@ -640,59 +685,46 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
+	size_t start = pgstart, end = pgend;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
-
-		/*
-		 * The user can ask us to unpin pages that are already entirely
-		 * or partially pinned. We handle those two cases here.
-		 */
+	/*
+	 * The user can ask us to unpin pages that are already entirely
+	 * or partially unpinned. Ranges never overlap, so everything that
+	 * overlaps the request is merged into a single new range.
+	 */
+	range = range_tree_iter_first(&asma->unpinned, pgstart, pgend);
+	while (range) {
+		next = range_tree_iter_next(range, pgstart, pgend);
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+		start = min_t(size_t, range->pgstart, start);
+		end = max_t(size_t, range->pgend, end);
+		purged |= range->purged;
+		range_del(range);
+		range = next;
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, start, end);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
-
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
-
-	return ret;
+	if (range_tree_iter_first(&asma->unpinned, pgstart, pgend))
+		return ASHMEM_IS_UNPINNED;
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -724,7 +756,17 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	/*
+	 * Nothing unpinned means nothing to do for a pin or a status query.
+	 * That is the common case, and it needs neither the lock nor the
+	 * tree: racing with an unpin of the same area is no different from
+	 * having run just before it.
+	 */
+	if (cmd != ASHMEM_UNPIN && !READ_ONCE(asma->unpinned.rb_node))
+		return cmd == ASHMEM_PIN ? ASHMEM_NOT_PURGED :
+					   ASHMEM_IS_PINNED;
+
+	mutex_lock(&asma->lock);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -738,7 +780,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -41,6 +41,12 @@ static void ion_page_pool_free_pages(struct ion_page_pool *pool,
 	__free_pages(page, pool->order);
 }
 
+static int ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	return ion_heap_pages_zero(page, PAGE_SIZE << pool->order,
+				   pgprot_writecombine(PAGE_KERNEL));
+}
+
 static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 {
 	mutex_lock(&pool->mutex);
@@ -73,19 +79,45 @@ static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 	return page;
 }
 
+static struct page *ion_page_pool_remove_dirty(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	BUG_ON(!pool->dirty_count);
+	page = list_first_entry(&pool->dirty_items, struct page, lru);
+	pool->dirty_count--;
+	list_del(&page->lru);
+	return page;
+}
+
 struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
 {
 	struct page *page = NULL;
+	bool dirty = false;
 
 	BUG_ON(!pool);
 
 	mutex_lock(&pool->mutex);
-	if (pool->high_count)
+	if (pool->high_count) {
 		page = ion_page_pool_remove(pool, true);
-	else if (pool->low_count)
+	} else if (pool->low_count) {
 		page = ion_page_pool_remove(pool, false);
+	} else if (pool->dirty_count) {
+		page = ion_page_pool_remove_dirty(pool);
+		dirty = true;
+	}
+	if (page)
+		pool->hits++;
+	else
+		pool->misses++;
 	mutex_unlock(&pool->mutex);
 
+	/* still cheaper than going back to the page allocator for it */
+	if (dirty && ion_page_pool_zero(pool, page)) {
+		ion_page_pool_free_pages(pool, page);
+		page = NULL;
+	}
+
 	if (!page)
 		page = ion_page_pool_alloc_pages(pool);
 
@@ -103,9 +135,64 @@ void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
 		ion_page_pool_free_pages(pool, page);
 }
 
+void ion_page_pool_free_dirty(struct ion_page_pool *pool, struct page *page)
+{
+	BUG_ON(pool->order != compound_order(page));
+
+	mutex_lock(&pool->mutex);
+	list_add_tail(&page->lru, &pool->dirty_items);
+	pool->dirty_count++;
+	mutex_unlock(&pool->mutex);
+}
+
+int ion_page_pool_refill(struct ion_page_pool *pool, int target)
+{
+	/* never reclaim for this, the shrinker would only undo it */
+	gfp_t gfp_mask = (pool->gfp_mask | __GFP_NORETRY | __GFP_NO_KSWAPD) &
+			 ~__GFP_WAIT;
+	int prefilled = 0;
+	int done = 0;
+
+	for (;;) {
+		struct page *page = NULL;
+
+		mutex_lock(&pool->mutex);
+		if (pool->dirty_count)
+			page = ion_page_pool_remove_dirty(pool);
+		mutex_unlock(&pool->mutex);
+		if (!page)
+			break;
+
+		if (ion_page_pool_zero(pool, page))
+			ion_page_pool_free_pages(pool, page);
+		else
+			ion_page_pool_add(pool, page);
+		done++;
+		cond_resched();
+	}
+
+	while (pool->high_count + pool->low_count < target) {
+		struct page *page = alloc_pages(gfp_mask, pool->order);
+
+		if (!page)
+			break;
+		ion_pages_sync_for_device(NULL, page, PAGE_SIZE << pool->order,
+					  DMA_BIDIRECTIONAL);
+		ion_page_pool_add(pool, page);
+		prefilled++;
+		cond_resched();
+	}
+
+	mutex_lock(&pool->mutex);
+	pool->prefilled += prefilled;
+	mutex_unlock(&pool->mutex);
+
+	return done + prefilled;
+}
+
 static int ion_page_pool_total(struct ion_page_pool *pool, bool high)
 {
-	int count = pool->low_count;
+	int count = pool->low_count + pool->dirty_count;
 
 	if (high)
 		count += pool->high_count;
@@ -131,7 +218,9 @@ int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 		struct page *page;
 
 		mutex_lock(&pool->mutex);
-		if (pool->low_count) {
+		if (pool->dirty_count) {
+			page = ion_page_pool_remove_dirty(pool);
+		} else if (pool->low_count) {
 			page = ion_page_pool_remove(pool, false);
 		} else if (high && pool->high_count) {
 			page = ion_page_pool_remove(pool, true);
@@ -154,8 +243,13 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 		return NULL;
 	pool->high_count = 0;
 	pool->low_count = 0;
+	pool->dirty_count = 0;
+	pool->hits = 0;
+	pool->misses = 0;
+	pool->prefilled = 0;
 	INIT_LIST_HEAD(&pool->low_items);
 	INIT_LIST_HEAD(&pool->high_items);
+	INIT_LIST_HEAD(&pool->dirty_items);
 	pool->gfp_mask = gfp_mask | __GFP_COMP;
 	pool->order = order;
 	mutex_init(&pool->mutex);
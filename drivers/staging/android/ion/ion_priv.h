@@ -352,8 +352,13 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  * struct ion_page_pool - pagepool struct
  * @high_count:		number of highmem items in the pool
  * @low_count:		number of lowmem items in the pool
+ * @dirty_count:	number of items still waiting to be zeroed
  * @high_items:		list of highmem items
  * @low_items:		list of lowmem items
+ * @dirty_items:	list of freed items not yet zeroed
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that went to the page allocator
+ * @prefilled:		items added by ion_page_pool_refill()
  * @mutex:		lock protecting this struct and especially the count
  *			item list
  * @gfp_mask:		gfp_mask to use from alloc
@@ -368,8 +373,13 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 struct ion_page_pool {
 	int high_count;
 	int low_count;
+	int dirty_count;
 	struct list_head high_items;
 	struct list_head low_items;
+	struct list_head dirty_items;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long prefilled;
 	struct mutex mutex;
 	gfp_t gfp_mask;
 	unsigned int order;
@@ -381,6 +391,27 @@ void ion_page_pool_destroy(struct ion_page_pool *);
 struct page *ion_page_pool_alloc(struct ion_page_pool *);
 void ion_page_pool_free(struct ion_page_pool *, struct page *);
 
+/**
+ * ion_page_pool_free_dirty - return an item that still holds user data
+ * @pool:		the pool
+ * @page:		the item
+ *
+ * The item is zeroed by ion_page_pool_refill(), or on allocation if the
+ * pool has nothing else to hand out.
+ */
+void ion_page_pool_free_dirty(struct ion_page_pool *pool, struct page *page);
+
+/**
+ * ion_page_pool_refill - zero dirty items and prefill the pool
+ * @pool:		the pool
+ * @target:		number of zeroed items to keep in the pool
+ *
+ * Meant for a low priority thread: zeroes everything on the dirty list,
+ * then allocates new items until @target are ready, without entering
+ * reclaim. Returns the number of items it zeroed or allocated.
+ */
+int ion_page_pool_refill(struct ion_page_pool *pool, int target);
+
 /** ion_page_pool_shrink - shrinks the size of the memory cached in the pool
  * @pool:		the pool
  * @gfp_mask:		the memory type to reclaim
@@ -17,12 +17,16 @@
 #include <asm/page.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/highmem.h>
+#include <linux/kthread.h>
 #include <linux/mm.h>
+#include <linux/module.h>
 #include <linux/scatterlist.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
 #include "ion.h"
 #include "ion_priv.h"
 
@@ -31,6 +35,16 @@ static gfp_t high_order_gfp_flags = (GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN |
 static gfp_t low_order_gfp_flags  = (GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN);
 static const unsigned int orders[] = {8, 4, 0};
 static const int num_orders = ARRAY_SIZE(orders);
+
+/*
+ * Zeroed items of each order to keep in the uncached pools, so the first
+ * allocations after boot do not have to zero pages from the allocator.
+ */
+static unsigned int pool_prefill[ARRAY_SIZE(orders)];
+module_param_array(pool_prefill, uint, NULL, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pool_prefill,
+		 "zeroed order 8, 4 and 0 pages to keep in the system heap pools");
+
 static int order_to_index(unsigned int order)
 {
 	int i;
@@ -49,19 +63,54 @@ static inline unsigned int order_to_size(int order)
 
 struct ion_system_heap {
 	struct ion_heap heap;
+	struct task_struct *refill_task;
+	wait_queue_head_t refill_wait;
+	atomic_t refill_pending;
 	struct ion_page_pool *pools[0];
 };
 
+static void ion_system_heap_kick_refill(struct ion_system_heap *heap)
+{
+	if (!atomic_xchg(&heap->refill_pending, 1))
+		wake_up(&heap->refill_wait);
+}
+
+/* Zeroes freed pages and prefills the pools, at SCHED_IDLE */
+static int ion_system_heap_refill(void *data)
+{
+	struct ion_system_heap *heap = data;
+	int i;
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(heap->refill_wait,
+				     atomic_read(&heap->refill_pending) ||
+				     kthread_should_stop());
+		atomic_set(&heap->refill_pending, 0);
+
+		for (i = 0; i < num_orders; i++)
+			ion_page_pool_refill(heap->pools[i],
+					     ACCESS_ONCE(pool_prefill[i]));
+	}
+
+	return 0;
+}
+
 static struct page *alloc_buffer_page(struct ion_system_heap *heap,
 				      struct ion_buffer *buffer,
 				      unsigned long order)
 {
 	bool cached = ion_buffer_cached(buffer);
-	struct ion_page_pool *pool = heap->pools[order_to_index(order)];
+	int i = order_to_index(order);
+	struct ion_page_pool *pool = heap->pools[i];
 	struct page *page;
 
 	if (!cached) {
+		unsigned int target = ACCESS_ONCE(pool_prefill[i]);
+
 		page = ion_page_pool_alloc(pool);
+		if (pool->high_count + pool->low_count <= target / 2 &&
+		    target)
+			ion_system_heap_kick_refill(heap);
 	} else {
 		gfp_t gfp_flags = low_order_gfp_flags;
 
@@ -78,7 +127,8 @@ static struct page *alloc_buffer_page(struct ion_system_heap *heap,
 }
 
 static void free_buffer_page(struct ion_system_heap *heap,
-			     struct ion_buffer *buffer, struct page *page)
+			     struct ion_buffer *buffer, struct page *page,
+			     bool dirty)
 {
 	unsigned int order = compound_order(page);
 	bool cached = ion_buffer_cached(buffer);
@@ -86,7 +136,10 @@ static void free_buffer_page(struct ion_system_heap *heap,
 	if (!cached && !(buffer->private_flags & ION_PRIV_FLAG_SHRINKER_FREE)) {
 		struct ion_page_pool *pool = heap->pools[order_to_index(order)];
 
-		ion_page_pool_free(pool, page);
+		if (dirty)
+			ion_page_pool_free_dirty(pool, page);
+		else
+			ion_page_pool_free(pool, page);
 	} else {
 		__free_pages(page, order);
 	}
@@ -171,7 +224,7 @@ free_table:
 	kfree(table);
 free_pages:
 	list_for_each_entry_safe(page, tmp_page, &pages, lru)
-		free_buffer_page(sys_heap, buffer, page);
+		free_buffer_page(sys_heap, buffer, page, false);
 	return -ENOMEM;
 }
 
@@ -185,15 +238,16 @@ static void ion_system_heap_free(struct ion_buffer *buffer)
 	struct scatterlist *sg;
 	int i;
 
-	/* uncached pages come from the page pools, zero them before returning
-	   for security purposes (other allocations are zerod at alloc time */
-	if (!cached && !(buffer->private_flags & ION_PRIV_FLAG_SHRINKER_FREE))
-		ion_heap_buffer_zero(buffer);
-
+	/* uncached pages go back to the page pools dirty, and are zeroed
+	   there before they are handed out again (other allocations are
+	   zeroed at alloc time) */
 	for_each_sg(table->sgl, sg, table->nents, i)
-		free_buffer_page(sys_heap, buffer, sg_page(sg));
+		free_buffer_page(sys_heap, buffer, sg_page(sg), true);
 	sg_free_table(table);
 	kfree(table);
+
+	if (!cached && !(buffer->private_flags & ION_PRIV_FLAG_SHRINKER_FREE))
+		ion_system_heap_kick_refill(sys_heap);
 }
 
 static struct sg_table *ion_system_heap_map_dma(struct ion_heap *heap,
@@ -254,12 +308,18 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 		seq_printf(s, "%d order %u lowmem pages in pool = %lu total\n",
 			   pool->low_count, pool->order,
 			   (PAGE_SIZE << pool->order) * pool->low_count);
+		seq_printf(s, "%d order %u pages waiting to be zeroed\n",
+			   pool->dirty_count, pool->order);
+		seq_printf(s, "order %u: %lu hits %lu misses %lu prefilled, prefill target %u\n",
+			   pool->order, pool->hits, pool->misses,
+			   pool->prefilled, ACCESS_ONCE(pool_prefill[i]));
 	}
 	return 0;
 }
 
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
+	struct sched_param param = { .sched_priority = 0 };
 	struct ion_system_heap *heap;
 	int i;
 
@@ -284,6 +344,17 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 		heap->pools[i] = pool;
 	}
 
+	init_waitqueue_head(&heap->refill_wait);
+	atomic_set(&heap->refill_pending, 1);
+	heap->refill_task = kthread_run(ion_system_heap_refill, heap,
+					"ion_system_refill");
+	if (IS_ERR(heap->refill_task)) {
+		pr_err("%s: creating thread for pool refill failed\n",
+		       __func__);
+		goto destroy_pools;
+	}
+	sched_setscheduler(heap->refill_task, SCHED_IDLE, &param);
+
 	heap->heap.debug_show = ion_system_heap_debug_show;
 	return &heap->heap;
 
@@ -301,6 +372,7 @@ void ion_system_heap_destroy(struct ion_heap *heap)
 							heap);
 	int i;
 
+	kthread_stop(sys_heap->refill_task);
 	for (i = 0; i < num_orders; i++)
 		ion_page_pool_destroy(sys_heap->pools[i]);
 	kfree(sys_heap);
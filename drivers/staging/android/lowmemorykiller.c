@@ -17,6 +17,16 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in one list per oom_score_adj value, updated as they
+ * fork, exit or have their oom_score_adj written, so picking a victim only
+ * looks at the highest populated list instead of every task.
+ *
+ * /proc/lowmem_pressure reports how many minfree thresholds are crossed
+ * ("level", 0 when none are) and the total time spent above level 0. It
+ * polls POLLPRI whenever the level changes. The lowmem_pressure,
+ * lowmem_kill and lowmem_victim_freed trace events time a kill from the
+ * onset of pressure to the victim dropping its memory.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -39,8 +49,19 @@
 #include <linux/sched.h>
 #include <linux/swap.h>
 #include <linux/rcupdate.h>
+#include <linux/rculist.h>
 #include <linux/profile.h>
 #include <linux/notifier.h>
+#include <linux/bitmap.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/proc_fs.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+
+#define CREATE_TRACE_POINTS
+#include "trace/lowmemorykiller.h"
 
 static uint32_t lowmem_debug_level = 1;
 static short lowmem_adj[6] = {
@@ -60,48 +81,278 @@ static int lowmem_minfree_size = 4;
 
 static unsigned long lowmem_deathpending_timeout;
 
+#define LOWMEM_ADJ_COUNT	(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+
+/*
+ * Group leaders by oom_score_adj, and the victim we are waiting on. Taken
+ * under tasklist_lock and siglock, so nothing may be waited for while
+ * holding it. The lists are only changed under the lock and are walked
+ * under RCU: task_structs are freed after a grace period, but a task
+ * moved by an oom_score_adj update may carry a walker over to another
+ * list, so walks end at any list head rather than their own.
+ */
+static DEFINE_SPINLOCK(lowmem_tasks_lock);
+static struct list_head lowmem_tasks[LOWMEM_ADJ_COUNT];
+static DECLARE_BITMAP(lowmem_tasks_map, LOWMEM_ADJ_COUNT);
+static bool lowmem_tasks_ready;	/* everything before lowmem_init() added */
+static struct task_struct *lowmem_victim;	/* holds a reference */
+static ktime_t lowmem_kill_time;
+static ktime_t lowmem_kill_onset;
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static int lowmem_level;
+static ktime_t lowmem_onset;
+static u64 lowmem_stall_us;
+static atomic_t lowmem_pressure_seq = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+/* while under pressure, look again this often to notice it is over */
+#define LOWMEM_RECHECK_DELAY	(HZ / 10)
+
+/* ->lowmem_adj of a task that is in none of the lists */
+#define LOWMEM_ADJ_UNLISTED	SHRT_MIN
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			pr_info(x);			\
 	} while (0)
 
+static void __lowmem_task_add(struct task_struct *p, short adj)
+{
+	int i = adj - OOM_SCORE_ADJ_MIN;
+
+	p->lowmem_adj = adj;
+	list_add_tail_rcu(&p->lowmem_node, &lowmem_tasks[i]);
+	__set_bit(i, lowmem_tasks_map);
+}
+
+static void __lowmem_task_del(struct task_struct *p)
+{
+	int i = p->lowmem_adj - OOM_SCORE_ADJ_MIN;
+
+	list_del_rcu(&p->lowmem_node);
+	p->lowmem_adj = LOWMEM_ADJ_UNLISTED;
+	if (list_empty(&lowmem_tasks[i]))
+		__clear_bit(i, lowmem_tasks_map);
+}
+
+void lowmem_task_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_tasks_lock, flags);
+	if (lowmem_tasks_ready)
+		__lowmem_task_add(p, p->signal->oom_score_adj);
+	spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+}
+
+void lowmem_task_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_tasks_lock, flags);
+	if (lowmem_tasks_ready)
+		__lowmem_task_del(p);
+	spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+}
+
+/* exec from a thread: it takes over the old leader's place */
+void lowmem_task_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_tasks_lock, flags);
+	if (lowmem_tasks_ready) {
+		new->lowmem_adj = old->lowmem_adj;
+		list_replace_rcu(&old->lowmem_node, &new->lowmem_node);
+		old->lowmem_adj = LOWMEM_ADJ_UNLISTED;
+	}
+	spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+}
+
+void lowmem_adj_update(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_tasks_lock, flags);
+	p = p->group_leader;
+	/* already unhashed if it is exiting */
+	if (lowmem_tasks_ready && p->lowmem_adj != LOWMEM_ADJ_UNLISTED) {
+		__lowmem_task_del(p);
+		__lowmem_task_add(p, p->signal->oom_score_adj);
+	}
+	spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+}
+
+void lowmem_oom_victim_freed(struct task_struct *p)
+{
+	unsigned long flags;
+	ktime_t now, kill_time, onset;
+
+	spin_lock_irqsave(&lowmem_tasks_lock, flags);
+	if (p != lowmem_victim) {
+		spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+		return;
+	}
+	lowmem_victim = NULL;
+	kill_time = lowmem_kill_time;
+	onset = lowmem_kill_onset;
+	spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+
+	now = ktime_get();
+	trace_lowmem_victim_freed(p, ktime_us_delta(now, kill_time),
+				  ktime_us_delta(now, onset));
+	put_task_struct(p);
+}
+
+/* Index the processes that were forked before the driver came up */
+static void __init lowmem_tasks_init(void)
+{
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_ADJ_COUNT; i++)
+		INIT_LIST_HEAD(&lowmem_tasks[i]);
+
+	/* keeps forks and exits out until the hooks take over */
+	read_lock(&tasklist_lock);
+	spin_lock_irq(&lowmem_tasks_lock);
+	for_each_process(p)
+		__lowmem_task_add(p, p->signal->oom_score_adj);
+	lowmem_tasks_ready = true;
+	spin_unlock_irq(&lowmem_tasks_lock);
+	read_unlock(&tasklist_lock);
+}
+
+static void lowmem_get_free(int *other_free, int *other_file)
+{
+	*other_free = global_page_state(NR_FREE_PAGES) - totalreserve_pages;
+	*other_file = global_page_state(NR_FILE_PAGES) -
+		global_page_state(NR_SHMEM) - total_swapcache_pages();
+}
+
+/*
+ * Returns the number of minfree thresholds crossed, and the lowest
+ * oom_score_adj that may be killed for it in *min_score_adj.
+ */
+static int lowmem_get_level(int other_free, int other_file,
+			    short *min_score_adj)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int i;
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i]) {
+			*min_score_adj = lowmem_adj[i];
+			return array_size - i;
+		}
+	}
+	*min_score_adj = OOM_SCORE_ADJ_MAX + 1;
+	return 0;
+}
+
+static void lowmem_recheck(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_recheck_work, lowmem_recheck);
+
+static void lowmem_set_level(int level, int other_free, int other_file)
+{
+	ktime_t now = ktime_get();
+	bool changed = false;
+
+	spin_lock(&lowmem_pressure_lock);
+	if (level != lowmem_level) {
+		if (!lowmem_level)
+			lowmem_onset = now;
+		else if (!level)
+			lowmem_stall_us += ktime_us_delta(now, lowmem_onset);
+		trace_lowmem_pressure(level, lowmem_level, other_free,
+				      other_file);
+		lowmem_level = level;
+		changed = true;
+	}
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (changed) {
+		atomic_inc(&lowmem_pressure_seq);
+		wake_up_interruptible(&lowmem_pressure_wait);
+	}
+	if (level)
+		schedule_delayed_work(&lowmem_recheck_work,
+				      LOWMEM_RECHECK_DELAY);
+}
+
+static int lowmem_update_level(void)
+{
+	int other_free, other_file, level;
+	short min_score_adj;
+
+	lowmem_get_free(&other_free, &other_file);
+	level = lowmem_get_level(other_free, other_file, &min_score_adj);
+	lowmem_set_level(level, other_free, other_file);
+	return level;
+}
+
+/* reclaim stops calling us once pressure is gone, so notice it here */
+static void lowmem_recheck(struct work_struct *work)
+{
+	lowmem_update_level();
+}
+
 static unsigned long lowmem_count(struct shrinker *s,
 				  struct shrink_control *sc)
 {
+	lowmem_update_level();
 	return global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
 		global_page_state(NR_INACTIVE_FILE);
 }
 
+static bool lowmem_tasks_head(struct list_head *node)
+{
+	return node >= lowmem_tasks && node < lowmem_tasks + LOWMEM_ADJ_COUNT;
+}
+
+/* Highest populated oom_score_adj slot below @below, or -1 */
+static int lowmem_prev_adj(int below)
+{
+	int i = find_last_bit(lowmem_tasks_map, below);
+
+	return i < below ? i : -1;
+}
+
+/* Is a kill still pending? Called with lowmem_tasks_lock held. */
+static bool lowmem_victim_pending(void)
+{
+	return lowmem_victim &&
+	       time_before_eq(jiffies, lowmem_deathpending_timeout);
+}
+
 static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
+	struct task_struct *old_victim = NULL;
+	struct list_head *node;
 	unsigned long rem = 0;
+	unsigned long flags;
 	int tasksize;
-	int i;
-	short min_score_adj = OOM_SCORE_ADJ_MAX + 1;
+	int i, min_i, level;
+	short min_score_adj;
 	int selected_tasksize = 0;
 	short selected_oom_score_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
-	int other_free = global_page_state(NR_FREE_PAGES) - totalreserve_pages;
-	int other_file = global_page_state(NR_FILE_PAGES) -
-						global_page_state(NR_SHMEM) -
-						total_swapcache_pages();
+	int other_free, other_file;
+	bool pending;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_score_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	lowmem_get_free(&other_free, &other_file);
+	level = lowmem_get_level(other_free, other_file, &min_score_adj);
+	lowmem_set_level(level, other_free, other_file);
 
 	lowmem_print(3, "lowmem_scan %lu, %x, ofree %d %d, ma %hd\n",
 			sc->nr_to_scan, sc->gfp_mask, other_free,
@@ -114,65 +365,93 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 	}
 
 	selected_oom_score_adj = min_score_adj;
+	min_i = max_t(int, min_score_adj - OOM_SCORE_ADJ_MIN, 0);
 
+	spin_lock_irqsave(&lowmem_tasks_lock, flags);
+	pending = lowmem_victim_pending();
+	spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+	if (pending)
+		return 0;
+
+	/* the first slot with a killable task has the highest score */
 	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		short oom_score_adj;
+	for (i = lowmem_prev_adj(LOWMEM_ADJ_COUNT); i >= min_i && !selected;
+	     i = lowmem_prev_adj(i)) {
+		short oom_score_adj = i + OOM_SCORE_ADJ_MIN;
 
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+		for (node = rcu_dereference(list_next_rcu(&lowmem_tasks[i]));
+		     !lowmem_tasks_head(node);
+		     node = rcu_dereference(list_next_rcu(node))) {
+			struct task_struct *p;
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
+			tsk = list_entry(node, struct task_struct, lowmem_node);
+			if (tsk->flags & PF_KTHREAD)
+				continue;
 
-		if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
-		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			task_unlock(p);
-			rcu_read_unlock();
-			return 0;
-		}
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
+			p = find_lock_task_mm(tsk);
+			if (!p)
+				continue;
+
+			tasksize = get_mm_rss(p->mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_score_adj = oom_score_adj;
+			lowmem_print(2, "select %d (%s), adj %hd, size %d, to kill\n",
+				     p->pid, p->comm, oom_score_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		lowmem_print(2, "select %d (%s), adj %hd, size %d, to kill\n",
-			     p->pid, p->comm, oom_score_adj, tasksize);
 	}
-	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %hd, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_score_adj, selected_tasksize);
-		lowmem_deathpending_timeout = jiffies + HZ;
-		/*
-		 * FIXME: lowmemorykiller shouldn't abuse global OOM killer
-		 * infrastructure. There is no real reason why the selected
-		 * task should have access to the memory reserves.
-		 */
-		mark_tsk_oom_victim(selected);
-		send_sig(SIGKILL, selected, 0);
-		rem += selected_tasksize;
+	if (selected)
+		get_task_struct(selected);
+	rcu_read_unlock();
+
+	if (!selected)
+		goto out;
+
+	spin_lock_irqsave(&lowmem_tasks_lock, flags);
+	/* another scan may have killed something meanwhile */
+	if (lowmem_victim_pending()) {
+		spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+		put_task_struct(selected);
+		return 0;
 	}
+	old_victim = lowmem_victim;
+	get_task_struct(selected);
+	lowmem_victim = selected;
+	lowmem_kill_time = ktime_get();
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_kill_onset = lowmem_level ? lowmem_onset : lowmem_kill_time;
+	spin_unlock(&lowmem_pressure_lock);
+	lowmem_deathpending_timeout = jiffies + HZ;
+	spin_unlock_irqrestore(&lowmem_tasks_lock, flags);
+
+	/* gave up waiting on that one */
+	if (old_victim)
+		put_task_struct(old_victim);
 
+	lowmem_print(1, "send sigkill to %d (%s), adj %hd, size %d\n",
+		     selected->pid, selected->comm,
+		     selected_oom_score_adj, selected_tasksize);
+	trace_lowmem_kill(selected, selected_oom_score_adj,
+			  selected_tasksize,
+			  ktime_us_delta(ktime_get(), lowmem_kill_onset));
+	/*
+	 * FIXME: lowmemorykiller shouldn't abuse global OOM killer
+	 * infrastructure. There is no real reason why the selected
+	 * task should have access to the memory reserves.
+	 */
+	mark_tsk_oom_victim(selected);
+	send_sig(SIGKILL, selected, 0);
+	put_task_struct(selected);
+	rem += selected_tasksize;
+
+out:
 	lowmem_print(4, "lowmem_scan %lu, %x, return %lu\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	rcu_read_unlock();
 	return rem;
 }
 
@@ -182,8 +461,76 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_pressure_show(char *buf, size_t size)
+{
+	int level;
+	u64 stall_us;
+
+	lowmem_update_level();
+	spin_lock(&lowmem_pressure_lock);
+	level = lowmem_level;
+	stall_us = lowmem_stall_us;
+	if (level)
+		stall_us += ktime_us_delta(ktime_get(), lowmem_onset);
+	spin_unlock(&lowmem_pressure_lock);
+
+	return scnprintf(buf, size, "level %d total=%llu\n", level,
+			 (unsigned long long)stall_us);
+}
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	int *seen = kmalloc(sizeof(*seen), GFP_KERNEL);
+
+	if (!seen)
+		return -ENOMEM;
+	*seen = atomic_read(&lowmem_pressure_seq);
+	file->private_data = seen;
+	return 0;
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *ubuf,
+				    size_t count, loff_t *ppos)
+{
+	int *seen = file->private_data;
+	char buf[64];
+	int len;
+
+	if (*ppos == 0)
+		*seen = atomic_read(&lowmem_pressure_seq);
+	len = lowmem_pressure_show(buf, sizeof(buf));
+	return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	int *seen = file->private_data;
+	unsigned int mask = POLLIN | POLLRDNORM;
+
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	if (atomic_read(&lowmem_pressure_seq) != *seen)
+		mask |= POLLPRI;
+	return mask;
+}
+
+static int lowmem_pressure_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.open = lowmem_pressure_open,
+	.read = lowmem_pressure_read,
+	.llseek = default_llseek,
+	.poll = lowmem_pressure_poll,
+	.release = lowmem_pressure_release,
+};
+
 static int __init lowmem_init(void)
 {
+	lowmem_tasks_init();
+	proc_create("lowmem_pressure", S_IRUGO, NULL, &lowmem_pressure_fops);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -191,6 +538,8 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	cancel_delayed_work_sync(&lowmem_recheck_work);
+	remove_proc_entry("lowmem_pressure", NULL);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -0,0 +1,88 @@
+#undef TRACE_SYSTEM
+#define TRACE_INCLUDE_PATH ../../drivers/staging/android/trace
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOWMEMORYKILLER_H
+
+#include <linux/sched.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmem_pressure,
+	TP_PROTO(int level, int prev_level, int other_free, int other_file),
+
+	TP_ARGS(level, prev_level, other_free, other_file),
+
+	TP_STRUCT__entry(
+			__field(int, level)
+			__field(int, prev_level)
+			__field(int, other_free)
+			__field(int, other_file)
+	),
+
+	TP_fast_assign(
+			__entry->level = level;
+			__entry->prev_level = prev_level;
+			__entry->other_free = other_free;
+			__entry->other_file = other_file;
+	),
+
+	TP_printk("level=%d prev=%d ofree=%d ofile=%d",
+		  __entry->level, __entry->prev_level,
+		  __entry->other_free, __entry->other_file)
+);
+
+TRACE_EVENT(lowmem_kill,
+	TP_PROTO(struct task_struct *p, short adj, int size, s64 onset_us),
+
+	TP_ARGS(p, adj, size, onset_us),
+
+	TP_STRUCT__entry(
+			__array(char, comm, TASK_COMM_LEN)
+			__field(pid_t, pid)
+			__field(short, adj)
+			__field(int, size)
+			__field(s64, onset_us)
+	),
+
+	TP_fast_assign(
+			memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+			__entry->pid = p->pid;
+			__entry->adj = adj;
+			__entry->size = size;
+			__entry->onset_us = onset_us;
+	),
+
+	TP_printk("comm=%s pid=%d adj=%hd size=%d since_onset=%lldus",
+		  __entry->comm, __entry->pid, __entry->adj, __entry->size,
+		  __entry->onset_us)
+);
+
+TRACE_EVENT(lowmem_victim_freed,
+	TP_PROTO(struct task_struct *p, s64 kill_us, s64 onset_us),
+
+	TP_ARGS(p, kill_us, onset_us),
+
+	TP_STRUCT__entry(
+			__array(char, comm, TASK_COMM_LEN)
+			__field(pid_t, pid)
+			__field(s64, kill_us)
+			__field(s64, onset_us)
+	),
+
+	TP_fast_assign(
+			memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+			__entry->pid = p->pid;
+			__entry->kill_us = kill_us;
+			__entry->onset_us = onset_us;
+	),
+
+	TP_printk("comm=%s pid=%d since_kill=%lldus since_onset=%lldus",
+		  __entry->comm, __entry->pid, __entry->kill_us,
+		  __entry->onset_us)
+);
+
+#endif /* if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ) */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
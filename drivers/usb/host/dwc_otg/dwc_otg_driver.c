@@ -247,6 +247,11 @@ bool fiq_fsm_enable = true;
 //Bulk split-transaction NAK holdoff in microframes
 uint16_t nak_holdoff = 8;
 
+// Use Descriptor DMA host mode when the core allows it and the FSM is off
+bool ddma_prefer = false;
+// Keep bulk channels and chain queued URBs in Descriptor DMA mode
+bool ddma_bulk_chain = true;
+
 unsigned short fiq_fsm_mask = 0x07;
 
 /**
@@ -311,6 +316,19 @@ static int set_parameters(dwc_otg_core_if_t * core_if)
 		    dwc_otg_set_param_dma_desc_enable(core_if,
 						      dwc_otg_module_params.
 						      dma_desc_enable);
+	} else if (ddma_prefer) {
+		/*
+		 * Descriptor DMA can't carry split transactions, which the FIQ
+		 * FSM exists to handle, and host mode needs a 2.90a or later
+		 * core. Quietly stay in Buffer DMA mode otherwise.
+		 */
+		if (!fiq_fsm_enable && core_if->hwcfg4.b.desc_dma
+		    && core_if->snpsid >= OTG_CORE_REV_2_90a
+		    && dwc_otg_get_param_dma_enable(core_if))
+			dwc_otg_set_param_dma_desc_enable(core_if, 1);
+		else
+			DWC_PRINTF("ddma_prefer set but Descriptor DMA unavailable, "
+				   "using Buffer DMA\n");
 	}
 	if (dwc_otg_module_params.opt != -1) {
 		retval +=
@@ -1389,6 +1407,11 @@ module_param(fiq_enable, bool, 0444);
 MODULE_PARM_DESC(fiq_enable, "Enable the FIQ");
 module_param(nak_holdoff, ushort, 0644);
 MODULE_PARM_DESC(nak_holdoff, "Throttle duration for bulk split-transaction endpoints on a NAK. Default 8");
+module_param(ddma_prefer, bool, 0444);
+MODULE_PARM_DESC(ddma_prefer, "Use Descriptor DMA host mode if the core supports it and fiq_fsm_enable=0. "
+				"Devices needing split transactions are not supported in this mode");
+module_param(ddma_bulk_chain, bool, 0644);
+MODULE_PARM_DESC(ddma_bulk_chain, "In Descriptor DMA mode, keep a bulk channel and chain all queued URBs on completion");
 module_param(fiq_fsm_enable, bool, 0444);
 MODULE_PARM_DESC(fiq_fsm_enable, "Enable the FIQ to perform split transactions as defined by fiq_fsm_mask");
 module_param(fiq_fsm_mask, ushort, 0444);
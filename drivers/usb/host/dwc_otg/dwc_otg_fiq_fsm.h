@@ -42,6 +42,10 @@
 #ifndef DWC_OTG_FIQ_FSM_H_
 #define DWC_OTG_FIQ_FSM_H_
 
+#ifdef DWC_OTG_FIQ_SIM
+/* Host-side build for the replay simulator in test/ */
+#include "fiq_fsm_sim.h"
+#else
 #include "dwc_otg_regs.h"
 #include "dwc_otg_cil.h"
 #include "dwc_otg_hcd.h"
@@ -49,6 +53,7 @@
 #include <linux/irqflags.h>
 #include <linux/string.h>
 #include <asm/barrier.h>
+#endif
 
 #if 0
 #define FLAME_ON(x)					\
@@ -77,8 +82,10 @@ do {							\
  * reads and writes are executed in-order therefore the need for memory barriers
  * is obviated if we're only talking to USB.
  */
+#ifndef FIQ_WRITE
 #define FIQ_WRITE(_addr_,_data_) (*(volatile unsigned int *) (_addr_) = (_data_))
 #define FIQ_READ(_addr_) (*(volatile unsigned int *) (_addr_))
+#endif
 
 /* FIQ-ified register definitions. Offsets are from dwc_regs_base. */
 #define GINTSTS		0x014
@@ -40,6 +40,7 @@
 #include "dwc_otg_regs.h"
 
 extern bool microframe_schedule;
+extern bool ddma_bulk_chain;
 
 static inline uint8_t frame_list_idx(uint16_t frame)
 {
@@ -1052,6 +1053,86 @@ stop_scan:
 
 }
 
+/**
+ * Decides whether a bulk channel that has just halted with XferComplete
+ * can be kept by its QH and restarted on the URBs queued behind it.
+ *
+ * Only error-free transfers are continued, and only while no other
+ * non-periodic QH is waiting for a channel, so that a busy bulk endpoint
+ * cannot starve control or other bulk traffic.
+ */
+static int can_continue_bulk_xfer_ddma(dwc_otg_hcd_t * hcd, dwc_otg_qh_t * qh,
+				       dwc_otg_halt_status_e halt_status)
+{
+	dwc_otg_qtd_t *qtd;
+
+	if (!ddma_bulk_chain || qh->ep_type != UE_BULK)
+		return 0;
+
+	if (halt_status != DWC_OTG_HC_XFER_COMPLETE ||
+	    qh->channel->halt_status == DWC_OTG_HC_XFER_URB_DEQUEUE)
+		return 0;
+
+	if (!hcd->flags.b.port_connect_status)
+		return 0;
+
+	if (DWC_CIRCLEQ_EMPTY(&qh->qtd_list) ||
+	    !DWC_LIST_EMPTY(&hcd->non_periodic_sched_inactive))
+		return 0;
+
+	qtd = DWC_CIRCLEQ_FIRST(&qh->qtd_list);
+	if (qtd->error_count)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Restarts a bulk channel without releasing it. All URBs queued on the
+ * QH while the previous descriptor list was being processed are chained
+ * into a new list by init_non_isoc_dma_desc(), so the channel raises a
+ * single interrupt for the whole batch instead of going back through the
+ * transaction scheduler for every URB.
+ *
+ * The channel characteristics and interrupt mask programmed by
+ * dwc_otg_hc_init() still hold, only the per-transfer state is reset here
+ * the same way assign_and_init_hc() would set it up.
+ */
+static void continue_bulk_xfer_ddma(dwc_otg_hcd_t * hcd, dwc_otg_qh_t * qh,
+				    dwc_otg_hc_regs_t * hc_regs)
+{
+	dwc_hc_t *hc = qh->channel;
+	dwc_otg_qtd_t *qtd = DWC_CIRCLEQ_FIRST(&qh->qtd_list);
+	dwc_otg_hcd_urb_t *urb = qtd->urb;
+	hcint_data_t hcint;
+
+	/* Clear the interrupt conditions of the transfer just completed. */
+	hcint.d32 = 0xFFFFFFFF;
+	hcint.b.reserved14_31 = 0;
+	DWC_WRITE_REG32(&hc_regs->hcint, hcint.d32);
+
+	hc->xfer_started = 0;
+	hc->halt_status = DWC_OTG_HC_XFER_NO_HALT_STATUS;
+	hc->error_state = 0;
+	hc->halt_on_queue = 0;
+	hc->halt_pending = 0;
+	hc->requests = 0;
+
+	hc->data_pid_start = qh->data_toggle;
+	hc->do_ping = hc->ep_is_in ? 0 : qh->ping_state;
+
+	hc->xfer_buff = (uint8_t *) urb->dma + urb->actual_length;
+	hc->xfer_len = urb->length - urb->actual_length;
+	hc->xfer_count = 0;
+
+	qh->ntd = 0;
+	dwc_memset(qh->desc_list, 0x00,
+		   sizeof(dwc_otg_host_dma_desc_t) * max_desc_num(qh));
+
+	dwc_otg_hcd_start_xfer_ddma(hcd, qh);
+	qh->ping_state = 0;
+}
+
 /**
  * This function is called from interrupt handlers.
  * Scans the descriptor list, updates URB's status and
@@ -1061,6 +1142,9 @@ stop_scan:
  * the end of the session, i.e. QTD list is empty.
  * If periodic channel released the FrameList is updated accordingly.
  *
+ * Bulk channels that completed normally are kept and restarted when more
+ * URBs are queued on the endpoint, see continue_bulk_xfer_ddma().
+ *
  * Calls transaction selection routines to activate pending transfers.
  *
  * @param hcd The HCD state structure for the DWC OTG controller.
@@ -1107,12 +1191,17 @@ void dwc_otg_hcd_complete_xfer_ddma(dwc_otg_hcd_t * hcd,
 		/* Scan descriptor list to complete the URB(s), then release the channel */
 		complete_non_isoc_xfer_ddma(hcd, hc, hc_regs, halt_status);
 
-		release_channel_ddma(hcd, qh);
-		dwc_otg_hcd_qh_remove(hcd, qh);
+		if (can_continue_bulk_xfer_ddma(hcd, qh, halt_status)) {
+			/* Keep the channel and chain the queued URBs on it */
+			continue_bulk_xfer_ddma(hcd, qh, hc_regs);
+		} else {
+			release_channel_ddma(hcd, qh);
+			dwc_otg_hcd_qh_remove(hcd, qh);
 
-		if (!DWC_CIRCLEQ_EMPTY(&qh->qtd_list)) {
-			/* Add back to inactive non-periodic schedule on normal completion */
-			dwc_otg_hcd_qh_add(hcd, qh);
+			if (!DWC_CIRCLEQ_EMPTY(&qh->qtd_list)) {
+				/* Add back to inactive non-periodic schedule on normal completion */
+				dwc_otg_hcd_qh_add(hcd, qh);
+			}
 		}
 
 	}
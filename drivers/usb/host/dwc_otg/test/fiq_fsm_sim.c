@@ -0,0 +1,930 @@
+/*
+ * fiq_fsm_sim.c - Register-level replay simulator for the FIQ FSM
+ *
+ * Copyright (c) 2015 Raspberry Pi Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Links dwc_otg_fiq_fsm.c into a host program and drives it from a
+ * channel-interrupt trace. The simulator models just enough of the
+ * DWC register file for the FIQ: write-1-to-clear GINTSTS/HCINT, HAINT
+ * and GINTSTS.hcintr derived from the per-channel interrupt and mask
+ * registers, HCCHAR channel enables and the MPHI doorbell the FIQ uses
+ * to kick the IRQ. The parts of the HCD the FIQ relies on are emulated
+ * as well: channels are set up the way fiq_fsm_queue_split_transaction()
+ * and fiq_fsm_queue_isoc_transaction() do it, and an IRQ kick retires
+ * every channel the FIQ handed back.
+ *
+ * Trace format, one event per line ('#' starts a comment):
+ *
+ *   frame <frnum>		set HFNUM.frnum (microframe number)
+ *   sof [<count>]		advance <count> microframes, taking the SOF
+ *				interrupt in the FIQ for each
+ *   queue <ch> <type> <in|out> [hub=<n>] [port=<n>] [mps=<n>] [len=<n>]
+ *	   [frames=<n>]	set up a transaction on host channel <ch>;
+ *				<type> is ctrl, bulk, int, isoc or hsisoc
+ *   hcint <ch> <flag>... [data=<n>]
+ *				halt channel <ch> with the given HCINT
+ *				flags (xfercomp ahberr stall nak ack nyet
+ *				xacterr bblerr frmovrun datatglerr) and take
+ *				the FIQ; data= is the number of bytes an IN
+ *				transfer received
+ *
+ * For each transaction type the report gives the FIQ entries, register
+ * accesses and host time spent in the FIQ per transaction along with
+ * the state the FSM handed back to the IRQ. For each transaction
+ * translator it gives the fraction of microframes the TT was reserved
+ * by a periodic split, and how often queued splits were held off.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "dwc_otg_fiq_fsm.h"
+
+#define SIM_MAX_CHANNELS	16
+#define SIM_MAX_TTS		16
+#define SIM_MAX_ISO_FRAMES	64
+#define SIM_REG_WORDS		(0x800 / 4)
+/* Fake bus addresses - the FIQ only does arithmetic on these. */
+#define SIM_DMA_BASE		0x10000000
+#define SIM_HS_ISOC_DMA		0x20000000
+/* Microframes between SOF-driven IRQ schedule runs in the HCD. */
+#define SIM_SCHED_INTERVAL	8
+
+enum sim_xfer_type {
+	SIM_XFER_CTRL,
+	SIM_XFER_BULK,
+	SIM_XFER_INT,
+	SIM_XFER_ISOC,
+	SIM_XFER_HS_ISOC,
+	SIM_XFER_TYPES,
+};
+
+static const char *const sim_xfer_names[SIM_XFER_TYPES] = {
+	"ctrl", "bulk", "int", "isoc", "hsisoc",
+};
+
+/* USB endpoint types as programmed into HCCHAR.eptype */
+static const int sim_xfer_eptype[SIM_XFER_TYPES] = { 0, 2, 3, 1, 1 };
+
+struct sim_cost {
+	unsigned long fiq_entries;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long restarts;
+	uint64_t ns;
+};
+
+struct sim_xfer_stats {
+	unsigned long count;
+	uint64_t uframes;
+	struct sim_cost cost;
+	unsigned long outcome[FIQ_TEST + 1];
+};
+
+struct sim_channel {
+	int active;
+	enum sim_xfer_type type;
+	uint64_t start_uframe;
+	struct sim_cost cost;
+	struct dwc_otg_hcd_iso_packet_desc iso_desc[SIM_MAX_ISO_FRAMES];
+};
+
+struct sim_tt {
+	unsigned int hub_addr;
+	unsigned int port_addr;
+	uint64_t busy;
+	uint64_t blocked;
+	uint64_t idle_waiting;
+};
+
+static uint32_t regs[SIM_REG_WORDS];
+static uint32_t mphi[5];
+static uint8_t dummy_send[16];
+
+static struct fiq_state *state;
+static int num_channels = 8;
+static unsigned short fsm_mask = 0x07;
+static int verbose;
+
+static struct sim_channel chan[SIM_MAX_CHANNELS];
+static struct sim_tt tts[SIM_MAX_TTS];
+static int num_tts;
+
+static struct sim_cost cur;		/* the FIQ entry in progress */
+static struct sim_cost sof_cost;
+static struct sim_xfer_stats xfer_stats[SIM_XFER_TYPES];
+static uint64_t uframes, fiq_max_ns;
+static unsigned long irq_kicks, queue_busy;
+static int irq_pending;
+
+/* Referenced by dwc_otg_fiq_fsm.h */
+bool fiq_enable = 1, fiq_fsm_enable = 1;
+ushort nak_holdoff = 8;
+
+static const char *fsm_name(enum fiq_fsm_state fsm)
+{
+	static const char *const names[FIQ_TEST + 1] = {
+		[FIQ_PASSTHROUGH] = "PASSTHROUGH",
+		[FIQ_PASSTHROUGH_ERRORSTATE] = "PASSTHROUGH_ERRORSTATE",
+		[FIQ_NP_SSPLIT_STARTED] = "NP_SSPLIT_STARTED",
+		[FIQ_NP_SSPLIT_RETRY] = "NP_SSPLIT_RETRY",
+		[FIQ_NP_OUT_CSPLIT_RETRY] = "NP_OUT_CSPLIT_RETRY",
+		[FIQ_NP_IN_CSPLIT_RETRY] = "NP_IN_CSPLIT_RETRY",
+		[FIQ_NP_SPLIT_DONE] = "NP_SPLIT_DONE",
+		[FIQ_NP_SPLIT_LS_ABORTED] = "NP_SPLIT_LS_ABORTED",
+		[FIQ_NP_SPLIT_HS_ABORTED] = "NP_SPLIT_HS_ABORTED",
+		[FIQ_PER_SSPLIT_QUEUED] = "PER_SSPLIT_QUEUED",
+		[FIQ_PER_SSPLIT_STARTED] = "PER_SSPLIT_STARTED",
+		[FIQ_PER_SSPLIT_LAST] = "PER_SSPLIT_LAST",
+		[FIQ_PER_ISO_OUT_PENDING] = "PER_ISO_OUT_PENDING",
+		[FIQ_PER_ISO_OUT_ACTIVE] = "PER_ISO_OUT_ACTIVE",
+		[FIQ_PER_ISO_OUT_LAST] = "PER_ISO_OUT_LAST",
+		[FIQ_PER_ISO_OUT_DONE] = "PER_ISO_OUT_DONE",
+		[FIQ_PER_CSPLIT_WAIT] = "PER_CSPLIT_WAIT",
+		[FIQ_PER_CSPLIT_NYET1] = "PER_CSPLIT_NYET1",
+		[FIQ_PER_CSPLIT_BROKEN_NYET1] = "PER_CSPLIT_BROKEN_NYET1",
+		[FIQ_PER_CSPLIT_NYET_FAFF] = "PER_CSPLIT_NYET_FAFF",
+		[FIQ_PER_CSPLIT_POLL] = "PER_CSPLIT_POLL",
+		[FIQ_PER_CSPLIT_LAST] = "PER_CSPLIT_LAST",
+		[FIQ_PER_SPLIT_DONE] = "PER_SPLIT_DONE",
+		[FIQ_PER_SPLIT_LS_ABORTED] = "PER_SPLIT_LS_ABORTED",
+		[FIQ_PER_SPLIT_HS_ABORTED] = "PER_SPLIT_HS_ABORTED",
+		[FIQ_PER_SPLIT_NYET_ABORTED] = "PER_SPLIT_NYET_ABORTED",
+		[FIQ_PER_SPLIT_TIMEOUT] = "PER_SPLIT_TIMEOUT",
+		[FIQ_HS_ISOC_TURBO] = "HS_ISOC_TURBO",
+		[FIQ_HS_ISOC_SLEEPING] = "HS_ISOC_SLEEPING",
+		[FIQ_HS_ISOC_DONE] = "HS_ISOC_DONE",
+		[FIQ_HS_ISOC_ABORTED] = "HS_ISOC_ABORTED",
+		[FIQ_DEQUEUE_ISSUED] = "DEQUEUE_ISSUED",
+		[FIQ_TEST] = "TEST",
+	};
+
+	if ((unsigned int) fsm > FIQ_TEST || !names[fsm])
+		return "?";
+	return names[fsm];
+}
+
+static inline uint32_t *hc_reg(int n, int reg)
+{
+	return &regs[(HC_START + HC_OFFSET * n + reg) / 4];
+}
+
+static inline uint32_t *hc_dma_reg(int n)
+{
+	return &regs[(HC_DMA + HC_OFFSET * n) / 4];
+}
+
+/* Recompute the interrupt summary bits the core derives in hardware. */
+static void sim_update_irq_lines(void)
+{
+	haint_data_t haint = { .d32 = 0 };
+	gintsts_data_t gintsts = { .d32 = regs[GINTSTS / 4] };
+	int n;
+
+	for (n = 0; n < num_channels; n++)
+		if (*hc_reg(n, HCINT) & *hc_reg(n, HCINTMSK))
+			haint.b2.chint |= 1 << n;
+	regs[HAINT / 4] = haint.d32;
+	gintsts.b.hcintr = !!(haint.d32 & regs[HAINTMSK / 4]);
+	regs[GINTSTS / 4] = gintsts.d32;
+}
+
+uint32_t fiq_sim_read(volatile void *addr)
+{
+	uintptr_t off = (uintptr_t) addr - (uintptr_t) regs;
+
+	cur.reads++;
+	if (off < sizeof(regs))
+		return regs[off / 4];
+	off = (uintptr_t) addr - (uintptr_t) mphi;
+	if (off < sizeof(mphi))
+		return mphi[off / 4];
+	fprintf(stderr, "FIQ read from unmapped address %p\n", addr);
+	abort();
+}
+
+void fiq_sim_write(volatile void *addr, uint32_t data)
+{
+	uintptr_t off = (uintptr_t) addr - (uintptr_t) regs;
+
+	cur.writes++;
+	if (off >= sizeof(regs)) {
+		off = (uintptr_t) addr - (uintptr_t) mphi;
+		if (off >= sizeof(mphi)) {
+			fprintf(stderr, "FIQ write to unmapped address %p\n", addr);
+			abort();
+		}
+		mphi[off / 4] = data;
+		if (addr == state->mphi_regs.outddb)
+			irq_pending = 1;
+		return;
+	}
+
+	if (off == GINTSTS) {
+		regs[off / 4] &= ~data;
+	} else if (off == HAINT) {
+		/* Read-only in the core: derived from HCINT & HCINTMSK */
+	} else if (off >= HC_START && off < HC_START + HC_OFFSET * num_channels &&
+		   (off - HC_START) % HC_OFFSET == HCINT) {
+		regs[off / 4] &= ~data;
+	} else if (off >= HC_START && off < HC_START + HC_OFFSET * num_channels &&
+		   (off - HC_START) % HC_OFFSET == HCCHAR) {
+		hcchar_data_t old = { .d32 = regs[off / 4] };
+		hcchar_data_t new = { .d32 = data };
+
+		if (!old.b.chen && new.b.chen)
+			chan[(off - HC_START) / HC_OFFSET].cost.restarts++;
+		regs[off / 4] = data;
+	} else {
+		regs[off / 4] = data;
+	}
+	sim_update_irq_lines();
+}
+
+static int sim_find_tt(unsigned int hub_addr, unsigned int port_addr)
+{
+	int i;
+
+	for (i = 0; i < num_tts; i++)
+		if (tts[i].hub_addr == hub_addr && tts[i].port_addr == port_addr)
+			return i;
+	if (num_tts == SIM_MAX_TTS)
+		return -1;
+	tts[num_tts].hub_addr = hub_addr;
+	tts[num_tts].port_addr = port_addr;
+	return num_tts++;
+}
+
+/* Account the microframe that is ending against each TT's state. */
+static void sim_sample_tts(void)
+{
+	int i, n;
+
+	for (i = 0; i < num_tts; i++) {
+		int busy = 0, waiting = 0;
+
+		for (n = 0; n < num_channels; n++) {
+			struct fiq_channel_state *st = &state->channel[n];
+
+			if (!chan[n].active || st->hub_addr != tts[i].hub_addr ||
+			    st->port_addr != tts[i].port_addr)
+				continue;
+			switch (st->fsm) {
+			/* Same set of states as fiq_fsm_tt_in_use() */
+			case FIQ_PER_SSPLIT_STARTED:
+			case FIQ_PER_CSPLIT_WAIT:
+			case FIQ_PER_CSPLIT_NYET1:
+			case FIQ_PER_ISO_OUT_ACTIVE:
+			case FIQ_PER_ISO_OUT_LAST:
+				busy = 1;
+				break;
+			case FIQ_PER_SSPLIT_QUEUED:
+			case FIQ_PER_ISO_OUT_PENDING:
+				waiting = 1;
+				break;
+			default:
+				break;
+			}
+		}
+		if (busy)
+			tts[i].busy++;
+		if (busy && waiting)
+			tts[i].blocked++;
+		if (!busy && waiting)
+			tts[i].idle_waiting++;
+	}
+}
+
+static void sim_cost_add(struct sim_cost *dst, const struct sim_cost *src)
+{
+	dst->fiq_entries += src->fiq_entries;
+	dst->reads += src->reads;
+	dst->writes += src->writes;
+	dst->restarts += src->restarts;
+	dst->ns += src->ns;
+}
+
+/* The FIQ handed channel n back: what the HCD IRQ handler would do. */
+static void sim_retire_channel(int n)
+{
+	struct fiq_channel_state *st = &state->channel[n];
+	struct sim_channel *c = &chan[n];
+	hcchar_data_t hcchar = { .d32 = *hc_reg(n, HCCHAR) };
+
+	if (c->active) {
+		struct sim_xfer_stats *xs = &xfer_stats[c->type];
+
+		xs->count++;
+		xs->uframes += uframes - c->start_uframe;
+		sim_cost_add(&xs->cost, &c->cost);
+		xs->outcome[st->fsm <= FIQ_TEST ? st->fsm : FIQ_TEST]++;
+		if (verbose)
+			printf("%6llu: ch%d %s retired in %s\n",
+			       (unsigned long long) uframes, n,
+			       sim_xfer_names[c->type], fsm_name(st->fsm));
+		c->active = 0;
+	}
+	st->fsm = FIQ_PASSTHROUGH;
+	*hc_reg(n, HCINT) = 0;
+	hcchar.b.chen = 0;
+	*hc_reg(n, HCCHAR) = hcchar.d32;
+}
+
+static void sim_irq(void)
+{
+	hfnum_data_t hfnum = { .d32 = regs[HFNUM / 4] };
+	gintmsk_data_t gintmsk = { .d32 = 0 };
+	uint32_t all = (1 << num_channels) - 1;
+	int n;
+
+	irq_kicks++;
+	irq_pending = 0;
+	for (n = 0; n < num_channels; n++)
+		if (!(state->haintmsk_saved.b2.chint & (1 << n)))
+			sim_retire_channel(n);
+
+	state->haintmsk_saved.b2.chint = all;
+	regs[HAINTMSK / 4] = all;
+	state->gintmsk_saved.d32 = ~0;
+	gintmsk.b.sofintr = 1;
+	gintmsk.b.hcintr = 1;
+	regs[GINTMSK / 4] = gintmsk.d32;
+	state->kick_np_queues = 0;
+	if (dwc_frame_num_le(state->next_sched_frame, hfnum.b.frnum))
+		state->next_sched_frame =
+			(hfnum.b.frnum + SIM_SCHED_INTERVAL) & DWC_HFNUM_MAX_FRNUM;
+	sim_update_irq_lines();
+}
+
+static void sim_run_fiq(int n)
+{
+	struct timespec t0, t1;
+	uint64_t ns;
+
+	memset(&cur, 0, sizeof(cur));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	dwc_otg_fiq_fsm(state, num_channels);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000ull + t1.tv_nsec - t0.tv_nsec;
+
+	cur.fiq_entries = 1;
+	cur.ns = ns;
+	if (ns > fiq_max_ns)
+		fiq_max_ns = ns;
+	if (n < 0)
+		sim_cost_add(&sof_cost, &cur);
+	else
+		sim_cost_add(&chan[n].cost, &cur);
+
+	if (irq_pending)
+		sim_irq();
+}
+
+static void sim_sof(void)
+{
+	hfnum_data_t hfnum = { .d32 = regs[HFNUM / 4] };
+	gintsts_data_t gintsts = { .d32 = regs[GINTSTS / 4] };
+
+	sim_sample_tts();
+	uframes++;
+	hfnum.b.frnum = (hfnum.b.frnum + 1) & DWC_HFNUM_MAX_FRNUM;
+	regs[HFNUM / 4] = hfnum.d32;
+	gintsts.b.sofintr = 1;
+	regs[GINTSTS / 4] = gintsts.d32;
+	sim_run_fiq(-1);
+}
+
+static int sim_hcint(int n, char **argv, int argc)
+{
+	struct fiq_channel_state *st = &state->channel[n];
+	hcint_data_t hcint = { .d32 = *hc_reg(n, HCINT) };
+	hcchar_data_t hcchar = { .d32 = *hc_reg(n, HCCHAR) };
+	int i;
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "xfercomp"))
+			hcint.b.xfercomp = 1;
+		else if (!strcmp(argv[i], "ahberr"))
+			hcint.b.ahberr = 1;
+		else if (!strcmp(argv[i], "stall"))
+			hcint.b.stall = 1;
+		else if (!strcmp(argv[i], "nak"))
+			hcint.b.nak = 1;
+		else if (!strcmp(argv[i], "ack"))
+			hcint.b.ack = 1;
+		else if (!strcmp(argv[i], "nyet"))
+			hcint.b.nyet = 1;
+		else if (!strcmp(argv[i], "xacterr"))
+			hcint.b.xacterr = 1;
+		else if (!strcmp(argv[i], "bblerr"))
+			hcint.b.bblerr = 1;
+		else if (!strcmp(argv[i], "frmovrun"))
+			hcint.b.frmovrun = 1;
+		else if (!strcmp(argv[i], "datatglerr"))
+			hcint.b.datatglerr = 1;
+		else if (!strncmp(argv[i], "data=", 5)) {
+			hctsiz_data_t hctsiz = { .d32 = *hc_reg(n, HCTSIZ) };
+			unsigned int len = strtoul(argv[i] + 5, NULL, 0);
+			unsigned int want = st->hctsiz_copy.b.xfersize;
+
+			hctsiz.b.xfersize = len < want ? want - len : 0;
+			*hc_reg(n, HCTSIZ) = hctsiz.d32;
+		} else
+			return -EINVAL;
+	}
+	/* Every interrupt the FIQ sees is a channel halt. */
+	hcint.b.chhltd = 1;
+	*hc_reg(n, HCINT) = hcint.d32;
+	hcchar.b.chen = 0;
+	*hc_reg(n, HCCHAR) = hcchar.d32;
+	sim_update_irq_lines();
+
+	if (verbose)
+		printf("%6llu: ch%d hcint %08x in %s\n",
+		       (unsigned long long) uframes, n, hcint.d32,
+		       fsm_name(st->fsm));
+	sim_run_fiq(n);
+	return 0;
+}
+
+/* Emulates the bounce buffer setup in fiq_fsm_setup_periodic_dma(). */
+static void sim_setup_periodic_dma(struct fiq_channel_state *st, int n,
+				   enum sim_xfer_type type, int in, int len)
+{
+	struct fiq_dma_blob *blob = (struct fiq_dma_blob *) state->dma_base;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		st->dma_info.slot_len[i] = 255;
+	st->dma_info.index = 0;
+	st->hcdma_copy.d32 = (dma_addr_t) &blob->channel[n].index[0].buf[0];
+
+	if (in) {
+		int frame_length = st->hcchar_copy.b.mps;
+
+		i = 0;
+		do {
+			i++;
+			frame_length -= 188;
+		} while (frame_length >= 0);
+		st->nrpackets = i;
+	} else if (type == SIM_XFER_ISOC) {
+		if (len == 0) {
+			st->dma_info.slot_len[0] = 0;
+			st->nrpackets = 1;
+		} else {
+			i = 0;
+			do {
+				st->dma_info.slot_len[i] = len > 188 ? 188 : len;
+				i++;
+				len -= 188;
+			} while (len > 0 && i < 6);
+			st->nrpackets = i;
+		}
+		st->hctsiz_copy.b.pid = 0;
+		st->hctsiz_copy.b.xfersize = st->dma_info.slot_len[0];
+	} else {
+		st->hcdma_copy.d32 = SIM_DMA_BASE / 2;
+	}
+}
+
+static int sim_tt_in_use(int n)
+{
+	struct fiq_channel_state *st = &state->channel[n];
+	int i;
+
+	/* As fiq_fsm_queue_split_transaction(), which also counts
+	 * channels polling for CSPLITs.
+	 */
+	for (i = 0; i < num_channels; i++) {
+		if (i == n)
+			continue;
+		switch (state->channel[i].fsm) {
+		case FIQ_PER_SSPLIT_STARTED:
+		case FIQ_PER_CSPLIT_WAIT:
+		case FIQ_PER_CSPLIT_NYET1:
+		case FIQ_PER_CSPLIT_POLL:
+		case FIQ_PER_ISO_OUT_ACTIVE:
+		case FIQ_PER_ISO_OUT_LAST:
+			if (state->channel[i].hub_addr == st->hub_addr &&
+			    state->channel[i].port_addr == st->port_addr)
+				return 1;
+			break;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+static void sim_queue_hs_isoc(int n, int in, int mps, int len, int frames)
+{
+	struct fiq_channel_state *st = &state->channel[n];
+	hfnum_data_t hfnum = { .d32 = regs[HFNUM / 4] };
+	int i, nrpackets;
+
+	for (i = 0; i < frames; i++) {
+		chan[n].iso_desc[i].offset = i * len;
+		chan[n].iso_desc[i].length = len;
+		chan[n].iso_desc[i].actual_length = 0;
+		chan[n].iso_desc[i].status = 0;
+	}
+	st->hs_isoc_info.iso_desc = chan[n].iso_desc;
+	st->hs_isoc_info.nrframes = frames;
+	st->hs_isoc_info.index = 0;
+	st->hcchar_copy.b.oddfrm = (hfnum.b.frnum & 0x1) ? 0 : 1;
+	st->hcdma_copy.d32 = SIM_HS_ISOC_DMA;
+
+	nrpackets = (len + mps - 1) / mps;
+	if (nrpackets == 0)
+		nrpackets = 1;
+	st->hcchar_copy.b.multicnt = nrpackets;
+	st->hctsiz_copy.b.pktcnt = nrpackets;
+	if (!in) {
+		st->hctsiz_copy.b.xfersize = len;
+		st->hctsiz_copy.b.pid = nrpackets == 1 ? DWC_PID_DATA0 : DWC_PID_MDATA;
+	} else {
+		st->hctsiz_copy.b.xfersize = nrpackets * mps;
+		st->hctsiz_copy.b.pid = nrpackets == 1 ? DWC_PID_DATA0 :
+					nrpackets == 2 ? DWC_PID_DATA1 : DWC_PID_DATA2;
+	}
+	st->fsm = FIQ_HS_ISOC_TURBO;
+}
+
+static int sim_queue(int n, char **argv, int argc)
+{
+	struct fiq_channel_state *st = &state->channel[n];
+	hfnum_data_t hfnum = { .d32 = regs[HFNUM / 4] };
+	enum sim_xfer_type type;
+	int in, hub = 1, port = 1, mps = 64, len = -1, frames = 1;
+	int xfer_len, periodic, start_immediate = 1;
+	int i;
+
+	if (argc < 2)
+		return -EINVAL;
+	for (type = 0; type < SIM_XFER_TYPES; type++)
+		if (!strcmp(argv[0], sim_xfer_names[type]))
+			break;
+	if (type == SIM_XFER_TYPES)
+		return -EINVAL;
+	if (!strcmp(argv[1], "in"))
+		in = 1;
+	else if (!strcmp(argv[1], "out"))
+		in = 0;
+	else
+		return -EINVAL;
+	for (i = 2; i < argc; i++) {
+		if (!strncmp(argv[i], "hub=", 4))
+			hub = strtol(argv[i] + 4, NULL, 0);
+		else if (!strncmp(argv[i], "port=", 5))
+			port = strtol(argv[i] + 5, NULL, 0);
+		else if (!strncmp(argv[i], "mps=", 4))
+			mps = strtol(argv[i] + 4, NULL, 0);
+		else if (!strncmp(argv[i], "len=", 4))
+			len = strtol(argv[i] + 4, NULL, 0);
+		else if (!strncmp(argv[i], "frames=", 7))
+			frames = strtol(argv[i] + 7, NULL, 0);
+		else
+			return -EINVAL;
+	}
+	if (len < 0)
+		len = mps;
+	if (frames < 1 || frames > SIM_MAX_ISO_FRAMES || mps < 1)
+		return -EINVAL;
+
+	if (st->fsm != FIQ_PASSTHROUGH || chan[n].active) {
+		queue_busy++;
+		return 0;
+	}
+
+	memset(&chan[n].cost, 0, sizeof(chan[n].cost));
+	chan[n].active = 1;
+	chan[n].type = type;
+	chan[n].start_uframe = uframes;
+
+	st->nr_errors = 0;
+	st->hcchar_copy.d32 = 0;
+	st->hcchar_copy.b.mps = mps;
+	st->hcchar_copy.b.epdir = in;
+	st->hcchar_copy.b.devaddr = n + 1;
+	st->hcchar_copy.b.epnum = 1;
+	st->hcchar_copy.b.eptype = sim_xfer_eptype[type];
+	st->hcsplt_copy.d32 = 0;
+	st->hctsiz_copy.d32 = 0;
+	st->hcintmsk_copy.d32 = 0;
+	st->hcintmsk_copy.b.chhltd = 1;
+
+	if (type == SIM_XFER_HS_ISOC) {
+		st->hub_addr = 0;
+		st->port_addr = 0;
+		sim_queue_hs_isoc(n, in, mps, len, frames);
+		goto program;
+	}
+
+	periodic = st->hcchar_copy.b.eptype & 0x1;
+	if (periodic)
+		st->hcchar_copy.b.multicnt = in ? 3 : 0;
+	else
+		st->hcchar_copy.b.multicnt = 1;
+
+	st->hcsplt_copy.b.spltena = 1;
+	st->hcsplt_copy.b.xactpos = ISOC_XACTPOS_ALL;
+	if (type == SIM_XFER_ISOC && !in && len > 188)
+		st->hcsplt_copy.b.xactpos = ISOC_XACTPOS_BEGIN;
+	st->hcsplt_copy.b.hubaddr = hub;
+	st->hcsplt_copy.b.prtaddr = port;
+	st->hub_addr = hub;
+	st->port_addr = port;
+	if (periodic && sim_find_tt(hub, port) < 0) {
+		fprintf(stderr, "too many transaction translators\n");
+		return -ENOSPC;
+	}
+
+	xfer_len = len;
+	if (in || xfer_len > mps)
+		xfer_len = mps;
+	else if (!in && xfer_len > 188)
+		xfer_len = 188;
+	st->hctsiz_copy.b.xfersize = xfer_len;
+	st->hctsiz_copy.b.pktcnt = 1;
+
+	if (periodic)
+		sim_setup_periodic_dma(st, n, type, in, len);
+	else
+		st->hcdma_copy.d32 = SIM_DMA_BASE / 2;
+	st->hcintmsk_copy.b.ahberr = 1;
+
+	if ((fsm_mask & 0x8) && type == SIM_XFER_INT) {
+		st->hcchar_copy.b.multicnt = 0;
+		st->hcchar_copy.b.eptype = 0;
+	}
+
+	if (periodic) {
+		if ((hfnum.b.frnum & 0x7) == 5)
+			start_immediate = 0;
+		else if (type == SIM_XFER_ISOC && !in)
+			start_immediate = 0;
+		else if (in && fiq_fsm_too_late(state, n))
+			start_immediate = 0;
+		else if (sim_tt_in_use(n))
+			start_immediate = 0;
+	}
+	if ((fsm_mask & 0x8) && type == SIM_XFER_INT)
+		start_immediate = 1;
+
+	switch (type) {
+	case SIM_XFER_CTRL:
+	case SIM_XFER_BULK:
+		st->fsm = FIQ_NP_SSPLIT_STARTED;
+		break;
+	case SIM_XFER_ISOC:
+		if (in)
+			st->fsm = start_immediate ? FIQ_PER_SSPLIT_STARTED :
+						    FIQ_PER_SSPLIT_QUEUED;
+		else if (start_immediate)
+			st->fsm = st->nrpackets == 1 ? FIQ_PER_ISO_OUT_LAST :
+						       FIQ_PER_ISO_OUT_ACTIVE;
+		else
+			st->fsm = FIQ_PER_ISO_OUT_PENDING;
+		break;
+	case SIM_XFER_INT:
+		if (fsm_mask & 0x8)
+			st->fsm = FIQ_NP_SSPLIT_STARTED;
+		else
+			st->fsm = start_immediate ? FIQ_PER_SSPLIT_STARTED :
+						    FIQ_PER_SSPLIT_QUEUED;
+		break;
+	default:
+		break;
+	}
+	if (start_immediate) {
+		st->expected_uframe = (hfnum.b.frnum + 1) & 0x3FFF;
+		st->hcchar_copy.b.oddfrm = (hfnum.b.frnum & 0x1) ? 0 : 1;
+	}
+
+program:
+	*hc_dma_reg(n) = st->hcdma_copy.d32;
+	*hc_reg(n, HCTSIZ) = st->hctsiz_copy.d32;
+	*hc_reg(n, HCSPLT) = st->hcsplt_copy.d32;
+	*hc_reg(n, HCINTMSK) = st->hcintmsk_copy.d32;
+	*hc_reg(n, HCINT) = 0;
+	if (start_immediate) {
+		st->hcchar_copy.b.chen = 1;
+		chan[n].cost.restarts++;
+	}
+	*hc_reg(n, HCCHAR) = st->hcchar_copy.d32;
+	st->hcchar_copy.b.chen = 0;
+	sim_update_irq_lines();
+
+	if (verbose)
+		printf("%6llu: ch%d queue %s %s -> %s\n",
+		       (unsigned long long) uframes, n, sim_xfer_names[type],
+		       in ? "in" : "out", fsm_name(st->fsm));
+	return 0;
+}
+
+static void sim_reset(void)
+{
+	gintmsk_data_t gintmsk = { .d32 = 0 };
+	size_t size = sizeof(*state) +
+		      num_channels * sizeof(struct fiq_channel_state);
+
+	free(state);
+	state = calloc(1, size);
+	if (!state) {
+		perror("calloc");
+		exit(1);
+	}
+	memset(regs, 0, sizeof(regs));
+	memset(mphi, 0, sizeof(mphi));
+	memset(chan, 0, sizeof(chan));
+
+	state->dwc_regs_base = regs;
+	state->mphi_regs.base = &mphi[0];
+	state->mphi_regs.ctrl = &mphi[1];
+	state->mphi_regs.outdda = &mphi[2];
+	state->mphi_regs.outddb = &mphi[3];
+	state->mphi_regs.intstat = &mphi[4];
+	state->dma_base = SIM_DMA_BASE;
+	state->dummy_send = dummy_send;
+	state->gintmsk_saved.d32 = ~0;
+	state->haintmsk_saved.b2.chint = (1 << num_channels) - 1;
+	state->next_sched_frame = SIM_SCHED_INTERVAL;
+
+	gintmsk.b.sofintr = 1;
+	gintmsk.b.hcintr = 1;
+	regs[GINTMSK / 4] = gintmsk.d32;
+	regs[HAINTMSK / 4] = (1 << num_channels) - 1;
+	irq_pending = 0;
+}
+
+static int sim_replay(const char *path)
+{
+	char line[256];
+	unsigned int lineno = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	sim_reset();
+
+	while (fgets(line, sizeof(line), f)) {
+		char *argv[16], *p, *tok;
+		int argc = 0, n, ret = 0;
+
+		lineno++;
+		p = strchr(line, '#');
+		if (p)
+			*p = '\0';
+		for (tok = strtok(line, " \t\r\n"); tok && argc < 16;
+		     tok = strtok(NULL, " \t\r\n"))
+			argv[argc++] = tok;
+		if (!argc)
+			continue;
+
+		if (!strcmp(argv[0], "sof")) {
+			int count = argc > 1 ? strtol(argv[1], NULL, 0) : 1;
+
+			while (count-- > 0)
+				sim_sof();
+		} else if (!strcmp(argv[0], "frame") && argc == 2) {
+			hfnum_data_t hfnum = { .d32 = regs[HFNUM / 4] };
+
+			hfnum.b.frnum = strtoul(argv[1], NULL, 0) &
+					DWC_HFNUM_MAX_FRNUM;
+			regs[HFNUM / 4] = hfnum.d32;
+		} else if ((!strcmp(argv[0], "queue") ||
+			    !strcmp(argv[0], "hcint")) && argc >= 2) {
+			n = strtol(argv[1], NULL, 0);
+			if (n < 0 || n >= num_channels)
+				ret = -EINVAL;
+			else if (argv[0][0] == 'q')
+				ret = sim_queue(n, argv + 2, argc - 2);
+			else
+				ret = sim_hcint(n, argv + 2, argc - 2);
+		} else {
+			ret = -EINVAL;
+		}
+
+		if (ret) {
+			fprintf(stderr, "%s:%u: bad event '%s'\n",
+				path, lineno, argv[0]);
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static void sim_report(int repeats)
+{
+	unsigned long fiq_entries = sof_cost.fiq_entries;
+	uint64_t fiq_ns = sof_cost.ns;
+	int t, s, i;
+
+	for (t = 0; t < SIM_XFER_TYPES; t++) {
+		fiq_entries += xfer_stats[t].cost.fiq_entries;
+		fiq_ns += xfer_stats[t].cost.ns;
+	}
+
+	printf("replays %d, microframes %llu, FIQ entries %lu, IRQ kicks %lu\n",
+	       repeats, (unsigned long long) uframes, fiq_entries, irq_kicks);
+	if (fiq_entries)
+		printf("FIQ host time: mean %llu ns, max %llu ns\n",
+		       (unsigned long long) (fiq_ns / fiq_entries),
+		       (unsigned long long) fiq_max_ns);
+	if (queue_busy)
+		printf("queue events on a busy channel: %lu\n", queue_busy);
+	if (uframes)
+		printf("SOF: %.2f reads %.2f writes %.1f ns per microframe\n",
+		       (double) sof_cost.reads / uframes,
+		       (double) sof_cost.writes / uframes,
+		       (double) sof_cost.ns / uframes);
+
+	printf("\n%-7s %7s %8s %8s %8s %8s %8s %9s\n", "type", "xfers",
+	       "uframes", "fiqs", "reads", "writes", "starts", "fiq ns");
+	for (t = 0; t < SIM_XFER_TYPES; t++) {
+		struct sim_xfer_stats *xs = &xfer_stats[t];
+		double count = xs->count;
+
+		if (!xs->count)
+			continue;
+		printf("%-7s %7lu %8.2f %8.2f %8.2f %8.2f %8.2f %9.1f\n",
+		       sim_xfer_names[t], xs->count,
+		       xs->uframes / count, xs->cost.fiq_entries / count,
+		       xs->cost.reads / count, xs->cost.writes / count,
+		       xs->cost.restarts / count, xs->cost.ns / count);
+		for (s = 0; s <= FIQ_TEST; s++)
+			if (xs->outcome[s])
+				printf("        %-24s %7lu\n",
+				       fsm_name(s), xs->outcome[s]);
+	}
+
+	if (!num_tts || !uframes)
+		return;
+	printf("\n%-9s %9s %9s %9s\n", "tt", "busy%", "blocked%", "missed%");
+	for (i = 0; i < num_tts; i++)
+		printf("%3u.%-5u %9.2f %9.2f %9.2f\n",
+		       tts[i].hub_addr, tts[i].port_addr,
+		       100.0 * tts[i].busy / uframes,
+		       100.0 * tts[i].blocked / uframes,
+		       100.0 * tts[i].idle_waiting / uframes);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c channels] [-m fiq_fsm_mask] [-r repeats] [-v] trace...\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int repeats = 1, opt, r, i;
+
+	while ((opt = getopt(argc, argv, "c:m:r:v")) != -1) {
+		switch (opt) {
+		case 'c':
+			num_channels = strtol(optarg, NULL, 0);
+			if (num_channels < 1 || num_channels > SIM_MAX_CHANNELS)
+				usage(argv[0]);
+			break;
+		case 'm':
+			fsm_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			repeats = strtol(optarg, NULL, 0);
+			if (repeats < 1)
+				usage(argv[0]);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		usage(argv[0]);
+
+	for (r = 0; r < repeats; r++) {
+		for (i = optind; i < argc; i++)
+			if (sim_replay(argv[i]))
+				return 1;
+		verbose = 0;
+	}
+	sim_report(repeats);
+	free(state);
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * fiq_fsm_sim.h - Host-side environment for building the FIQ FSM
+ *
+ * Copyright (c) 2015 Raspberry Pi Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * dwc_otg_fiq_fsm.c is built unmodified against this header when
+ * DWC_OTG_FIQ_SIM is defined. It supplies the handful of kernel types
+ * and helpers the FSM uses, and routes FIQ_READ/FIQ_WRITE through the
+ * simulator's register model so that every MMIO access the FIQ makes
+ * is seen (and counted) by fiq_fsm_sim.c.
+ */
+
+#ifndef FIQ_FSM_SIM_H_
+#define FIQ_FSM_SIM_H_
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned short ushort;
+/* Only ever used to carry the fake bounce buffer bus address. */
+typedef uintptr_t dma_addr_t;
+typedef dma_addr_t dwc_dma_t;
+
+#define notrace
+#define noinline	__attribute__((noinline))
+#define mb()		__sync_synchronize()
+#define BUG()		abort()
+
+#include "dwc_otg_regs.h"
+
+/* From dwc_otg_hcd.h */
+struct dwc_otg_hcd_iso_packet_desc {
+	uint32_t offset;
+	uint32_t length;
+	uint32_t actual_length;
+	uint32_t status;
+};
+
+static inline int dwc_frame_num_le(uint16_t frame1, uint16_t frame2)
+{
+	return ((frame2 - frame1) & DWC_HFNUM_MAX_FRNUM) <=
+	    (DWC_HFNUM_MAX_FRNUM >> 1);
+}
+
+static inline int dwc_frame_num_gt(uint16_t frame1, uint16_t frame2)
+{
+	return (frame1 != frame2) &&
+	    (((frame1 - frame2) & DWC_HFNUM_MAX_FRNUM) <
+	     (DWC_HFNUM_MAX_FRNUM >> 1));
+}
+
+extern uint32_t fiq_sim_read(volatile void *addr);
+extern void fiq_sim_write(volatile void *addr, uint32_t data);
+
+#define FIQ_WRITE(_addr_,_data_) fiq_sim_write((volatile void *) (_addr_), (_data_))
+#define FIQ_READ(_addr_) fiq_sim_read((volatile void *) (_addr_))
+
+#endif /* FIQ_FSM_SIM_H_ */
@@ -40,6 +40,9 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/kthread.h>
+#include <linux/fdtable.h>
+#include <linux/cred.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -154,6 +157,22 @@ struct kioctx {
 	struct file		*aio_ring_file;
 
 	unsigned		id;
+
+	/*
+	 * IOCTX_FLAG_SQPOLL: sq_thread runs in the submitter's mm, files
+	 * and credentials and feeds sq_ring to io_submit_one().  sq_head
+	 * is the kernel's copy, sq_ring->head only mirrors it.
+	 */
+	struct aio_sq_ring __user *sq_ring;
+	unsigned		sq_nr;
+	unsigned		sq_head;
+	unsigned		sq_dropped;
+	unsigned long		sq_idle;
+	bool			sq_compat;
+	struct task_struct	*sq_thread;
+	struct mm_struct	*sq_mm;
+	struct files_struct	*sq_files;
+	const struct cred	*sq_cred;
 };
 
 /*
@@ -186,16 +205,25 @@ struct aio_kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/* buffered reads handed to aio_read_wq, see aio_queue_read() */
+	struct work_struct	ki_work;
+	struct mm_struct	*ki_mm;
+	struct iov_iter		ki_iter;
+	struct iovec		*ki_iovec;	/* kmalloc'ed ki_iter vector */
+	struct iovec		ki_inline_vec;
 };
 
 /*------ sysctl variables----*/
 static DEFINE_SPINLOCK(aio_nr_lock);
 unsigned long aio_nr;		/* current system wide number of aio requests */
 unsigned long aio_max_nr = 0x10000; /* system wide maximum number of aio requests */
+int aio_buffered_async;		/* punt buffered reads to aio_read_wq */
 /*----end sysctl variables---*/
 
 static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
+static struct workqueue_struct *aio_read_wq;
 
 static struct vfsmount *aio_mnt;
 
@@ -260,6 +288,10 @@ static int __init aio_setup(void)
 	kiocb_cachep = KMEM_CACHE(aio_kiocb, SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 	kioctx_cachep = KMEM_CACHE(kioctx,SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 
+	aio_read_wq = alloc_workqueue("aio_read", WQ_UNBOUND, 0);
+	if (!aio_read_wq)
+		panic("Failed to create aio read workqueue.");
+
 	pr_debug("sizeof(struct page) = %zu\n", sizeof(struct page));
 
 	return 0;
@@ -565,6 +597,8 @@ static void free_ioctx(struct work_struct *work)
 
 	pr_debug("freeing %p\n", ctx);
 
+	if (ctx->sq_thread)
+		put_task_struct(ctx->sq_thread);
 	aio_free_ring(ctx);
 	free_percpu(ctx->cpu);
 	percpu_ref_exit(&ctx->reqs);
@@ -806,6 +840,10 @@ static int kill_ioctx(struct mm_struct *mm, struct kioctx *ctx,
 	/* percpu_ref_kill() will do the necessary call_rcu() */
 	wake_up_all(&ctx->wait);
 
+	/* the poller sees ->dead and drops its reference to ->users */
+	if (ctx->sq_thread)
+		wake_up_process(ctx->sq_thread);
+
 	/*
 	 * It'd be more correct to do this in free_ioctx(), after all
 	 * the outstanding kiocbs have finished - but by then io_destroy
@@ -1014,6 +1052,7 @@ static void kiocb_free(struct aio_kiocb *req)
 		fput(req->common.ki_filp);
 	if (req->ki_eventfd != NULL)
 		eventfd_ctx_put(req->ki_eventfd);
+	kfree(req->ki_iovec);
 	kmem_cache_free(kiocb_cachep, req);
 }
 
@@ -1387,6 +1426,73 @@ static int aio_setup_vectored_rw(int rw, char __user *buf, size_t len,
 				len, UIO_FASTIOV, iovec, iter);
 }
 
+static void aio_rw_done(struct kiocb *req, ssize_t ret)
+{
+	if (ret != -EIOCBQUEUED) {
+		/*
+		 * There's no easy way to restart the syscall since other AIO's
+		 * may be already running. Just fail this IO with EINTR.
+		 */
+		if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
+			     ret == -ERESTARTNOHAND ||
+			     ret == -ERESTART_RESTARTBLOCK))
+			ret = -EINTR;
+		aio_complete(req, ret, 0);
+	}
+}
+
+/*
+ * Buffered reads sleep in ->read_iter() on every page cache miss, which
+ * turns io_submit() into a synchronous read.  With aio-buffered-async set
+ * they run from aio_read_wq instead.  The worker borrows the submitter's
+ * mm; exit_aio() waits for every request before that mm is torn down.
+ */
+static void aio_read_work(struct work_struct *work)
+{
+	struct aio_kiocb *req = container_of(work, struct aio_kiocb, ki_work);
+	struct kiocb *iocb = &req->common;
+	struct mm_struct *mm = req->ki_mm;
+	mm_segment_t oldfs = get_fs();
+	ssize_t ret;
+
+	use_mm(mm);
+	set_fs(USER_DS);
+	ret = iocb->ki_filp->f_op->read_iter(iocb, &req->ki_iter);
+	set_fs(oldfs);
+	unuse_mm(mm);
+
+	aio_rw_done(iocb, ret);
+}
+
+static bool aio_queue_read(struct kiocb *iocb, struct iov_iter *iter,
+			   struct iovec *iovec)
+{
+	struct aio_kiocb *req = container_of(iocb, struct aio_kiocb, common);
+
+	if (!iovec) {
+		/* iter still points at aio_run_iocb()'s inline_vecs */
+		if (iter->nr_segs == 1) {
+			req->ki_inline_vec = *iter->iov;
+			iter->iov = &req->ki_inline_vec;
+		} else {
+			iovec = kmemdup(iter->iov,
+					iter->nr_segs * sizeof(*iovec),
+					GFP_KERNEL);
+			if (!iovec)
+				return false;
+			iter->iov = iovec;
+		}
+	}
+
+	/* freed with the kiocb */
+	req->ki_iovec = iovec;
+	req->ki_iter = *iter;
+	req->ki_mm = current->mm;
+	INIT_WORK(&req->ki_work, aio_read_work);
+	queue_work(aio_read_wq, &req->ki_work);
+	return true;
+}
+
 /*
  * aio_run_iocb:
  *	Performs the initial checks and io submission.
@@ -1440,6 +1546,12 @@ rw_common:
 
 		len = ret;
 
+		if (rw == READ && aio_buffered_async &&
+		    !(req->ki_flags & IOCB_DIRECT) &&
+		    S_ISREG(file_inode(file)->i_mode) &&
+		    aio_queue_read(req, &iter, iovec))
+			return 0;
+
 		if (rw == WRITE)
 			file_start_write(file);
 
@@ -1469,27 +1581,12 @@ rw_common:
 		return -EINVAL;
 	}
 
-	if (ret != -EIOCBQUEUED) {
-		/*
-		 * There's no easy way to restart the syscall since other AIO's
-		 * may be already running. Just fail this IO with EINTR.
-		 */
-		if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
-			     ret == -ERESTARTNOHAND ||
-			     ret == -ERESTART_RESTARTBLOCK))
-			ret = -EINTR;
-		aio_complete(req, ret, 0);
-	}
-
+	aio_rw_done(req, ret);
 	return 0;
 }
 
-static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
-			 struct iocb *iocb, bool compat)
+static int aio_check_iocb(struct iocb *iocb)
 {
-	struct aio_kiocb *req;
-	ssize_t ret;
-
 	/* enforce forwards compatibility on users */
 	if (unlikely(iocb->aio_reserved1 || iocb->aio_reserved2)) {
 		pr_debug("EINVAL: reserve field set\n");
@@ -1505,16 +1602,21 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		pr_debug("EINVAL: overflow check\n");
 		return -EINVAL;
 	}
+	return 0;
+}
 
-	req = aio_get_req(ctx);
-	if (unlikely(!req))
-		return -EAGAIN;
+/*
+ * Sets up and issues @req for @iocb.  On failure the request has not
+ * been issued and still belongs to the caller.
+ */
+static int aio_submit_req(struct aio_kiocb *req, struct iocb __user *user_iocb,
+			  struct iocb *iocb, bool compat)
+{
+	ssize_t ret;
 
 	req->common.ki_filp = fget(iocb->aio_fildes);
-	if (unlikely(!req->common.ki_filp)) {
-		ret = -EBADF;
-		goto out_put_req;
-	}
+	if (unlikely(!req->common.ki_filp))
+		return -EBADF;
 	req->common.ki_pos = iocb->aio_offset;
 	req->common.ki_complete = aio_complete;
 	req->common.ki_flags = iocb_flags(req->common.ki_filp);
@@ -1530,7 +1632,7 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		if (IS_ERR(req->ki_eventfd)) {
 			ret = PTR_ERR(req->ki_eventfd);
 			req->ki_eventfd = NULL;
-			goto out_put_req;
+			return ret;
 		}
 
 		req->common.ki_flags |= IOCB_EVENTFD;
@@ -1539,24 +1641,38 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	ret = put_user(KIOCB_KEY, &user_iocb->aio_key);
 	if (unlikely(ret)) {
 		pr_debug("EFAULT: aio_key\n");
-		goto out_put_req;
+		return ret;
 	}
 
 	req->ki_user_iocb = user_iocb;
 	req->ki_user_data = iocb->aio_data;
 
-	ret = aio_run_iocb(&req->common, iocb->aio_lio_opcode,
-			   (char __user *)(unsigned long)iocb->aio_buf,
-			   iocb->aio_nbytes,
-			   compat);
-	if (ret)
-		goto out_put_req;
+	return aio_run_iocb(&req->common, iocb->aio_lio_opcode,
+			    (char __user *)(unsigned long)iocb->aio_buf,
+			    iocb->aio_nbytes,
+			    compat);
+}
 
-	return 0;
-out_put_req:
-	put_reqs_available(ctx, 1);
-	percpu_ref_put(&ctx->reqs);
-	kiocb_free(req);
+static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
+			 struct iocb *iocb, bool compat)
+{
+	struct aio_kiocb *req;
+	int ret;
+
+	ret = aio_check_iocb(iocb);
+	if (unlikely(ret))
+		return ret;
+
+	req = aio_get_req(ctx);
+	if (unlikely(!req))
+		return -EAGAIN;
+
+	ret = aio_submit_req(req, user_iocb, iocb, compat);
+	if (unlikely(ret)) {
+		put_reqs_available(ctx, 1);
+		percpu_ref_put(&ctx->reqs);
+		kiocb_free(req);
+	}
 	return ret;
 }
 
@@ -1583,6 +1699,10 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 		return -EINVAL;
 	}
 
+	/* io_submit(ctx, 0, NULL) is the doorbell for a sleeping poller */
+	if (ctx->sq_thread)
+		wake_up_process(ctx->sq_thread);
+
 	blk_start_plug(&plug);
 
 	/*
@@ -1631,6 +1751,259 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 	return do_io_submit(ctx_id, nr, iocbpp, 0);
 }
 
+#define AIO_SQ_IDLE_MS		10
+#define AIO_SQ_IDLE_MAX_MS	1000
+#define AIO_SQ_MAX_ENTRIES	4096
+
+static void aio_sq_set_flags(struct kioctx *ctx, unsigned flags)
+{
+	put_user(flags, &ctx->sq_ring->flags);
+}
+
+static bool aio_sq_pending(struct kioctx *ctx)
+{
+	unsigned tail;
+
+	if (get_user(tail, &ctx->sq_ring->tail))
+		return false;
+	return tail != ctx->sq_head;
+}
+
+/*
+ * aio_sq_submit:
+ *	Submits what userland has published in the sq ring, at most one
+ *	ring's worth per call.  Returns the number of iocbs consumed and
+ *	sets *full if the completion ring had no room left.  An iocb that
+ *	fails to submit, for whatever reason, completes with the error as
+ *	its result; it is never retried.
+ */
+static unsigned aio_sq_submit(struct kioctx *ctx, bool *full)
+{
+	struct aio_sq_ring __user *ring = ctx->sq_ring;
+	unsigned head = ctx->sq_head, tail, done = 0;
+	struct blk_plug plug;
+	struct iocb tmp;
+	int ret;
+
+	*full = false;
+	if (get_user(tail, &ring->tail))
+		return 0;
+	/* pairs with the write barrier before userland's tail update */
+	smp_rmb();
+
+	blk_start_plug(&plug);
+	while (head != tail && done < ctx->sq_nr) {
+		struct iocb __user *user_iocb =
+			&ring->iocbs[head & (ctx->sq_nr - 1)];
+		struct aio_kiocb *req;
+
+		/* the only condition that is worth waiting out */
+		req = aio_get_req(ctx);
+		if (unlikely(!req)) {
+			*full = true;
+			break;
+		}
+
+		if (unlikely(copy_from_user(&tmp, user_iocb, sizeof(tmp)))) {
+			memset(&tmp, 0, sizeof(tmp));
+			ret = -EFAULT;
+		} else {
+			ret = aio_check_iocb(&tmp);
+			if (!ret)
+				ret = aio_submit_req(req, user_iocb, &tmp,
+						     ctx->sq_compat);
+		}
+		if (unlikely(ret)) {
+			pr_debug("failed iocb %u: %d\n", head, ret);
+			put_user(++ctx->sq_dropped, &ring->dropped);
+			req->ki_user_iocb = user_iocb;
+			req->ki_user_data = tmp.aio_data;
+			aio_complete(&req->common, ret, 0);
+		}
+		head++;
+		done++;
+	}
+	blk_finish_plug(&plug);
+
+	if (done) {
+		ctx->sq_head = head;
+		/* the slots are free for reuse once head moves */
+		smp_mb();
+		put_user(head, &ring->head);
+	}
+	return done;
+}
+
+/*
+ * aio_sq_thread:
+ *	Polls the submission ring while there is work, then for sq_idle
+ *	jiffies more, then advertises AIO_SQ_NEED_WAKEUP and sleeps until
+ *	io_submit() or kill_ioctx() wakes it.  Holds a reference to
+ *	ctx->users for its whole life, so the context cannot finish dying
+ *	before the thread has left.
+ */
+static int aio_sq_thread(void *data)
+{
+	struct kioctx *ctx = data;
+	struct mm_struct *mm = ctx->sq_mm;
+	struct files_struct *files;
+	const struct cred *old_cred;
+	unsigned long timeout = jiffies + ctx->sq_idle;
+	bool full;
+
+	/* act as the submitter: its fd table, credentials and mm */
+	task_lock(current);
+	files = current->files;
+	current->files = ctx->sq_files;
+	task_unlock(current);
+	old_cred = override_creds(ctx->sq_cred);
+	use_mm(mm);
+	set_fs(USER_DS);
+
+	while (!atomic_read(&ctx->dead)) {
+		if (aio_sq_submit(ctx, &full)) {
+			timeout = jiffies + ctx->sq_idle;
+			cond_resched();
+			continue;
+		}
+
+		if (full) {
+			/* userland reaps without telling us, so poll slowly */
+			schedule_timeout_interruptible(1);
+			continue;
+		}
+
+		if (time_before(jiffies, timeout)) {
+			cond_resched();
+			continue;
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		aio_sq_set_flags(ctx, AIO_SQ_NEED_WAKEUP);
+		/* order the flag against the tail recheck, see aio_abi.h */
+		smp_mb();
+		if (!aio_sq_pending(ctx) && !atomic_read(&ctx->dead))
+			schedule();
+		__set_current_state(TASK_RUNNING);
+		aio_sq_set_flags(ctx, 0);
+		timeout = jiffies + ctx->sq_idle;
+	}
+
+	unuse_mm(mm);
+	mmdrop(mm);
+	revert_creds(old_cred);
+	put_cred(ctx->sq_cred);
+	task_lock(current);
+	current->files = files;
+	task_unlock(current);
+	put_files_struct(ctx->sq_files);
+
+	/* ctx may be freed as soon as this is dropped */
+	percpu_ref_put(&ctx->users);
+	return 0;
+}
+
+static int aio_sq_start(struct kioctx *ctx, unsigned flags,
+			struct aio_sq_params *p)
+{
+	struct task_struct *tsk;
+	u32 idle_ms;
+
+	ctx->sq_ring = (struct aio_sq_ring __user *)(unsigned long)p->sq_ring;
+	ctx->sq_nr = p->sq_entries;
+	idle_ms = p->sq_idle_ms ? : AIO_SQ_IDLE_MS;
+	ctx->sq_idle = msecs_to_jiffies(min_t(u32, idle_ms,
+					      AIO_SQ_IDLE_MAX_MS));
+	if (get_user(ctx->sq_head, &ctx->sq_ring->head) ||
+	    put_user(0, &ctx->sq_ring->flags))
+		return -EFAULT;
+	ctx->sq_compat = is_compat_task();
+
+	tsk = kthread_create(aio_sq_thread, ctx, "aio_sq/%d",
+			     task_pid_nr(current));
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	if (flags & IOCTX_FLAG_SQ_AFFINITY)
+		kthread_bind(tsk, p->sq_cpu);
+
+	/* all of these are dropped by the thread on its way out */
+	ctx->sq_mm = current->mm;
+	atomic_inc(&ctx->sq_mm->mm_count);
+	ctx->sq_files = get_files_struct(current);
+	ctx->sq_cred = get_current_cred();
+	percpu_ref_get(&ctx->users);
+
+	get_task_struct(tsk);
+	ctx->sq_thread = tsk;
+	wake_up_process(tsk);
+	return 0;
+}
+
+/* sys_io_setup2:
+ *	Like io_setup(), with flags.  IOCTX_FLAG_SQPOLL attaches the
+ *	submission ring described by params: a kernel thread submits the
+ *	iocbs userland places there, so a busy submitter needs no system
+ *	calls at all.  IOCTX_FLAG_SQ_AFFINITY binds that thread to
+ *	params->sq_cpu.  The thread polls for at most one second before
+ *	it sleeps.  May fail with -EPERM without CAP_SYS_ADMIN or
+ *	CAP_SYS_NICE, -EINVAL for unknown flags, a ring size that is not
+ *	a power of two or an offline cpu, and otherwise as io_setup().
+ */
+SYSCALL_DEFINE4(io_setup2, unsigned, nr_events, unsigned, flags,
+		struct aio_sq_params __user *, params,
+		aio_context_t __user *, ctxp)
+{
+	struct aio_sq_params p;
+	struct kioctx *ioctx;
+	unsigned long ctx;
+	long ret;
+
+	if (flags & ~(IOCTX_FLAG_SQPOLL | IOCTX_FLAG_SQ_AFFINITY))
+		return -EINVAL;
+	if ((flags & IOCTX_FLAG_SQ_AFFINITY) && !(flags & IOCTX_FLAG_SQPOLL))
+		return -EINVAL;
+
+	ret = get_user(ctx, ctxp);
+	if (unlikely(ret))
+		return ret;
+	if (unlikely(ctx || nr_events == 0))
+		return -EINVAL;
+
+	if (flags & IOCTX_FLAG_SQPOLL) {
+		/* a polling thread, possibly on a cpu of the caller's choice */
+		if (!capable(CAP_SYS_ADMIN) && !capable(CAP_SYS_NICE))
+			return -EPERM;
+		if (copy_from_user(&p, params, sizeof(p)))
+			return -EFAULT;
+		if (!p.sq_entries || p.sq_entries > AIO_SQ_MAX_ENTRIES ||
+		    !is_power_of_2(p.sq_entries))
+			return -EINVAL;
+		if ((flags & IOCTX_FLAG_SQ_AFFINITY) &&
+		    (p.sq_cpu < 0 || p.sq_cpu >= nr_cpu_ids ||
+		     !cpu_online(p.sq_cpu)))
+			return -EINVAL;
+		if (!access_ok(VERIFY_WRITE,
+			       (void __user *)(unsigned long)p.sq_ring,
+			       sizeof(struct aio_sq_ring) +
+			       p.sq_entries * sizeof(struct iocb)))
+			return -EFAULT;
+	}
+
+	ioctx = ioctx_alloc(nr_events);
+	if (IS_ERR(ioctx))
+		return PTR_ERR(ioctx);
+
+	ret = 0;
+	if (flags & IOCTX_FLAG_SQPOLL)
+		ret = aio_sq_start(ioctx, flags, &p);
+	if (!ret)
+		ret = put_user(ioctx->user_id, ctxp);
+	if (ret)
+		kill_ioctx(current->mm, ioctx, NULL);
+	percpu_ref_put(&ioctx->users);
+	return ret;
+}
+
 /* lookup_kiocb
  *	Finds a given iocb for cancellation.
  */
@@ -42,6 +42,8 @@
 #include <linux/seq_file.h>
 #include <linux/compat.h>
 #include <linux/rculist.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
 
 /*
  * LOCKING:
@@ -141,8 +143,15 @@ struct epitem {
 		struct rcu_head rcu;
 	};
 
-	/* List header used to link this structure to the eventpoll ready list */
-	struct list_head rdllink;
+	union {
+		/* List header used to link this structure to the eventpoll ready list */
+		struct list_head rdllink;
+		/* EPOLL_PERCPU: link in a per-cpu ready list, and EPI_QUEUED */
+		struct {
+			struct llist_node llnode;
+			unsigned long pcp_flags;
+		};
+	};
 
 	/*
 	 * Works together "struct eventpoll"->ovflist in keeping the
@@ -219,6 +228,12 @@ struct eventpoll {
 	/* used to optimize loop detection check */
 	int visited;
 	struct list_head visited_list_link;
+
+	/*
+	 * EPOLL_PERCPU: ready items are pushed without locks on the list of
+	 * the cpu that ran the wakeup, and rdllist/ovflist are unused.
+	 */
+	struct llist_head __percpu *pcp_ready;
 };
 
 /* Wait structure used by the poll hooks */
@@ -379,6 +394,19 @@ static inline int ep_events_available(struct eventpoll *ep)
 	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
 }
 
+/* epitem->pcp_flags */
+#define EPI_QUEUED	0	/* on one of ep->pcp_ready */
+
+static bool ep_pcp_events_available(struct eventpoll *ep)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (!llist_empty(per_cpu_ptr(ep->pcp_ready, cpu)))
+			return true;
+	return false;
+}
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -576,6 +604,64 @@ static inline void ep_pm_stay_awake_rcu(struct epitem *epi)
 	rcu_read_unlock();
 }
 
+/*
+ * Queues @epi on this cpu's ready list unless it already is on one.  Safe
+ * against concurrent wakeups and against ep_pcp_send_events(), which
+ * clears EPI_QUEUED before it looks at the item.
+ */
+static bool ep_pcp_queue(struct eventpoll *ep, struct epitem *epi)
+{
+	if (test_and_set_bit(EPI_QUEUED, &epi->pcp_flags))
+		return false;
+	llist_add(&epi->llnode, raw_cpu_ptr(ep->pcp_ready));
+	return true;
+}
+
+/*
+ * Waiters sit on ep->wq as exclusive, autoremoving entries and re-add
+ * themselves at the tail, so each wakeup goes to the next one in turn.
+ */
+static void ep_pcp_wake(struct eventpoll *ep)
+{
+	/* llist_add() implies a full barrier against waitqueue_active() */
+	if (waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	if (waitqueue_active(&ep->poll_wait))
+		ep_poll_safewake(&ep->poll_wait);
+}
+
+/*
+ * Takes @epi off whichever per-cpu list holds it.  Called with ep->mtx
+ * held once no wakeup can requeue the item, so only producers for other
+ * items race with us, and llist_del_all()/llist_add_batch() allow that.
+ */
+static void ep_pcp_unlink(struct eventpoll *ep, struct epitem *epi)
+{
+	struct llist_node *node, *next, *first, *last;
+	int cpu;
+
+	if (!test_bit(EPI_QUEUED, &epi->pcp_flags))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct llist_head *head = per_cpu_ptr(ep->pcp_ready, cpu);
+
+		first = last = NULL;
+		for (node = llist_del_all(head); node; node = next) {
+			next = node->next;
+			if (node == &epi->llnode)
+				continue;
+			node->next = first;
+			first = node;
+			if (!last)
+				last = node;
+		}
+		if (first)
+			llist_add_batch(first, last, head);
+	}
+	clear_bit(EPI_QUEUED, &epi->pcp_flags);
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -711,10 +797,14 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	if (ep->pcp_ready) {
+		ep_pcp_unlink(ep, epi);
+	} else {
+		spin_lock_irqsave(&ep->lock, flags);
+		if (ep_is_linked(&epi->rdllink))
+			list_del_init(&epi->rdllink);
+		spin_unlock_irqrestore(&ep->lock, flags);
+	}
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 	/*
@@ -760,6 +850,20 @@ static void ep_free(struct eventpoll *ep)
 		cond_resched();
 	}
 
+	/* nothing can queue any more, so forget the per-cpu lists at once */
+	if (ep->pcp_ready) {
+		struct llist_node *node;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			node = llist_del_all(per_cpu_ptr(ep->pcp_ready, cpu));
+			for (; node; node = node->next) {
+				epi = llist_entry(node, struct epitem, llnode);
+				clear_bit(EPI_QUEUED, &epi->pcp_flags);
+			}
+		}
+	}
+
 	/*
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
@@ -780,6 +884,7 @@ static void ep_free(struct eventpoll *ep)
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
+	free_percpu(ep->pcp_ready);
 	kfree(ep);
 }
 
@@ -833,10 +938,46 @@ struct readyevents_arg {
 	bool locked;
 };
 
+/*
+ * EPOLL_PERCPU version of ep_read_events_proc().  Holding ep->mtx keeps
+ * ep_pcp_send_events() out, and producers only ever push in front of
+ * the first node we read, so the lists can be walked in place.  Items
+ * that turn out not to be ready are left for the next epoll_wait().
+ */
+static int ep_pcp_read_events(struct eventpoll *ep, int depth, bool locked)
+{
+	struct llist_node *node;
+	struct epitem *epi;
+	poll_table pt;
+	int cpu, res = 0;
+
+	init_poll_funcptr(&pt, NULL);
+
+	if (!locked)
+		mutex_lock_nested(&ep->mtx, depth);
+	for_each_possible_cpu(cpu) {
+		node = ACCESS_ONCE(per_cpu_ptr(ep->pcp_ready, cpu)->first);
+		for (; node; node = node->next) {
+			epi = llist_entry(node, struct epitem, llnode);
+			if (ep_item_poll(epi, &pt)) {
+				res = POLLIN | POLLRDNORM;
+				goto out;
+			}
+		}
+	}
+out:
+	if (!locked)
+		mutex_unlock(&ep->mtx);
+	return res;
+}
+
 static int ep_poll_readyevents_proc(void *priv, void *cookie, int call_nests)
 {
 	struct readyevents_arg *arg = priv;
 
+	if (arg->ep->pcp_ready)
+		return ep_pcp_read_events(arg->ep, call_nests + 1,
+					  arg->locked);
 	return ep_scan_ready_list(arg->ep, ep_read_events_proc, NULL,
 				  call_nests + 1, arg->locked);
 }
@@ -932,7 +1073,7 @@ void eventpoll_release_file(struct file *file)
 	mutex_unlock(&epmutex);
 }
 
-static int ep_alloc(struct eventpoll **pep)
+static int ep_alloc(struct eventpoll **pep, int flags)
 {
 	int error;
 	struct user_struct *user;
@@ -944,6 +1085,12 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
+	if (flags & EPOLL_PERCPU) {
+		ep->pcp_ready = alloc_percpu(struct llist_head);
+		if (!ep->pcp_ready)
+			goto free_ep;
+	}
+
 	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
@@ -957,6 +1104,8 @@ static int ep_alloc(struct eventpoll **pep)
 
 	return 0;
 
+free_ep:
+	kfree(ep);
 free_uid:
 	free_uid(user);
 	return error;
@@ -1014,6 +1163,17 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		list_del_init(&wait->task_list);
 	}
 
+	if (ep->pcp_ready) {
+		/* same filtering as below, but no ep->lock */
+		if ((epi->event.events & ~EP_PRIVATE_BITS) &&
+		    (!key || ((unsigned long)key & epi->event.events)) &&
+		    ep_pcp_queue(ep, epi)) {
+			ep_pm_stay_awake_rcu(epi);
+			ep_pcp_wake(ep);
+		}
+		return 1;
+	}
+
 	spin_lock_irqsave(&ep->lock, flags);
 
 	/*
@@ -1277,7 +1437,12 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		return -ENOMEM;
 
 	/* Item initialization follow here ... */
-	INIT_LIST_HEAD(&epi->rdllink);
+	if (ep->pcp_ready) {
+		epi->llnode.next = NULL;
+		epi->pcp_flags = 0;
+	} else {
+		INIT_LIST_HEAD(&epi->rdllink);
+	}
 	INIT_LIST_HEAD(&epi->fllink);
 	INIT_LIST_HEAD(&epi->pwqlist);
 	epi->ep = ep;
@@ -1331,6 +1496,15 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	if (full_check && reverse_path_check())
 		goto error_remove_epi;
 
+	if (ep->pcp_ready) {
+		if ((revents & event->events) && ep_pcp_queue(ep, epi)) {
+			ep_pm_stay_awake(epi);
+			ep_pcp_wake(ep);
+		}
+		atomic_long_inc(&ep->user->epoll_watches);
+		return 0;
+	}
+
 	/* We have to drop the new item inside our item list to keep track of it */
 	spin_lock_irqsave(&ep->lock, flags);
 
@@ -1372,10 +1546,14 @@ error_unregister:
 	 * list, since that is used/cleaned only inside a section bound by "mtx".
 	 * And ep_insert() is called with "mtx" held.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	if (ep->pcp_ready) {
+		ep_pcp_unlink(ep, epi);
+	} else {
+		spin_lock_irqsave(&ep->lock, flags);
+		if (ep_is_linked(&epi->rdllink))
+			list_del_init(&epi->rdllink);
+		spin_unlock_irqrestore(&ep->lock, flags);
+	}
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 
@@ -1437,6 +1615,14 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 */
 	revents = ep_item_poll(epi, &pt);
 
+	if (ep->pcp_ready) {
+		if ((revents & event->events) && ep_pcp_queue(ep, epi)) {
+			ep_pm_stay_awake(epi);
+			ep_pcp_wake(ep);
+		}
+		return 0;
+	}
+
 	/*
 	 * If the item is "hot" and it is not registered inside the ready
 	 * list, push it inside.
@@ -1554,6 +1740,96 @@ static int ep_send_events(struct eventpoll *ep,
 	return ep_scan_ready_list(ep, ep_send_events_proc, &esed, 0, false);
 }
 
+/*
+ * EPOLL_PERCPU version of ep_send_events().  Starting with this cpu's list,
+ * takes ready items until @maxevents are delivered and pushes back what
+ * it did not need.  ep->mtx still pins the items against epoll_ctl() and
+ * close, but is only held for at most @maxevents items and never with
+ * ep->lock, which wakeups do not take at all.
+ */
+static int ep_pcp_send_events(struct eventpoll *ep,
+			      struct epoll_event __user *events, int maxevents)
+{
+	struct llist_node *list, *last;
+	struct llist_head *head;
+	struct wakeup_source *ws;
+	struct epitem *epi;
+	unsigned int revents;
+	int i, cpu, eventcnt = 0;
+	poll_table pt;
+
+	init_poll_funcptr(&pt, NULL);
+
+	mutex_lock(&ep->mtx);
+	cpu = raw_smp_processor_id();
+	for (i = 0; i < num_possible_cpus() && eventcnt < maxevents; i++) {
+		if (i) {
+			cpu = cpumask_next(cpu, cpu_possible_mask);
+			if (cpu >= nr_cpu_ids)
+				cpu = cpumask_first(cpu_possible_mask);
+		}
+		head = per_cpu_ptr(ep->pcp_ready, cpu);
+		list = llist_del_all(head);
+		if (!list)
+			continue;
+		list = llist_reverse_order(list);
+
+		while (list && eventcnt < maxevents) {
+			epi = llist_entry(list, struct epitem, llnode);
+			list = list->next;
+
+			/* see ep_send_events_proc() */
+			ws = ep_wakeup_source(epi);
+			if (ws) {
+				if (ws->active)
+					__pm_stay_awake(ep->ws);
+				__pm_relax(ws);
+			}
+
+			/* a wakeup from here on queues the item again */
+			clear_bit(EPI_QUEUED, &epi->pcp_flags);
+			smp_mb__after_atomic();
+
+			revents = ep_item_poll(epi, &pt);
+			if (!revents)
+				continue;
+
+			if (__put_user(revents, &events[eventcnt].events) ||
+			    __put_user(epi->event.data, &events[eventcnt].data)) {
+				if (ep_pcp_queue(ep, epi))
+					ep_pm_stay_awake(epi);
+				if (!eventcnt)
+					eventcnt = -EFAULT;
+				break;
+			}
+			eventcnt++;
+			if (epi->event.events & EPOLLONESHOT)
+				epi->event.events &= EP_PRIVATE_BITS;
+			else if (!(epi->event.events & EPOLLET)) {
+				/* level triggered: look again next time */
+				if (ep_pcp_queue(ep, epi))
+					ep_pm_stay_awake(epi);
+			}
+		}
+
+		if (list) {
+			for (last = list; last->next; last = last->next)
+				;
+			llist_add_batch(list, last, head);
+		}
+		if (eventcnt < 0)
+			break;
+	}
+	__pm_relax(ep->ws);
+	mutex_unlock(&ep->mtx);
+
+	/* hand what is left to the next waiter */
+	if (ep_pcp_events_available(ep))
+		ep_pcp_wake(ep);
+
+	return eventcnt;
+}
+
 static inline struct timespec ep_set_mstimeout(long ms)
 {
 	struct timespec now, ts = {
@@ -1565,6 +1841,52 @@ static inline struct timespec ep_set_mstimeout(long ms)
 	return timespec_add_safe(now, ts);
 }
 
+/*
+ * EPOLL_PERCPU version of the ep_poll() loop.  ep->wq is protected by its
+ * own lock here, as ep_poll_callback() wakes it without ep->lock, and the
+ * autoremoving exclusive entry makes each wakeup go to one waiter.
+ */
+static int ep_pcp_poll(struct eventpoll *ep, struct epoll_event __user *events,
+		       int maxevents, long timeout, ktime_t *to, long slack)
+{
+	int res = 0, timed_out = timeout == 0;
+	DEFINE_WAIT(wait);
+
+	for (;;) {
+		if (!ep_pcp_events_available(ep) && !timed_out) {
+			for (;;) {
+				prepare_to_wait_exclusive(&ep->wq, &wait,
+							  TASK_INTERRUPTIBLE);
+				if (ep_pcp_events_available(ep) || timed_out)
+					break;
+				if (signal_pending(current)) {
+					res = -EINTR;
+					break;
+				}
+				if (!schedule_hrtimeout_range(to, slack,
+							      HRTIMER_MODE_ABS))
+					timed_out = 1;
+			}
+			/*
+			 * The wait is exclusive: if we were woken but leave
+			 * without events to consume, pass the wakeup on so
+			 * another waiter doesn't sleep through them.
+			 */
+			if (res || !ep_pcp_events_available(ep))
+				abort_exclusive_wait(&ep->wq, &wait,
+						     TASK_INTERRUPTIBLE, NULL);
+			else
+				finish_wait(&ep->wq, &wait);
+		}
+
+		if (res || !ep_pcp_events_available(ep))
+			return res;
+		res = ep_pcp_send_events(ep, events, maxevents);
+		if (res || timed_out)
+			return res;
+	}
+}
+
 /**
  * ep_poll - Retrieves ready events, and delivers them to the caller supplied
  *           event buffer.
@@ -1597,7 +1919,12 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		slack = select_estimate_accuracy(&end_time);
 		to = &expires;
 		*to = timespec_to_ktime(end_time);
-	} else if (timeout == 0) {
+	}
+
+	if (ep->pcp_ready)
+		return ep_pcp_poll(ep, events, maxevents, timeout, to, slack);
+
+	if (timeout == 0) {
 		/*
 		 * Avoid the unnecessary trip to the wait queue loop, if the
 		 * caller specified a non blocking operation.
@@ -1769,13 +2096,14 @@ SYSCALL_DEFINE1(epoll_create1, int, flags)
 
 	/* Check the EPOLL_* constant for consistency.  */
 	BUILD_BUG_ON(EPOLL_CLOEXEC != O_CLOEXEC);
+	BUILD_BUG_ON(EPOLL_PERCPU & EPOLL_CLOEXEC);
 
-	if (flags & ~EPOLL_CLOEXEC)
+	if (flags & ~(EPOLL_CLOEXEC | EPOLL_PERCPU))
 		return -EINVAL;
 	/*
 	 * Create the internal data structure ("struct eventpoll").
 	 */
-	error = ep_alloc(&ep);
+	error = ep_alloc(&ep, flags);
 	if (error < 0)
 		return error;
 	/*
@@ -502,6 +502,7 @@ struct nameidata {
 	int		last_type;
 	unsigned	depth;
 	struct file	*base;
+	const struct path *start;	/* LOOKUP_START */
 	char *saved_names[MAX_NESTED_LINKS + 1];
 };
 
@@ -1903,6 +1904,20 @@ static int path_init(int dfd, const struct filename *name, unsigned int flags,
 			path_get(&nd->root);
 		}
 		nd->path = nd->root;
+	} else if (flags & LOOKUP_START) {
+		/* like a dfd, but the caller holds the reference */
+		struct dentry *dentry = nd->start->dentry;
+
+		if (*s && !d_can_lookup(dentry))
+			return -ENOTDIR;
+
+		nd->path = *nd->start;
+		if (flags & LOOKUP_RCU) {
+			nd->seq = __read_seqcount_begin(&nd->path.dentry->d_seq);
+			rcu_read_lock();
+		} else {
+			path_get(&nd->path);
+		}
 	} else if (dfd == AT_FDCWD) {
 		if (flags & LOOKUP_RCU) {
 			struct fs_struct *fs = current->fs;
@@ -2097,6 +2112,27 @@ int kern_path(const char *name, unsigned int flags, struct path *path)
 }
 EXPORT_SYMBOL(kern_path);
 
+/*
+ * Relative names are walked from @start rather than from a dfd, so that a
+ * caller resolving many names under one directory walks it only once.
+ * Unlike vfs_path_lookup(), ".." and absolute symlinks are not confined
+ * to @start.
+ */
+int filename_lookup_from(const struct path *start, struct filename *name,
+			 unsigned int flags, struct path *path)
+{
+	struct nameidata nd;
+	int err;
+
+	BUG_ON(flags & LOOKUP_PARENT);
+
+	nd.start = start;
+	err = filename_lookup(-1, name, flags | LOOKUP_START, &nd);
+	if (!err)
+		*path = nd.path;
+	return err;
+}
+
 /**
  * vfs_path_lookup - lookup a file path relative to a dentry-vfsmount pair
  * @dentry:  pointer to dentry of the base directory
@@ -3322,6 +3358,23 @@ struct file *do_file_open_root(struct dentry *dentry, struct vfsmount *mnt,
 	return file;
 }
 
+/* do_filp_open() with relative names walked from @start */
+struct file *do_filp_open_from(const struct path *start,
+		struct filename *pathname, const struct open_flags *op)
+{
+	struct nameidata nd;
+	int flags = op->lookup_flags | LOOKUP_START;
+	struct file *filp;
+
+	nd.start = start;
+	filp = path_openat(-1, pathname, &nd, op, flags | LOOKUP_RCU);
+	if (unlikely(filp == ERR_PTR(-ECHILD)))
+		filp = path_openat(-1, pathname, &nd, op, flags);
+	if (unlikely(filp == ERR_PTR(-ESTALE)))
+		filp = path_openat(-1, pathname, &nd, op, flags | LOOKUP_REVAL);
+	return filp;
+}
+
 static struct dentry *filename_create(int dfd, struct filename *name,
 				struct path *path, unsigned int lookup_flags)
 {
@@ -0,0 +1,321 @@
+/*
+ *  linux/fs/path_batch.c
+ *
+ *  path_batch(2): stat, open and readlink an array of names in one call.
+ *
+ *  Programs that probe thousands of files at startup pay a system call
+ *  and a full walk of the same leading directories for every name.  Here
+ *  the directory part of each name is looked up once and kept while the
+ *  following names share it; only the last component is walked for each.
+ */
+
+#include <linux/syscalls.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fs_struct.h>
+#include <linux/namei.h>
+#include <linux/security.h>
+#include <linux/fsnotify.h>
+#include <linux/cred.h>
+#include <linux/path_batch.h>
+
+#include <asm/uaccess.h>
+
+#include "internal.h"
+
+#define PATH_BATCH_MAX		1024	/* ops looked at per call */
+
+struct path_batch {
+	struct path	base;		/* dfd */
+	struct path	dir;		/* directory part of the last name */
+	char		*dir_name;
+	int		dir_len;	/* -1: nothing cached */
+	int		dir_err;
+
+	char __user	*buf;
+	size_t		len;
+	size_t		off;
+};
+
+static int path_batch_init(struct path_batch *pb, int dfd)
+{
+	pb->dir_name = __getname();
+	if (!pb->dir_name)
+		return -ENOMEM;
+	pb->dir_len = -1;
+
+	if (dfd == AT_FDCWD) {
+		get_fs_pwd(current->fs, &pb->base);
+	} else {
+		struct fd f = fdget_raw(dfd);
+
+		if (!f.file) {
+			__putname(pb->dir_name);
+			return -EBADF;
+		}
+		pb->base = f.file->f_path;
+		path_get(&pb->base);
+		fdput(f);
+	}
+	return 0;
+}
+
+static void path_batch_release(struct path_batch *pb)
+{
+	if (pb->dir_len >= 0 && !pb->dir_err)
+		path_put(&pb->dir);
+	path_put(&pb->base);
+	__putname(pb->dir_name);
+}
+
+/* Looks up the first @len bytes of @name, unless that is what we hold. */
+static int path_batch_dir(struct path_batch *pb, const char *name, int len)
+{
+	struct filename *dir;
+
+	if (len == pb->dir_len && !memcmp(name, pb->dir_name, len))
+		return pb->dir_err;
+
+	if (pb->dir_len >= 0 && !pb->dir_err)
+		path_put(&pb->dir);
+	memcpy(pb->dir_name, name, len);
+	pb->dir_name[len] = '\0';
+	pb->dir_len = len;
+
+	dir = getname_kernel(pb->dir_name);
+	if (IS_ERR(dir)) {
+		pb->dir_err = PTR_ERR(dir);
+	} else {
+		pb->dir_err = filename_lookup_from(&pb->base, dir,
+					LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
+					&pb->dir);
+		putname(dir);
+	}
+	return pb->dir_err;
+}
+
+static int path_batch_getattr(struct path_batch *pb, const struct path *start,
+			      struct filename *name, unsigned int lookup_flags)
+{
+	struct path_batch_stat tmp;
+	struct kstat stat;
+	struct path path;
+	int error;
+
+	error = filename_lookup_from(start, name, lookup_flags, &path);
+	if (error)
+		return error;
+	error = vfs_getattr(&path, &stat);
+	path_put(&path);
+	if (error)
+		return error;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.st_dev = new_encode_dev(stat.dev);
+	tmp.st_ino = stat.ino;
+	tmp.st_mode = stat.mode;
+	tmp.st_nlink = stat.nlink;
+	tmp.st_uid = from_kuid_munged(current_user_ns(), stat.uid);
+	tmp.st_gid = from_kgid_munged(current_user_ns(), stat.gid);
+	tmp.st_rdev = new_encode_dev(stat.rdev);
+	tmp.st_size = stat.size;
+	tmp.st_blocks = stat.blocks;
+	tmp.st_blksize = stat.blksize;
+	tmp.st_atime_sec = stat.atime.tv_sec;
+	tmp.st_atime_nsec = stat.atime.tv_nsec;
+	tmp.st_mtime_sec = stat.mtime.tv_sec;
+	tmp.st_mtime_nsec = stat.mtime.tv_nsec;
+	tmp.st_ctime_sec = stat.ctime.tv_sec;
+	tmp.st_ctime_nsec = stat.ctime.tv_nsec;
+
+	if (copy_to_user(pb->buf + pb->off, &tmp, sizeof(tmp)))
+		return -EFAULT;
+	pb->off += sizeof(tmp);
+	return 0;
+}
+
+static int path_batch_readlink(struct path_batch *pb, const struct path *start,
+			       struct filename *name)
+{
+	struct inode *inode;
+	struct path path;
+	int error;
+
+	error = filename_lookup_from(start, name, 0, &path);
+	if (error)
+		return error;
+
+	inode = d_backing_inode(path.dentry);
+	error = -EINVAL;
+	if (inode->i_op->readlink) {
+		error = security_inode_readlink(path.dentry);
+		if (!error) {
+			touch_atime(&path);
+			error = inode->i_op->readlink(path.dentry,
+					pb->buf + pb->off,
+					min_t(size_t, pb->len - pb->off, INT_MAX));
+		}
+	}
+	path_put(&path);
+
+	if (error > 0)
+		pb->off = min(pb->len, pb->off + ALIGN(error, 8));
+	return error;
+}
+
+static int path_batch_open(const struct path *start, struct filename *name,
+			   int flags)
+{
+	struct open_flags op;
+	struct file *f;
+	int fd;
+
+	if (flags & (O_CREAT | __O_TMPFILE))
+		return -EINVAL;
+	if (force_o_largefile())
+		flags |= O_LARGEFILE;
+
+	fd = build_open_flags(flags, 0, &op);
+	if (fd)
+		return fd;
+
+	fd = get_unused_fd_flags(flags);
+	if (fd >= 0) {
+		f = do_filp_open_from(start, name, &op);
+		if (IS_ERR(f)) {
+			put_unused_fd(fd);
+			fd = PTR_ERR(f);
+		} else {
+			fsnotify_open(f);
+			fd_install(fd, f);
+		}
+	}
+	return fd;
+}
+
+static int path_batch_one(struct path_batch *pb, struct path_batch_op *op)
+{
+	const struct path *start = &pb->base;
+	struct filename *name, *last;
+	const char *slash;
+	int error;
+
+	name = getname((const char __user *)(unsigned long)op->path);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+
+	/* names without a directory part, or ending in '/', go as they are */
+	last = name;
+	slash = strrchr(name->name, '/');
+	if (slash && slash[1]) {
+		error = path_batch_dir(pb, name->name,
+				       max_t(int, slash - name->name, 1));
+		if (error)
+			goto out;
+		last = getname_kernel(slash + 1);
+		if (IS_ERR(last)) {
+			error = PTR_ERR(last);
+			goto out;
+		}
+		start = &pb->dir;
+	}
+
+	switch (op->op) {
+	case PATH_BATCH_STAT:
+		error = path_batch_getattr(pb, start, last, LOOKUP_FOLLOW);
+		break;
+	case PATH_BATCH_LSTAT:
+		error = path_batch_getattr(pb, start, last, 0);
+		break;
+	case PATH_BATCH_OPEN:
+		error = path_batch_open(start, last, op->open_flags);
+		break;
+	case PATH_BATCH_READLINK:
+		error = path_batch_readlink(pb, start, last);
+		break;
+	default:
+		error = -EINVAL;
+	}
+
+	if (last != name)
+		putname(last);
+out:
+	putname(name);
+	return error;
+}
+
+/* does the op fit in what is left of the output buffer? */
+static bool path_batch_room(struct path_batch *pb, struct path_batch_op *op)
+{
+	size_t left = pb->len - pb->off;
+
+	switch (op->op) {
+	case PATH_BATCH_STAT:
+	case PATH_BATCH_LSTAT:
+		return left >= sizeof(struct path_batch_stat);
+	case PATH_BATCH_READLINK:
+		return left > 0;
+	}
+	return true;
+}
+
+/*
+ * sys_path_batch:
+ *	Runs up to @nr ops against names relative to @dfd, filling in each
+ *	op's result.  Returns the number of ops run, which is less than @nr
+ *	if @buf filled up or a fatal signal arrived; userland continues from
+ *	there.  -ENOSPC if not even the first op's data fits, -EINVAL if
+ *	@len is beyond what the ops' 32-bit out_off can address.
+ */
+SYSCALL_DEFINE6(path_batch, int, dfd, struct path_batch_op __user *, uops,
+		unsigned int, nr, void __user *, buf, size_t, len,
+		unsigned int, flags)
+{
+	struct path_batch pb;
+	unsigned int i;
+	int error;
+
+	if (flags || len > U32_MAX)
+		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, buf, len))
+		return -EFAULT;
+	if (nr > PATH_BATCH_MAX)
+		nr = PATH_BATCH_MAX;
+
+	error = path_batch_init(&pb, dfd);
+	if (error)
+		return error;
+	pb.buf = buf;
+	pb.len = len;
+	pb.off = 0;
+
+	for (i = 0; i < nr; i++) {
+		struct path_batch_op op;
+
+		if (copy_from_user(&op, &uops[i], sizeof(op))) {
+			error = -EFAULT;
+			break;
+		}
+		if (!path_batch_room(&pb, &op)) {
+			error = -ENOSPC;
+			break;
+		}
+
+		op.out_off = pb.off;
+		op.result = path_batch_one(&pb, &op);
+		if (put_user(op.result, &uops[i].result) ||
+		    put_user(op.out_off, &uops[i].out_off)) {
+			error = -EFAULT;
+			break;
+		}
+
+		if (fatal_signal_pending(current)) {
+			i++;
+			break;
+		}
+		cond_resched();
+	}
+
+	path_batch_release(&pb);
+	return i ? i : error;
+}
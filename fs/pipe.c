@@ -225,6 +225,176 @@ static const struct pipe_buf_operations packet_pipe_buf_ops = {
 	.get = generic_pipe_buf_get,
 };
 
+/*
+ * A writer that opted in with F_SETPIPE_ZEROCOPY on its write-only fd has
+ * whole pages of its private anonymous memory queued as they are instead
+ * of copied. So that later stores can't
+ * change data still sitting in the pipe, or in a socket's send queue after
+ * splice(), the pages are unmapped from the writer, which faults in fresh
+ * zero-filled pages on its next touch.
+ */
+static const struct pipe_buf_operations ref_pipe_buf_ops = {
+	.can_merge = 0,
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = generic_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+static DEFINE_PER_CPU(unsigned long [PIPE_ZC_NR], pipe_zerocopy_count);
+unsigned long pipe_zerocopy_bytes[PIPE_ZC_NR];
+
+void pipe_account_zerocopy(int dir, size_t bytes)
+{
+	this_cpu_add(pipe_zerocopy_count[dir], bytes);
+}
+
+int pipe_zerocopy_proc_fn(struct ctl_table *table, int write,
+			  void __user *buf, size_t *lenp, loff_t *ppos)
+{
+	int cpu, i;
+
+	for (i = 0; i < PIPE_ZC_NR; i++) {
+		unsigned long sum = 0;
+
+		for_each_possible_cpu(cpu)
+			sum += per_cpu(pipe_zerocopy_count, cpu)[i];
+		pipe_zerocopy_bytes[i] = sum;
+	}
+	return proc_doulongvec_minmax(table, write, buf, lenp, ppos);
+}
+
+static bool pipe_vma_detachable(struct vm_area_struct *vma)
+{
+	return !vma->vm_file && !vma->vm_ops && (vma->vm_flags & VM_WRITE) &&
+	       !(vma->vm_flags & (VM_SHARED | VM_LOCKED | VM_HUGETLB |
+				  VM_SPECIAL));
+}
+
+/**
+ * pipe_detach_user_pages - unmap pinned pages from the caller
+ * @addr:	page aligned user address the pages were pinned at
+ * @nr:		number of pages
+ *
+ * Description:
+ *	Zaps the ptes of @nr pages from @addr, as MADV_DONTNEED does, if
+ *	they are writable private anonymous memory. The caller must hold its own
+ *	references to the pages. Returns the number of pages unmapped,
+ *	which stops short at the end of the first vma.
+ */
+int pipe_detach_user_pages(unsigned long addr, int nr)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long end = addr + ((unsigned long)nr << PAGE_SHIFT);
+
+	if (!mm)
+		return 0;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, addr);
+	if (vma && vma->vm_start <= addr && pipe_vma_detachable(vma)) {
+		end = min(end, vma->vm_end);
+		zap_page_range(vma, addr, end - addr, NULL);
+		nr = (end - addr) >> PAGE_SHIFT;
+	} else {
+		nr = 0;
+	}
+	up_read(&mm->mmap_sem);
+	return nr;
+}
+
+/* Would pipe_detach_user_pages() take the page at @addr? */
+static bool pipe_user_page_detachable(unsigned long addr)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	bool ret;
+
+	if (!mm)
+		return false;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, addr);
+	ret = vma && vma->vm_start <= addr && pipe_vma_detachable(vma);
+	up_read(&mm->mmap_sem);
+	return ret;
+}
+
+/**
+ * pipe_page_detached - is a detached page the pipe's alone
+ * @page:	page unmapped by pipe_detach_user_pages()
+ *
+ * Description:
+ *	A page still mapped elsewhere (a forked child, KSM) or sitting in
+ *	the swap cache may be written or mapped again behind the pipe's
+ *	back; such pages are not safe to hold by reference.
+ */
+bool pipe_page_detached(struct page *page)
+{
+	return !PageCompound(page) && !PageSwapCache(page) &&
+	       !page_mapped(page);
+}
+
+/*
+ * Queue the next page of @from by reference if it is a whole, page aligned
+ * page of private anonymous memory. Returns false if it has to be copied.
+ */
+static bool pipe_write_ref(struct pipe_inode_info *pipe,
+			   struct pipe_buffer *buf, struct iov_iter *from)
+{
+	struct iovec iov = iov_iter_iovec(from);
+	unsigned long addr = (unsigned long)iov.iov_base;
+	struct page *page;
+
+	if (from->type & (ITER_KVEC | ITER_BVEC) ||
+	    segment_eq(get_fs(), KERNEL_DS))
+		return false;
+	if (addr & ~PAGE_MASK || iov.iov_len < PAGE_SIZE)
+		return false;
+	/* don't break COW on memory we would only end up copying */
+	if (!pipe_user_page_detachable(addr))
+		return false;
+
+	/*
+	 * Have a page for the copy below before anything is unmapped: once
+	 * it is, falling back to the copy path would read zeroes.
+	 */
+	if (!pipe->tmp_page) {
+		pipe->tmp_page = alloc_page(GFP_HIGHUSER);
+		if (!pipe->tmp_page)
+			return false;
+	}
+
+	/* a write fault breaks any COW sharing, so the page is ours */
+	if (get_user_pages_fast(addr, 1, 1, &page) != 1)
+		return false;
+	if (!pipe_detach_user_pages(addr, 1)) {
+		page_cache_release(page);
+		return false;
+	}
+
+	/*
+	 * From here on our pin holds the only copy of the data. If the page
+	 * is still mapped somewhere else, queue a private copy of it.
+	 */
+	if (!pipe_page_detached(page)) {
+		copy_highpage(pipe->tmp_page, page);
+		page_cache_release(page);
+		page = pipe->tmp_page;
+		pipe->tmp_page = NULL;
+	}
+
+	buf->page = page;
+	buf->ops = &ref_pipe_buf_ops;
+	buf->offset = 0;
+	buf->len = PAGE_SIZE;
+	buf->flags = 0;
+	iov_iter_advance(from, PAGE_SIZE);
+	pipe_account_zerocopy(PIPE_ZC_IN, PAGE_SIZE);
+	return true;
+}
+
 static ssize_t
 pipe_read(struct kiocb *iocb, struct iov_iter *to)
 {
@@ -396,9 +566,22 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
 			int copied;
 
+			if ((filp->f_mode & FMODE_PIPE_ZEROCOPY) &&
+			    !is_packetized(filp) &&
+			    pipe_write_ref(pipe, buf, from)) {
+				do_wakeup = 1;
+				ret += PAGE_SIZE;
+				pipe->nrbufs = ++bufs;
+				if (!iov_iter_count(from))
+					break;
+				continue;
+			}
+
+			/* pipe_write_ref() may have left one here */
+			page = pipe->tmp_page;
 			if (!page) {
 				page = alloc_page(GFP_HIGHUSER);
 				if (unlikely(!page)) {
@@ -1074,6 +1257,26 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 	case F_GETPIPE_SZ:
 		ret = pipe->buffers * PAGE_SIZE;
 		break;
+	case F_SETPIPE_ZEROCOPY:
+		/*
+		 * Only the writer may opt in, and only for its own open
+		 * file: the reader or another opener of a FIFO must not be
+		 * able to make someone else's write() unmap its memory.
+		 */
+		ret = -EBADF;
+		if ((file->f_mode & (FMODE_READ | FMODE_WRITE)) != FMODE_WRITE)
+			break;
+		spin_lock(&file->f_lock);
+		if (arg)
+			file->f_mode |= FMODE_PIPE_ZEROCOPY;
+		else
+			file->f_mode &= ~FMODE_PIPE_ZEROCOPY;
+		spin_unlock(&file->f_lock);
+		ret = 0;
+		break;
+	case F_GETPIPE_ZEROCOPY:
+		ret = !!(file->f_mode & FMODE_PIPE_ZEROCOPY);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
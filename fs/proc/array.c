@@ -83,6 +83,7 @@
 #include <linux/tracehook.h>
 #include <linux/string_helpers.h>
 #include <linux/user_namespace.h>
+#include <linux/proc_snapshot.h>
 
 #include <asm/pgtable.h>
 #include <asm/processor.h>
@@ -569,6 +570,98 @@ int proc_pid_statm(struct seq_file *m, struct pid_namespace *ns,
 	return 0;
 }
 
+/*
+ * Fill a /proc/snapshot record for the thread group of @task with what
+ * /proc/<pid>/stat, status and statm show, minus anything those only
+ * show to a ptracer.
+ */
+void proc_task_snapshot(struct pid_namespace *ns,
+			struct user_namespace *user_ns,
+			struct task_struct *task, struct proc_snapshot_task *rec)
+{
+	cputime_t cutime = 0, cstime = 0, utime = 0, stime = 0, gtime = 0;
+	const struct cred *cred;
+	struct mm_struct *mm;
+	unsigned long flags;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->pid = task_tgid_nr_ns(task, ns);
+	rec->start_time = task->real_start_time;
+
+	rcu_read_lock();
+	cred = __task_cred(task);
+	rec->uid = from_kuid_munged(user_ns, cred->uid);
+	rec->gid = from_kgid_munged(user_ns, cred->gid);
+	rec->euid = from_kuid_munged(user_ns, cred->euid);
+	rec->egid = from_kgid_munged(user_ns, cred->egid);
+	rcu_read_unlock();
+	get_task_comm(rec->comm, task);
+
+	rec->state = *get_task_state(task);
+	rec->flags = task->flags;
+	rec->prio = task_prio(task);
+	rec->nice = task_nice(task);
+	rec->policy = task->policy;
+	rec->rt_priority = task->rt_priority;
+	rec->processor = task_cpu(task);
+	rec->nvcsw = task->nvcsw;
+	rec->nivcsw = task->nivcsw;
+
+	if (lock_task_sighand(task, &flags)) {
+		struct signal_struct *sig = task->signal;
+		struct task_struct *t = task;
+
+		if (sig->tty)
+			rec->tty_nr = new_encode_dev(tty_devnum(sig->tty));
+		rec->num_threads = get_nr_threads(task);
+
+		rec->cmin_flt = sig->cmin_flt;
+		rec->cmaj_flt = sig->cmaj_flt;
+		cutime = sig->cutime;
+		cstime = sig->cstime;
+
+		do {
+			rec->min_flt += t->min_flt;
+			rec->maj_flt += t->maj_flt;
+			gtime += task_gtime(t);
+		} while_each_thread(task, t);
+
+		rec->min_flt += sig->min_flt;
+		rec->maj_flt += sig->maj_flt;
+		thread_group_cputime_adjusted(task, &utime, &stime);
+		gtime += sig->gtime;
+
+		rec->sid = task_session_nr_ns(task, ns);
+		rec->ppid = task_tgid_nr_ns(task->real_parent, ns);
+		rec->pgid = task_pgrp_nr_ns(task, ns);
+
+		unlock_task_sighand(task, &flags);
+	}
+
+	rec->utime = cputime_to_nsecs(utime);
+	rec->stime = cputime_to_nsecs(stime);
+	rec->cutime = cputime_to_nsecs(cutime);
+	rec->cstime = cputime_to_nsecs(cstime);
+	rec->gtime = cputime_to_nsecs(gtime);
+
+	mm = get_task_mm(task);
+	if (mm) {
+		unsigned long shared, text, data, resident;
+
+		rec->vsize = task_vsize(mm);
+		task_statm(mm, &shared, &text, &data, &resident);
+		rec->rss = resident;
+		rec->anon = get_mm_counter(mm, MM_ANONPAGES);
+		rec->shared = shared;
+		rec->text = text;
+		rec->data = data;
+		rec->swap = get_mm_counter(mm, MM_SWAPENTS);
+		rec->hiwater_rss = get_mm_hiwater_rss(mm);
+		rec->hiwater_vm = get_mm_hiwater_vm(mm);
+		mmput(mm);
+	}
+}
+
 #ifdef CONFIG_CHECKPOINT_RESTORE
 static struct pid *
 get_children_pid(struct inode *inode, struct pid *pid_prev, loff_t pos)
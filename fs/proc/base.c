@@ -532,9 +532,9 @@ int proc_setattr(struct dentry *dentry, struct iattr *attr)
  * May current process learn task's sched/cmdline info (for hide_pid_min=1)
  * or euid/egid (for hide_pid_min=2)?
  */
-static bool has_pid_permissions(struct pid_namespace *pid,
-				 struct task_struct *task,
-				 int hide_pid_min)
+bool has_pid_permissions(struct pid_namespace *pid,
+			 struct task_struct *task,
+			 int hide_pid_min)
 {
 	if (pid->hide_pid < hide_pid_min)
 		return true;
@@ -907,6 +907,7 @@ static ssize_t oom_adj_write(struct file *file, const char __user *buf,
 		  task_pid_nr(task));
 
 	task->signal->oom_score_adj = oom_adj;
+	lowmem_adj_update(task);
 	trace_oom_score_adj_update(task);
 err_sighand:
 	unlock_task_sighand(task, &flags);
@@ -995,6 +996,7 @@ static ssize_t oom_score_adj_write(struct file *file, const char __user *buf,
 	task->signal->oom_score_adj = (short)oom_score_adj;
 	if (has_capability_noaudit(current, CAP_SYS_RESOURCE))
 		task->signal->oom_score_adj_min = (short)oom_score_adj;
+	lowmem_adj_update(task);
 	trace_oom_score_adj_update(task);
 
 err_sighand:
@@ -2811,11 +2813,7 @@ out:
  * Find the first task with tgid >= tgid
  *
  */
-struct tgid_iter {
-	unsigned int tgid;
-	struct task_struct *task;
-};
-static struct tgid_iter next_tgid(struct pid_namespace *ns, struct tgid_iter iter)
+struct tgid_iter next_tgid(struct pid_namespace *ns, struct tgid_iter iter)
 {
 	struct pid *pid;
 
@@ -156,6 +156,10 @@ extern int proc_pid_status(struct seq_file *, struct pid_namespace *,
 extern int proc_pid_statm(struct seq_file *, struct pid_namespace *,
 			  struct pid *, struct task_struct *);
 
+struct proc_snapshot_task;
+extern void proc_task_snapshot(struct pid_namespace *, struct user_namespace *,
+			       struct task_struct *, struct proc_snapshot_task *);
+
 /*
  * base.c
  */
@@ -169,6 +173,14 @@ extern int proc_pid_readdir(struct file *, struct dir_context *);
 extern struct dentry *proc_pid_lookup(struct inode *, struct dentry *, unsigned int);
 extern loff_t mem_lseek(struct file *, loff_t, int);
 
+struct tgid_iter {
+	unsigned int tgid;
+	struct task_struct *task;
+};
+extern struct tgid_iter next_tgid(struct pid_namespace *, struct tgid_iter);
+extern bool has_pid_permissions(struct pid_namespace *, struct task_struct *,
+				int);
+
 /* Lookups */
 typedef int instantiate_t(struct inode *, struct dentry *,
 				     struct task_struct *, const void *);
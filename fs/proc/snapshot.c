@@ -0,0 +1,319 @@
+/*
+ *  linux/fs/proc/snapshot.c
+ *
+ *  /proc/snapshot: binary records for all processes in one read.
+ *
+ *  A monitor that reads stat, status and statm of every process once a
+ *  second spends most of that time formatting and parsing numbers, and
+ *  most of the numbers have not changed since the last second.  Here every
+ *  open file keeps the last record it returned for each process and only
+ *  returns processes that differ, marking which groups of fields did.
+ */
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/pid_namespace.h>
+#include <linux/proc_fs.h>
+#include <linux/rbtree.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/proc_snapshot.h>
+
+#include "internal.h"
+
+#define SNAPSHOT_REAP	(-1)	/* ->next: all live tasks done, report exits */
+
+struct snapshot_entry {
+	struct rb_node		node;
+	u64			pass;		/* last pass that saw it */
+	struct proc_snapshot_task rec;
+};
+
+struct snapshot {
+	struct mutex		lock;
+	struct rb_root		seen;		/* by pid */
+	u64			pass;
+	int			next;		/* tgid to resume at, 0: idle */
+};
+
+/* field groups of struct proc_snapshot_task, in layout order */
+static const struct {
+	u32	mask;
+	size_t	start, end;
+} snapshot_groups[] = {
+	{ PROC_SNAP_IDENT, offsetof(struct proc_snapshot_task, ppid),
+			   offsetof(struct proc_snapshot_task, state) },
+	{ PROC_SNAP_SCHED, offsetof(struct proc_snapshot_task, state),
+			   offsetof(struct proc_snapshot_task, utime) },
+	{ PROC_SNAP_TIME,  offsetof(struct proc_snapshot_task, utime),
+			   offsetof(struct proc_snapshot_task, min_flt) },
+	{ PROC_SNAP_FAULT, offsetof(struct proc_snapshot_task, min_flt),
+			   offsetof(struct proc_snapshot_task, vsize) },
+	{ PROC_SNAP_MEM,   offsetof(struct proc_snapshot_task, vsize),
+			   sizeof(struct proc_snapshot_task) },
+};
+
+static u32 snapshot_changed(const struct proc_snapshot_task *old,
+			    const struct proc_snapshot_task *new)
+{
+	u32 changed = 0;
+	int i;
+
+	if (old->start_time != new->start_time)
+		return PROC_SNAP_NEW;
+
+	for (i = 0; i < ARRAY_SIZE(snapshot_groups); i++)
+		if (memcmp((const void *)old + snapshot_groups[i].start,
+			   (const void *)new + snapshot_groups[i].start,
+			   snapshot_groups[i].end - snapshot_groups[i].start))
+			changed |= snapshot_groups[i].mask;
+	return changed;
+}
+
+static struct snapshot_entry *snapshot_find(struct snapshot *snap, u32 pid)
+{
+	struct rb_node *n = snap->seen.rb_node;
+
+	while (n) {
+		struct snapshot_entry *e = rb_entry(n, struct snapshot_entry,
+						    node);
+
+		if (pid < e->rec.pid)
+			n = n->rb_left;
+		else if (pid > e->rec.pid)
+			n = n->rb_right;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+static void snapshot_insert(struct snapshot *snap, struct snapshot_entry *new)
+{
+	struct rb_node **p = &snap->seen.rb_node, *parent = NULL;
+
+	while (*p) {
+		struct snapshot_entry *e = rb_entry(*p, struct snapshot_entry,
+						    node);
+
+		parent = *p;
+		if (new->rec.pid < e->rec.pid)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &snap->seen);
+}
+
+static void snapshot_forget(struct snapshot *snap)
+{
+	struct snapshot_entry *e, *tmp;
+
+	rbtree_postorder_for_each_entry_safe(e, tmp, &snap->seen, node)
+		kfree(e);
+	snap->seen = RB_ROOT;
+	snap->next = 0;
+}
+
+/*
+ * Compare @rec with what was returned for its pid last time and remember
+ * it.  Returns the mask to report it with, 0 if it is unchanged.
+ */
+static u32 snapshot_update(struct snapshot *snap,
+			   struct proc_snapshot_task *rec)
+{
+	struct snapshot_entry *e = snapshot_find(snap, rec->pid);
+	u32 changed;
+
+	if (!e) {
+		e = kmalloc(sizeof(*e), GFP_KERNEL);
+		if (!e)		/* report it again next time */
+			return PROC_SNAP_NEW;
+		e->rec = *rec;
+		snapshot_insert(snap, e);
+		changed = PROC_SNAP_NEW;
+	} else {
+		changed = snapshot_changed(&e->rec, rec);
+		if (changed)
+			e->rec = *rec;
+	}
+	e->pass = snap->pass;
+	return changed;
+}
+
+/* Returns the number of records written, or -EFAULT. */
+static int snapshot_tasks(struct snapshot *snap, struct pid_namespace *ns,
+			  struct user_namespace *user_ns,
+			  struct proc_snapshot_task __user *out, int room)
+{
+	struct proc_snapshot_task rec;
+	struct tgid_iter iter;
+	int nr = 0;
+
+	iter.tgid = snap->next;
+	iter.task = NULL;
+	for (iter = next_tgid(ns, iter);
+	     iter.task;
+	     iter.tgid += 1, iter = next_tgid(ns, iter)) {
+		if (!has_pid_permissions(ns, iter.task, 2))
+			continue;
+		if (nr == room) {
+			put_task_struct(iter.task);
+			snap->next = iter.tgid;
+			return nr;
+		}
+
+		proc_task_snapshot(ns, user_ns, iter.task, &rec);
+		rec.changed = snapshot_update(snap, &rec);
+		if (!rec.changed)
+			continue;
+		if (copy_to_user(&out[nr], &rec, sizeof(rec))) {
+			put_task_struct(iter.task);
+			return -EFAULT;
+		}
+		nr++;
+
+		if (fatal_signal_pending(current)) {
+			put_task_struct(iter.task);
+			snap->next = iter.tgid + 1;
+			return nr;
+		}
+		cond_resched();
+	}
+	snap->next = SNAPSHOT_REAP;
+	return nr;
+}
+
+/* Report and forget the processes this pass did not see. */
+static int snapshot_exits(struct snapshot *snap,
+			  struct proc_snapshot_task __user *out, int room)
+{
+	struct proc_snapshot_task rec;
+	struct snapshot_entry *e;
+	struct rb_node *n;
+	int nr = 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.changed = PROC_SNAP_EXIT;
+	for (n = rb_first(&snap->seen); n; ) {
+		e = rb_entry(n, struct snapshot_entry, node);
+		n = rb_next(n);
+		if (e->pass == snap->pass)
+			continue;
+		if (nr == room)
+			return nr;
+
+		rec.pid = e->rec.pid;
+		rec.start_time = e->rec.start_time;
+		if (copy_to_user(&out[nr], &rec, sizeof(rec)))
+			return -EFAULT;
+		rb_erase(&e->node, &snap->seen);
+		kfree(e);
+		nr++;
+	}
+	snap->next = 0;
+	return nr;
+}
+
+static ssize_t snapshot_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct snapshot *snap = file->private_data;
+	struct pid_namespace *ns = file_inode(file)->i_sb->s_fs_info;
+	struct proc_snapshot_task __user *out;
+	struct proc_snapshot_header hdr;
+	int room, nr;
+
+	if (count < sizeof(hdr) + sizeof(struct proc_snapshot_task))
+		return -EINVAL;
+	out = (struct proc_snapshot_task __user *)(buf + sizeof(hdr));
+	room = min_t(size_t, count - sizeof(hdr), INT_MAX) /
+	       sizeof(struct proc_snapshot_task);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = PROC_SNAPSHOT_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.record_size = sizeof(struct proc_snapshot_task);
+
+	if (mutex_lock_interruptible(&snap->lock))
+		return -ERESTARTSYS;
+
+	if (!snap->next) {
+		snap->pass++;
+		snap->next = 1;
+		hdr.flags |= PROC_SNAPSHOT_START;
+	}
+	hdr.cursor = snap->pass;
+
+	nr = 0;
+	if (snap->next != SNAPSHOT_REAP)
+		nr = snapshot_tasks(snap, ns, file->f_cred->user_ns, out, room);
+	if (nr >= 0 && snap->next == SNAPSHOT_REAP) {
+		int exits = snapshot_exits(snap, out + nr, room - nr);
+
+		nr = exits < 0 ? exits : nr + exits;
+	}
+	if (nr >= 0 && !snap->next)
+		hdr.flags |= PROC_SNAPSHOT_END;
+
+	mutex_unlock(&snap->lock);
+
+	if (nr < 0)
+		return nr;
+	hdr.nr_records = nr;
+	if (copy_to_user(buf, &hdr, sizeof(hdr)))
+		return -EFAULT;
+	return sizeof(hdr) + nr * sizeof(struct proc_snapshot_task);
+}
+
+/* Only a seek to 0 is allowed: it starts over with a full snapshot. */
+static loff_t snapshot_lseek(struct file *file, loff_t offset, int whence)
+{
+	struct snapshot *snap = file->private_data;
+
+	if (whence != SEEK_SET || offset)
+		return -EINVAL;
+
+	mutex_lock(&snap->lock);
+	snapshot_forget(snap);
+	mutex_unlock(&snap->lock);
+	return 0;
+}
+
+static int snapshot_open(struct inode *inode, struct file *file)
+{
+	struct snapshot *snap;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+	mutex_init(&snap->lock);
+	snap->seen = RB_ROOT;
+	file->private_data = snap;
+	return 0;
+}
+
+static int snapshot_release(struct inode *inode, struct file *file)
+{
+	struct snapshot *snap = file->private_data;
+
+	snapshot_forget(snap);
+	kfree(snap);
+	return 0;
+}
+
+static const struct file_operations proc_snapshot_operations = {
+	.open		= snapshot_open,
+	.read		= snapshot_read,
+	.llseek		= snapshot_lseek,
+	.release	= snapshot_release,
+};
+
+static int __init proc_snapshot_init(void)
+{
+	proc_create("snapshot", 0, NULL, &proc_snapshot_operations);
+	return 0;
+}
+fs_initcall(proc_snapshot_init);
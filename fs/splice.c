@@ -142,10 +142,14 @@ const struct pipe_buf_operations page_cache_pipe_buf_ops = {
 	.get = generic_pipe_buf_get,
 };
 
+/* pipe_buffer.private of a zero-copy gift that is still mapped elsewhere */
+#define VMSPLICE_GIFT_SHARED	1
+
 static int user_page_pipe_buf_steal(struct pipe_inode_info *pipe,
 				    struct pipe_buffer *buf)
 {
-	if (!(buf->flags & PIPE_BUF_FLAG_GIFT))
+	if (!(buf->flags & PIPE_BUF_FLAG_GIFT) ||
+	    buf->private == VMSPLICE_GIFT_SHARED)
 		return 1;
 
 	buf->flags |= PIPE_BUF_FLAG_LRU;
@@ -706,7 +710,7 @@ static int pipe_to_sendpage(struct pipe_inode_info *pipe,
 {
 	struct file *file = sd->u.file;
 	loff_t pos = sd->pos;
-	int more;
+	int more, ret;
 
 	if (!likely(file->f_op->sendpage))
 		return -EINVAL;
@@ -716,8 +720,11 @@ static int pipe_to_sendpage(struct pipe_inode_info *pipe,
 	if (sd->len < sd->total_len && pipe->nrbufs > 1)
 		more |= MSG_SENDPAGE_NOTLAST;
 
-	return file->f_op->sendpage(file, buf->page, buf->offset,
-				    sd->len, &pos, more);
+	ret = file->f_op->sendpage(file, buf->page, buf->offset,
+				   sd->len, &pos, more);
+	if (ret > 0)
+		pipe_account_zerocopy(PIPE_ZC_OUT, ret);
+	return ret;
 }
 
 static void wakeup_pipe_writers(struct pipe_inode_info *pipe)
@@ -1424,6 +1431,34 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 	return -EINVAL;
 }
 
+/*
+ * Pages gifted through a zero-copy fd are unmapped from the giver, so they
+ * can't change while queued and are left for the pipe alone to steal.
+ * Only pages the iovec covers completely are taken; the others, and any
+ * that something else still maps, are marked so they are never stolen.
+ */
+static void vmsplice_detach_gift(unsigned long base, struct page **pages,
+				 struct partial_page *partial, int nr)
+{
+	int first = 0, last = nr, detached = 0, i;
+
+	if (partial[0].offset || partial[0].len < PAGE_SIZE)
+		first = 1;
+	if (last > first && partial[last - 1].len < PAGE_SIZE)
+		last--;
+	if (last > first)
+		detached = pipe_detach_user_pages(PAGE_ALIGN(base),
+						  last - first);
+
+	for (i = 0; i < nr; i++) {
+		if (i >= first && i < first + detached &&
+		    pipe_page_detached(pages[i]))
+			pipe_account_zerocopy(PIPE_ZC_IN, PAGE_SIZE);
+		else
+			partial[i].private = VMSPLICE_GIFT_SHARED;
+	}
+}
+
 /*
  * Map an iov into an array of pages and offset/length tupples. With the
  * partial_page structure, we can map several non-contiguous ranges into
@@ -1434,7 +1469,7 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 static int get_iovec_page_array(const struct iovec __user *iov,
 				unsigned int nr_vecs, struct page **pages,
 				struct partial_page *partial, bool aligned,
-				unsigned int pipe_buffers)
+				bool gift, unsigned int pipe_buffers)
 {
 	int buffers = 0, error = 0;
 
@@ -1443,7 +1478,7 @@ static int get_iovec_page_array(const struct iovec __user *iov,
 		struct iovec entry;
 		void __user *base;
 		size_t len;
-		int i;
+		int i, first;
 
 		error = -EFAULT;
 		if (copy_from_user(&entry, iov, sizeof(entry)))
@@ -1480,8 +1515,15 @@ static int get_iovec_page_array(const struct iovec __user *iov,
 		if (npages > pipe_buffers - buffers)
 			npages = pipe_buffers - buffers;
 
+		/*
+		 * A gift is mapped for writing, which breaks any COW sharing
+		 * and leaves the pages ours to detach.
+		 */
 		error = get_user_pages_fast((unsigned long)base, npages,
-					0, &pages[buffers]);
+					gift, &pages[buffers]);
+		if (gift && error <= 0)
+			error = get_user_pages_fast((unsigned long)base, npages,
+						0, &pages[buffers]);
 
 		if (unlikely(error <= 0))
 			break;
@@ -1489,17 +1531,23 @@ static int get_iovec_page_array(const struct iovec __user *iov,
 		/*
 		 * Fill this contiguous range into the partial page map.
 		 */
+		first = buffers;
 		for (i = 0; i < error; i++) {
 			const int plen = min_t(size_t, len, PAGE_SIZE - off);
 
 			partial[buffers].offset = off;
 			partial[buffers].len = plen;
+			partial[buffers].private = 0;
 
 			off = 0;
 			len -= plen;
 			buffers++;
 		}
 
+		if (gift)
+			vmsplice_detach_gift((unsigned long)base, &pages[first],
+					     &partial[first], buffers - first);
+
 		/*
 		 * We didn't complete this iov, stop here since it probably
 		 * means we have to move some of this into a pipe to
@@ -1602,6 +1650,8 @@ static long vmsplice_to_pipe(struct file *file, const struct iovec __user *iov,
 
 	spd.nr_pages = get_iovec_page_array(iov, nr_segs, spd.pages,
 					    spd.partial, false,
+					    (flags & SPLICE_F_GIFT) &&
+					    (file->f_mode & FMODE_PIPE_ZEROCOPY),
 					    spd.nr_pages_max);
 	if (spd.nr_pages <= 0)
 		ret = spd.nr_pages;
@@ -51,6 +51,25 @@ extern void mark_tsk_oom_victim(struct task_struct *tsk);
 
 extern void unmark_oom_victim(void);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+/* Keep the lowmemorykiller's candidate index in sync; tasklist_lock held */
+extern void lowmem_task_add(struct task_struct *p);
+extern void lowmem_task_del(struct task_struct *p);
+extern void lowmem_task_replace(struct task_struct *old,
+				struct task_struct *new);
+/* After p->signal->oom_score_adj changed; siglock held */
+extern void lowmem_adj_update(struct task_struct *p);
+/* An OOM victim has dropped its mm */
+extern void lowmem_oom_victim_freed(struct task_struct *p);
+#else
+static inline void lowmem_task_add(struct task_struct *p) { }
+static inline void lowmem_task_del(struct task_struct *p) { }
+static inline void lowmem_task_replace(struct task_struct *old,
+				       struct task_struct *new) { }
+static inline void lowmem_adj_update(struct task_struct *p) { }
+static inline void lowmem_oom_victim_freed(struct task_struct *p) { }
+#endif
+
 extern unsigned long oom_badness(struct task_struct *p,
 		struct mem_cgroup *memcg, const nodemask_t *nodemask,
 		unsigned long totalpages);
@@ -125,6 +125,20 @@ void pipe_double_lock(struct pipe_inode_info *, struct pipe_inode_info *);
 extern unsigned int pipe_max_size, pipe_min_size;
 int pipe_proc_fn(struct ctl_table *, int, void __user *, size_t *, loff_t *);
 
+/* Bytes moved by page reference, see /proc/sys/fs/pipe-zerocopy-bytes */
+enum {
+	PIPE_ZC_IN,		/* user memory taken into a pipe */
+	PIPE_ZC_OUT,		/* pipe pages handed to ->sendpage() */
+	PIPE_ZC_NR,
+};
+extern unsigned long pipe_zerocopy_bytes[PIPE_ZC_NR];
+void pipe_account_zerocopy(int dir, size_t bytes);
+int pipe_zerocopy_proc_fn(struct ctl_table *, int, void __user *, size_t *,
+			  loff_t *);
+
+int pipe_detach_user_pages(unsigned long addr, int nr);
+bool pipe_page_detached(struct page *page);
+
 
 /* Drop the inode semaphore and wait for a pipe event, atomically */
 void pipe_wait(struct pipe_inode_info *pipe);
@@ -140,7 +154,7 @@ void generic_pipe_buf_release(struct pipe_inode_info *, struct pipe_buffer *);
 
 extern const struct pipe_buf_operations nosteal_pipe_buf_ops;
 
-/* for F_SETPIPE_SZ and F_GETPIPE_SZ */
+/* for F_SETPIPE_SZ, F_GETPIPE_SZ and F_{SET,GET}PIPE_ZEROCOPY */
 long pipe_fcntl(struct file *, unsigned int, unsigned long arg);
 struct pipe_inode_info *get_pipe_info(struct file *file);
 
@@ -1350,6 +1350,11 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	/* group leaders only: lowmemorykiller candidates by oom_score_adj */
+	struct list_head lowmem_node;
+	short lowmem_adj;
+#endif
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 	struct rb_node pushable_dl_tasks;
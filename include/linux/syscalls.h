@@ -15,6 +15,7 @@ struct epoll_event;
 struct iattr;
 struct inode;
 struct iocb;
+struct path_batch_op;
 struct io_event;
 struct iovec;
 struct itimerspec;
@@ -497,6 +498,9 @@ asmlinkage long sys_ioctl(unsigned int fd, unsigned int cmd,
 				unsigned long arg);
 asmlinkage long sys_flock(unsigned int fd, unsigned int cmd);
 asmlinkage long sys_io_setup(unsigned nr_reqs, aio_context_t __user *ctx);
+asmlinkage long sys_io_setup2(unsigned nr_reqs, unsigned flags,
+				struct aio_sq_params __user *params,
+				aio_context_t __user *ctx);
 asmlinkage long sys_io_destroy(aio_context_t ctx);
 asmlinkage long sys_io_getevents(aio_context_t ctx_id,
 				long min_nr,
@@ -513,6 +517,9 @@ asmlinkage long sys_sendfile64(int out_fd, int in_fd,
 			       loff_t __user *offset, size_t count);
 asmlinkage long sys_readlink(const char __user *path,
 				char __user *buf, int bufsiz);
+asmlinkage long sys_path_batch(int dfd, struct path_batch_op __user *ops,
+				unsigned int nr, void __user *buf, size_t len,
+				unsigned int flags);
 asmlinkage long sys_creat(const char __user *pathname, umode_t mode);
 asmlinkage long sys_open(const char __user *filename,
 				int flags, umode_t mode);
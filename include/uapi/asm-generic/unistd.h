@@ -709,9 +709,13 @@ __SYSCALL(__NR_memfd_create, sys_memfd_create)
 __SYSCALL(__NR_bpf, sys_bpf)
 #define __NR_execveat 281
 __SC_COMP(__NR_execveat, sys_execveat, compat_sys_execveat)
+#define __NR_io_setup2 282
+__SYSCALL(__NR_io_setup2, sys_io_setup2)
+#define __NR_path_batch 283
+__SYSCALL(__NR_path_batch, sys_path_batch)
 
 #undef __NR_syscalls
-#define __NR_syscalls 282
+#define __NR_syscalls 284
 
 /*
  * All syscalls below here should go away really,
@@ -136,12 +136,20 @@ struct drm_vc4_submit_cl {
 	uint32_t pad:24;
 
 #define VC4_SUBMIT_CL_USE_CLEAR_COLOR			(1 << 0)
+/* Return a sync_file fence fd in fence_fd that signals when this
+ * render job completes.
+ */
+#define VC4_SUBMIT_CL_FENCE_FD_OUT			(1 << 1)
 	uint32_t flags;
 
 	/* Returned value of the seqno of this render job (for the
 	 * wait ioctl).
 	 */
 	uint64_t seqno;
+
+	/* Returned fence fd, if VC4_SUBMIT_CL_FENCE_FD_OUT was set. */
+	int32_t fence_fd;
+	uint32_t pad2;
 };
 
 /**
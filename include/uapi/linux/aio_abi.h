@@ -104,6 +104,42 @@ struct iocb {
 	__u32	aio_resfd;
 }; /* 64 bytes */
 
+/* Valid flags for io_setup2(). */
+#define IOCTX_FLAG_SQPOLL	(1 << 0)	/* a kernel thread polls the sq ring */
+#define IOCTX_FLAG_SQ_AFFINITY	(1 << 1)	/* ... bound to sq_cpu */
+
+/* "flags" of struct aio_sq_ring, written by the kernel */
+#define AIO_SQ_NEED_WAKEUP	(1 << 0)	/* poller is asleep, io_submit(ctx, 0, NULL) */
+
+/*
+ * Submission ring for IOCTX_FLAG_SQPOLL contexts.  Userland fills
+ * iocbs[tail & (nr - 1)] and publishes it by advancing tail after a
+ * write barrier; the kernel consumes entries up to tail and advances
+ * head.  A slot may be reused once head has moved past it, so the
+ * completion's "obj" is not meaningful: use aio_data to match events.
+ * iocbs that fail before they are queued (bad fd, bad opcode, ...)
+ * complete with the error as their result and are counted in "dropped".
+ * Setting up such a context needs CAP_SYS_ADMIN or CAP_SYS_NICE.
+ */
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by userland */
+	__u32	nr;		/* number of iocbs, a power of two */
+	__u32	flags;		/* AIO_SQ_* */
+	__u32	dropped;	/* written by the kernel */
+	__u32	resv[3];
+	struct iocb	iocbs[0];
+};
+
+struct aio_sq_params {
+	__u64	sq_ring;	/* address of a struct aio_sq_ring */
+	__u32	sq_entries;	/* must match sq_ring->nr */
+	__u32	sq_idle_ms;	/* poll this long before sleeping, 0: default,
+				   at most 1000 */
+	__s32	sq_cpu;		/* with IOCTX_FLAG_SQ_AFFINITY */
+	__u32	resv[3];
+};
+
 #undef IFBIG
 #undef IFLITTLE
 
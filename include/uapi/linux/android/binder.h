@@ -33,6 +33,8 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_FDA		= B_PACK_CHARS('f', 'd', 'a', B_TYPE_LARGE),
+	BINDER_TYPE_PTR		= B_PACK_CHARS('p', 't', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -70,6 +72,44 @@ struct flat_binder_object {
 	binder_uintptr_t	cookie;
 };
 
+enum {
+	BINDER_BUFFER_FLAG_HAS_PARENT = 0x01,
+};
+
+/*
+ * A buffer outside the transaction data, sent with BC_TRANSACTION_SG or
+ * BC_REPLY_SG. The driver copies 'length' bytes at 'buffer' straight into
+ * the target's mapping and rewrites 'buffer' to point at that copy.
+ *
+ * With BINDER_BUFFER_FLAG_HAS_PARENT set, 'parent' is the index in the
+ * offsets array of an earlier BINDER_TYPE_PTR object, and the pointer
+ * stored 'parent_offset' bytes into that object's buffer is rewritten to
+ * the new location as well. Fixups have to be made in the order the
+ * buffers were sent, and never before a previous fixup in the same buffer.
+ */
+struct binder_buffer_object {
+	__u32			type;
+	__u32			flags;
+	binder_uintptr_t	buffer;
+	binder_size_t		length;
+	binder_size_t		parent;
+	binder_size_t		parent_offset;
+};
+
+/*
+ * An array of 'num_fds' file descriptors, stored as __u32 at
+ * 'parent_offset' in the buffer of the BINDER_TYPE_PTR object at index
+ * 'parent' of the offsets array. Every fd is translated in place, so a
+ * whole set of fds costs a single object.
+ */
+struct binder_fd_array_object {
+	__u32			type;
+	__u32			pad;
+	binder_size_t		num_fds;
+	binder_size_t		parent;
+	binder_size_t		parent_offset;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses appropriately.
@@ -162,6 +202,15 @@ struct binder_transaction_data {
 	} data;
 };
 
+/*
+ * 'buffers_size' is the total size of the BINDER_TYPE_PTR buffers, each
+ * rounded up to 8 bytes.
+ */
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	binder_size_t buffers_size;
+};
+
 struct binder_ptr_cookie {
 	binder_uintptr_t ptr;
 	binder_uintptr_t cookie;
@@ -346,6 +395,13 @@ enum binder_driver_command_protocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, its data may contain
+	 * BINDER_TYPE_PTR and BINDER_TYPE_FDA objects.
+	 */
 };
 
 #endif /* _UAPI_LINUX_BINDER_H */
@@ -33,6 +33,14 @@
 #define F_ADD_SEALS	(F_LINUX_SPECIFIC_BASE + 9)
 #define F_GET_SEALS	(F_LINUX_SPECIFIC_BASE + 10)
 
+/*
+ * Set/Get zero-copy mode of a write-only pipe fd: whole pages of private
+ * anonymous memory written or gifted through it are taken by reference
+ * and unmapped from the writer
+ */
+#define F_SETPIPE_ZEROCOPY	(F_LINUX_SPECIFIC_BASE + 11)
+#define F_GETPIPE_ZEROCOPY	(F_LINUX_SPECIFIC_BASE + 12)
+
 /*
  * Types of seals
  */
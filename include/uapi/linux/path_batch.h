@@ -0,0 +1,50 @@
+#ifndef _UAPI_LINUX_PATH_BATCH_H
+#define _UAPI_LINUX_PATH_BATCH_H
+
+#include <linux/types.h>
+
+/* "op" of struct path_batch_op */
+#define PATH_BATCH_STAT		0	/* struct path_batch_stat, follows links */
+#define PATH_BATCH_LSTAT	1	/* struct path_batch_stat */
+#define PATH_BATCH_OPEN		2	/* result is the new fd */
+#define PATH_BATCH_READLINK	3	/* result is the length, no NUL */
+
+/*
+ * One entry of the array passed to path_batch(2).  "result" is filled in
+ * with 0, a file descriptor or a length on success and -errno on failure.
+ * STAT, LSTAT and READLINK place their data in the caller's buffer at
+ * "out_off", 8-byte aligned; a link longer than the space left is
+ * truncated, as with readlink(2).  The buffer is at most 4 GiB - 1.
+ * Paths that share a directory with the previous entry reuse its lookup,
+ * so sort names by directory.
+ */
+struct path_batch_op {
+	__u64	path;		/* const char * */
+	__u32	op;		/* PATH_BATCH_* */
+	__u32	open_flags;	/* O_* for PATH_BATCH_OPEN, no O_CREAT */
+	__s32	result;
+	__u32	out_off;
+};
+
+struct path_batch_stat {
+	__u64	st_dev;
+	__u64	st_ino;
+	__u32	st_mode;
+	__u32	st_nlink;
+	__u32	st_uid;
+	__u32	st_gid;
+	__u64	st_rdev;
+	__s64	st_size;
+	__u64	st_blocks;
+	__u32	st_blksize;
+	__u32	__pad;
+	__s64	st_atime_sec;
+	__s64	st_mtime_sec;
+	__s64	st_ctime_sec;
+	__u32	st_atime_nsec;
+	__u32	st_mtime_nsec;
+	__u32	st_ctime_nsec;
+	__u32	__pad2;
+};
+
+#endif /* _UAPI_LINUX_PATH_BATCH_H */
@@ -0,0 +1,106 @@
+#ifndef _UAPI_LINUX_PROC_SNAPSHOT_H
+#define _UAPI_LINUX_PROC_SNAPSHOT_H
+
+#include <linux/types.h>
+
+/*
+ * /proc/snapshot: fixed-layout records for every process, as a binary
+ * alternative to parsing /proc/<pid>/stat, status and statm.
+ *
+ * Every read() returns a struct proc_snapshot_header followed by
+ * nr_records records of record_size bytes each.  Newer kernels may grow
+ * both structures at the end; skip by the sizes in the header.  A pass
+ * over all processes may take several reads if the buffer is small; the
+ * first read of a pass has PROC_SNAPSHOT_START set and the last one
+ * PROC_SNAPSHOT_END.
+ *
+ * The file remembers what it returned: a process is only reported again
+ * once something about it changed, and "changed" says which groups of
+ * fields did.  lseek() to 0 forgets everything, so the next pass reports
+ * every process as new.
+ */
+
+#define PROC_SNAPSHOT_VERSION	1
+
+/* struct proc_snapshot_header.flags */
+#define PROC_SNAPSHOT_START	(1 << 0)	/* first read of a pass */
+#define PROC_SNAPSHOT_END	(1 << 1)	/* last read of a pass */
+
+struct proc_snapshot_header {
+	__u32	version;
+	__u32	header_size;
+	__u32	record_size;
+	__u32	nr_records;
+	__u64	cursor;		/* number of the pass, from 1 */
+	__u32	flags;
+	__u32	__pad;
+};
+
+/* struct proc_snapshot_task.changed */
+#define PROC_SNAP_NEW		(1 << 0)	/* first report of this process */
+#define PROC_SNAP_EXIT		(1 << 1)	/* gone: pid, start_time only */
+#define PROC_SNAP_IDENT		(1 << 2)
+#define PROC_SNAP_SCHED		(1 << 3)
+#define PROC_SNAP_TIME		(1 << 4)
+#define PROC_SNAP_FAULT		(1 << 5)
+#define PROC_SNAP_MEM		(1 << 6)
+
+/*
+ * One thread group, with the values /proc/<pid>/stat shows for it.  A
+ * new record for a pid that is already known means the pid was reused.
+ * Times are in nanoseconds, memory sizes in pages except vsize.
+ */
+struct proc_snapshot_task {
+	__u32	pid;
+	__u32	changed;	/* PROC_SNAP_* */
+	__u64	start_time;	/* since boot */
+
+	/* PROC_SNAP_IDENT */
+	__u32	ppid;
+	__u32	pgid;
+	__u32	sid;
+	__u32	tty_nr;
+	__u32	uid;
+	__u32	gid;
+	__u32	euid;
+	__u32	egid;
+	char	comm[16];
+
+	/* PROC_SNAP_SCHED */
+	__u32	state;		/* as the letter in /proc/<pid>/stat */
+	__u32	flags;		/* PF_* */
+	__s32	prio;
+	__s32	nice;
+	__u32	policy;
+	__u32	rt_priority;
+	__u32	num_threads;
+	__s32	processor;
+
+	/* PROC_SNAP_TIME */
+	__u64	utime;
+	__u64	stime;
+	__u64	cutime;
+	__u64	cstime;
+	__u64	gtime;
+	__u64	nvcsw;
+	__u64	nivcsw;
+
+	/* PROC_SNAP_FAULT */
+	__u64	min_flt;
+	__u64	maj_flt;
+	__u64	cmin_flt;
+	__u64	cmaj_flt;
+
+	/* PROC_SNAP_MEM */
+	__u64	vsize;		/* bytes */
+	__u64	rss;
+	__u64	anon;
+	__u64	shared;
+	__u64	text;
+	__u64	data;
+	__u64	swap;
+	__u64	hiwater_rss;
+	__u64	hiwater_vm;
+};
+
+#endif /* _UAPI_LINUX_PROC_SNAPSHOT_H */
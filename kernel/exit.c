@@ -71,6 +71,7 @@ static void __unhash_process(struct task_struct *p, bool group_dead)
 
 		list_del_rcu(&p->tasks);
 		list_del_init(&p->sibling);
+		lowmem_task_del(p);
 		__this_cpu_dec(process_counts);
 	}
 	list_del_rcu(&p->thread_group);
@@ -435,8 +436,10 @@ static void exit_mm(struct task_struct *tsk)
 	task_unlock(tsk);
 	mm_update_next_owner(mm);
 	mmput(mm);
-	if (test_thread_flag(TIF_MEMDIE))
+	if (test_thread_flag(TIF_MEMDIE)) {
+		lowmem_oom_victim_freed(tsk);
 		unmark_oom_victim();
+	}
 }
 
 static struct task_struct *find_alive_thread(struct task_struct *p)
@@ -1643,6 +1643,15 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_doulongvec_minmax,
 	},
+	{
+		.procname	= "aio-buffered-async",
+		.data		= &aio_buffered_async,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
 #endif /* CONFIG_AIO */
 #ifdef CONFIG_INOTIFY_USER
 	{
@@ -1701,6 +1710,13 @@ static struct ctl_table fs_table[] = {
 		.proc_handler	= &pipe_proc_fn,
 		.extra1		= &pipe_min_size,
 	},
+	{
+		.procname	= "pipe-zerocopy-bytes",
+		.data		= &pipe_zerocopy_bytes,
+		.maxlen		= sizeof(pipe_zerocopy_bytes),
+		.mode		= 0444,
+		.proc_handler	= &pipe_zerocopy_proc_fn,
+	},
 	{ }
 };
 
@@ -14,11 +14,17 @@
 
 #include <linux/interrupt.h>
 #include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/module.h>
 
 #include <sound/asoundef.h>
+#include <sound/info.h>
 
 #include "bcm2835.h"
 
+static bool interpolate_pointer;
+static bool latency_stats;
+
 /* hardware definition */
 static struct snd_pcm_hardware snd_bcm2835_playback_hw = {
 	.info = (SNDRV_PCM_INFO_INTERLEAVED | SNDRV_PCM_INFO_BLOCK_TRANSFER |
@@ -61,10 +67,54 @@ static void snd_bcm2835_playback_free(struct snd_pcm_runtime *runtime)
 	runtime->private_data = NULL;
 }
 
+/* Called with alsa_stream->lock held */
+static void bcm2835_playback_latency(bcm2835_alsa_stream_t *alsa_stream,
+				     unsigned int periods, ktime_t now)
+{
+	bcm2835_chip_t *chip = alsa_stream->chip;
+	struct bcm2835_latency_stats *stats = &chip->latency[alsa_stream->idx];
+	unsigned int n = periods;
+	unsigned int e2e;
+	int jitter;
+
+	spin_lock(&chip->stats_lock);
+	while (n-- && alsa_stream->lat_played != alsa_stream->lat_acked) {
+		/* the stamp is gone if more periods were acked than we keep */
+		if (alsa_stream->lat_acked - alsa_stream->lat_played <=
+		    LATENCY_STAMPS) {
+			e2e = ktime_us_delta(now, alsa_stream->lat_stamp[
+				alsa_stream->lat_played & (LATENCY_STAMPS - 1)]);
+			if (!stats->e2e_count || e2e < stats->e2e_min_us)
+				stats->e2e_min_us = e2e;
+			if (e2e > stats->e2e_max_us)
+				stats->e2e_max_us = e2e;
+			stats->e2e_sum_us += e2e;
+			stats->e2e_count++;
+		}
+		alsa_stream->lat_played++;
+	}
+
+	if (ktime_to_ns(alsa_stream->period_time)) {
+		jitter = ktime_us_delta(now, alsa_stream->period_time) -
+			 periods * stats->period_us;
+		if (!stats->periods || jitter < stats->jitter_min_us)
+			stats->jitter_min_us = jitter;
+		if (!stats->periods || jitter > stats->jitter_max_us)
+			stats->jitter_max_us = jitter;
+		stats->jitter_abs_sum_us += abs(jitter);
+		stats->periods += periods;
+	}
+	alsa_stream->period_time = now;
+	spin_unlock(&chip->stats_lock);
+}
+
 static irqreturn_t bcm2835_playback_fifo_irq(int irq, void *dev_id)
 {
 	bcm2835_alsa_stream_t *alsa_stream = (bcm2835_alsa_stream_t *) dev_id;
+	ktime_t now = ktime_get();
 	uint32_t consumed = 0;
+	unsigned int bytes, periods = 0;
+	unsigned long flags;
 	int new_period = 0;
 
 	audio_info(" .. IN\n");
@@ -74,15 +124,19 @@ static irqreturn_t bcm2835_playback_fifo_irq(int irq, void *dev_id)
 
 	if (alsa_stream->open)
 		consumed = bcm2835_audio_retrieve_buffers(alsa_stream);
+	bytes = consumed & ~(1 << 30);
 
 	/* We get called only if playback was triggered, So, the number of buffers we retrieve in
 	 * each iteration are the buffers that have been played out already
 	 */
 
+	spin_lock_irqsave(&alsa_stream->lock, flags);
 	if (alsa_stream->period_size) {
 		if ((alsa_stream->pos / alsa_stream->period_size) !=
 		    ((alsa_stream->pos + consumed) / alsa_stream->period_size))
 			new_period = 1;
+		periods = (alsa_stream->pos + bytes) / alsa_stream->period_size -
+			  alsa_stream->pos / alsa_stream->period_size;
 	}
 	audio_debug("updating pos cur: %d + %d max:%d period_bytes:%d, hw_ptr: %d new_period:%d\n",
 		      alsa_stream->pos,
@@ -92,10 +146,20 @@ static irqreturn_t bcm2835_playback_fifo_irq(int irq, void *dev_id)
 			  frames_to_bytes(alsa_stream->substream->runtime, alsa_stream->substream->runtime->status->hw_ptr),
 			  new_period);
 	if (alsa_stream->buffer_size) {
-		alsa_stream->pos += consumed &~ (1<<30);
+		alsa_stream->pos += bytes;
 		alsa_stream->pos %= alsa_stream->buffer_size;
 	}
 
+	/* what was interpolated ahead of pos has now (partly) been played */
+	alsa_stream->played += bytes;
+	alsa_stream->interp_off = alsa_stream->interp_off > bytes ?
+				  alsa_stream->interp_off - bytes : 0;
+	alsa_stream->pos_time = now;
+
+	if (latency_stats && periods)
+		bcm2835_playback_latency(alsa_stream, periods, now);
+	spin_unlock_irqrestore(&alsa_stream->lock, flags);
+
 	if (alsa_stream->substream) {
 		if (new_period)
 			snd_pcm_period_elapsed(alsa_stream->substream);
@@ -338,9 +402,34 @@ static int snd_bcm2835_pcm_prepare(struct snd_pcm_substream *substream)
 	alsa_stream->pcm_indirect.sw_buffer_size =
 		snd_pcm_lib_buffer_bytes(substream);
 
+	/* nothing from a previous run may still be on its way to VC */
+	flush_work(&alsa_stream->write_work);
+
+	spin_lock_irq(&alsa_stream->lock);
 	alsa_stream->buffer_size = snd_pcm_lib_buffer_bytes(substream);
 	alsa_stream->period_size = snd_pcm_lib_period_bytes(substream);
 	alsa_stream->pos = 0;
+	alsa_stream->write_offset = 0;
+	alsa_stream->write_queued = 0;
+	alsa_stream->write_sent = 0;
+	alsa_stream->played = 0;
+	alsa_stream->interp_off = 0;
+	alsa_stream->ring_bulk = ring_bulk;
+	alsa_stream->lat_fill = 0;
+	alsa_stream->lat_acked = 0;
+	alsa_stream->lat_played = 0;
+	spin_unlock_irq(&alsa_stream->lock);
+
+	alsa_stream->bytes_per_sec = frames_to_bytes(runtime, runtime->rate);
+
+	spin_lock_irq(&chip->stats_lock);
+	memset(&chip->latency[alsa_stream->idx], 0,
+	       sizeof(chip->latency[alsa_stream->idx]));
+	if (alsa_stream->bytes_per_sec)
+		chip->latency[alsa_stream->idx].period_us =
+			div_u64((u64)alsa_stream->period_size * USEC_PER_SEC,
+				alsa_stream->bytes_per_sec);
+	spin_unlock_irq(&chip->stats_lock);
 
 	audio_debug("buffer_size=%d, period_size=%d pos=%d frame_bits=%d\n",
 		      alsa_stream->buffer_size, alsa_stream->period_size,
@@ -356,8 +445,23 @@ static void snd_bcm2835_pcm_transfer(struct snd_pcm_substream *substream,
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	bcm2835_alsa_stream_t *alsa_stream = runtime->private_data;
 	void *src = (void *)(substream->runtime->dma_area + rec->sw_data);
+	unsigned long flags;
+	ktime_t now;
 	int err;
 
+	/* remember when each period was handed over, for latency_stats */
+	if (latency_stats && alsa_stream->period_size) {
+		now = ktime_get();
+		spin_lock_irqsave(&alsa_stream->lock, flags);
+		alsa_stream->lat_fill += bytes;
+		while (alsa_stream->lat_fill >= alsa_stream->period_size) {
+			alsa_stream->lat_fill -= alsa_stream->period_size;
+			alsa_stream->lat_stamp[alsa_stream->lat_acked++ &
+					       (LATENCY_STAMPS - 1)] = now;
+		}
+		spin_unlock_irqrestore(&alsa_stream->lock, flags);
+	}
+
 	err = bcm2835_audio_write(alsa_stream, bytes, src);
 	if (err)
 		audio_error(" Failed to transfer to alsa device (%d)\n", err);
@@ -392,6 +496,8 @@ static int snd_bcm2835_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		if (!alsa_stream->running) {
 			err = bcm2835_audio_start(alsa_stream);
 			if (err == 0) {
+				alsa_stream->pos_time = ktime_get();
+				alsa_stream->period_time = ktime_set(0, 0);
 				alsa_stream->pcm_indirect.hw_io =
 				alsa_stream->pcm_indirect.hw_data =
 					bytes_to_frames(runtime,
@@ -414,6 +520,7 @@ static int snd_bcm2835_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		} else {
 			audio_info("DROPPING\n");
 			alsa_stream->draining = 0;
+			bcm2835_audio_drop_writes(alsa_stream);
 		}
 		if (alsa_stream->running) {
 			err = bcm2835_audio_stop(alsa_stream);
@@ -430,6 +537,46 @@ static int snd_bcm2835_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 	return err;
 }
 
+/*
+ * VC only reports progress when it has finished a chunk, so pos moves in
+ * steps. With interpolate_pointer the time since the last report is added
+ * at the stream rate, without ever crossing into the next period or past
+ * the data VC has been given, and without ever going backwards.  Not with
+ * ring_bulk: VC reads those periods from the buffer itself, so ALSA must
+ * not get it back before VC has reported it played.
+ */
+static unsigned int bcm2835_pcm_interpolate(struct snd_pcm_runtime *runtime,
+					    bcm2835_alsa_stream_t *alsa_stream)
+{
+	unsigned int pos, delta, limit;
+	unsigned long flags;
+	s64 elapsed;
+
+	spin_lock_irqsave(&alsa_stream->lock, flags);
+	pos = alsa_stream->pos;
+	if (interpolate_pointer && !alsa_stream->ring_bulk &&
+	    alsa_stream->running &&
+	    alsa_stream->bytes_per_sec && alsa_stream->period_size) {
+		elapsed = ktime_to_ns(ktime_sub(ktime_get(),
+						alsa_stream->pos_time));
+		delta = div_u64((u64)max_t(s64, elapsed, 0) *
+				alsa_stream->bytes_per_sec, NSEC_PER_SEC);
+
+		limit = min(alsa_stream->period_size - 1 -
+			    pos % alsa_stream->period_size,
+			    alsa_stream->write_sent - alsa_stream->played);
+		delta = min(delta, limit);
+		delta -= delta % frames_to_bytes(runtime, 1);
+		delta = max(delta, alsa_stream->interp_off);
+
+		alsa_stream->interp_off = delta;
+		pos = (pos + delta) % alsa_stream->buffer_size;
+	}
+	spin_unlock_irqrestore(&alsa_stream->lock, flags);
+
+	return pos;
+}
+
 /* pointer callback */
 static snd_pcm_uframes_t
 snd_bcm2835_pcm_pointer(struct snd_pcm_substream *substream)
@@ -447,7 +594,8 @@ snd_bcm2835_pcm_pointer(struct snd_pcm_substream *substream)
 	audio_info(" .. OUT\n");
 	return snd_pcm_indirect_playback_pointer(substream,
 						 &alsa_stream->pcm_indirect,
-						 alsa_stream->pos);
+						 bcm2835_pcm_interpolate(runtime,
+									 alsa_stream));
 }
 
 static int snd_bcm2835_pcm_lib_ioctl(struct snd_pcm_substream *substream,
@@ -484,14 +632,49 @@ static struct snd_pcm_ops snd_bcm2835_playback_spdif_ops = {
 	.ack = snd_bcm2835_pcm_ack,
 };
 
+static void snd_bcm2835_latency_proc_read(struct snd_info_entry *entry,
+					  struct snd_info_buffer *buffer)
+{
+	bcm2835_chip_t *chip = entry->private_data;
+	struct bcm2835_latency_stats stats;
+	int i;
+
+	for (i = 0; i < MAX_SUBSTREAMS; i++) {
+		if (!(chip->avail_substreams & (1 << i)))
+			continue;
+
+		spin_lock_irq(&chip->stats_lock);
+		stats = chip->latency[i];
+		spin_unlock_irq(&chip->stats_lock);
+
+		snd_iprintf(buffer, "substream %d: period %u us\n",
+			    i, stats.period_us);
+		if (stats.periods)
+			snd_iprintf(buffer,
+				    "  jitter: periods %u min %d avg %llu max %d us\n",
+				    stats.periods, stats.jitter_min_us,
+				    div_u64(stats.jitter_abs_sum_us,
+					    stats.periods),
+				    stats.jitter_max_us);
+		if (stats.e2e_count)
+			snd_iprintf(buffer,
+				    "  ack to played: periods %u min %u avg %llu max %u us\n",
+				    stats.e2e_count, stats.e2e_min_us,
+				    div_u64(stats.e2e_sum_us, stats.e2e_count),
+				    stats.e2e_max_us);
+	}
+}
+
 /* create a pcm device */
 int snd_bcm2835_new_pcm(bcm2835_chip_t * chip)
 {
+	struct snd_info_entry *entry;
 	struct snd_pcm *pcm;
 	int err;
 
 	audio_info(" .. IN\n");
 	mutex_init(&chip->audio_mutex);
+	spin_lock_init(&chip->stats_lock);
 	if(mutex_lock_interruptible(&chip->audio_mutex))
 	{
 		audio_error("Interrupted whilst waiting for lock\n");
@@ -518,6 +701,10 @@ int snd_bcm2835_new_pcm(bcm2835_chip_t * chip)
 					      (GFP_KERNEL), 64 * 1024,
 					      64 * 1024);
 
+	if (!snd_card_proc_new(chip->card, "latency", &entry))
+		snd_info_set_text_ops(entry, chip,
+				      snd_bcm2835_latency_proc_read);
+
 out:
 	mutex_unlock(&chip->audio_mutex);
 	audio_info(" .. OUT\n");
@@ -555,3 +742,8 @@ out:
 
 	return 0;
 }
+
+module_param(interpolate_pointer, bool, 0644);
+MODULE_PARM_DESC(interpolate_pointer, "Interpolate the playback position between VC completions");
+module_param(latency_stats, bool, 0644);
+MODULE_PARM_DESC(latency_stats, "Measure period jitter and ack to playout latency, see /proc/asound/cardX/latency");
@@ -40,7 +40,6 @@
 
 #define BCM2835_AUDIO_STOP           0
 #define BCM2835_AUDIO_START          1
-#define BCM2835_AUDIO_WRITE          2
 
 /* Logging macros (for remapping to other logging mechanisms, i.e., printf) */
 #ifdef AUDIO_DEBUG_ENABLE
@@ -66,6 +65,7 @@ typedef struct opaque_AUDIO_INSTANCE_T {
 } AUDIO_INSTANCE_T;
 
 bool force_bulk = false;
+bool ring_bulk;
 
 /* ---- Private Variables ---------------------------------------------------- */
 
@@ -82,8 +82,6 @@ typedef struct {
 	struct work_struct my_work;
 	bcm2835_alsa_stream_t *alsa_stream;
 	int cmd;
-	void *src;
-	uint32_t count;
 } my_work_t;
 
 static void my_wq_function(struct work_struct *work)
@@ -98,10 +96,6 @@ static void my_wq_function(struct work_struct *work)
 	case BCM2835_AUDIO_STOP:
 		ret = bcm2835_audio_stop_worker(w->alsa_stream);
 		break;
-	case BCM2835_AUDIO_WRITE:
-		ret = bcm2835_audio_write_worker(w->alsa_stream, w->count,
-						 w->src);
-		break;
 	default:
 		LOG_ERR(" Unexpected work: %p:%d\n", w->alsa_stream, w->cmd);
 		break;
@@ -152,30 +146,77 @@ int bcm2835_audio_stop(bcm2835_alsa_stream_t * alsa_stream)
 	return ret;
 }
 
+/*
+ * Called from the ALSA ack with the stream lock held, so only account for
+ * the new data here. The ring itself is the queue: acked bytes follow each
+ * other in the buffer and write_work sends them from there, one period at a
+ * time, instead of allocating a work item per write.
+ */
 int bcm2835_audio_write(bcm2835_alsa_stream_t *alsa_stream,
 			uint32_t count, void *src)
 {
+	char *area = alsa_stream->substream->runtime->dma_area;
+	unsigned long flags;
 	int ret = -1;
 	LOG_DBG(" .. IN\n");
 	if (alsa_stream->my_wq) {
-		my_work_t *work = kmalloc(sizeof(my_work_t), GFP_ATOMIC);
-		 /*--- Queue some work (item 1) ---*/
-		if (work) {
-			INIT_WORK((struct work_struct *)work, my_wq_function);
-			work->alsa_stream = alsa_stream;
-			work->cmd = BCM2835_AUDIO_WRITE;
-			work->src = src;
-			work->count = count;
-			if (queue_work
-			    (alsa_stream->my_wq, (struct work_struct *)work))
-				ret = 0;
-		} else
-			LOG_ERR(" .. Error: NULL work kmalloc\n");
+		spin_lock_irqsave(&alsa_stream->lock, flags);
+		if (alsa_stream->write_queued == alsa_stream->write_sent)
+			alsa_stream->write_offset = (char *)src - area;
+		alsa_stream->write_queued += count;
+		spin_unlock_irqrestore(&alsa_stream->lock, flags);
+
+		queue_work(alsa_stream->my_wq, &alsa_stream->write_work);
+		ret = 0;
 	}
 	LOG_DBG(" .. OUT %d\n", ret);
 	return ret;
 }
 
+/* Forget data acked but not yet sent, e.g. when playback is dropped */
+void bcm2835_audio_drop_writes(bcm2835_alsa_stream_t *alsa_stream)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&alsa_stream->lock, flags);
+	alsa_stream->write_sent = alsa_stream->write_queued;
+	spin_unlock_irqrestore(&alsa_stream->lock, flags);
+}
+
+static void bcm2835_audio_write_work(struct work_struct *work)
+{
+	bcm2835_alsa_stream_t *alsa_stream =
+		container_of(work, bcm2835_alsa_stream_t, write_work);
+	char *area = alsa_stream->substream->runtime->dma_area;
+	unsigned int offset, count;
+	unsigned long flags;
+
+	for (;;) {
+		/* claim the next chunk before sending so a drop can't race it */
+		spin_lock_irqsave(&alsa_stream->lock, flags);
+		count = alsa_stream->write_queued - alsa_stream->write_sent;
+		offset = alsa_stream->write_offset;
+		if (count && alsa_stream->period_size) {
+			count = min(count, alsa_stream->period_size -
+				    offset % alsa_stream->period_size);
+			alsa_stream->write_sent += count;
+			alsa_stream->write_offset = (offset + count) %
+						    alsa_stream->buffer_size;
+		} else {
+			count = 0;
+		}
+		spin_unlock_irqrestore(&alsa_stream->lock, flags);
+
+		if (!count)
+			break;
+
+		if (bcm2835_audio_write_worker(alsa_stream, count,
+					       area + offset) != 0)
+			LOG_ERR(" Failed to write %u bytes at %u\n",
+				count, offset);
+	}
+}
+
 void my_workqueue_init(bcm2835_alsa_stream_t * alsa_stream)
 {
 	alsa_stream->my_wq = alloc_workqueue("my_queue", WQ_HIGHPRI, 1);
@@ -427,6 +468,7 @@ int bcm2835_audio_open(bcm2835_alsa_stream_t * alsa_stream)
 	int ret;
 	LOG_DBG(" .. IN\n");
 
+	INIT_WORK(&alsa_stream->write_work, bcm2835_audio_write_work);
 	my_workqueue_init(alsa_stream);
 
 	ret = bcm2835_audio_open_connection(alsa_stream);
@@ -815,7 +857,8 @@ int bcm2835_audio_write_worker(bcm2835_alsa_stream_t *alsa_stream,
 	m.type = VC_AUDIO_MSG_TYPE_WRITE;
 	m.u.write.count = count;
 	// old version uses bulk, new version uses control
-	m.u.write.max_packet = instance->peer_version < 2 || force_bulk ? 0:4000;
+	m.u.write.max_packet = instance->peer_version < 2 || force_bulk ||
+			       alsa_stream->ring_bulk ? 0:4000;
 	m.u.write.callback = alsa_stream->fifo_irq_handler;
 	m.u.write.cookie = alsa_stream;
 	m.u.write.silence = src == NULL;
@@ -834,13 +877,18 @@ int bcm2835_audio_write_worker(bcm2835_alsa_stream_t *alsa_stream,
 	}
 	if (!m.u.write.silence) {
 		if (m.u.write.max_packet == 0) {
-			/* Send the message to the videocore */
+			/*
+			 * In ring mode the bulk is only queued: the data lives
+			 * in the ALSA buffer, which is not reused before VC
+			 * reports it played (the pointer isn't interpolated
+			 * ahead of that in this mode), so there's nothing to
+			 * wait for.  The buffer is kernel memory, which vchiq
+			 * maps without touching the worker's (absent) mm.
+			 */
 			success = vchi_bulk_queue_transmit(instance->vchi_handle[0],
 							   src, count,
-							   0 *
-							   VCHI_FLAGS_BLOCK_UNTIL_QUEUED
-							   +
-							   1 *
+							   alsa_stream->ring_bulk ?
+							   VCHI_FLAGS_BLOCK_UNTIL_QUEUED :
 							   VCHI_FLAGS_BLOCK_UNTIL_DATA_READ,
 							   NULL);
 		} else {
@@ -900,3 +948,5 @@ uint32_t bcm2835_audio_retrieve_buffers(bcm2835_alsa_stream_t * alsa_stream)
 
 module_param(force_bulk, bool, 0444);
 MODULE_PARM_DESC(force_bulk, "Force use of vchiq bulk for audio");
+module_param(ring_bulk, bool, 0644);
+MODULE_PARM_DESC(ring_bulk, "Send periods straight from the ring buffer as vchiq bulk transfers without waiting for VC to read them (disables interpolate_pointer, applies from the next prepare)");
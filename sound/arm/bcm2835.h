@@ -25,6 +25,7 @@
 #include <sound/pcm_params.h>
 #include <sound/pcm-indirect.h>
 #include <linux/workqueue.h>
+#include <linux/ktime.h>
 
 /*
 #define AUDIO_DEBUG_ENABLE
@@ -93,6 +94,23 @@ typedef enum {
 	PCM_PLAYBACK_DEVICE,
 } SND_BCM2835_CTRL_T;
 
+/* Number of queued periods whose hand-over time is remembered for the
+ * end-to-end latency figures; must be a power of two. */
+#define LATENCY_STAMPS			(16)
+
+/* Period timing of the last run of a substream, see /proc/asound/cardX/latency */
+struct bcm2835_latency_stats {
+	unsigned int period_us;		/* nominal period length */
+	unsigned int periods;		/* completed periods measured */
+	int jitter_min_us;		/* completion interval - nominal period */
+	int jitter_max_us;
+	u64 jitter_abs_sum_us;
+	unsigned int e2e_count;		/* periods with a known ack time */
+	unsigned int e2e_min_us;	/* ack of a period -> VC reports it played */
+	unsigned int e2e_max_us;
+	u64 e2e_sum_us;
+};
+
 /* definition of the chip-specific record */
 typedef struct bcm2835_chip {
 	struct snd_card *card;
@@ -111,6 +129,9 @@ typedef struct bcm2835_chip {
 	unsigned int opened;
 	unsigned int spdif_status;
 	struct mutex audio_mutex;
+
+	spinlock_t stats_lock;
+	struct bcm2835_latency_stats latency[MAX_SUBSTREAMS];
 } bcm2835_chip_t;
 
 typedef struct bcm2835_alsa_stream {
@@ -143,6 +164,27 @@ typedef struct bcm2835_alsa_stream {
 	struct opaque_AUDIO_INSTANCE_T *instance;
 	struct workqueue_struct *my_wq;
 	int idx;
+
+	/* Ring of data acked by ALSA but not yet handed to VC, drained by
+	 * write_work; all totals are in bytes and wrap, protected by lock */
+	struct work_struct write_work;
+	unsigned int write_offset;	/* ring offset of the next byte to send */
+	unsigned int write_queued;	/* total bytes acked */
+	unsigned int write_sent;	/* total bytes handed to VC */
+	unsigned int played;		/* total bytes VC reported played */
+	bool ring_bulk;			/* ring_bulk as of the last prepare */
+
+	/* pointer interpolation between VC completions */
+	unsigned int bytes_per_sec;
+	ktime_t pos_time;		/* when pos last advanced */
+	unsigned int interp_off;	/* bytes reported ahead of pos */
+
+	/* latency measurement, see latency_stats */
+	ktime_t period_time;		/* last period completion */
+	ktime_t lat_stamp[LATENCY_STAMPS];
+	unsigned int lat_fill;		/* bytes acked towards the next stamp */
+	unsigned int lat_acked;		/* periods acked */
+	unsigned int lat_played;	/* periods played */
 } bcm2835_alsa_stream_t;
 
 int snd_bcm2835_new_ctl(bcm2835_chip_t * chip);
@@ -160,8 +202,11 @@ int bcm2835_audio_stop(bcm2835_alsa_stream_t * alsa_stream);
 int bcm2835_audio_set_ctls(bcm2835_chip_t * chip);
 int bcm2835_audio_write(bcm2835_alsa_stream_t * alsa_stream, uint32_t count,
 			void *src);
+void bcm2835_audio_drop_writes(bcm2835_alsa_stream_t *alsa_stream);
 uint32_t bcm2835_audio_retrieve_buffers(bcm2835_alsa_stream_t * alsa_stream);
 void bcm2835_audio_flush_buffers(bcm2835_alsa_stream_t * alsa_stream);
 void bcm2835_audio_flush_playback_buffers(bcm2835_alsa_stream_t * alsa_stream);
 
+extern bool ring_bulk;
+
 #endif /* __SOUND_ARM_BCM2835_H */
@@ -0,0 +1,344 @@
+/*
+ * aio_ring_bench.c - io_submit() versus a polled submission ring
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Keeps a fixed number of random reads in flight against a file, fio
+ * style, and reports IOPS and CPU time per I/O for two submission paths:
+ * one io_submit() per reap batch, and an IOCTX_FLAG_SQPOLL context where
+ * the iocbs are written to a shared ring and a kernel thread submits
+ * them. "proc" CPU is what this process used; "system" CPU comes from
+ * /proc/stat and includes the poller thread, which is accounted to no
+ * process. Without -D the reads are buffered, so comparing runs with
+ * fs.aio-buffered-async set and clear shows whether io_submit() blocked.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/aio_abi.h>
+
+#ifndef IOCTX_FLAG_SQPOLL
+#define IOCTX_FLAG_SQPOLL	(1 << 0)
+#define AIO_SQ_NEED_WAKEUP	(1 << 0)
+
+struct aio_sq_ring {
+	__u32	head;
+	__u32	tail;
+	__u32	nr;
+	__u32	flags;
+	__u32	dropped;
+	__u32	resv[3];
+	struct iocb	iocbs[0];
+};
+
+struct aio_sq_params {
+	__u64	sq_ring;
+	__u32	sq_entries;
+	__u32	sq_idle_ms;
+	__s32	sq_cpu;
+	__u32	resv[3];
+};
+#endif
+
+#ifndef __NR_io_setup2
+#if defined(__arm__)
+#define __NR_io_setup2		(__NR_SYSCALL_BASE + 388)
+#elif defined(__aarch64__)
+#define __NR_io_setup2		282	/* asm-generic */
+#else
+#define __NR_io_setup2		-1	/* fails with ENOSYS */
+#endif
+#endif
+
+#define MAX_DEPTH	256
+#define FILE_SIZE	(64 << 20)
+
+static const char *path;
+static size_t bs = 4096;
+static int depth = 32;
+static int seconds = 5;
+static int odirect;
+
+static char *bufs[MAX_DEPTH];
+static off_t nblocks;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static long long proc_cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec +
+	       ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+}
+
+/* busy time of all cpus, in microseconds */
+static long long system_cpu_us(void)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq;
+	FILE *f = fopen("/proc/stat", "r");
+	int n;
+
+	if (!f)
+		return 0;
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+		   &sys, &idle, &iowait, &irq, &softirq);
+	fclose(f);
+	if (n != 7)
+		return 0;
+	return (user + nice + sys + irq + softirq) * 1000000LL /
+	       sysconf(_SC_CLK_TCK);
+}
+
+static void prep_iocb(struct iocb *cb, int fd, int slot)
+{
+	memset(cb, 0, sizeof(*cb));
+	cb->aio_data = slot;
+	cb->aio_lio_opcode = IOCB_CMD_PREAD;
+	cb->aio_fildes = fd;
+	cb->aio_buf = (unsigned long)bufs[slot];
+	cb->aio_nbytes = bs;
+	cb->aio_offset = (random() % nblocks) * bs;
+}
+
+static void report(const char *name, long long ios, long long usec,
+		   long long pcpu, long long scpu)
+{
+	if (!ios)
+		ios = 1;
+	printf("%-10s %10lld %10lld %12.2f %12.2f\n", name, ios,
+	       ios * 1000000LL / usec, (double)pcpu / ios, (double)scpu / ios);
+}
+
+static void run(int fd, int ring_mode)
+{
+	static struct iocb cbs[MAX_DEPTH];
+	struct iocb *cbp[MAX_DEPTH];
+	struct io_event ev[MAX_DEPTH];
+	struct aio_sq_ring *ring = NULL;
+	struct aio_sq_params p;
+	aio_context_t ctx = 0;
+	long long start, end, pcpu, scpu, ios = 0;
+	int i, n, pending = 0;
+	unsigned int nr = 1;
+
+	if (ring_mode) {
+		while (nr < depth)
+			nr <<= 1;
+		if (posix_memalign((void **)&ring, 4096, sizeof(*ring) +
+				   nr * sizeof(struct iocb)))
+			die("posix_memalign");
+		memset(ring, 0, sizeof(*ring));
+		ring->nr = nr;
+
+		memset(&p, 0, sizeof(p));
+		p.sq_ring = (unsigned long)ring;
+		p.sq_entries = nr;
+		if (syscall(__NR_io_setup2, depth, IOCTX_FLAG_SQPOLL, &p,
+			    &ctx) < 0) {
+			if (errno == ENOSYS) {
+				printf("%-10s io_setup2 not available, skipping\n",
+				       "sqpoll");
+				free(ring);
+				return;
+			}
+			if (errno == EPERM) {
+				printf("%-10s needs CAP_SYS_NICE, skipping\n",
+				       "sqpoll");
+				free(ring);
+				return;
+			}
+			die("io_setup2");
+		}
+	} else if (syscall(__NR_io_setup, depth, &ctx) < 0) {
+		die("io_setup");
+	}
+
+	start = now_us();
+	end = start + seconds * 1000000LL;
+	pcpu = proc_cpu_us();
+	scpu = system_cpu_us();
+
+	for (i = 0; i < depth; i++)
+		cbp[i] = &cbs[i];
+	n = depth;
+	for (;;) {
+		/* refill the n slots whose buffers cbp[0..n) name */
+		if (ring_mode) {
+			for (i = 0; i < n; i++) {
+				int slot = cbp[i] - cbs;
+
+				prep_iocb(&ring->iocbs[ring->tail & (nr - 1)],
+					  fd, slot);
+				__sync_synchronize();
+				ring->tail++;
+			}
+			__sync_synchronize();
+			if (ring->flags & AIO_SQ_NEED_WAKEUP)
+				syscall(__NR_io_submit, ctx, 0, NULL);
+		} else if (n) {
+			for (i = 0; i < n; i++)
+				prep_iocb(cbp[i], fd, cbp[i] - cbs);
+			if (syscall(__NR_io_submit, ctx, n, cbp) != n)
+				die("io_submit");
+		}
+		pending += n;
+
+		if (now_us() >= end)
+			break;
+
+		n = syscall(__NR_io_getevents, ctx, 1, depth, ev, NULL);
+		if (n < 0)
+			die("io_getevents");
+		for (i = 0; i < n; i++) {
+			if (ev[i].res != bs) {
+				fprintf(stderr, "short read: %lld\n",
+					(long long)ev[i].res);
+				exit(1);
+			}
+			cbp[i] = &cbs[ev[i].data];
+		}
+		pending -= n;
+		ios += n;
+	}
+
+	pcpu = proc_cpu_us() - pcpu;
+	scpu = system_cpu_us() - scpu;
+	report(ring_mode ? "sqpoll" : "io_submit", ios, now_us() - start,
+	       pcpu, scpu);
+
+	while (pending > 0) {
+		n = syscall(__NR_io_getevents, ctx, 1, depth, ev, NULL);
+		if (n < 0)
+			die("io_getevents");
+		pending -= n;
+	}
+	if (ring && ring->dropped)
+		printf("%-10s %u iocbs failed\n", "sqpoll", ring->dropped);
+
+	syscall(__NR_io_destroy, ctx);
+	free(ring);
+}
+
+static int open_file(void)
+{
+	char *buf;
+	int fd, i;
+
+	if (path) {
+		fd = open(path, O_RDONLY | (odirect ? O_DIRECT : 0));
+		if (fd < 0)
+			die(path);
+		nblocks = lseek(fd, 0, SEEK_END) / bs;
+		if (nblocks < 1) {
+			fprintf(stderr, "%s: smaller than one block\n", path);
+			exit(1);
+		}
+		return fd;
+	}
+
+	path = "aio_ring_bench.dat";
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		die(path);
+	buf = malloc(1 << 20);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0xa5, 1 << 20);
+	for (i = 0; i < FILE_SIZE >> 20; i++)
+		if (write(fd, buf, 1 << 20) != 1 << 20)
+			die("write");
+	free(buf);
+	fsync(fd);
+	close(fd);
+
+	fd = open(path, O_RDONLY | (odirect ? O_DIRECT : 0));
+	unlink(path);
+	if (fd < 0)
+		die(path);
+	nblocks = FILE_SIZE / bs;
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, fd, i;
+	int modes = 3;
+
+	while ((opt = getopt(argc, argv, "f:b:d:t:m:D")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'b':
+			bs = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "submit"))
+				modes = 1;
+			else if (!strcmp(optarg, "sqpoll"))
+				modes = 2;
+			break;
+		case 'D':
+			odirect = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f file] [-b block size] [-d depth] [-t seconds] [-m submit|sqpoll] [-D]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (depth < 1)
+		depth = 1;
+	if (depth > MAX_DEPTH)
+		depth = MAX_DEPTH;
+	if (seconds < 1)
+		seconds = 1;
+	if (bs < 512 || bs & 511) {
+		fprintf(stderr, "block size must be a multiple of 512\n");
+		return 1;
+	}
+
+	fd = open_file();
+	for (i = 0; i < depth; i++)
+		if (posix_memalign((void **)&bufs[i], 4096, bs))
+			die("posix_memalign");
+
+	printf("%-10s %10s %10s %12s %12s\n", "mode", "ios", "iops",
+	       "proc us/io", "system us/io");
+	if (modes & 1)
+		run(fd, 0);
+	if (modes & 2)
+		run(fd, 1);
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * ashmem_pin_tests.c - ashmem pin/unpin throughput
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Each thread unpins and re-pins the one-page tiles of an ashmem area,
+ * the way a tile cache hands pages back while they are off screen. The
+ * threads either get an area each or share a single one, and a last
+ * pass pins tiles that are already pinned, the most common call of all.
+ * Rates are pin + unpin calls per second summed over all threads.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <linux/types.h>
+#include <ashmem.h>
+
+#define TILES		1024
+#define MAX_THREADS	64
+
+enum {
+	MODE_PRIVATE,	/* an area per thread */
+	MODE_SHARED,	/* every thread on the same area */
+	MODE_PINNED,	/* pin tiles that are already pinned */
+};
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	int first_tile;
+	int tiles;
+	unsigned long ops;
+};
+
+static int duration = 2;
+static int mode;
+static long page_size;
+static volatile int stop;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static int area_create(int tiles)
+{
+	void *map;
+	int fd;
+
+	fd = open("/dev/ashmem", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (ioctl(fd, ASHMEM_SET_SIZE, (size_t)tiles * page_size) < 0)
+		die("ASHMEM_SET_SIZE");
+	/* the backing file only exists once the area has been mapped */
+	map = mmap(NULL, tiles * page_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		die("mmap");
+	munmap(map, tiles * page_size);
+	return fd;
+}
+
+static void tile_ioctl(int fd, int cmd, int tile)
+{
+	struct ashmem_pin pin = {
+		.offset = tile * page_size,
+		.len = page_size,
+	};
+
+	if (ioctl(fd, cmd, &pin) < 0)
+		die(cmd == ASHMEM_PIN ? "ASHMEM_PIN" : "ASHMEM_UNPIN");
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+	int i;
+
+	while (!stop) {
+		if (mode == MODE_PINNED) {
+			for (i = 0; i < w->tiles; i++)
+				tile_ioctl(w->fd, ASHMEM_PIN, w->first_tile + i);
+			ops += w->tiles;
+			continue;
+		}
+		/* every other tile, so the area fills with separate ranges */
+		for (i = 0; i < w->tiles; i += 2)
+			tile_ioctl(w->fd, ASHMEM_UNPIN, w->first_tile + i);
+		for (i = 1; i < w->tiles; i += 2)
+			tile_ioctl(w->fd, ASHMEM_UNPIN, w->first_tile + i);
+		for (i = 0; i < w->tiles; i++)
+			tile_ioctl(w->fd, ASHMEM_PIN, w->first_tile + i);
+		ops += 2 * w->tiles;
+	}
+	w->ops = ops;
+	return NULL;
+}
+
+static double run(int threads)
+{
+	struct worker workers[MAX_THREADS];
+	unsigned long total = 0;
+	int shared_fd = -1;
+	int i;
+
+	if (mode != MODE_PRIVATE) {
+		shared_fd = area_create(TILES * threads);
+		if (shared_fd < 0)
+			die("/dev/ashmem");
+	}
+	for (i = 0; i < threads; i++) {
+		struct worker *w = &workers[i];
+
+		memset(w, 0, sizeof(*w));
+		w->tiles = TILES;
+		if (shared_fd >= 0) {
+			w->fd = shared_fd;
+			w->first_tile = i * TILES;
+		} else {
+			w->fd = area_create(TILES);
+			if (w->fd < 0)
+				die("/dev/ashmem");
+		}
+	}
+
+	stop = 0;
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_main,
+				   &workers[i]))
+			die("pthread_create");
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ops;
+		if (shared_fd < 0)
+			close(workers[i].fd);
+	}
+	if (shared_fd >= 0)
+		close(shared_fd);
+	return (double)total / duration;
+}
+
+int main(int argc, char **argv)
+{
+	static const char * const mode_names[] = {
+		[MODE_PRIVATE] = "private areas",
+		[MODE_SHARED] = "shared area",
+		[MODE_PINNED] = "pin of pinned",
+	};
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = cpus > 0 ? cpus : 1;
+	int threads, opt, fd;
+
+	while ((opt = getopt(argc, argv, "d:t:")) != -1) {
+		switch (opt) {
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-d seconds] [-t max_threads]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (duration < 1)
+		duration = 1;
+	if (max_threads < 1)
+		max_threads = 1;
+	if (max_threads > MAX_THREADS)
+		max_threads = MAX_THREADS;
+	page_size = sysconf(_SC_PAGESIZE);
+
+	fd = open("/dev/ashmem", O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		printf("ashmem_pin_tests: /dev/ashmem not available, skipping\n");
+		return 0;
+	}
+	close(fd);
+
+	for (mode = MODE_PRIVATE; mode <= MODE_PINNED; mode++) {
+		double base_rate = 0;
+
+		printf("%s\nthreads         ops/s  scaling\n", mode_names[mode]);
+		threads = 1;
+		while (1) {
+			double rate = run(threads);
+
+			if (threads == 1)
+				base_rate = rate;
+			printf("%7d  %12.0f  %6.2fx\n", threads, rate,
+			       base_rate ? rate / base_rate : 0);
+			if (threads == max_threads)
+				break;
+			threads = threads * 2 < max_threads ?
+				  threads * 2 : max_threads;
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,520 @@
+/*
+ * binder_perf_tests.c - binder transaction throughput with N client/server
+ * pairs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A registry process becomes the context manager. Each server process
+ * publishes a binder object with it, each client looks its server up and
+ * then does synchronous round trips against it for a fixed time. Pairs
+ * never share a process, so the aggregate rate should scale with the
+ * number of pairs up to the number of CPUs.
+ *
+ * A single pair then sends payloads of growing size, once flattened into
+ * the parcel and once as a BINDER_TYPE_PTR buffer with BC_TRANSACTION_SG,
+ * and reports the bytes/s of each.
+ *
+ * The registry needs the context manager slot, so this cannot run next
+ * to a live servicemanager. Build with -DBINDER_IPC_32BIT for kernels
+ * using the old 32-bit protocol.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <linux/android/binder.h>
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	64
+#define MAX_IDS		256
+#define MAX_PARCEL	(64 * 1024)
+
+enum {
+	REG_ADD = 1,	/* data: id, object: the server's binder */
+	REG_GET,	/* data: id; reply: the handle, or nothing yet */
+	PING,
+};
+
+struct binder_ctx {
+	int fd;
+	void *map;
+};
+
+struct txn_data {
+	uint32_t id;
+	struct flat_binder_object obj;
+};
+
+static int duration = 2;
+static size_t parcel_size;	/* payload bytes per PING */
+static int use_sg;		/* send the payload with BC_TRANSACTION_SG */
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static int binder_open(struct binder_ctx *bc)
+{
+	struct binder_version version;
+
+	bc->fd = open("/dev/binder", O_RDWR | O_CLOEXEC);
+	if (bc->fd < 0)
+		return -1;
+	if (ioctl(bc->fd, BINDER_VERSION, &version) < 0 ||
+	    version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		exit(1);
+	}
+	bc->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, bc->fd, 0);
+	if (bc->map == MAP_FAILED)
+		die("mmap");
+	return 0;
+}
+
+static void binder_write_read(struct binder_ctx *bc, void *wbuf, size_t wlen,
+			      void *rbuf, size_t rlen, size_t *consumed)
+{
+	struct binder_write_read bwr = {
+		.write_size = wlen,
+		.write_buffer = (uintptr_t)wbuf,
+		.read_size = rlen,
+		.read_buffer = (uintptr_t)rbuf,
+	};
+
+	while (ioctl(bc->fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR)
+			die("BINDER_WRITE_READ");
+	}
+	if (consumed)
+		*consumed = bwr.read_consumed;
+}
+
+/* Queue a command and its argument into a write buffer. */
+static size_t put_cmd(void *buf, size_t pos, uint32_t cmd,
+		      const void *arg, size_t len)
+{
+	memcpy((char *)buf + pos, &cmd, sizeof(cmd));
+	memcpy((char *)buf + pos + sizeof(cmd), arg, len);
+	return pos + sizeof(cmd) + len;
+}
+
+static size_t put_transaction(void *buf, size_t pos, uint32_t cmd,
+			      uint32_t handle, uint32_t code,
+			      struct txn_data *data, int with_obj)
+{
+	static binder_size_t offsets[1] = {
+		offsetof(struct txn_data, obj),
+	};
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = with_obj ? sizeof(*data) : sizeof(data->id);
+	tr.offsets_size = with_obj ? sizeof(offsets) : 0;
+	tr.data.ptr.buffer = (uintptr_t)data;
+	tr.data.ptr.offsets = (uintptr_t)offsets;
+	return put_cmd(buf, pos, cmd, &tr, sizeof(tr));
+}
+
+/*
+ * A PING carrying parcel_size bytes. Without scatter-gather the payload
+ * is flattened into the parcel first, as writing it into a Parcel would;
+ * with it the driver copies the payload from where it already is.
+ */
+static size_t put_ping(void *buf, uint32_t handle, struct txn_data *data,
+		       char *parcel, const char *blob)
+{
+	static binder_size_t offsets[1];
+	struct binder_transaction_data_sg sg;
+	struct binder_buffer_object *bp;
+
+	if (!parcel_size)
+		return put_transaction(buf, 0, BC_TRANSACTION, handle, PING,
+				       data, 0);
+
+	memset(&sg, 0, sizeof(sg));
+	sg.transaction_data.target.handle = handle;
+	sg.transaction_data.code = PING;
+	sg.transaction_data.data.ptr.buffer = (uintptr_t)parcel;
+	sg.transaction_data.data.ptr.offsets = (uintptr_t)offsets;
+	if (!use_sg) {
+		memcpy(parcel, blob, parcel_size);
+		sg.transaction_data.data_size = parcel_size;
+		return put_cmd(buf, 0, BC_TRANSACTION, &sg.transaction_data,
+			       sizeof(sg.transaction_data));
+	}
+
+	bp = (struct binder_buffer_object *)parcel;
+	memset(bp, 0, sizeof(*bp));
+	bp->type = BINDER_TYPE_PTR;
+	bp->buffer = (uintptr_t)blob;
+	bp->length = parcel_size;
+	sg.transaction_data.data_size = sizeof(*bp);
+	sg.transaction_data.offsets_size = sizeof(offsets);
+	sg.buffers_size = (parcel_size + 7) & ~(size_t)7;
+	return put_cmd(buf, 0, BC_TRANSACTION_SG, &sg, sizeof(sg));
+}
+
+/*
+ * Wait for the next BR_TRANSACTION or BR_REPLY, answering refcount
+ * requests on the way. Returns the command; *tr is filled in.
+ */
+static uint32_t wait_for_txn(struct binder_ctx *bc,
+			     struct binder_transaction_data *tr)
+{
+	uint32_t rbuf[64];
+	char wbuf[256];
+	size_t wlen = 0;
+
+	while (1) {
+		size_t len, pos = 0;
+
+		binder_write_read(bc, wbuf, wlen, rbuf, sizeof(rbuf), &len);
+		wlen = 0;
+		while (pos < len) {
+			uint32_t cmd;
+			struct binder_ptr_cookie pc;
+
+			memcpy(&cmd, (char *)rbuf + pos, sizeof(cmd));
+			pos += sizeof(cmd);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_SPAWN_LOOPER:
+			case BR_TRANSACTION_COMPLETE:
+				break;
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+			case BR_RELEASE:
+			case BR_DECREFS:
+				memcpy(&pc, (char *)rbuf + pos, sizeof(pc));
+				pos += sizeof(pc);
+				if (cmd == BR_INCREFS)
+					wlen = put_cmd(wbuf, wlen,
+						       BC_INCREFS_DONE,
+						       &pc, sizeof(pc));
+				else if (cmd == BR_ACQUIRE)
+					wlen = put_cmd(wbuf, wlen,
+						       BC_ACQUIRE_DONE,
+						       &pc, sizeof(pc));
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(tr, (char *)rbuf + pos, sizeof(*tr));
+				/* nothing may follow a transaction */
+				if (wlen)
+					binder_write_read(bc, wbuf, wlen,
+							  NULL, 0, NULL);
+				return cmd;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				fprintf(stderr, "%d: transaction failed (%x)\n",
+					getpid(), cmd);
+				exit(1);
+			default:
+				fprintf(stderr, "%d: unexpected return %x\n",
+					getpid(), cmd);
+				exit(1);
+			}
+		}
+	}
+}
+
+static size_t put_free_buffer(void *buf, size_t pos,
+			      struct binder_transaction_data *tr)
+{
+	binder_uintptr_t ptr = tr->data.ptr.buffer;
+
+	return put_cmd(buf, pos, BC_FREE_BUFFER, &ptr, sizeof(ptr));
+}
+
+static void run_registry(struct binder_ctx *bc)
+{
+	uint32_t handles[MAX_IDS];
+	uint32_t looper = BC_ENTER_LOOPER;
+	char wbuf[256];
+
+	memset(handles, 0, sizeof(handles));
+	if (ioctl(bc->fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		die("BINDER_SET_CONTEXT_MGR");
+	binder_write_read(bc, &looper, sizeof(looper), NULL, 0, NULL);
+
+	while (1) {
+		struct binder_transaction_data tr;
+		struct txn_data in, out;
+		size_t wlen;
+		int with_obj = 0;
+
+		wait_for_txn(bc, &tr);
+		memcpy(&in, (void *)(uintptr_t)tr.data.ptr.buffer,
+		       tr.data_size < sizeof(in) ? tr.data_size : sizeof(in));
+		memset(&out, 0, sizeof(out));
+		wlen = 0;
+
+		if (in.id >= MAX_IDS)
+			in.id = 0;
+		if (tr.code == REG_ADD && tr.data_size == sizeof(in)) {
+			uint32_t handle = in.obj.handle;
+
+			/* hold our own reference past freeing the buffer */
+			wlen = put_cmd(wbuf, wlen, BC_ACQUIRE,
+				       &handle, sizeof(handle));
+			handles[in.id] = handle;
+		} else if (tr.code == REG_GET && handles[in.id]) {
+			out.obj.type = BINDER_TYPE_HANDLE;
+			out.obj.handle = handles[in.id];
+			with_obj = 1;
+		}
+		wlen = put_free_buffer(wbuf, wlen, &tr);
+		wlen = put_transaction(wbuf, wlen, BC_REPLY, 0, 0, &out,
+				       with_obj);
+		binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+	}
+}
+
+static void run_server(struct binder_ctx *bc, uint32_t id)
+{
+	struct binder_transaction_data tr;
+	struct txn_data out;
+	uint32_t looper = BC_ENTER_LOOPER;
+	char wbuf[256];
+	size_t wlen;
+
+	binder_write_read(bc, &looper, sizeof(looper), NULL, 0, NULL);
+
+	memset(&out, 0, sizeof(out));
+	out.id = id;
+	out.obj.type = BINDER_TYPE_BINDER;
+	out.obj.binder = 0x1000 + id;
+	wlen = put_transaction(wbuf, 0, BC_TRANSACTION, 0, REG_ADD, &out, 1);
+	binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+	if (wait_for_txn(bc, &tr) != BR_REPLY) {
+		fprintf(stderr, "server %u: registration failed\n", id);
+		exit(1);
+	}
+	wlen = put_free_buffer(wbuf, 0, &tr);
+	binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+
+	while (1) {
+		wait_for_txn(bc, &tr);
+		wlen = put_free_buffer(wbuf, 0, &tr);
+		wlen = put_transaction(wbuf, wlen, BC_REPLY, 0, 0, &out, 0);
+		binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+	}
+}
+
+static void run_client(struct binder_ctx *bc, uint32_t id, int start_fd,
+		       int result_fd)
+{
+	struct binder_transaction_data tr;
+	struct txn_data out;
+	struct timeval end, now;
+	unsigned long count = 0;
+	uint32_t handle = 0;
+	char *parcel, *blob;
+	char wbuf[256];
+	size_t wlen;
+	char go;
+
+	parcel = malloc(MAX_PARCEL + sizeof(struct binder_buffer_object));
+	blob = malloc(MAX_PARCEL);
+	if (!parcel || !blob)
+		die("malloc");
+	memset(blob, 0x5a, MAX_PARCEL);
+	memset(&out, 0, sizeof(out));
+	out.id = id;
+	while (!handle) {
+		wlen = put_transaction(wbuf, 0, BC_TRANSACTION, 0, REG_GET,
+				       &out, 0);
+		binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+		wait_for_txn(bc, &tr);
+		wlen = 0;
+		if (tr.offsets_size) {
+			handle = ((struct txn_data *)(uintptr_t)
+				  tr.data.ptr.buffer)->obj.handle;
+			wlen = put_cmd(wbuf, wlen, BC_ACQUIRE,
+				       &handle, sizeof(handle));
+		}
+		wlen = put_free_buffer(wbuf, wlen, &tr);
+		binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+		if (!handle)
+			usleep(1000);
+	}
+
+	if (read(start_fd, &go, 1) != 1)
+		die("read");
+	gettimeofday(&end, NULL);
+	end.tv_sec += duration;
+	do {
+		wlen = put_ping(wbuf, handle, &out, parcel, blob);
+		binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+		wait_for_txn(bc, &tr);
+		wlen = put_free_buffer(wbuf, 0, &tr);
+		binder_write_read(bc, wbuf, wlen, NULL, 0, NULL);
+		count++;
+		gettimeofday(&now, NULL);
+	} while (timercmp(&now, &end, <));
+
+	if (write(result_fd, &count, sizeof(count)) != sizeof(count))
+		die("write");
+	exit(0);
+}
+
+static pid_t spawn(void (*fn)(struct binder_ctx *, uint32_t), uint32_t id)
+{
+	struct binder_ctx bc;
+	pid_t pid = fork();
+
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		if (binder_open(&bc) < 0)
+			die("/dev/binder");
+		fn(&bc, id);
+		exit(0);
+	}
+	return pid;
+}
+
+static void registry_main(struct binder_ctx *bc, uint32_t id)
+{
+	run_registry(bc);
+}
+
+static double run_pairs(int pairs, uint32_t base)
+{
+	pid_t servers[MAX_PAIRS], clients[MAX_PAIRS];
+	int start[2], result[2];
+	unsigned long total = 0;
+	int i;
+
+	if (pipe(start) || pipe(result))
+		die("pipe");
+	for (i = 0; i < pairs; i++) {
+		struct binder_ctx bc;
+
+		servers[i] = spawn(run_server, base + i);
+		clients[i] = fork();
+		if (clients[i] < 0)
+			die("fork");
+		if (clients[i] == 0) {
+			close(start[1]);
+			close(result[0]);
+			if (binder_open(&bc) < 0)
+				die("/dev/binder");
+			run_client(&bc, base + i, start[0], result[1]);
+		}
+	}
+	close(start[0]);
+	close(result[1]);
+
+	/* all clients start together once they hold their handles */
+	for (i = 0; i < pairs; i++) {
+		if (write(start[1], "g", 1) != 1)
+			die("write");
+	}
+	for (i = 0; i < pairs; i++) {
+		unsigned long count;
+
+		if (read(result[0], &count, sizeof(count)) != sizeof(count))
+			die("read");
+		total += count;
+	}
+	for (i = 0; i < pairs; i++) {
+		waitpid(clients[i], NULL, 0);
+		kill(servers[i], SIGKILL);
+		waitpid(servers[i], NULL, 0);
+	}
+	close(start[1]);
+	close(result[0]);
+	return (double)total / duration;
+}
+
+int main(int argc, char **argv)
+{
+	struct binder_ctx bc;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_pairs = cpus > 0 ? cpus : 1;
+	double base_rate = 0;
+	uint32_t base = 1;
+	pid_t registry;
+	int pairs, opt;
+
+	while ((opt = getopt(argc, argv, "d:p:")) != -1) {
+		switch (opt) {
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'p':
+			max_pairs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-d seconds] [-p max_pairs]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (duration < 1)
+		duration = 1;
+	if (max_pairs < 1)
+		max_pairs = 1;
+
+	if (binder_open(&bc) < 0) {
+		printf("binder_perf_tests: /dev/binder not available, skipping\n");
+		return 0;
+	}
+	close(bc.fd);
+	munmap(bc.map, MAP_SIZE);
+
+	registry = spawn(registry_main, 0);
+
+	if (max_pairs > MAX_PAIRS)
+		max_pairs = MAX_PAIRS;
+
+	printf("pairs  transactions/s  per pair  scaling\n");
+	pairs = 1;
+	while (1) {
+		double rate;
+
+		rate = run_pairs(pairs, base);
+		base += pairs;
+		if (pairs == 1)
+			base_rate = rate;
+		printf("%5d  %14.0f  %8.0f  %6.2fx\n", pairs, rate,
+		       rate / pairs, base_rate ? rate / base_rate : 0);
+		if (pairs == max_pairs)
+			break;
+		pairs = pairs * 2 < max_pairs ? pairs * 2 : max_pairs;
+	}
+
+	printf("\n  bytes  parcel MB/s  sg MB/s\n");
+	for (parcel_size = 64; parcel_size <= MAX_PARCEL; parcel_size *= 4) {
+		double parcel_rate, sg_rate;
+
+		use_sg = 0;
+		parcel_rate = run_pairs(1, base++);
+		use_sg = 1;
+		sg_rate = run_pairs(1, base++);
+		printf("%7zu  %11.1f  %7.1f\n", parcel_size,
+		       parcel_rate * parcel_size / 1e6,
+		       sg_rate * parcel_size / 1e6);
+	}
+
+	kill(registry, SIGKILL);
+	waitpid(registry, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * epoll_threads_bench.c - events/sec of one epoll set shared by N threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A number of non-blocking eventfds are registered edge triggered in a
+ * single epoll set. Every worker thread loops in epoll_wait(); for each
+ * event it drains the eventfd and writes it again, so every handled event
+ * produces the next wakeup. The rate is reported for 1, 2, 4, ... threads,
+ * once for a default set and once for an EPOLL_PERCPU one.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+
+#ifndef EPOLL_PERCPU
+#define EPOLL_PERCPU	1
+#endif
+
+#define MAX_THREADS	64
+#define MAX_EVENTS	16
+
+static int nfds = 256;
+static int max_threads;
+static int seconds = 2;
+
+static int epfd;
+static int *efds;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	unsigned long long events;
+} __attribute__((aligned(64)));
+
+static struct worker workers[MAX_THREADS];
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct epoll_event ev[MAX_EVENTS];
+	uint64_t val, one = 1;
+	int i, n, fd;
+
+	while (!stop) {
+		n = epoll_wait(epfd, ev, MAX_EVENTS, 100);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			die("epoll_wait");
+		}
+		for (i = 0; i < n; i++) {
+			fd = ev[i].data.fd;
+			/* another thread may have drained it already */
+			if (read(fd, &val, sizeof(val)) != sizeof(val))
+				continue;
+			w->events++;
+			if (write(fd, &one, sizeof(one)) != sizeof(one))
+				die("write");
+		}
+	}
+	return NULL;
+}
+
+/* returns events/sec, or -1 if the kernel rejected the flags */
+static double run(int flags, int nthreads)
+{
+	struct epoll_event ev;
+	unsigned long long total = 0;
+	uint64_t one = 1;
+	int i;
+
+	epfd = epoll_create1(flags);
+	if (epfd < 0) {
+		if (errno == EINVAL)
+			return -1;
+		die("epoll_create1");
+	}
+
+	for (i = 0; i < nfds; i++) {
+		efds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (efds[i] < 0)
+			die("eventfd");
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.fd = efds[i];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, efds[i], &ev))
+			die("epoll_ctl");
+	}
+
+	stop = 0;
+	for (i = 0; i < nthreads; i++) {
+		workers[i].events = 0;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nfds; i++)
+		if (write(efds[i], &one, sizeof(one)) != sizeof(one))
+			die("write");
+
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].events;
+	}
+
+	for (i = 0; i < nfds; i++)
+		close(efds[i]);
+	close(epfd);
+	return (double)total / seconds;
+}
+
+int main(int argc, char **argv)
+{
+	double def, pcp;
+	int opt, t;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "f:t:s:")) != -1) {
+		switch (opt) {
+		case 'f':
+			nfds = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f eventfds] [-t max threads] [-s seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nfds < 1)
+		nfds = 1;
+	if (max_threads < 1)
+		max_threads = 1;
+	if (max_threads > MAX_THREADS)
+		max_threads = MAX_THREADS;
+	if (seconds < 1)
+		seconds = 1;
+
+	efds = calloc(nfds, sizeof(*efds));
+	if (!efds)
+		die("calloc");
+
+	printf("%8s %14s %14s\n", "threads", "default ev/s", "percpu ev/s");
+	for (t = 1; t <= max_threads; t *= 2) {
+		def = run(0, t);
+		pcp = run(EPOLL_PERCPU, t);
+		if (pcp < 0)
+			printf("%8d %14.0f %14s\n", t, def, "n/a");
+		else
+			printf("%8d %14.0f %14.0f\n", t, def, pcp);
+	}
+	return 0;
+}
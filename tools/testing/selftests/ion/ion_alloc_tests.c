@@ -0,0 +1,127 @@
+/*
+ * ion_alloc_tests.c - ion allocation latency
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Allocates and frees buffers of a few sizes from the system heap and
+ * prints the latency of ION_IOC_ALLOC. The first allocation of each size
+ * is reported on its own, since that is the one a cold page pool makes
+ * slow; compare runs with and without ion_system_heap.pool_prefill set.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/types.h>
+#include <ion.h>
+
+#define MAX_ITERS	10000
+
+static int iters = 200;
+static unsigned int heap_mask = ION_HEAP_SYSTEM_MASK;
+static unsigned int flags;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static long long alloc_free(int fd, size_t len)
+{
+	struct ion_allocation_data alloc = {
+		.len = len,
+		.align = 0,
+		.heap_id_mask = heap_mask,
+		.flags = flags,
+	};
+	struct ion_handle_data handle;
+	long long start, end;
+
+	start = now_us();
+	if (ioctl(fd, ION_IOC_ALLOC, &alloc) < 0)
+		die("ION_IOC_ALLOC");
+	end = now_us();
+
+	handle.handle = alloc.handle;
+	if (ioctl(fd, ION_IOC_FREE, &handle) < 0)
+		die("ION_IOC_FREE");
+	return end - start;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = {
+		4096, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024,
+	};
+	static long long lat[MAX_ITERS];
+	int opt, fd, i, j;
+
+	while ((opt = getopt(argc, argv, "n:m:c")) != -1) {
+		switch (opt) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'm':
+			heap_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			flags |= ION_FLAG_CACHED;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-m heap_mask] [-c]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (iters < 1)
+		iters = 1;
+	if (iters > MAX_ITERS)
+		iters = MAX_ITERS;
+
+	fd = open("/dev/ion", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		printf("ion_alloc_tests: /dev/ion not available, skipping\n");
+		return 0;
+	}
+
+	printf("%10s %10s %10s %10s %10s %10s\n", "bytes", "first us",
+	       "min us", "avg us", "p99 us", "max us");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		long long first, total = 0;
+
+		first = alloc_free(fd, sizes[i]);
+		for (j = 0; j < iters; j++) {
+			lat[j] = alloc_free(fd, sizes[i]);
+			total += lat[j];
+		}
+		qsort(lat, iters, sizeof(lat[0]), cmp_ll);
+		printf("%10zu %10lld %10lld %10lld %10lld %10lld\n", sizes[i],
+		       first, lat[0], total / iters, lat[iters * 99 / 100],
+		       lat[iters - 1]);
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * path_batch_bench.c - file probing with fstatat()/openat() vs path_batch()
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Builds a tree shaped like a library search path (a few deep directories
+ * holding many files), then stats and opens every file the way a launcher
+ * does at boot: once with one system call per name, once with
+ * path_batch(). With -c the dentry and inode caches are dropped before
+ * each pass (needs root) to approximate a cold boot.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/types.h>
+
+#ifndef PATH_BATCH_STAT
+#define PATH_BATCH_STAT		0
+#define PATH_BATCH_OPEN		2
+
+struct path_batch_op {
+	__u64	path;
+	__u32	op;
+	__u32	open_flags;
+	__s32	result;
+	__u32	out_off;
+};
+
+struct path_batch_stat {
+	__u64	st_dev;
+	__u64	st_ino;
+	__u32	st_mode;
+	__u32	st_nlink;
+	__u32	st_uid;
+	__u32	st_gid;
+	__u64	st_rdev;
+	__s64	st_size;
+	__u64	st_blocks;
+	__u32	st_blksize;
+	__u32	__pad;
+	__s64	st_atime_sec;
+	__s64	st_mtime_sec;
+	__s64	st_ctime_sec;
+	__u32	st_atime_nsec;
+	__u32	st_mtime_nsec;
+	__u32	st_ctime_nsec;
+	__u32	__pad2;
+};
+#endif
+
+#ifndef __NR_path_batch
+#if defined(__arm__)
+#define __NR_path_batch		(__NR_SYSCALL_BASE + 389)
+#elif defined(__aarch64__)
+#define __NR_path_batch		283	/* asm-generic */
+#else
+#define __NR_path_batch		-1	/* fails with ENOSYS */
+#endif
+#endif
+
+#define BATCH		256
+#define PREFIX		"usr/lib/arm-linux-gnueabihf/app/plugins"
+
+static int ndirs = 8;
+static int nfiles = 250;
+static int cold;
+
+static char **names;
+static int nnames;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	if (!cold)
+		return;
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "2", 1) != 1)
+		die("drop_caches");
+	close(fd);
+}
+
+static void mkdirs(const char *path)
+{
+	char buf[256], *p;
+
+	snprintf(buf, sizeof(buf), "%s", path);
+	for (p = buf + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(buf, 0755) && errno != EEXIST)
+			die(buf);
+		*p = '/';
+	}
+	if (mkdir(buf, 0755) && errno != EEXIST)
+		die(buf);
+}
+
+static void build_tree(void)
+{
+	char path[256];
+	int d, f, fd;
+
+	names = calloc(ndirs * nfiles, sizeof(*names));
+	if (!names)
+		die("calloc");
+	for (d = 0; d < ndirs; d++) {
+		snprintf(path, sizeof(path), PREFIX "%d", d);
+		mkdirs(path);
+		for (f = 0; f < nfiles; f++) {
+			snprintf(path, sizeof(path), PREFIX "%d/lib%d.so", d, f);
+			fd = open(path, O_WRONLY | O_CREAT, 0644);
+			if (fd < 0)
+				die(path);
+			close(fd);
+			names[nnames++] = strdup(path);
+		}
+	}
+}
+
+static void remove_tree(void)
+{
+	char path[256];
+	int d, i;
+
+	for (i = 0; i < nnames; i++)
+		unlink(names[i]);
+	for (d = 0; d < ndirs; d++) {
+		snprintf(path, sizeof(path), PREFIX "%d", d);
+		rmdir(path);
+	}
+	/* PREFIX's parents: usr/lib/arm-linux-gnueabihf/app, ..., usr */
+	strcpy(path, PREFIX);
+	for (;;) {
+		char *slash = strrchr(path, '/');
+
+		if (!slash)
+			break;
+		*slash = '\0';
+		if (rmdir(path))
+			break;
+	}
+}
+
+static long long probe_single(void)
+{
+	long long start = now_us();
+	struct stat st;
+	int i, fd;
+
+	for (i = 0; i < nnames; i++) {
+		if (fstatat(AT_FDCWD, names[i], &st, 0))
+			die(names[i]);
+		fd = openat(AT_FDCWD, names[i], O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			die(names[i]);
+		close(fd);
+	}
+	return now_us() - start;
+}
+
+static long long probe_batch(void)
+{
+	static struct path_batch_op ops[BATCH * 2];
+	static struct path_batch_stat st[BATCH];
+	long long start = now_us();
+	int i, j, n, done;
+
+	for (i = 0; i < nnames; i += n) {
+		n = nnames - i < BATCH ? nnames - i : BATCH;
+		for (j = 0; j < n; j++) {
+			ops[2 * j].path = (unsigned long)names[i + j];
+			ops[2 * j].op = PATH_BATCH_STAT;
+			ops[2 * j + 1].path = (unsigned long)names[i + j];
+			ops[2 * j + 1].op = PATH_BATCH_OPEN;
+			ops[2 * j + 1].open_flags = O_RDONLY | O_CLOEXEC;
+		}
+		done = syscall(__NR_path_batch, AT_FDCWD, ops, 2 * n, st,
+			       sizeof(st), 0);
+		if (done != 2 * n)
+			return -1;
+		for (j = 0; j < 2 * n; j++) {
+			if (ops[j].result < 0) {
+				errno = -ops[j].result;
+				die(names[i + j / 2]);
+			}
+			if (ops[j].op == PATH_BATCH_OPEN)
+				close(ops[j].result);
+		}
+	}
+	return now_us() - start;
+}
+
+int main(int argc, char **argv)
+{
+	long long single, batch;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:f:c")) != -1) {
+		switch (opt) {
+		case 'd':
+			ndirs = atoi(optarg);
+			break;
+		case 'f':
+			nfiles = atoi(optarg);
+			break;
+		case 'c':
+			cold = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-d dirs] [-f files per dir] [-c]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (ndirs < 1)
+		ndirs = 1;
+	if (nfiles < 1)
+		nfiles = 1;
+
+	build_tree();
+
+	drop_caches();
+	single = probe_single();
+	drop_caches();
+	batch = probe_batch();
+	remove_tree();
+
+	printf("%-12s %8s %10s %10s\n", "mode", "files", "total us",
+	       "us/file");
+	printf("%-12s %8d %10lld %10.2f\n", "stat+open", nnames, single,
+	       (double)single / nnames);
+	if (batch < 0) {
+		printf("%-12s path_batch not available, skipping\n",
+		       "path_batch");
+		return 0;
+	}
+	printf("%-12s %8d %10lld %10.2f\n", "path_batch", nnames, batch,
+	       (double)batch / nnames);
+	return 0;
+}
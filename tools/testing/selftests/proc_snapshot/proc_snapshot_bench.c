@@ -0,0 +1,223 @@
+/*
+ * proc_snapshot_bench.c - per-process text files versus /proc/snapshot
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Samples every process the way a monitoring agent does, a number of
+ * times in a row: once by reading and parsing /proc/<pid>/stat, status
+ * and statm (and smaps with -m), once by reading /proc/snapshot. The
+ * first snapshot pass returns every process, later ones only those that
+ * changed, so both the full and the incremental cost are reported, in
+ * wall and CPU time per sweep.
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <linux/types.h>
+
+#ifndef PROC_SNAPSHOT_VERSION
+#define PROC_SNAPSHOT_END	(1 << 1)
+
+struct proc_snapshot_header {
+	__u32	version;
+	__u32	header_size;
+	__u32	record_size;
+	__u32	nr_records;
+	__u64	cursor;
+	__u32	flags;
+	__u32	__pad;
+};
+#endif
+
+static int sweeps = 10;
+static int smaps;
+
+/* the few values an agent keeps from each process */
+struct sample {
+	unsigned long long utime, stime, rss, vsize, min_flt, maj_flt;
+};
+
+static char iobuf[1 << 16];
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static long long cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec +
+	       ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+}
+
+/* whole file into iobuf, -1 if the process went away */
+static int slurp(const char *pid, const char *file)
+{
+	char path[64];
+	ssize_t n, len = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%s/%s", pid, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	while ((n = read(fd, iobuf + len, sizeof(iobuf) - 1 - len)) > 0)
+		len += n;
+	close(fd);
+	iobuf[len] = '\0';
+	return n < 0 ? -1 : 0;
+}
+
+static int sample_text(const char *pid, struct sample *s)
+{
+	unsigned long long rss_kb, vals[4];
+	char *p;
+
+	if (slurp(pid, "stat"))
+		return -1;
+	p = strrchr(iobuf, ')');
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %llu %*u %llu "
+			 "%*u %llu %llu %*d %*d %*d %*d %*d %*d %*u %llu %llu",
+			 &s->min_flt, &s->maj_flt, &s->utime, &s->stime,
+			 &s->vsize, &s->rss) != 6)
+		return -1;
+
+	if (slurp(pid, "status"))
+		return -1;
+	p = strstr(iobuf, "VmRSS:");
+	if (p)
+		sscanf(p, "VmRSS: %llu", &rss_kb);
+
+	if (slurp(pid, "statm"))
+		return -1;
+	sscanf(iobuf, "%llu %llu %llu %llu", &vals[0], &vals[1], &vals[2],
+	       &vals[3]);
+
+	if (smaps && !slurp(pid, "smaps")) {
+		unsigned long long pss = 0, kb;
+
+		for (p = iobuf; (p = strstr(p, "\nPss:")); p++)
+			if (sscanf(p, "\nPss: %llu", &kb) == 1)
+				pss += kb;
+	}
+	return 0;
+}
+
+static int sweep_text(void)
+{
+	struct sample s;
+	struct dirent *de;
+	DIR *dir;
+	int nr = 0;
+
+	dir = opendir("/proc");
+	if (!dir)
+		die("/proc");
+	while ((de = readdir(dir))) {
+		if (!isdigit(de->d_name[0]))
+			continue;
+		if (!sample_text(de->d_name, &s))
+			nr++;
+	}
+	closedir(dir);
+	return nr;
+}
+
+/* one pass, however many reads it takes; returns the records seen */
+static int sweep_snapshot(int fd)
+{
+	struct proc_snapshot_header *hdr = (void *)iobuf;
+	int nr = 0;
+	ssize_t n;
+
+	do {
+		n = read(fd, iobuf, sizeof(iobuf));
+		if (n < (ssize_t)sizeof(*hdr))
+			die("read /proc/snapshot");
+		nr += hdr->nr_records;
+	} while (!(hdr->flags & PROC_SNAPSHOT_END));
+	return nr;
+}
+
+static void report(const char *name, int records, long long usec,
+		   long long cpu, int n)
+{
+	printf("%-16s %10d %12.1f %12.1f\n", name, records / n,
+	       (double)usec / n, (double)cpu / n);
+}
+
+int main(int argc, char **argv)
+{
+	long long start, cpu;
+	int opt, i, fd, nr;
+
+	while ((opt = getopt(argc, argv, "n:m")) != -1) {
+		switch (opt) {
+		case 'n':
+			sweeps = atoi(optarg);
+			break;
+		case 'm':
+			smaps = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n sweeps] [-m]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (sweeps < 2)
+		sweeps = 2;
+
+	printf("%-16s %10s %12s %12s\n", "mode", "records", "us/sweep",
+	       "cpu us/sweep");
+
+	start = now_us();
+	cpu = cpu_us();
+	for (nr = 0, i = 0; i < sweeps; i++)
+		nr += sweep_text();
+	report(smaps ? "text+smaps" : "text", nr, now_us() - start,
+	       cpu_us() - cpu, sweeps);
+
+	fd = open("/proc/snapshot", O_RDONLY);
+	if (fd < 0) {
+		printf("%-16s /proc/snapshot not available, skipping\n",
+		       "snapshot");
+		return 0;
+	}
+
+	start = now_us();
+	cpu = cpu_us();
+	nr = sweep_snapshot(fd);
+	report("snapshot full", nr, now_us() - start, cpu_us() - cpu, 1);
+
+	start = now_us();
+	cpu = cpu_us();
+	for (nr = 0, i = 1; i < sweeps; i++)
+		nr += sweep_snapshot(fd);
+	report("snapshot delta", nr, now_us() - start, cpu_us() - cpu,
+	       sweeps - 1);
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * pipe_zerocopy_bench.c - user memory to a TCP socket through a pipe
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A relay fills a buffer, puts it into a pipe and splice()s the pipe to a
+ * loopback TCP connection drained by a child process. The pipe is fed
+ * three ways: write() to a plain pipe, write() to an F_SETPIPE_ZEROCOPY
+ * pipe, and vmsplice(SPLICE_F_GIFT) to a zero-copy pipe. Throughput, the
+ * relay's CPU time per MiB and the growth of /proc/sys/fs/pipe-zerocopy-bytes are
+ * reported for each. The first bytes arriving at the child are checked
+ * to catch pages that changed while queued.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#ifndef F_SETPIPE_ZEROCOPY
+#define F_SETPIPE_ZEROCOPY	(1024 + 11)
+#define F_GETPIPE_ZEROCOPY	(1024 + 12)
+#endif
+
+#define PAGE		4096
+#define CHUNK		(64 * 1024)	/* one default-sized pipe's worth */
+
+enum { MODE_WRITE, MODE_ZC_WRITE, MODE_ZC_GIFT };
+static const char *mode_name[] = { "write", "zc-write", "zc-gift" };
+
+static int seconds = 3;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static long long cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec +
+	       ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+}
+
+/* 0 if the sysctl is missing */
+static int zerocopy_bytes(unsigned long *in, unsigned long *out)
+{
+	FILE *f = fopen("/proc/sys/fs/pipe-zerocopy-bytes", "r");
+	int n;
+
+	*in = *out = 0;
+	if (!f)
+		return 0;
+	n = fscanf(f, "%lu %lu", in, out);
+	fclose(f);
+	return n == 2;
+}
+
+static void fill(char *buf, unsigned long seq)
+{
+	int i;
+
+	for (i = 0; i < CHUNK; i += PAGE)
+		memset(buf + i, 'a' + (seq + i / PAGE) % 26, PAGE);
+}
+
+/* the child: read and count; the first chunks must match fill() */
+static void drain(int sock)
+{
+	static char buf[CHUNK], want[CHUNK];
+	unsigned long long total = 0;
+	ssize_t n;
+
+	while ((n = read(sock, buf, sizeof(buf))) > 0) {
+		if (total < 16 * CHUNK) {
+			size_t off = total % CHUNK;
+			size_t cmp = n < CHUNK - off ? n : CHUNK - off;
+
+			fill(want, total / CHUNK);
+			if (memcmp(buf, want + off, cmp)) {
+				fprintf(stderr, "data corrupted at %llu\n",
+					total);
+				exit(1);
+			}
+		}
+		total += n;
+	}
+	exit(0);
+}
+
+static void connect_pair(int *tx, pid_t *child)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int lsock, rx;
+
+	lsock = socket(AF_INET, SOCK_STREAM, 0);
+	if (lsock < 0)
+		die("socket");
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lsock, (struct sockaddr *)&sin, sizeof(sin)) ||
+	    listen(lsock, 1) ||
+	    getsockname(lsock, (struct sockaddr *)&sin, &len))
+		die("listen");
+
+	*tx = socket(AF_INET, SOCK_STREAM, 0);
+	if (*tx < 0 || connect(*tx, (struct sockaddr *)&sin, sizeof(sin)))
+		die("connect");
+	rx = accept(lsock, NULL, NULL);
+	if (rx < 0)
+		die("accept");
+	close(lsock);
+
+	fflush(stdout);
+	*child = fork();
+	if (*child < 0)
+		die("fork");
+	if (!*child) {
+		close(*tx);
+		drain(rx);
+	}
+	close(rx);
+}
+
+/* put one chunk into the pipe, returns bytes queued */
+static ssize_t feed(int mode, int pfd, char *buf)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = CHUNK };
+	ssize_t n, done = 0;
+
+	while (done < CHUNK) {
+		iov.iov_base = buf + done;
+		iov.iov_len = CHUNK - done;
+		if (mode == MODE_ZC_GIFT)
+			n = vmsplice(pfd, &iov, 1, SPLICE_F_GIFT);
+		else
+			n = write(pfd, iov.iov_base, iov.iov_len);
+		if (n <= 0)
+			die(mode == MODE_ZC_GIFT ? "vmsplice" : "write");
+		done += n;
+	}
+	return done;
+}
+
+static void run(int mode)
+{
+	unsigned long in0, out0, in1, out1;
+	long long start, end, pcpu;
+	unsigned long long bytes = 0;
+	unsigned long seq = 0;
+	int pfd[2], sock, status, has_stat;
+	pid_t child;
+	char *buf;
+	ssize_t n;
+
+	buf = mmap(NULL, CHUNK, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap");
+	if (pipe(pfd))
+		die("pipe");
+	/* older kernels reject the command, newer ones use it for another */
+	if (mode != MODE_WRITE &&
+	    (fcntl(pfd[1], F_SETPIPE_ZEROCOPY, 1) < 0 ||
+	     fcntl(pfd[1], F_GETPIPE_ZEROCOPY) != 1)) {
+		printf("%-10s F_SETPIPE_ZEROCOPY not available, skipping\n",
+		       mode_name[mode]);
+		goto out;
+	}
+	connect_pair(&sock, &child);
+
+	has_stat = zerocopy_bytes(&in0, &out0);
+	pcpu = cpu_us();
+	start = now_us();
+	end = start + seconds * 1000000LL;
+	while (now_us() < end) {
+		/*
+		 * A zero-copy pipe took the previous chunk's pages away;
+		 * refilling faults in fresh ones.
+		 */
+		fill(buf, seq++);
+		feed(mode, pfd[1], buf);
+		for (n = 0; n < CHUNK; ) {
+			ssize_t r = splice(pfd[0], NULL, sock, NULL, CHUNK - n,
+					   SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (r <= 0)
+				die("splice");
+			n += r;
+		}
+		bytes += CHUNK;
+	}
+	end = now_us();
+	pcpu = cpu_us() - pcpu;
+	zerocopy_bytes(&in1, &out1);
+
+	close(sock);
+	if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		exit(1);
+
+	printf("%-10s %10.1f %12.1f", mode_name[mode],
+	       bytes / (double)(end - start), (double)pcpu * (1 << 20) / bytes);
+	if (has_stat)
+		printf(" %10.1f %10.1f\n", (in1 - in0) * 100.0 / bytes,
+		       (out1 - out0) * 100.0 / bytes);
+	else
+		printf(" %10s %10s\n", "n/a", "n/a");
+out:
+	close(pfd[0]);
+	close(pfd[1]);
+	munmap(buf, CHUNK);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (seconds < 1)
+		seconds = 1;
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%-10s %10s %12s %10s %10s\n", "mode", "MB/s", "cpu us/MiB",
+	       "% in zc", "% out zc");
+	run(MODE_WRITE);
+	run(MODE_ZC_WRITE);
+	run(MODE_ZC_GIFT);
+	return 0;
+}